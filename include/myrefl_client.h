@@ -274,6 +274,159 @@ void myrefl_test_notify(const char *test_name,
                         myrefl_result_t result,
                         long value);
 
+/** One result within myrefl_test_notify_many()
+ */
+typedef struct myrefl_notify_entry_s {
+    const char *instance_name; /**< Instance, NULL for the test itself */
+    myrefl_result_t result;    /**< Result for this instance */
+    long value;                /**< Optional value for this instance */
+} myrefl_notify_entry_t;
+
+/** Notification of the results of many instances of a test
+ *
+ * As calling myrefl_test_notify() for each entry in turn, but more 
+ * efficient for probes that observe many instances at once since the 
+ * results are applied together and their rules evaluated as a single 
+ * job.
+ *
+ * @param[in] test_name Test Name for the notifications
+ * @param[in] entries   Instance results
+ * @param[in] count     Number of entries
+ *
+ * @pre test_name has been created and is enabled
+ *
+ * @see myrefl_test_notify()
+ */
+void myrefl_test_notify_many(const char *test_name,
+                             const myrefl_notify_entry_t *entries,
+                             unsigned int count);
+
+/** Notification of the result of a test without waiting
+ *
+ * As myrefl_test_notify() except that the notification is queued and 
+ * the caller never waits for myrefl, making it suitable for calling from 
+ * an application's time critical threads. The queue is drained by the
+ * myrefl scheduler thread shortly afterwards.
+ *
+ * Should the queue be full then the notification is handled according to
+ * the policy set with myrefl_notify_set_overflow(), by default it is
+ * dropped. Overflows are counted, see myrefl_notify_get_stats().
+ *
+ * @param[in] test_name Test Name for the notification
+ * @param[in] instance_name Optional instance name, may be NULL
+ * @param[in] result    Result for this notification (e.g. pass or fail)
+ * @param[in] value     Optional test value that may be used by a rule
+ *
+ * @see myrefl_test_notify(), myrefl_notify_set_overflow()
+ */
+void myrefl_test_notify_nowait(const char *test_name,
+                               const char *instance_name,
+                               myrefl_result_t result,
+                               long value);
+
+/** What to do with a myrefl_test_notify_nowait() when the queue is full
+ */
+typedef enum myrefl_notify_overflow_e {
+    MYREFL_NOTIFY_OVERFLOW_DROP = 0, /**< Drop the notification (default) */
+    MYREFL_NOTIFY_OVERFLOW_COALESCE, /**< Replace any notification for the same test instance that is also waiting, else drop */
+    MYREFL_NOTIFY_OVERFLOW_BLOCK,    /**< Wait for room, draining the queue in the caller, so it stays behind those queued */
+    MYREFL_NOTIFY_OVERFLOW_LAST,     /**< Not to be used */
+} myrefl_notify_overflow_t;
+
+/** Set the overflow policy for myrefl_test_notify_nowait()
+ *
+ * @param[in] policy What to do with a notification when the queue is full
+ */
+void myrefl_notify_set_overflow(myrefl_notify_overflow_t policy);
+
+/** Counters for myrefl_test_notify_nowait()
+ */
+typedef struct myrefl_notify_stats_s {
+    unsigned long queued;    /**< Notifications queued */
+    unsigned long delivered; /**< Notifications passed on to the test */
+    unsigned long coalesced; /**< Notifications replaced by a later one on overflow */
+    unsigned long dropped;   /**< Notifications lost on overflow */
+    unsigned long blocked;   /**< Notifications that waited on overflow */
+} myrefl_notify_stats_t;
+
+/** Get the counters for myrefl_test_notify_nowait()
+ *
+ * @param[out] stats Counters since myrefl was started
+ */
+void myrefl_notify_get_stats(myrefl_notify_stats_t *stats);
+
+/** Handle for a test or instance
+ *
+ * Returned by the handle variants of the create functions so that 
+ * frequent callers can refer to a test or instance without myrefl 
+ * having to look up its name. A handle stays valid until its test or
+ * instance is deleted, after which it is safely rejected, even should
+ * the memory be reused.
+ *
+ * A generation of 0 is never valid, and is what is returned on failure.
+ */
+typedef struct myrefl_handle_s {
+    unsigned int index;      /**< Private */
+    unsigned int generation; /**< Private, 0 if not valid */
+} myrefl_handle_t;
+
+typedef myrefl_handle_t myrefl_test_handle_t;
+typedef myrefl_handle_t myrefl_instance_handle_t;
+
+/** Create a Polled Test returning a handle
+ *
+ * As myrefl_test_create_polled()
+ *
+ * @returns Handle for the test, generation 0 on failure
+ */
+myrefl_test_handle_t myrefl_test_create_polled_handle(const char *test_name,
+                                                      myrefl_test_t test_func,
+                                                      void *context,
+                                                      unsigned int period);
+
+/** Create a Notification Test returning a handle
+ *
+ * As myrefl_test_create_notification()
+ *
+ * @returns Handle for the test, generation 0 on failure
+ */
+myrefl_test_handle_t myrefl_test_create_notification_handle(const char *test_name);
+
+/** Create an instance returning a handle
+ *
+ * As myrefl_instance_create()
+ *
+ * @returns Handle for the instance, generation 0 on failure
+ */
+myrefl_instance_handle_t myrefl_instance_create_handle(const char *object_name,
+                                                       const char *instance_name,
+                                                       void *context);
+
+/** Notification of the result of a test by handle
+ *
+ * As myrefl_test_notify() but for the test or test instance handle, 
+ * which involves no name lookups or memory allocation.
+ *
+ * @param[in] handle    Test or test instance handle
+ * @param[in] result    Result for this notification (e.g. pass or fail)
+ * @param[in] value     Optional test value that may be used by a rule
+ */
+void myrefl_test_notify_handle(myrefl_handle_t handle,
+                               myrefl_result_t result,
+                               long value);
+
+/** Enable a test or test instance by handle
+ *
+ * As myrefl_test_enable()
+ */
+void myrefl_test_enable_handle(myrefl_handle_t handle);
+
+/** Disable a test or test instance by handle
+ *
+ * As myrefl_test_disable()
+ */
+void myrefl_test_disable_handle(myrefl_handle_t handle);
+
 /** Test Flags
  * 
  * Flags that modify the behaviour of a test, including location flags
@@ -477,6 +630,41 @@ void myrefl_test_set_description(const char *test_name,
  */
 void myrefl_test_set_autopass(const char *test_name,
                               unsigned int delay);
+
+/** Statistic fed to the rules from a window of aggregated notifications
+ */
+typedef enum myrefl_aggregate_e {
+    MYREFL_AGGREGATE_FAILURES = 0, /**< Number of failures (default) */
+    MYREFL_AGGREGATE_COUNT,        /**< Number of notifications */
+    MYREFL_AGGREGATE_MIN,          /**< Smallest value */
+    MYREFL_AGGREGATE_MAX,          /**< Largest value */
+    MYREFL_AGGREGATE_AVERAGE,      /**< Average value */
+    MYREFL_AGGREGATE_SUM,          /**< Sum of the values */
+    MYREFL_AGGREGATE_LAST,         /**< Last value - not to be used */
+} myrefl_aggregate_t;
+
+/** Aggregate the notifications for a notification test
+ *
+ * For tests that notify at very high rates, rather than run the rules
+ * for every notification, accumulate the notifications for each instance
+ * over a window and feed them to the rules once per window.
+ *
+ * The result fed to the rules is a failure if any notification in the
+ * window failed, else a value if any notification was a value, else a
+ * pass (or an abort if all the notifications were aborts). The value fed
+ * to the rules is the selected statistic over the window, the minimum, 
+ * maximum, average and sum are over the value notifications alone.
+ *
+ * @param[in] test_name Name of the notification test
+ * @param[in] window Window in milli-seconds, 0 to feed every notification
+ *                   to the rules as it arrives (default)
+ * @param[in] aggregate Statistic to feed to the rules as the value
+ *
+ * @pre Test with test_name must exist and be a notification test
+ */
+void myrefl_test_set_aggregate(const char *test_name,
+                               unsigned int window,
+                               myrefl_aggregate_t aggregate);
                           
 /* @} */
 
@@ -679,6 +867,42 @@ void myrefl_action_delete(const char *action_name);
 void myrefl_action_set_description(const char *action_name,
                                    const char *description);
 
+/** Limit how many instances of a recovery action run at once
+ *
+ * When a shared dependency fails many rule instances may become the
+ * root cause together, each running its action. Instances of this
+ * action beyond the limit wait for a running one to return.
+ *
+ * @param[in] action_name Name of the action
+ * @param[in] max_running Instances that may run at once, 0 for no limit
+ *                        (default)
+ */
+void myrefl_action_set_limit(const char *action_name,
+                             unsigned int max_running);
+
+/** Control recovery action storms across all actions
+ *
+ * Limit how many recovery actions may run at once, and how many may be
+ * started per minute using a token bucket that allows bursts of up to
+ * "burst" actions. Actions over the limits wait their turn, in the order
+ * that they were requested, up to 1000 of them after which further
+ * actions are suppressed.
+ *
+ * Whatever the limits, an action instance that is already waiting to 
+ * run is not requested again, the requests are coalesced into the one 
+ * run.
+ *
+ * @param[in] max_running Actions that may run at once, 0 for no limit
+ *                        (default)
+ * @param[in] rate Actions that may be started per minute, 0 for no limit
+ *                 (default)
+ * @param[in] burst Actions that may be started together within the rate
+ *                  (default 10)
+ */
+void myrefl_action_set_storm_control(unsigned int max_running,
+                                     unsigned int rate,
+                                     unsigned int burst);
+
 /** Action Flags
  * 
  * Flags that modify the behaviour of an action, including location flags
@@ -832,9 +1056,14 @@ typedef enum myrefl_rule_operator_e {
     MYREFL_RULE_N_IN_M,        /**< N fails out of M runs */
     MYREFL_RULE_RANGE_N_TO_M,  /**< Fail if within the specific range */
     MYREFL_RULE_N_IN_TIME_M,   /**< N occurrences in M milliseconds */
-    MYREFL_RULE_FAIL_FOR_TIME_N, /**< Failed for M milliseconds */
+    MYREFL_RULE_FAIL_FOR_TIME_N, /**< Failing continuously for N milliseconds */
     MYREFL_RULE_OR,            /**< Any input is passing */
     MYREFL_RULE_AND,           /**< All inputs are passing */
+    MYREFL_RULE_EWMA_ABOVE_N,  /**< Moving average > N, M is new value weight in % */
+    MYREFL_RULE_P95_ABOVE_N,   /**< 95th percentile > N over windows of M values */
+    MYREFL_RULE_P99_ABOVE_N,   /**< 99th percentile > N over windows of M values */
+    MYREFL_RULE_RATE_ABOVE_N,  /**< Value rising faster than N per second */
+    MYREFL_RULE_BASELINE_N_SIGMA, /**< Value more than N std deviations from its learnt baseline, learning from M values */
     MYREFL_RULE_LAST,          /**< Last value - not to be used  */
 } myrefl_rule_operator_t;
 
@@ -849,6 +1078,21 @@ typedef enum myrefl_rule_operator_e {
  *       MYREFL_RULE_AND does not use either operand@n
  *       MYREFL_RULE_RANGE_N_TO_M uses both N and M@n
  *
+ * The statistical rule types (MYREFL_RULE_EWMA_ABOVE_N, MYREFL_RULE_P95_ABOVE_N,
+ * MYREFL_RULE_P99_ABOVE_N and MYREFL_RULE_RATE_ABOVE_N) are evaluated on
+ * the values returned by the input, using a small fixed amount of state per
+ * instance no matter how many values have been seen. The percentiles are
+ * estimated with a streaming sketch over consecutive windows of M values,
+ * or over all values seen if M is 0.
+ *
+ * MYREFL_RULE_BASELINE_N_SIGMA learns the mean and variance of the values
+ * for each instance over the first M values (learning mode), after which
+ * it fails any value more than N standard deviations from the mean
+ * (enforcing mode) while continuing to track the baseline with the values
+ * that pass. Set MYREFL_RULE_BASELINE_TIME_OF_DAY to keep a separate
+ * baseline for each hour of the day. Baselines can be persisted across
+ * restarts with myrefl_baseline_set_file().
+ *
  * The default rule type when the rule is created is MYREFL_RULE_ON_FAIL.
  *
  * @param[in] rule_name Name of the rule to change the type on
@@ -902,6 +1146,8 @@ typedef enum myrefl_rule_flags_e {
     MYREFL_RULE_TRIGGER_ROOT_CAUSE  = 0x0010, /**< Only trigger recovery action if rule is the root cause (default) */
     MYREFL_RULE_TRIGGER_ALWAYS      = 0x0020, /**< Trigger the recovery action whenever this rule fails */
     MYREFL_RULE_NO_RESULT_STATS     = 0x0040, /**< Don't keep stats on this rule since it doesn't indicate anything on its own */
+    MYREFL_RULE_PROPAGATE_ON_CHANGE = 0x0080, /**< Only pass this rule's result on to output rules, root cause identification and component health when it changes */
+    MYREFL_RULE_BASELINE_TIME_OF_DAY = 0x0100, /**< Baseline rules learn a separate baseline for each hour of the day (UTC) */
 } myrefl_rule_flags_t;
 
 /** Set a rules flags
@@ -999,6 +1245,54 @@ typedef enum myrefl_severity_e {
 void myrefl_rule_set_severity(const char *rule_name,
                               myrefl_severity_t severity);
 
+/** Set the hysteresis for a threshold rule
+ *
+ * A value that hovers around N would have the rule change between pass
+ * and fail on every value. With hysteresis the rule fails at N as 
+ * before, but once failing it only passes again when the value comes
+ * back past a clear threshold "hysteresis" away from N. For example a
+ * MYREFL_RULE_GREATER_THAN_N rule with N of 90 and hysteresis of 10 
+ * fails above 90 and clears at 80 or below.
+ *
+ * Applies to MYREFL_RULE_LESS_THAN_N, MYREFL_RULE_GREATER_THAN_N, 
+ * MYREFL_RULE_RANGE_N_TO_M (both ends of the range), 
+ * MYREFL_RULE_EWMA_ABOVE_N, MYREFL_RULE_P95_ABOVE_N, 
+ * MYREFL_RULE_P99_ABOVE_N and MYREFL_RULE_RATE_ABOVE_N.
+ *
+ * @param[in] rule_name Name of the rule
+ * @param[in] hysteresis Distance between the fail and clear thresholds,
+ *                       0 for none (default), for a range it must be
+ *                       less than half the width of the range
+ */
+void myrefl_rule_set_hysteresis(const char *rule_name,
+                                long hysteresis);
+
+/** Damp a flapping rule
+ *
+ * Each time an instance of the rule changes between pass and fail it 
+ * gains a penalty of 1000, which halves every half life. Once the 
+ * penalty reaches "suppress" the instance is flapping, and holds the 
+ * result it had before it started flapping, not passing it on to 
+ * dependent rules, root cause identification or component health, until
+ * the penalty has decayed below "reuse". It then reports its latest 
+ * result. The penalty is capped at four times "suppress".
+ *
+ * The results held are those that the rule reports, in its statistics
+ * as well as to the rest of the system.
+ *
+ * @param[in] rule_name Name of the rule
+ * @param[in] half_life Half life of the penalty in milli-seconds, 0 to
+ *                      turn off flap damping (default)
+ * @param[in] suppress Penalty at which the rule is flapping, e.g. 3000
+ *                     for the third change in quick succession
+ * @param[in] reuse Penalty below which the rule is no longer flapping, 
+ *                  more than 0 and less than suppress, e.g. 750
+ */
+void myrefl_rule_set_flap_damping(const char *rule_name,
+                                  unsigned int half_life,
+                                  unsigned int suppress,
+                                  unsigned int reuse);
+
 /** Add subsequent actions to a rule
  * 
  * Sometimes it is desirable to have more than one action triggered
@@ -1363,6 +1657,28 @@ void myrefl_instance_create(const char *object,
  */
 void myrefl_instance_delete(const char *object,
                             const char *instance);
+
+/** Keep a time series of results for an object or instance
+ *
+ * The time series holds the most recent results in full, compressed,
+ * along with per minute aggregates for the last hour and per hour
+ * aggregates for the last two days, within a fixed amount of memory per
+ * instance. The series can be viewed from the CLI and webserver.
+ *
+ * @param[in] object Object name (test, rule or action) to keep the series for
+ * @param[in] instance Instance name, or NULL for all the instances of the 
+ *                     object including those created later
+ */
+void myrefl_series_enable(const char *object,
+                          const char *instance);
+
+/** Stop keeping a time series of results, discarding the series
+ *
+ * @param[in] object Object name to stop keeping the series for
+ * @param[in] instance Instance name, or NULL for all the instances
+ */
+void myrefl_series_disable(const char *object,
+                           const char *instance);
 /*@}*/
 /*******************************************************************
  * Utilities
@@ -1399,6 +1715,40 @@ void myrefl_health_set(const char *component_name,
  */
 unsigned int myrefl_health_get(const char *component_name);
 
+/** Set how often component health changes are published
+ *
+ * Changes in component health are batched up and published, to
+ * component health tests and clients, once per interval so that a burst
+ * of failing rules results in a single notification per component.
+ *
+ * @param[in] interval_ms Interval in milli-seconds, 0 to publish every
+ *                        change immediately
+ */
+void myrefl_health_set_interval(unsigned int interval_ms);
+
+/** Persist the learnt baselines in a file
+ *
+ * Baselines for MYREFL_RULE_BASELINE_N_SIGMA rules are loaded from the
+ * file, if it exists, and are used in preference to learning again when
+ * the rule instances are next run. The baselines are written back to the
+ * file periodically, when myrefl_baseline_save() is called, and when the
+ * system is stopped.
+ *
+ * @param[in] filename Path of the file to keep the baselines in, NULL to
+ *                     stop persisting them
+ *
+ * @note Call before the rules are run so that they don't start learning
+ *       from scratch.
+ */
+void myrefl_baseline_set_file(const char *filename);
+
+/** Write the learnt baselines to the file now
+ *
+ * @returns Non-zero if the baselines were written
+ * @see myrefl_baseline_set_file()
+ */
+int myrefl_baseline_save(void);
+
 /** Get the context for an existing object
  *
  */
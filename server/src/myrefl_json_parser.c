@@ -511,6 +511,16 @@ static boolean parse_rule(char *module, char *request, jsmntok_t **token_ptr, ch
                            operator = MYREFL_RULE_OR;
                        } else if (json_token_streq(request, token, "MYREFL_RULE_AND")) {
                            operator = MYREFL_RULE_AND;
+                       } else if (json_token_streq(request, token, "MYREFL_RULE_EWMA_ABOVE_N")) {
+                           operator = MYREFL_RULE_EWMA_ABOVE_N;
+                       } else if (json_token_streq(request, token, "MYREFL_RULE_P95_ABOVE_N")) {
+                           operator = MYREFL_RULE_P95_ABOVE_N;
+                       } else if (json_token_streq(request, token, "MYREFL_RULE_P99_ABOVE_N")) {
+                           operator = MYREFL_RULE_P99_ABOVE_N;
+                       } else if (json_token_streq(request, token, "MYREFL_RULE_RATE_ABOVE_N")) {
+                           operator = MYREFL_RULE_RATE_ABOVE_N;
+                       } else if (json_token_streq(request, token, "MYREFL_RULE_BASELINE_N_SIGMA")) {
+                           operator = MYREFL_RULE_BASELINE_N_SIGMA;
                        } else {
                            myrefl_error("Module '%s': Configuration contains invalid rule operator '%s'", module, json_token_to_str(request, token));
                        }
@@ -27,6 +27,7 @@
 #include "mongoose/mongoose.h"
 #include "myrefl_cli.h"
 #include "myrefl_cli_local.h"
+#include "myrefl_util.h"
 
 #include "myrefl_server_config.h"
 
@@ -70,6 +71,71 @@ static int get_components_json(cli_info_element_t *element, char *content, int c
 	return content_length;
 }
 
+/**
+ * Return in JSON one tier of the time series for an object or instance,
+ * requested as /series/<recent|minute|hour>/<object>?instance=<instance>
+ */
+static int get_series_json(const struct mg_request_info *request_info, char *content) {
+	const char *uri = request_info->uri + 8;
+	char instance[MYREFL_MAX_NAME_LEN];
+	cli_series_tier_t tier;
+	cli_series_t *series;
+	cli_series_point_t *point;
+	int content_length = 0;
+	unsigned int i;
+
+	if (strncmp(uri, "recent/", 7) == 0) {
+		tier = CLI_SERIES_RECENT;
+	} else if (strncmp(uri, "minute/", 7) == 0) {
+		tier = CLI_SERIES_MINUTE;
+	} else if (strncmp(uri, "hour/", 5) == 0) {
+		tier = CLI_SERIES_HOUR;
+	} else {
+		return -1;
+	}
+	uri = strchr(uri, '/') + 1;
+
+	memset(instance, 0, sizeof(instance));
+	if (request_info->query_string) {
+		mg_get_var(request_info->query_string, strlen(request_info->query_string),
+				"instance", instance, sizeof(instance));
+	}
+
+	series = myrefl_cli_local_get_series(uri, instance[0] ? instance : NULL, tier);
+	if (!series) {
+		return -1;
+	}
+
+	content_length += snprintf(content, MAX_HTTP_RESPONSE_SIZE, "{\"tier\":\"%s\",\"points\":[",
+			myrefl_cli_series_tier_to_str(tier));
+	/*
+	 * Only the most recent points if they won't all fit in the response.
+	 */
+	i = 0;
+	if (series->num_points > MAX_HTTP_RESPONSE_SIZE / 100) {
+		i = series->num_points - (MAX_HTTP_RESPONSE_SIZE / 100);
+	}
+	for (; i < series->num_points; i++) {
+		point = &series->points[i];
+		if (content_length > MAX_HTTP_RESPONSE_SIZE - 200) {
+			break;
+		}
+		if (tier == CLI_SERIES_RECENT) {
+			content_length += snprintf(content + content_length, MAX_HTTP_RESPONSE_SIZE-content_length,
+					"%s{\"time\":%lu.%03lu,\"result\":\"%s\",\"value\":%ld}", (content[content_length-1] == '[') ? "" : ",",
+					point->time.sec, point->time.nsec / 1000000,
+					myrefl_util_myrefl_result_str(point->result), point->min);
+		} else {
+			content_length += snprintf(content + content_length, MAX_HTTP_RESPONSE_SIZE-content_length,
+					"%s{\"time\":%lu,\"count\":%u,\"failures\":%u,\"min\":%ld,\"max\":%ld,\"avg\":%ld}", (content[content_length-1] == '[') ? "" : ",",
+					point->time.sec, point->count, point->failures, point->min, point->max, point->avg);
+		}
+	}
+	content_length += snprintf(content + content_length, MAX_HTTP_RESPONSE_SIZE-content_length, "]}");
+	myrefl_cli_local_free_series(series);
+	return content_length;
+}
+
 static void *https_request_callback(enum mg_event event,
         							struct mg_connection *conn) {
 
@@ -91,6 +157,26 @@ static void *https_request_callback(enum mg_event event,
             return NULL;
         }
 
+        if (strncmp(request_info->uri, "/series/", 8) == 0) {
+            content_length = get_series_json(request_info, content);
+            if (content_length >= 0) {
+                mg_printf(conn,
+                        "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: application/json\r\n"
+                        "Content-Length: %d\r\n"
+                        "\r\n"
+                        "%s",
+                        content_length, content);
+            } else {
+                mg_printf(conn,
+                        "HTTP/1.1 404 Not Found\r\n"
+                        "Content-Length: 0\r\n"
+                        "\r\n");
+            }
+            free(content);
+            return processed;
+        }
+
         if (strncmp(request_info->uri, "/comp/", 6) == 0) {
             type = CLI_COMPONENT;
             if (strlen(request_info->uri) > 0) {
@@ -129,7 +215,7 @@ static void *https_request_callback(enum mg_event event,
                         break;
                     case CLI_RULE:
                         while(element != NULL) {
-                            content_length += snprintf(content + content_length, MAX_HTTP_RESPONSE_SIZE-content_length, "Rule %s %d %d %d\n", element->name, element->stats.runs, element->stats.passes, element->stats.failures);
+                            content_length += snprintf(content + content_length, MAX_HTTP_RESPONSE_SIZE-content_length, "Rule %s %d %d %d %s\n", element->name, element->stats.runs, element->stats.passes, element->stats.failures, myrefl_cli_baseline_to_str(element->baseline));
                             // Does this rule have any instances? if so get them and the info for each one.
                             unsigned int handle_instance = myrefl_cli_local_get_info_handle(element->name, CLI_RULE_INSTANCE,
                                                                                             CLI_FILTER_NONE, NULL);
@@ -138,7 +224,7 @@ static void *https_request_callback(enum mg_event event,
                                 while (info_instance != NULL) {
                                     element_instance = info_instance->elements;
                                     while (element_instance != NULL) {
-                                        content_length += snprintf(content + content_length, MAX_HTTP_RESPONSE_SIZE-content_length, "      <span style='%s'> %s %d %d %d</span>\n", (element_instance->last_result == MYREFL_RESULT_FAIL) ? "color:red" : "", element_instance->name, element_instance->stats.runs, element_instance->stats.passes, element_instance->stats.failures);
+                                        content_length += snprintf(content + content_length, MAX_HTTP_RESPONSE_SIZE-content_length, "      <span style='%s'> %s %d %d %d %s</span>\n", (element_instance->last_result == MYREFL_RESULT_FAIL) ? "color:red" : "", element_instance->name, element_instance->stats.runs, element_instance->stats.passes, element_instance->stats.failures, myrefl_cli_baseline_to_str(element_instance->baseline));
                                         element_instance = element_instance->next;
                                     }
                                     myrefl_cli_local_free_info(info_instance);
@@ -150,7 +236,7 @@ static void *https_request_callback(enum mg_event event,
                         break;
                     case CLI_ACTION:
                         while(element != NULL) {
-                            content_length += snprintf(content + content_length, MAX_HTTP_RESPONSE_SIZE-content_length, "Action %s %d %d %d\n", element->name, element->stats.runs, element->stats.passes, element->stats.failures);
+                            content_length += snprintf(content + content_length, MAX_HTTP_RESPONSE_SIZE-content_length, "Action %s %d %d %d %u %u %u\n", element->name, element->stats.runs, element->stats.passes, element->stats.failures, element->coalesced, element->deferred, element->suppressed);
                             element = element->next;
                         }
                         break;
@@ -37,12 +37,6 @@
 
 #define BADSTR(s) (!(s) || *(s)=='\0')
 
-/*
- * Limit of number of rules chained together, do not make this greater
- * than 99 or you will run out of stack when doing recursion.
- */
-#define RULE_DEPTH_LIMIT 25
-
 #define MYREFL_NAME_SEPERATOR '@'
 
 obj_state_t default_obj_state = OBJ_STATE_ENABLED;
@@ -53,6 +47,50 @@ obj_state_t default_obj_state = OBJ_STATE_ENABLED;
  */
 static boolean running = FALSE;
 
+/*
+ * Queue for myrefl_test_notify_nowait(), a bounded ring that any number
+ * of client threads write to without locking, and which the scheduler
+ * drains with the DB lock held. Each cell's "seq" is twice the lap of
+ * the ring that it may next be written in, plus one once it has been
+ * written and is waiting to be read. So a zeroed ring is empty.
+ *
+ * Each notification is stamped with where it falls in the order they were
+ * made, twice its position in the ring, so that one parked in a coalesce
+ * slot is never applied over a later one for the same instance.
+ */
+#define NOTIFY_QUEUE_SIZE 1024      /* Must be a power of 2 */
+#define NOTIFY_COALESCE_SLOTS 64
+
+typedef struct notify_entry_s {
+    volatile ulong seq;
+    ulong stamp;
+    char test_name[MYREFL_MAX_NAME_LEN + 1];
+    char instance_name[MYREFL_MAX_NAME_LEN + 1];
+    myrefl_result_t result;
+    long value;
+} notify_entry_t;
+
+static notify_entry_t notify_queue[NOTIFY_QUEUE_SIZE];
+static volatile ulong notify_queue_head = 0;
+static ulong notify_queue_tail = 0;
+
+/*
+ * When the queue is full and coalescing, notifications are parked here
+ * hashed by name, a later one for the same instance replacing the earlier.
+ * Their stamp is odd, falling after the ring entries already claimed and
+ * before any claimed later. The slot's "seq" is one of the following states.
+ */
+#define NOTIFY_SLOT_FREE  0
+#define NOTIFY_SLOT_BUSY  1
+#define NOTIFY_SLOT_READY 2
+
+static notify_entry_t notify_coalesce[NOTIFY_COALESCE_SLOTS];
+
+static volatile int notify_kick_pending = 0;
+static myrefl_notify_overflow_t notify_overflow = MYREFL_NOTIFY_OVERFLOW_DROP;
+static myrefl_notify_stats_t notify_stats;
+static ulong notify_dropped_reported = 0;
+
 /*******************************************************************
  * Local functions
  *******************************************************************/
@@ -486,6 +524,92 @@ void myrefl_test_create_notification (const char *test_name)
     myrefl_obj_db_unlock();
 }
 
+/*
+ * test_notify_instance()
+ *
+ * Pass the client's test result for this instance on to the sequencer, 
+ * the DB lock must be held.
+ */
+static void test_notify_instance (obj_instance_t *instance,
+                                  myrefl_result_t result,
+                                  long value)
+{
+    if (instance->state == OBJ_STATE_ENABLED) {
+        if (instance->obj->t.test->aggregate_ms) {
+            myrefl_seq_from_test_notify_aggregate(instance, result, value);
+        } else {
+            myrefl_seq_from_test_notify(instance, result, value);
+        }
+    }
+}
+
+/*
+ * test_notify_lookup()
+ *
+ * Find the instance that the client's test result is for, the DB lock 
+ * must be held.
+ */
+static obj_instance_t *test_notify_lookup (const char *test_name,
+                                           const char *instance_name)
+{
+    obj_t *obj;
+    obj_instance_t *instance;
+    char *instance_copy = NULL;
+    const char fnstr[] = "Notify test";
+
+    /*
+     * Get or create test and set defaults if applicable
+     */
+    obj = myrefl_obj_get_by_name_unconverted(test_name, OBJ_TYPE_TEST);
+    if (!obj) {
+        myrefl_error("%s No test with name '%s' found", fnstr, test_name);
+        return (NULL);
+    }
+
+    if (instance_name) {
+        instance_copy = myrefl_api_convert_name(instance_name);
+        if (!instance_copy) {
+            myrefl_error("%s memory allocation failure for '%s'", 
+                         fnstr, test_name);
+            return (NULL);
+        }
+        instance = myrefl_obj_instance_by_name(obj, instance_copy);
+    } else {
+        instance = &obj->i;
+    }
+
+    if (!instance) { 
+        myrefl_error("Test '%s' %s %s does not exist",
+                     obj->i.name, 
+                     instance_name ? "instance" : "",
+                     instance_name ? instance_name : "");
+    }
+
+    if (instance_copy) {
+        free(instance_copy);
+    }
+    return (instance);
+}
+
+/*
+ * test_notify_guts()
+ *
+ * Pass the client's test result on to the sequencer, the DB lock must
+ * be held.
+ */
+static void test_notify_guts (const char *test_name,
+                              const char *instance_name,
+                              myrefl_result_t result,
+                              long value)
+{
+    obj_instance_t *instance;
+
+    instance = test_notify_lookup(test_name, instance_name);
+    if (instance) { 
+        test_notify_instance(instance, result, value);
+    }
+}
+
 /*
  * myrefl_test_notify()
  *
@@ -498,9 +622,6 @@ void myrefl_test_notify (const char *test_name,
                          myrefl_result_t result,
                          long value)
 {
-    obj_t *obj;
-    obj_instance_t *instance;
-    char *instance_copy = NULL;
     const char fnstr[] = "Notify test";
 
     /*
@@ -517,11 +638,40 @@ void myrefl_test_notify (const char *test_name,
         return;
     }
 
+    myrefl_obj_db_lock();
+    test_notify_guts(test_name, instance_name, result, value);
+    myrefl_obj_db_unlock();
+}
+
+/*
+ * myrefl_test_notify_many()
+ *
+ * Notify the results for many instances of the one test, taking the lock
+ * once and handing the results to the sequencer as one job.
+ */
+void myrefl_test_notify_many (const char *test_name,
+                              const myrefl_notify_entry_t *entries,
+                              unsigned int count)
+{
+    obj_t *obj;
+    obj_instance_t *instance;
+    char *instance_copy;
+    seq_batch_t *batch;
+    const myrefl_notify_entry_t *entry;
+    unsigned int i;
+    const char fnstr[] = "Notify test many";
+
+    if (BADSTR(test_name)) {
+        myrefl_error("%s - bad test_name", fnstr);
+        return;
+    }
+
+    if (!entries || count == 0) {
+        return;
+    }
+
     myrefl_obj_db_lock();
 
-    /*
-     * Get or create test and set defaults if applicable
-     */
     obj = myrefl_obj_get_by_name_unconverted(test_name, OBJ_TYPE_TEST);
     if (!obj) {
         myrefl_obj_db_unlock();
@@ -529,36 +679,404 @@ void myrefl_test_notify (const char *test_name,
         return;
     }
 
+    batch = myrefl_seq_batch_create(count);
+
+    for (i = 0; i < count; i++) {
+        entry = &entries[i];
+
+        if (entry->result <= MYREFL_RESULT_INVALID || 
+            entry->result >= MYREFL_RESULT_LAST ||
+            entry->result == MYREFL_RESULT_IN_PROGRESS) {
+            myrefl_error("%s - '%s' bad result value", fnstr, test_name);
+            continue;
+        }
+
+        if (entry->instance_name) {
+            instance_copy = myrefl_api_convert_name(entry->instance_name);
+            if (!instance_copy) {
+                myrefl_error("%s memory allocation failure for '%s'", 
+                             fnstr, test_name);
+                continue;
+            }
+            instance = myrefl_obj_instance_by_name(obj, instance_copy);
+            free(instance_copy);
+        } else {
+            instance = &obj->i;
+        }
+
+        if (!instance) {
+            myrefl_error("Test '%s' instance %s does not exist",
+                         obj->i.name, entry->instance_name);
+            continue;
+        }
+
+        if (instance->state != OBJ_STATE_ENABLED) {
+            continue;
+        }
+
+        if (obj->t.test->aggregate_ms) {
+            myrefl_seq_from_test_notify_aggregate(instance, entry->result, 
+                                                  entry->value);
+        } else {
+            myrefl_seq_batch_add(batch, instance, entry->result, 
+                                 entry->value);
+        }
+    }
+
+    myrefl_seq_batch_dispatch(batch);
+
+    myrefl_obj_db_unlock();
+}
+
+/*
+ * notify_entry_fill()
+ *
+ * Copy the notification into a queue entry that we own.
+ */
+static void notify_entry_fill (notify_entry_t *entry,
+                               const char *test_name,
+                               const char *instance_name,
+                               myrefl_result_t result,
+                               long value)
+{
+    myrefl_xos_sstrncpy(entry->test_name, test_name, 
+                        sizeof(entry->test_name));
     if (instance_name) {
-        instance_copy = myrefl_api_convert_name(instance_name);
-        if (!instance_copy) {
-            myrefl_error("%s memory allocation failure for '%s'", 
-                         fnstr, test_name);
+        myrefl_xos_sstrncpy(entry->instance_name, instance_name,
+                            sizeof(entry->instance_name));
+    } else {
+        entry->instance_name[0] = '\0';
+    }
+    entry->result = result;
+    entry->value = value;
+}
+
+/*
+ * notify_queue_add()
+ *
+ * Claim the next cell in the ring and write the notification to it.
+ * Returns FALSE if the ring is full.
+ */
+static boolean notify_queue_add (const char *test_name,
+                                 const char *instance_name,
+                                 myrefl_result_t result,
+                                 long value)
+{
+    notify_entry_t *entry;
+    ulong pos, lap;
+    long diff;
+
+    pos = notify_queue_head;
+    for (;;) {
+        entry = &notify_queue[pos & (NOTIFY_QUEUE_SIZE - 1)];
+        lap = pos / NOTIFY_QUEUE_SIZE;
+        diff = (long)(entry->seq - (lap * 2));
+        if (diff == 0) {
+            if (__sync_bool_compare_and_swap(&notify_queue_head, 
+                                             pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /*
+             * Still holding the notification from the last lap.
+             */
+            return (FALSE);
+        }
+        pos = notify_queue_head;
+    }
+
+    notify_entry_fill(entry, test_name, instance_name, result, value);
+    entry->stamp = (pos + 1) * 2;
+    __sync_synchronize();
+    entry->seq = (lap * 2) + 1;
+    return (TRUE);
+}
+
+/*
+ * notify_coalesce_add()
+ *
+ * The ring is full, so park the notification in its coalesce slot, 
+ * replacing one for the same instance. Returns FALSE if the slot is
+ * in use for another instance.
+ */
+static boolean notify_coalesce_add (const char *test_name,
+                                    const char *instance_name,
+                                    myrefl_result_t result,
+                                    long value)
+{
+    notify_entry_t *entry;
+    const char *c;
+    uint hash = 0;
+
+    for (c = test_name; *c; c++) {
+        hash = (hash * 31) + *c;
+    }
+    for (c = instance_name; c && *c; c++) {
+        hash = (hash * 31) + *c;
+    }
+    entry = &notify_coalesce[hash % NOTIFY_COALESCE_SLOTS];
+
+    if (__sync_bool_compare_and_swap(&entry->seq, NOTIFY_SLOT_FREE, 
+                                     NOTIFY_SLOT_BUSY)) {
+        notify_entry_fill(entry, test_name, instance_name, result, value);
+        entry->stamp = (notify_queue_head * 2) + 1;
+        __sync_synchronize();
+        entry->seq = NOTIFY_SLOT_READY;
+        __sync_fetch_and_add(&notify_stats.queued, 1);
+        return (TRUE);
+    }
+
+    if (!__sync_bool_compare_and_swap(&entry->seq, NOTIFY_SLOT_READY, 
+                                      NOTIFY_SLOT_BUSY)) {
+        return (FALSE);
+    }
+
+    if (strncmp(entry->test_name, test_name, 
+                sizeof(entry->test_name) - 1) != 0 ||
+        strncmp(entry->instance_name, instance_name ? instance_name : "", 
+                sizeof(entry->instance_name) - 1) != 0) {
+        entry->seq = NOTIFY_SLOT_READY;
+        return (FALSE);
+    }
+
+    entry->result = result;
+    entry->value = value;
+    entry->stamp = (notify_queue_head * 2) + 1;
+    __sync_synchronize();
+    entry->seq = NOTIFY_SLOT_READY;
+    __sync_fetch_and_add(&notify_stats.coalesced, 1);
+    return (TRUE);
+}
+
+/*
+ * myrefl_test_notify_nowait()
+ *
+ * As myrefl_test_notify() but queue the notification for the scheduler
+ * rather than wait for the DB lock.
+ */
+void myrefl_test_notify_nowait (const char *test_name,
+                                const char *instance_name,
+                                myrefl_result_t result,
+                                long value)
+{
+    const char fnstr[] = "Notify test nowait";
+
+    if (BADSTR(test_name)) {
+        myrefl_error("%s - bad test_name", fnstr);
+        return;
+    }
+
+    if (result <= MYREFL_RESULT_INVALID || result >= MYREFL_RESULT_LAST ||
+        result == MYREFL_RESULT_IN_PROGRESS) {
+        myrefl_error("%s - '%s' bad result value", fnstr, test_name);
+        return;
+    }
+
+    if (notify_queue_add(test_name, instance_name, result, value)) {
+        __sync_fetch_and_add(&notify_stats.queued, 1);
+    } else {
+        switch (notify_overflow) {
+        case MYREFL_NOTIFY_OVERFLOW_COALESCE:
+            if (notify_coalesce_add(test_name, instance_name, result, value)) {
+                break;
+            }
+            __sync_fetch_and_add(&notify_stats.dropped, 1);
+            return;
+        case MYREFL_NOTIFY_OVERFLOW_BLOCK:
+            /*
+             * Drain the ring ourselves to make room, so the notification
+             * still goes in behind those already queued, then pass it on.
+             */
+            __sync_fetch_and_add(&notify_stats.blocked, 1);
+            myrefl_obj_db_lock();
+            do {
+                myrefl_api_notify_drain();
+            } while (!notify_queue_add(test_name, instance_name, 
+                                       result, value));
+            __sync_fetch_and_add(&notify_stats.queued, 1);
+            myrefl_api_notify_drain();
             myrefl_obj_db_unlock();
+            break;
+        default:
+            __sync_fetch_and_add(&notify_stats.dropped, 1);
             return;
         }
-        instance = myrefl_obj_instance_by_name(obj, instance_copy);
-    } else {
-        instance = &obj->i;
     }
 
-    if (instance) { 
-        if (instance->state == OBJ_STATE_ENABLED) {
-            myrefl_seq_from_test_notify(instance, result, value);
+    /*
+     * Only wake the scheduler if it hasn't already been woken since it 
+     * last drained the queue. The entry must be visible before the flag
+     * is read, else the scheduler could clear the flag and miss the 
+     * entry between the two, with no kick to come back for it.
+     */
+    __sync_synchronize();
+    if (!notify_kick_pending &&
+        __sync_bool_compare_and_swap(&notify_kick_pending, 0, 1)) {
+        myrefl_sched_kick();
+    }
+}
+
+/*
+ * notify_entry_deliver()
+ *
+ * Pass a queued notification on, unless a later one for the instance has
+ * already been, as when a coalesce slot was parked before a ring entry
+ * that was drained ahead of it.
+ */
+static void notify_entry_deliver (notify_entry_t *entry)
+{
+    obj_instance_t *instance;
+
+    instance = test_notify_lookup(entry->test_name,
+                                  entry->instance_name[0] ? 
+                                  entry->instance_name : NULL);
+    if (instance) {
+        if ((long)(entry->stamp - instance->notify_stamp) < 0) {
+            __sync_fetch_and_add(&notify_stats.coalesced, 1);
+            return;
         }
-    } else {
-        myrefl_error("Test '%s' %s %s does not exist",
-                     obj->i.name, 
-                     instance_name ? "instance" : "",
-                     instance_name ? instance_name : "");
+        instance->notify_stamp = entry->stamp;
+        test_notify_instance(instance, entry->result, entry->value);
     }
+    __sync_fetch_and_add(&notify_stats.delivered, 1);
+}
 
-    if (instance_copy) {
-        free(instance_copy);
+/*
+ * myrefl_api_notify_drain()
+ *
+ * Called by the scheduler with the DB lock held to pass the queued 
+ * notifications on. Drains at most a ring's worth so that the scheduler
+ * can't be kept here by busy clients, waking itself again if there is 
+ * more.
+ */
+void myrefl_api_notify_drain (void)
+{
+    notify_entry_t *entry, copy;
+    ulong lap, dropped;
+    uint count, i;
+
+    /*
+     * Clear the flag before looking at the entries, pairs with the 
+     * barrier in myrefl_test_notify_nowait().
+     */
+    notify_kick_pending = 0;
+    __sync_synchronize();
+
+    for (count = 0; count < NOTIFY_QUEUE_SIZE; count++) {
+        entry = &notify_queue[notify_queue_tail & (NOTIFY_QUEUE_SIZE - 1)];
+        lap = notify_queue_tail / NOTIFY_QUEUE_SIZE;
+        if (entry->seq != (lap * 2) + 1) {
+            break;
+        }
+        __sync_synchronize();
+        copy = *entry;
+        __sync_synchronize();
+        entry->seq = (lap + 1) * 2;
+        notify_queue_tail++;
+
+        notify_entry_deliver(&copy);
+    }
+
+    if (count == NOTIFY_QUEUE_SIZE) {
+        /*
+         * Leave the coalesced notifications until the ring has been 
+         * drained of those made before them.
+         */
+        if (__sync_bool_compare_and_swap(&notify_kick_pending, 0, 1)) {
+            myrefl_sched_kick();
+        }
+        goto report;
     }
+
+    /*
+     * The ring is empty, so pass on those coalesced. One made before a 
+     * ring entry for the same instance that was just drained is dropped 
+     * by notify_entry_deliver().
+     */
+    for (i = 0; i < NOTIFY_COALESCE_SLOTS; i++) {
+        entry = &notify_coalesce[i];
+        if (!__sync_bool_compare_and_swap(&entry->seq, NOTIFY_SLOT_READY,
+                                          NOTIFY_SLOT_BUSY)) {
+            continue;
+        }
+        copy = *entry;
+        __sync_synchronize();
+        entry->seq = NOTIFY_SLOT_FREE;
+
+        notify_entry_deliver(&copy);
+    }
+
+ report:
+    dropped = notify_stats.dropped;
+    if (dropped != notify_dropped_reported) {
+        myrefl_error("Notify queue full, %lu notifications dropped",
+                     dropped - notify_dropped_reported);
+        notify_dropped_reported = dropped;
+    }
+}
+
+/*
+ * myrefl_test_notify_handle()
+ *
+ * As myrefl_test_notify() for a handle, so no name lookup.
+ */
+void myrefl_test_notify_handle (myrefl_handle_t handle,
+                                myrefl_result_t result,
+                                long value)
+{
+    obj_instance_t *instance;
+    const char fnstr[] = "Notify test handle";
+
+    if (result <= MYREFL_RESULT_INVALID || result >= MYREFL_RESULT_LAST ||
+        result == MYREFL_RESULT_IN_PROGRESS) {
+        myrefl_error("%s - bad result value", fnstr);
+        return;
+    }
+
+    myrefl_obj_db_lock();
+
+    instance = myrefl_obj_handle_instance(handle);
+    if (!instance || instance->obj->type != OBJ_TYPE_TEST) {
+        myrefl_obj_db_unlock();
+        myrefl_error("%s - stale or bad handle %u/%u", fnstr, 
+                     handle.index, handle.generation);
+        return;
+    }
+
+    test_notify_instance(instance, result, value);
+
     myrefl_obj_db_unlock();
 }
 
+/*
+ * myrefl_notify_set_overflow()
+ *
+ * What to do with notifications when the nowait queue is full.
+ */
+void myrefl_notify_set_overflow (myrefl_notify_overflow_t policy)
+{
+    if (policy < MYREFL_NOTIFY_OVERFLOW_DROP ||
+        policy >= MYREFL_NOTIFY_OVERFLOW_LAST) {
+        myrefl_error("Set notify overflow - bad policy %d", policy);
+        return;
+    }
+    notify_overflow = policy;
+}
+
+/*
+ * myrefl_notify_get_stats()
+ *
+ * Counters for the nowait queue.
+ */
+void myrefl_notify_get_stats (myrefl_notify_stats_t *stats)
+{
+    if (!stats) {
+        myrefl_error("Get notify stats - bad stats");
+        return;
+    }
+    *stats = notify_stats;
+}
+
 /*
  * myrefl_test_set_autopass()
  *
@@ -601,6 +1119,55 @@ void myrefl_test_set_autopass (const char *test_name,
     myrefl_obj_db_unlock();
 }
 
+/*
+ * myrefl_test_set_aggregate()
+ *
+ * Accumulate the notifications for each instance of this test over
+ * "window" ms and feed them to the rules once per window.
+ */
+void myrefl_test_set_aggregate (const char *test_name,
+                                unsigned int window,
+                                myrefl_aggregate_t aggregate)
+{
+    obj_t *obj;
+    const char fnstr[] = "Set test aggregate";   
+
+    /*
+     * Sanity check client params
+     */
+    if (BADSTR(test_name)) {
+        myrefl_error("%s - bad test_name", fnstr);
+        return;
+    }
+
+    if (aggregate < MYREFL_AGGREGATE_FAILURES || 
+        aggregate >= MYREFL_AGGREGATE_LAST) {
+        myrefl_error("%s - '%s' bad aggregate %d", fnstr, test_name, 
+                     aggregate);
+        return;
+    }
+
+    myrefl_obj_db_lock();
+
+    obj = myrefl_obj_get_by_name_unconverted(test_name, OBJ_TYPE_TEST);
+    if (!obj) {
+        myrefl_obj_db_unlock();
+        myrefl_error("%s No test with name '%s' found", fnstr, test_name);
+        return;
+    }
+
+    if (obj->t.test->type != OBJ_TEST_TYPE_NOTIFICATION) {
+        myrefl_obj_db_unlock();
+        myrefl_error("%s '%s' is not a notification test", fnstr, test_name);
+        return;
+    }
+    
+    obj->t.test->aggregate_ms = window;
+    obj->t.test->aggregate = aggregate;
+
+    myrefl_obj_db_unlock();
+}
+
 static myrefl_result_t poll_for_comp_health (const char *instance,
                                              void *context,
                                              long *value)
@@ -857,6 +1424,12 @@ void myrefl_test_chain_ready (const char *test_name)
 
         myrefl_obj_chain_update_state(obj, state);
 
+        /*
+         * The chain is complete, compile the rule graph now rather than
+         * on the first result.
+         */
+        myrefl_obj_graph();
+
         if (obj->i.cli_state != OBJ_STATE_INITIALIZED) {
             /*
              * The test may have been explicitrly configured to be enabled
@@ -1974,57 +2547,59 @@ void myrefl_action_set_description (const char *action_name,
     myrefl_obj_db_unlock();
 }
 
-/*******************************************************************
- * External API for rules
- *******************************************************************/
-
 /*
- * rule_input_search()
+ * myrefl_action_set_limit()
  *
- * Starting from obj look through the inputs looking for target,
- * TRUE if it is found, FALSE if not.
+ * Limit how many instances of this action may run at once.
  */
-static boolean rule_input_search (obj_t *obj, obj_t *target, unsigned int depth)
-{ 
-    myrefl_list_element_t *element;
-    obj_rule_t *rule;
-    obj_t *input;
-    boolean retval = FALSE;
+void myrefl_action_set_limit (const char *action_name,
+                              unsigned int max_running)
+{
+    obj_t *obj;
+    const char fnstr[] = "Set limit for action";
 
     /*
-     * Don't recurse more than a set limit else we will run out of stack.
-     * It is an error to have more than this level, so return TRUE to block
-     * the addition of this new rule.
+     * Sanity check client params
      */
-    if (++depth > RULE_DEPTH_LIMIT) {
-        myrefl_error("Adding rule '%s' failed, too many rules %d chained together, maximum %d",
-                     target->i.name, depth, RULE_DEPTH_LIMIT);
-        return(TRUE);
+    if (BADSTR(action_name)) {
+        myrefl_error("%s - bad action_name", fnstr);
+        return;
     }
-
-    if (obj && obj->type == OBJ_TYPE_RULE) {
-        rule = obj->t.rule;
-        for(element = rule->inputs->head;
-            element != NULL;
-            element = element->next) {
-            /*
-             * For every input in the inputs list for this rule...
-             */
-            input = (obj_t*)element->data;
-            if (input == target) {
-                retval = TRUE;
-                break;
-            } else {
-                if (rule_input_search(input, target, depth)) {
-                    retval = TRUE;
-                    break;
-                }
-            }
-        }
+    myrefl_obj_db_lock();
+    /*
+     * Get or create action and set defaults if applicable
+     */
+    obj = myrefl_api_get_or_create(action_name, OBJ_TYPE_ACTION);
+    if (!obj) {
+        myrefl_error("%s '%s'", fnstr, action_name);
+        myrefl_obj_db_unlock();
+        return;
     }
-    return(retval);
+
+    obj->t.action->max_running = max_running;
+    myrefl_seq_action_flush();
+    myrefl_obj_db_unlock();
+}
+
+/*
+ * myrefl_action_set_storm_control()
+ *
+ * Limit how many recovery actions run at once, and how quickly they 
+ * are started, across all actions.
+ */
+void myrefl_action_set_storm_control (unsigned int max_running,
+                                      unsigned int rate,
+                                      unsigned int burst)
+{
+    myrefl_obj_db_lock();
+    myrefl_seq_action_set_limits(max_running, rate, burst);
+    myrefl_obj_db_unlock();
 }
 
+/*******************************************************************
+ * External API for rules
+ *******************************************************************/
+
 void myrefl_rule_create (const char *rule_name,
                          const char *test_or_rule_name,
                          const char *action_name)
@@ -2092,7 +2667,7 @@ void myrefl_rule_create (const char *rule_name,
     /*
      * Can't have the same input more than once.
      */
-    if (rule_input_search(rule_obj, input_obj, 0)) {
+    if (myrefl_obj_order_reaches(OBJ_ORDER_INPUT, rule_obj, input_obj)) {
         myrefl_error("%s '%s', '%s' already an input",
                      fnstr, rule_name, test_or_rule_name);
         myrefl_obj_db_unlock();
@@ -2103,12 +2678,12 @@ void myrefl_rule_create (const char *rule_name,
      * Check to see whether the input_obj has an existing dependency
      * on this rule, if it does then we can not connect the two.
      */
-    if (rule_input_search(input_obj, rule_obj, 0)) {
+    if (!myrefl_obj_order_link(OBJ_ORDER_INPUT, rule_obj, input_obj)) {
         /*
          * Invalid linkage since the input is referencing this
          * rule, which would be a loop.
          */
-        myrefl_error("%s - Can not create '%s' since it would create a loop or there are too many rules connected",
+        myrefl_error("%s - Can not create '%s' since it would create a loop",
                      fnstr, rule_name);
         /*
          * Delete the rule - since it can't have this input rather than
@@ -2254,6 +2829,7 @@ void myrefl_rule_create (const char *rule_name,
         rule->output = rule_obj->ref_rule;
     }
 
+    myrefl_obj_graph_changed();
     rule_obj->i.state = OBJ_STATE_CREATED;
     myrefl_obj_db_unlock();
 }
@@ -2313,19 +2889,19 @@ void myrefl_rule_add_input (const char *rule_name,
         return;
     }
 
-     if (rule_input_search(rule_obj, input_obj, 0)) {
+    if (myrefl_obj_order_reaches(OBJ_ORDER_INPUT, rule_obj, input_obj)) {
         myrefl_error("%s '%s', '%s' already an input",
                      fnstr, rule_name, test_or_rule_name);
         myrefl_obj_db_unlock();
         return;
     }
 
-    if (rule_input_search(input_obj, rule_obj, 0)) {
+    if (!myrefl_obj_order_link(OBJ_ORDER_INPUT, rule_obj, input_obj)) {
         /*
          * Invalid linkage since the input is referencing this
          * rule, which would be a loop.
          */
-        myrefl_error("%s - Can not add '%s' since it would cause a loop or there are too many rules connected.",
+        myrefl_error("%s - Can not add '%s' since it would cause a loop.",
                      fnstr, test_or_rule_name);
         myrefl_obj_db_unlock();
         return;
@@ -2347,6 +2923,7 @@ void myrefl_rule_add_input (const char *rule_name,
             rule->next_in_input = *head_output_rule;
             *head_output_rule = rule;
         }
+        myrefl_obj_graph_changed();
     }
 
     myrefl_obj_db_unlock();
@@ -2446,6 +3023,52 @@ void myrefl_rule_set_type (const char *rule_name,
             return;
         }
         break;
+    case MYREFL_RULE_FAIL_FOR_TIME_N:
+        if (operand_n < 1) {
+            myrefl_error("%s - rule '%s' N operand less than 1 (%ld)", 
+                         fnstr, rule_name, operand_n);
+            return;
+        }
+        break;
+    case MYREFL_RULE_EWMA_ABOVE_N:
+        if (operand_m < 1 || operand_m > 100) {
+            myrefl_error("%s - rule '%s' M operand not a weight from 1 to 100 (%ld)", 
+                         fnstr, rule_name, operand_m);
+            return;
+        }
+        break;
+    case MYREFL_RULE_P95_ABOVE_N:
+    case MYREFL_RULE_P99_ABOVE_N:
+        if (operand_m && operand_m < RULE_SKETCH_MARKERS) {
+            myrefl_error("%s - rule '%s' M operand less than %d (%ld)", 
+                         fnstr, rule_name, RULE_SKETCH_MARKERS, operand_m);
+            return;
+        }
+        if (operand_m < 0) {
+            myrefl_error("%s - rule '%s' M operand less than 0 (%ld)", 
+                         fnstr, rule_name, operand_m);
+            return;
+        }
+        break;
+    case MYREFL_RULE_BASELINE_N_SIGMA:
+        if (operand_n < 1) {
+            myrefl_error("%s - rule '%s' N operand less than 1 (%ld)", 
+                         fnstr, rule_name, operand_n);
+            return;
+        }
+        if (operand_m < 2) {
+            myrefl_error("%s - rule '%s' M operand less than 2 (%ld)", 
+                         fnstr, rule_name, operand_m);
+            return;
+        }
+        break;
+    case MYREFL_RULE_RATE_ABOVE_N:
+        if (operand_m) {
+            myrefl_error("%s - rule '%s' M operand specified (%ld) when not expected", 
+                         fnstr, rule_name, operand_m);
+            return;
+        }
+        break;
     default:
         break;
     }
@@ -2461,6 +3084,14 @@ void myrefl_rule_set_type (const char *rule_name,
     }
 
     rule = obj->t.rule;
+    if (operator == MYREFL_RULE_RANGE_N_TO_M && rule->hysteresis &&
+        2 * rule->hysteresis >= operand_m - operand_n) {
+        myrefl_error("%s - rule '%s' hysteresis (%ld) too wide for range "
+                     "%ld to %ld", fnstr, rule_name, rule->hysteresis,
+                     operand_n, operand_m);
+        myrefl_obj_db_unlock();
+        return;
+    }
     rule->operator = operator;
     rule->default_operator = operator;
     rule->op_n = operand_n;
@@ -2521,6 +3152,7 @@ void myrefl_rule_add_action (const char *rule_name,
     
     if (!myrefl_list_find(rule->action_list, action_obj)) {
         myrefl_list_add(rule->action_list, action_obj);
+        myrefl_obj_graph_changed();
     } else {
         myrefl_error("%s '%s' - action '%s' already present", 
                      fnstr, rule_name, action_name);
@@ -2741,6 +3373,11 @@ void myrefl_api_rule_enable_guts (const char *rule_name,
         break;
     }
 
+    myrefl_rci_depend_changed();
+    if (myrefl_obj_validate(obj, OBJ_TYPE_RULE)) {
+        myrefl_seq_obj_health_sync(obj);
+    }
+
     if (instance_copy) {
         free(instance_copy);
     }
@@ -2858,6 +3495,11 @@ void myrefl_api_rule_default (const char *rule_name,
         break;
     }
 
+    myrefl_rci_depend_changed();
+    if (myrefl_obj_validate(obj, OBJ_TYPE_RULE)) {
+        myrefl_seq_obj_health_sync(obj);
+    }
+
     if (instance_copy) {
         free(instance_copy);
     }
@@ -2986,6 +3628,11 @@ void myrefl_api_rule_disable_guts (const char *rule_name,
         break;
     }
 
+    myrefl_rci_depend_changed();
+    if (myrefl_obj_validate(obj, OBJ_TYPE_RULE)) {
+        myrefl_seq_obj_health_sync(obj);
+    }
+
     if (instance_copy) {
         free(instance_copy);
     }
@@ -3047,15 +3694,108 @@ void myrefl_rule_set_severity (const char *rule_name,
     /*
      * If changing the severity on an existing rule then make sure that
      * if the rule is currently failing that the health is updated to
-     * reflect this change.
-     *
-     * The same is true of adding and removing objects from a component.
-     * ALl of which comes under the banner of health propagation.
-     *
-     * TODO
+     * reflect this change. Adding and removing objects from a component
+     * is handled when they are linked and unlinked.
      */
     rule = obj->t.rule;
     rule->severity = severity;
+    myrefl_seq_obj_health_sync(obj);
+    myrefl_obj_db_unlock();
+}
+
+/*
+ * myrefl_rule_set_hysteresis()
+ *
+ * Once failing, threshold rules have to come back "hysteresis" past
+ * their threshold to pass.
+ */
+void myrefl_rule_set_hysteresis (const char *rule_name,
+                                 long hysteresis)
+{ 
+    obj_rule_t *rule;
+    obj_t *obj;
+    const char fnstr[] = "Set hysteresis for rule";
+
+    if (BADSTR(rule_name)) {
+        myrefl_error("%s - bad rule_name", fnstr);
+        return;
+    }
+    if (hysteresis < 0) {
+        myrefl_error("%s '%s' - bad hysteresis %ld", fnstr, rule_name,
+                     hysteresis);
+        return;
+    }
+    myrefl_obj_db_lock();
+    /*
+     * Get or create rule and set defaults if applicable
+     */
+    obj = myrefl_api_get_or_create(rule_name, OBJ_TYPE_RULE);
+    if (!obj) {
+        myrefl_error("%s '%s'", fnstr, rule_name);
+        myrefl_obj_db_unlock();
+        return;
+    }
+
+    rule = obj->t.rule;
+    if (rule->operator == MYREFL_RULE_RANGE_N_TO_M && hysteresis &&
+        2 * hysteresis >= rule->op_m - rule->op_n) {
+        /*
+         * The clear thresholds would meet or cross in the middle of
+         * the range.
+         */
+        myrefl_error("%s '%s' - hysteresis %ld too wide for range %ld to %ld",
+                     fnstr, rule_name, hysteresis, rule->op_n, rule->op_m);
+        myrefl_obj_db_unlock();
+        return;
+    }
+
+    rule->hysteresis = hysteresis;
+    myrefl_obj_db_unlock();
+}
+
+/*
+ * myrefl_rule_set_flap_damping()
+ *
+ * Hold the results of rule instances that are flapping between pass
+ * and fail.
+ */
+void myrefl_rule_set_flap_damping (const char *rule_name,
+                                   unsigned int half_life,
+                                   unsigned int suppress,
+                                   unsigned int reuse)
+{ 
+    obj_rule_t *rule;
+    obj_t *obj;
+    const char fnstr[] = "Set flap damping for rule";
+
+    if (BADSTR(rule_name)) {
+        myrefl_error("%s - bad rule_name", fnstr);
+        return;
+    }
+    if (half_life && (reuse == 0 || reuse >= suppress)) {
+        myrefl_error("%s '%s' - bad thresholds suppress %u reuse %u", 
+                     fnstr, rule_name, suppress, reuse);
+        return;
+    }
+    myrefl_obj_db_lock();
+    /*
+     * Get or create rule and set defaults if applicable
+     */
+    obj = myrefl_api_get_or_create(rule_name, OBJ_TYPE_RULE);
+    if (!obj) {
+        myrefl_error("%s '%s'", fnstr, rule_name);
+        myrefl_obj_db_unlock();
+        return;
+    }
+
+    /*
+     * Instances that are flapping now carry on holding their result
+     * until they are next run.
+     */
+    rule = obj->t.rule;
+    rule->flap_half_life = half_life;
+    rule->flap_suppress = suppress;
+    rule->flap_reuse = reuse;
     myrefl_obj_db_unlock();
 }
 
@@ -3089,6 +3829,7 @@ void myrefl_comp_create (const char *component_name)
 
     comp = obj->t.comp;
     comp->health = 1000;
+    comp->health_published = 1000;
     comp->confidence = 1000;
 
     /*
@@ -3206,6 +3947,7 @@ void myrefl_api_comp_contains (obj_t *parent, obj_t *child)
             myrefl_list_add(parent->t.comp->bottom_depend, child);
         }
     }
+    myrefl_rci_depend_changed();
 }
 
 void myrefl_comp_contains (const char *parent_component_name,
@@ -3495,6 +4237,10 @@ void myrefl_api_comp_enable_guts (const char *comp_name,
         myrefl_error("%s '%s'", fnstr, comp_name);
         break;
     } 
+    myrefl_rci_depend_changed();
+    if (myrefl_obj_validate(comp_obj, OBJ_TYPE_COMP)) {
+        myrefl_seq_comp_health_resync(comp_obj->t.comp);
+    }
     myrefl_obj_db_unlock();
 }
 
@@ -3603,6 +4349,7 @@ void myrefl_api_comp_default (const char *comp_name)
             }
         }
 
+        myrefl_seq_comp_health_resync(comp);
         break;
     case OBJ_STATE_INITIALIZED:
         /*
@@ -3628,6 +4375,7 @@ void myrefl_api_comp_default (const char *comp_name)
         break;
     }
 
+    myrefl_rci_depend_changed();
     myrefl_obj_db_unlock();
 }
 
@@ -3739,6 +4487,10 @@ void myrefl_api_comp_disable_guts (const char *comp_name, boolean cli)
         myrefl_error("%s '%s'", fnstr, comp_name);
         break;
     } 
+    myrefl_rci_depend_changed();
+    if (myrefl_obj_validate(comp_obj, OBJ_TYPE_COMP)) {
+        myrefl_seq_comp_health_resync(comp_obj->t.comp);
+    }
     myrefl_obj_db_unlock();
 }
 
@@ -3836,6 +4588,30 @@ unsigned int myrefl_health_get (const char *component_name)
     return (health/10);
 }
 
+void myrefl_health_set_interval (unsigned int interval_ms)
+{
+    myrefl_obj_db_lock();
+    myrefl_seq_set_health_interval(interval_ms);
+    myrefl_obj_db_unlock();
+}
+
+void myrefl_baseline_set_file (const char *filename)
+{
+    myrefl_obj_db_lock();
+    myrefl_seq_baseline_set_file(filename);
+    myrefl_obj_db_unlock();
+}
+
+int myrefl_baseline_save (void)
+{
+    seq_baseline_snapshot_t *snapshot;
+
+    myrefl_obj_db_lock();
+    snapshot = myrefl_seq_baseline_snapshot();
+    myrefl_obj_db_unlock();
+    return (myrefl_seq_baseline_write(snapshot));
+}
+
 /*******************************************************************
  * Instance
  *******************************************************************/
@@ -3907,6 +4683,135 @@ void myrefl_instance_create (const char *object_name,
     myrefl_obj_db_unlock();
 }
 
+/*
+ * api_handle_by_name()
+ *
+ * Handle for the named object, or instance of it if instance_name is
+ * given.
+ */
+static myrefl_handle_t api_handle_by_name (const char *object_name,
+                                           const char *instance_name,
+                                           obj_type_t type)
+{
+    myrefl_handle_t handle = { 0, 0 };
+    obj_t *obj;
+    obj_instance_t *instance = NULL;
+    char *instance_copy;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(object_name, type);
+    if (obj) {
+        if (instance_name) {
+            instance_copy = myrefl_api_convert_name(instance_name);
+            if (instance_copy) {
+                instance = myrefl_obj_instance_by_name(obj, instance_copy);
+                free(instance_copy);
+            }
+        } else {
+            instance = &obj->i;
+        }
+        handle = myrefl_obj_handle_get(instance);
+    }
+    myrefl_obj_db_unlock();
+    return (handle);
+}
+
+myrefl_test_handle_t myrefl_test_create_polled_handle (const char *test_name,
+                                                       myrefl_test_t test_func,
+                                                       void *context,
+                                                       unsigned int period)
+{
+    myrefl_test_handle_t handle = { 0, 0 };
+
+    myrefl_test_create_polled(test_name, test_func, context, period);
+    if (BADSTR(test_name)) {
+        return (handle);
+    }
+    return (api_handle_by_name(test_name, NULL, OBJ_TYPE_TEST));
+}
+
+myrefl_test_handle_t myrefl_test_create_notification_handle (const char *test_name)
+{
+    myrefl_test_handle_t handle = { 0, 0 };
+
+    myrefl_test_create_notification(test_name);
+    if (BADSTR(test_name)) {
+        return (handle);
+    }
+    return (api_handle_by_name(test_name, NULL, OBJ_TYPE_TEST));
+}
+
+myrefl_instance_handle_t myrefl_instance_create_handle (const char *object_name,
+                                                        const char *instance_name,
+                                                        void *context)
+{
+    myrefl_instance_handle_t handle = { 0, 0 };
+
+    myrefl_instance_create(object_name, instance_name, context);
+    if (BADSTR(object_name) || BADSTR(instance_name)) {
+        return (handle);
+    }
+    return (api_handle_by_name(object_name, instance_name, OBJ_TYPE_ANY));
+}
+
+/*
+ * api_handle_names()
+ *
+ * Copy out the test and instance names for the handle so that the name
+ * based guts can be used. Returns FALSE if the handle is not valid.
+ */
+static boolean api_handle_names (myrefl_handle_t handle,
+                                 char *test_name,
+                                 char *instance_name,
+                                 boolean *has_instance)
+{
+    obj_instance_t *instance;
+
+    myrefl_obj_db_lock();
+    instance = myrefl_obj_handle_instance(handle);
+    if (!instance || instance->obj->type != OBJ_TYPE_TEST) {
+        myrefl_obj_db_unlock();
+        myrefl_error("Test handle - stale or bad handle %u/%u", 
+                     handle.index, handle.generation);
+        return (FALSE);
+    }
+    myrefl_xos_sstrncpy(test_name, instance->obj->i.name, 
+                        MYREFL_MAX_NAME_LEN + 1);
+    *has_instance = (instance != &instance->obj->i);
+    if (*has_instance) {
+        myrefl_xos_sstrncpy(instance_name, instance->name, 
+                            MYREFL_MAX_NAME_LEN + 1);
+    }
+    myrefl_obj_db_unlock();
+    return (TRUE);
+}
+
+void myrefl_test_enable_handle (myrefl_handle_t handle)
+{
+    char test_name[MYREFL_MAX_NAME_LEN + 1];
+    char instance_name[MYREFL_MAX_NAME_LEN + 1];
+    boolean has_instance;
+
+    if (api_handle_names(handle, test_name, instance_name, &has_instance)) {
+        myrefl_api_test_enable_guts(test_name, 
+                                    has_instance ? instance_name : NULL,
+                                    FALSE);
+    }
+}
+
+void myrefl_test_disable_handle (myrefl_handle_t handle)
+{
+    char test_name[MYREFL_MAX_NAME_LEN + 1];
+    char instance_name[MYREFL_MAX_NAME_LEN + 1];
+    boolean has_instance;
+
+    if (api_handle_names(handle, test_name, instance_name, &has_instance)) {
+        myrefl_api_test_disable_guts(test_name, 
+                                     has_instance ? instance_name : NULL,
+                                     FALSE);
+    }
+}
+
 /*
  * myrefl_instance_delete()
  *
@@ -3966,6 +4871,94 @@ void myrefl_instance_delete (const char *object_name,
     free(instance_copy);
     myrefl_obj_db_unlock();
 }
+
+/*
+ * series_enable_guts()
+ *
+ * Flag the instance (or the base instance, which all the instances 
+ * follow) for a time series, the series itself is created when the
+ * next result is recorded. Disabling discards any series kept.
+ */
+static void series_enable_guts (const char *object_name, 
+                                const char *instance_name,
+                                boolean enable)
+{
+    obj_t *obj;
+    obj_instance_t *instance;
+    char *instance_copy = NULL;
+    const char fnstr[] = "Time series for an object";
+
+    if (BADSTR(object_name)) {
+        myrefl_error("%s - bad object name", fnstr);
+        return;
+    }
+
+    if (instance_name && *instance_name == '\0') {
+        myrefl_error("%s - bad instance name", fnstr);
+        return; 
+    }
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(object_name, OBJ_TYPE_ANY);
+    if (!obj) { 
+        myrefl_error("%s '%s' - unknown", fnstr, object_name);
+        myrefl_obj_db_unlock();
+        return;
+    }
+
+    if (instance_name) {
+        instance_copy = myrefl_api_convert_name(instance_name);
+        if (!instance_copy) {
+            myrefl_error("%s memory allocation failure for '%s'", 
+                         fnstr, object_name);
+            myrefl_obj_db_unlock();
+            return;
+        }
+        instance = myrefl_obj_instance_by_name(obj, instance_copy);
+        free(instance_copy);
+        if (!instance) {
+            myrefl_error("%s '%s' - unknown instance '%s'", fnstr, 
+                         object_name, instance_name);
+            myrefl_obj_db_unlock();
+            return;
+        }
+    } else {
+        instance = &obj->i;
+    }
+
+    if (enable) {
+        instance->flags.any |= OBJ_FLAG_SERIES;
+    } else {
+        instance->flags.any &= ~OBJ_FLAG_SERIES;
+        free(instance->series);
+        instance->series = NULL;
+
+        if (instance == &obj->i) {
+            /*
+             * All of the instances follow the base instance.
+             */
+            for (instance = obj->i.next; instance; instance = instance->next) {
+                if (!(instance->flags.any & OBJ_FLAG_SERIES)) {
+                    free(instance->series);
+                    instance->series = NULL;
+                }
+            }
+        }
+    }
+    myrefl_obj_db_unlock();
+}
+
+void myrefl_series_enable (const char *object_name, 
+                           const char *instance_name)
+{
+    series_enable_guts(object_name, instance_name, TRUE);
+}
+
+void myrefl_series_disable (const char *object_name, 
+                            const char *instance_name)
+{
+    series_enable_guts(object_name, instance_name, FALSE);
+}
 /*******************************************************************
  * External API for miscellaneous utilities
  *******************************************************************/
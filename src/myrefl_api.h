@@ -38,6 +38,7 @@ char *myrefl_api_convert_name(const char *from_to_name);
 obj_t *myrefl_api_get_or_create(const char *name, obj_type_t type);
 
 void myrefl_api_init(void);
+void myrefl_api_notify_drain(void);
 void myrefl_api_terminate(void);
 
 void myrefl_set_slave(const char *slave_name);
@@ -119,6 +119,12 @@ typedef enum cli_state_t_ {
     CLI_STATE_INVALID
 } cli_state_t;        
 
+typedef enum cli_baseline_t_ {
+    CLI_BASELINE_NONE,
+    CLI_BASELINE_LEARNING,
+    CLI_BASELINE_ENFORCING
+} cli_baseline_t;
+
 typedef enum cli_test_type_t_  {
      CLI_TEST_TYPE_POLLED,
      CLI_TEST_TYPE_NOTIFICATION,
@@ -180,6 +186,7 @@ typedef struct cli_rule_info_t_ {
     unsigned int last_result_count;
     unsigned int fail_count;
     myrefl_severity_t severity;
+    cli_baseline_t baseline;
 } cli_rule_t;
 
 typedef struct cli_comp_info_t_ {
@@ -212,6 +219,9 @@ typedef struct cli_action_info_t_ {
     cli_state_t default_state;
     myrefl_result_t last_result;
     unsigned int last_result_count;
+    unsigned int coalesced;
+    unsigned int deferred;
+    unsigned int suppressed;
 } cli_action_t;    
 
 typedef struct cli_instance_t_ {
@@ -249,6 +259,10 @@ typedef struct cli_info_element_t_ {
     unsigned int period;
     unsigned int default_period;
     myrefl_severity_t severity;
+    cli_baseline_t baseline;
+    unsigned int coalesced;      /* Actions only */
+    unsigned int deferred;
+    unsigned int suppressed;
 } cli_info_element_t;
 
 
@@ -292,6 +306,31 @@ typedef struct cli_data_t {
     cli_data_element_t *elements;
 } cli_data_t;    
 
+/* Time series of results for an instance, the recent results or the
+ * per minute or per hour aggregates.
+ */
+typedef enum cli_series_tier_t_ {
+    CLI_SERIES_RECENT,
+    CLI_SERIES_MINUTE,
+    CLI_SERIES_HOUR
+} cli_series_tier_t;
+
+typedef struct cli_series_point_t_ {
+    xos_time_t time;
+    myrefl_result_t result;        /* Recent results only */
+    unsigned int count;
+    unsigned int failures;
+    long min;
+    long max;
+    long avg;
+} cli_series_point_t;
+
+typedef struct cli_series_t_ {
+    cli_series_tier_t tier;
+    unsigned int num_points;
+    cli_series_point_t *points;
+} cli_series_t;
+
 typedef struct cli_debug_t {
     unsigned int num_filters;
     char *filters;
@@ -358,4 +397,6 @@ void myrefl_cli_debug_disable(const char *name);
 cli_debug_t *myrefl_cli_debug_get(void);
 
 const char *myrefl_cli_state_to_str(cli_state_t state);
+const char *myrefl_cli_baseline_to_str(cli_baseline_t baseline);
+const char *myrefl_cli_series_tier_to_str(cli_series_tier_t tier);
 #endif
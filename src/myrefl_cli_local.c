@@ -339,6 +339,21 @@ static cli_state_t obj_state_to_cli (obj_state_t state)
     return(CLI_STATE_INVALID);                            
 }
 
+/*
+ * obj_baseline_to_cli()
+ *
+ * Whether a rule instance is learning or enforcing its baseline.
+ */
+static cli_baseline_t obj_baseline_to_cli (obj_instance_t *instance)
+{
+    switch (myrefl_seq_baseline_mode(instance)) {
+    case SEQ_BASELINE_NONE:      return (CLI_BASELINE_NONE);
+    case SEQ_BASELINE_LEARNING:  return (CLI_BASELINE_LEARNING);
+    case SEQ_BASELINE_ENFORCING: return (CLI_BASELINE_ENFORCING);
+    }
+    return (CLI_BASELINE_NONE);
+}
+
 /*
  * obj_test_type_to_cli_type()
  * Convert obj type test to Cli test type.
@@ -712,6 +727,9 @@ void *myrefl_cli_local_get_single_info (unsigned int handle_id)
             cli_action->default_state = obj_state_to_cli(obj->i.default_state);
             cli_action->last_result_count = obj->i.last_result_count;       
             cli_action->last_result = obj->i.last_result;       
+            cli_action->coalesced = obj->t.action->coalesced;
+            cli_action->deferred = obj->t.action->deferred;
+            cli_action->suppressed = obj->t.action->suppressed;
         }
         return_ptr = (void *)cli_action;
     }    
@@ -760,6 +778,7 @@ void *myrefl_cli_local_get_single_info (unsigned int handle_id)
             cli_rule->last_result_count = obj->i.last_result_count;       
             cli_rule->last_result = obj->i.last_result;
             cli_rule->last_value = obj->i.last_value;
+            cli_rule->baseline = obj_baseline_to_cli(&obj->i);
         }
         return_ptr = (void *)cli_rule;
     }    
@@ -989,6 +1008,9 @@ cli_info_t *myrefl_cli_local_get_instance_info (unsigned int handle_id,
                 
                 element->last_result = instance->last_result;
                 element->last_result_count = instance->last_result_count;
+                if (type == CLI_RULE) {
+                    element->baseline = obj_baseline_to_cli(instance);
+                }
 
                 element->next = NULL;
                 
@@ -1247,8 +1269,12 @@ cli_info_t *myrefl_cli_local_get_info (unsigned int handle_id,
                     element->op_m = obj->t.rule->op_m;
                     element->last_result_count = obj->i.last_result_count;
                     element->severity = obj->t.rule->severity;
+                    element->baseline = obj_baseline_to_cli(&obj->i);
                     break;
                 case CLI_ACTION:
+                    element->coalesced = obj->t.action->coalesced;
+                    element->deferred = obj->t.action->deferred;
+                    element->suppressed = obj->t.action->suppressed;
                     break;
                 default:
                     /*
@@ -3183,3 +3209,122 @@ const char *myrefl_cli_state_to_str(cli_state_t state) {
         return "Invalid";
     }
 }
+
+/*
+ * myrefl_cli_local_get_series()
+ *
+ * Copy one tier of the time series for an object, or one of its 
+ * instances, oldest first. Returns NULL if there is no series.
+ */
+cli_series_t *myrefl_cli_local_get_series (const char *name,
+                                           const char *instance_name,
+                                           cli_series_tier_t tier)
+{
+    obj_t *obj;
+    obj_instance_t *instance;
+    obj_series_tier_t obj_tier;
+    obj_series_point_t *points = NULL;
+    cli_series_t *series = NULL;
+    char *instance_copy;
+    uint count, i;
+    const char fnstr[] = "Local series";
+
+    if (!name) {
+        return (NULL);
+    }
+
+    switch (tier) {
+    case CLI_SERIES_MINUTE: obj_tier = OBJ_SERIES_MINUTE; break;
+    case CLI_SERIES_HOUR:   obj_tier = OBJ_SERIES_HOUR; break;
+    default:                obj_tier = OBJ_SERIES_RECENT; break;
+    }
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_ANY);
+    if (!obj) {
+        myrefl_obj_db_unlock();
+        return (NULL);
+    }
+    if (instance_name) {
+        instance_copy = myrefl_api_convert_name(instance_name);
+        if (!instance_copy) {
+            myrefl_error("%s memory allocation failure for '%s'", 
+                         fnstr, name);
+            myrefl_obj_db_unlock();
+            return (NULL);
+        }
+        instance = myrefl_obj_instance_by_name(obj, instance_copy);
+        free(instance_copy);
+    } else {
+        instance = &obj->i;
+    }
+    if (!instance || !instance->series) {
+        myrefl_obj_db_unlock();
+        return (NULL);
+    }
+
+    count = myrefl_obj_series_read(instance->series, obj_tier, NULL, 0);
+    series = calloc(1, sizeof(cli_series_t));
+    if (series && count) {
+        points = calloc(count, sizeof(obj_series_point_t));
+        series->points = calloc(count, sizeof(cli_series_point_t));
+    }
+    if (!series || (count && (!points || !series->points))) {
+        myrefl_error("%s - No memory for %u points of '%s'", fnstr, count,
+                     name);
+        myrefl_obj_db_unlock();
+        free(points);
+        myrefl_cli_local_free_series(series);
+        return (NULL);
+    }
+    count = myrefl_obj_series_read(instance->series, obj_tier, points, count);
+    myrefl_obj_db_unlock();
+
+    series->tier = tier;
+    series->num_points = count;
+    for (i = 0; i < count; i++) {
+        series->points[i].time.sec = points[i].time / 1000;
+        series->points[i].time.nsec = (points[i].time % 1000) * 1000000;
+        series->points[i].result = points[i].result;
+        series->points[i].count = points[i].count;
+        series->points[i].failures = points[i].failures;
+        series->points[i].min = points[i].min;
+        series->points[i].max = points[i].max;
+        series->points[i].avg = points[i].count ? 
+            (long)(points[i].sum / points[i].count) : 0;
+    }
+    free(points);
+    return (series);
+}
+
+void myrefl_cli_local_free_series (cli_series_t *series)
+{
+    if (series) {
+        free(series->points);
+        free(series);
+    }
+}
+
+const char *myrefl_cli_series_tier_to_str(cli_series_tier_t tier) {
+    switch(tier) {
+    case CLI_SERIES_RECENT:
+        return "recent";
+    case CLI_SERIES_MINUTE:
+        return "minute";
+    case CLI_SERIES_HOUR:
+        return "hour";
+    }
+    return "unknown";
+}
+
+const char *myrefl_cli_baseline_to_str(cli_baseline_t baseline) {
+    switch(baseline) {
+    case CLI_BASELINE_NONE:
+        return "-";
+    case CLI_BASELINE_LEARNING:
+        return "Learning";
+    case CLI_BASELINE_ENFORCING:
+        return "Enforcing";
+    }
+    return "Unknown";
+}
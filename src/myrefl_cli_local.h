@@ -117,4 +117,9 @@ void myrefl_cli_local_debug_enable(const char *name);
 void myrefl_cli_local_debug_disable(const char *name);
 cli_debug_t *myrefl_cli_local_debug_get(void);
 
+cli_series_t *myrefl_cli_local_get_series(const char *name,
+                                          const char *instance_name,
+                                          cli_series_tier_t tier);
+void myrefl_cli_local_free_series(cli_series_t *series);
+
 #endif
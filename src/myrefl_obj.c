@@ -38,6 +38,7 @@
 #include "myrefl_obj.h"
 #include "myrefl_api.h"
 #include "myrefl_rci.h"
+#include "myrefl_sequence.h"
 #include "myrefl_thread.h"
 #include "myrefl_cli_handle.h"
 
@@ -45,15 +46,6 @@
  * Structures and Types
  *******************************************************************/
 
-/*
- * The following defines the maximum pointer walk iterations
- * to avoid lock ups in case of bugs. There is no imposed client limit,
- * so we use a large number.
- */
-#define MAX_SERIAL_RULES 24
-#define MAX_COMP_NESTING 255
-#define MAX_NEXT_COMPS   255
-
 obj_comp_t *myrefl_obj_system_comp = NULL;
 
 static unsigned int obj_idents[] = {
@@ -81,6 +73,67 @@ static myrefl_list_t *freeme = NULL;
 static myrefl_thread_t *garbage_collector = NULL;
 static xos_timer_t *start_garbage_collect;
 
+/*
+ * The compiled rule graph, and the generation that the object linkages
+ * are currently at. The graph is out of date when the two differ.
+ */
+static obj_graph_t obj_graph;
+static uint obj_graph_generation = 1;
+
+/*
+ * Topological order of the objects for each obj_order_t relation, 
+ * indexed by position less one, NULL where an object has been removed.
+ * Every link "from" -> "to" has "from" before "to". The objects occupy
+ * [first, last) with room kept at both ends, new objects with no links
+ * yet can then go at whichever end saves reordering.
+ */
+typedef struct obj_order_list_s {
+    obj_t **objs;
+    uint first;
+    uint last;
+    uint size;
+} obj_order_list_t;
+
+#define OBJ_ORDER_INITIAL 64
+
+static obj_order_list_t obj_orders[OBJ_ORDER_MAX];
+static obj_walk_t obj_order_walk = OBJ_WALK_INIT(obj_t *);
+static uint obj_order_visit = 0;
+
+/*
+ * Stack for myrefl_obj_chain_update_state().
+ */
+static obj_walk_t obj_chain_walk = OBJ_WALK_INIT(obj_t *);
+
+/*
+ * Scratch space for reordering, kept between links.
+ */
+static obj_t **obj_order_moved = NULL;
+static uint obj_order_scratch_size = 0;
+
+/*
+ * Stamp for the objects visited by the current walk, see 
+ * myrefl_obj_walk_stamp().
+ */
+static uint obj_walk_visit = 0;
+
+/*
+ * Handle table, the client holds an index into it along with the slot's
+ * generation, which is bumped when the slot's instance is freed. Slot 0 
+ * is never used so that an instance's handle of 0 means it has none.
+ */
+typedef struct obj_handle_slot_s {
+    obj_instance_t *instance;
+    uint generation;
+    uint next_free;
+} obj_handle_slot_t;
+
+#define OBJ_HANDLE_TABLE_INITIAL 64
+
+static obj_handle_slot_t *obj_handles = NULL;
+static uint obj_handles_size = 0;
+static uint obj_handles_free = 0;
+
 /*
  * GARBAGE_PERIOD_SEC
  *
@@ -149,7 +202,6 @@ static obj_rel_t type_to_rel (obj_type_t type)
 static obj_comp_t *comp_get_next (obj_comp_t *comp)
 {
     obj_comp_t *next = NULL;
-    int i = 0;
 
     if (!comp) {
         /*
@@ -170,10 +222,6 @@ static obj_comp_t *comp_get_next (obj_comp_t *comp)
         /*
          * Parents next component
          */
-        if (i++ > MAX_COMP_NESTING) {
-            myrefl_error("%s: Too much comp nesting", __FUNCTION__);
-            return (NULL);
-        }
         comp = comp->obj->parent_comp;
         if (!comp) {
             break; /* reached top of tree */
@@ -249,7 +297,6 @@ static obj_comp_t *comp_get_next_contained (
     obj_comp_t *top_comp, obj_comp_t *last_comp)
 {
     obj_comp_t *comp, *next_comp = NULL;
-    int i = 0;
 
     if (!top_comp) {
         top_comp = myrefl_obj_system_comp;
@@ -272,17 +319,17 @@ static obj_comp_t *comp_get_next_contained (
         next_comp = last_comp->obj->next_in_comp->t.comp;
     } else do {
         /*
-         * Parents next component
+         * Parents next component, or its parents and so on up to
+         * the top component.
          */
-        if (i++ > MAX_COMP_NESTING) {
-            myrefl_error("%s: Too much comp nesting", __FUNCTION__);
-            return (NULL);
-        }
         comp = last_comp->obj->parent_comp;
         if (comp == top_comp || !comp) {
             break;
         }
-        next_comp = comp->obj->next_in_comp->t.comp;
+        if (comp->obj->next_in_comp) {
+            next_comp = comp->obj->next_in_comp->t.comp;
+        }
+        last_comp = comp;
     } while (!next_comp);
 
     return (next_comp);
@@ -303,7 +350,6 @@ static obj_t *comp_get_next_type_contained (
 {
     obj_t *obj = NULL;
     obj_comp_t *next_comp;
-    int i = 0;
 
     if (!top_comp) {
         top_comp = myrefl_obj_system_comp;
@@ -346,10 +392,6 @@ static obj_t *comp_get_next_type_contained (
 
       case OBJ_TYPE_ANY:
         while (next_comp && !obj) {
-            if (i++ > MAX_NEXT_COMPS) {
-                myrefl_error("%s: Too many empty next comps", __FUNCTION__);
-                return (NULL);
-            }
             if (next_comp->nones) {
                 obj = next_comp->nones;
             } else if (next_comp->tests) {
@@ -504,6 +546,7 @@ static boolean allocate_object_type (obj_t *obj, obj_type_t type)
 
     if (success) {
         obj->i.state = OBJ_STATE_ALLOCATED;
+        myrefl_rci_depend_changed();
     } else {
         obj->i.state = OBJ_STATE_INVALID;
         obj->type = OBJ_TYPE_NONE;
@@ -639,8 +682,6 @@ obj_t *myrefl_comp_get_next_contained (
  */
 obj_t *myrefl_obj_get_rel (obj_t *obj, obj_rel_t rel)
 {
-    int i = 0;
-
     if (!obj) {
         return (NULL);
     }
@@ -649,17 +690,13 @@ obj_t *myrefl_obj_get_rel (obj_t *obj, obj_rel_t rel)
         if (rel == OBJ_REL_TEST) {
             /*
              * Walk backwards thru the input rules looking for the first test.
-             * Use a loop with a sanity maximum to avoid any chance of lock-up.
+             * Rule inputs can't loop, see myrefl_obj_order_link().
              *
              * Note that this is broken really, since it is supposed to
              * return *all* the tests for a given rule, which may be more than
              * one now that we support multiple inputs.
              */
             do {
-                if (i++ > MAX_SERIAL_RULES) {
-                    myrefl_error("%s: too many serial rules", __FUNCTION__);
-                    return (NULL);
-                }
                 obj = (obj_t*)(obj->t.rule->inputs->head ? obj->t.rule->inputs->head->data : NULL);
             } while (obj && obj->type != OBJ_TYPE_TEST);
             return (obj);
@@ -849,6 +886,11 @@ void myrefl_obj_unlink_from_comp (obj_t *obj)
         return; /* no component to remove from */
     }
 
+    /*
+     * Give back any health that this object was taking off the component
+     */
+    myrefl_seq_obj_health_withdraw(obj);
+
     switch (obj->type) {
     case OBJ_TYPE_NONE: 
         list = &comp->nones;
@@ -885,6 +927,7 @@ void myrefl_obj_unlink_from_comp (obj_t *obj)
     
     myrefl_list_remove(comp->top_depend, obj);
     myrefl_list_remove(comp->bottom_depend, obj);
+    myrefl_rci_depend_changed();
 
     //ttyprintf(CONTTY, "\nunlinked %s from comp", obj->name);
 }
@@ -934,214 +977,865 @@ void myrefl_obj_comp_link_obj (obj_comp_t *comp, obj_t *obj)
 
     myrefl_debug(obj->i.name, "%s linked to comp %s", obj->i.name, obj->parent_comp->obj->i.name);
 
+    myrefl_seq_obj_health_sync(obj);
+    myrefl_rci_depend_changed();
+
     return;
 }
 
 /*
- * Find the object with the given name and type (or of any type for OBJ_TYPE_ANY).
- * If not found then the object is created and is set to enabled state.
- * The type specific portion (if applicable) is also created, but is unitialized.
- *  OBJ_TYPE_NONE will be grown into an object of type
- * A pointer to the object is returned.
- *
- * When a real type (TEST,RULE,ACTION,COMP) is given and where an object exists
- * with the same name and is of OBJ_TYPE_NONE, then that object will grow into
- * the given real object, with the type specific portion is created. In this way
- * a partially created object can be referenced before it being fully created.
+ * graph_add_node()
  *
- * It is the responsibility of the caller to:
- * 1. Complete the initialization of the specialized portion of a created object.
- * 2. Link the object into the diagnostics database using myrefl_obj_link().
- * 3. Delete the object in case of errors.
+ * Add an object to the list of graph nodes being compiled if it is not
+ * there already, growing the list as required.
  */
-obj_t *myrefl_obj_get_or_create (char *obj_name, obj_type_t type)
+static boolean graph_add_node (obj_t ***objs, uint *count, uint *size,
+                               obj_t *obj, uint generation)
 {
-    obj_t *obj = NULL;
-    obj_comp_t *comp;
-    
-    /*
-     * If there is no myrefl_obj_system_comp yet then create it first before
-     * creating this object.
-     */
-    if (!myrefl_obj_system_comp && strcmp(obj_name, MYREFL_SYSTEM_COMP) != 0) {
-        obj = myrefl_obj_get_or_create(MYREFL_SYSTEM_COMP, OBJ_TYPE_COMP);
-        if (!obj) {
-            myrefl_error("Could not create system component");
-            return (NULL);
-        }
-        obj->t.comp->health = 1000;
-        obj->t.comp->confidence = 1000;
-        obj->i.state = OBJ_STATE_ENABLED;
-        obj->i.default_state = OBJ_STATE_ENABLED;
-        obj->i.cli_state = OBJ_STATE_INITIALIZED;  // CLI not set.
-        obj = NULL;
+    obj_t **new_objs;
+
+    if (obj->graph_generation == generation) {
+        return (TRUE);
     }
 
-    if (myrefl_obj_system_comp) {
-        /*
-         * It is at this point where we ensure there is only one name space
-         * for all object types. The underlying functions do support separate
-         * name spaces, however we are placing the restriction on behalf
-         * of the greater swdiag component to avoid API issues.
-         * So we look for an existing name of ANY type.
-         */
-        obj = myrefl_obj_get_by_name(obj_name, OBJ_TYPE_ANY);
+    if (*count == *size) {
+        *size = *size ? *size * 2 : 64;
+        new_objs = realloc(*objs, *size * sizeof(obj_t *));
+        if (!new_objs) {
+            return (FALSE);
+        }
+        *objs = new_objs;
     }
 
-    if (obj) {
-        /*
-         * We have an existing entry, make sure that it is of the correct 
-         * type, if not then convert it if possible.
-         */
-        if (type == OBJ_TYPE_ANY) {
-            /* found it and we don't care what type */
-        } else if (type == obj->type) {
-            /* found it with matching type */
-        } else if (type != OBJ_TYPE_NONE && obj->type == OBJ_TYPE_NONE) {
-            /*
-             * Unlink the object from the component's list of NONE types,
-             * migrate to a real type, and then link the object back into
-             * the same component on the correct type list.
-             */
-            comp = obj->parent_comp;
-            myrefl_obj_unlink_from_comp(obj);
-            if (!allocate_object_type(obj, type)) {
-                myrefl_error("Can't create object type from NONE type");
-                /* fall thru and relink the failed NONE type anyway */
+    obj->graph_generation = generation;
+    obj->graph_index = *count;
+    (*objs)[(*count)++] = obj;
+    return (TRUE);
+}
+
+static int graph_operand_cmp (const void *a, const void *b)
+{
+    uint operand_a = *(const uint *)a;
+    uint operand_b = *(const uint *)b;
+
+    return (operand_a < operand_b ? -1 : operand_a > operand_b);
+}
+
+/*
+ * graph_compile()
+ *
+ * Lower the rule linkages into the compiled graph. Every rule and every
+ * input to a rule becomes a node, the nodes are placed in topological
+ * order and each gets contiguous runs of operands for its inputs, for the
+ * rules that it feeds, and of recovery actions.
+ *
+ * The rule input lists are the master copy of the linkages, so the rules
+ * that an object feeds are derived from them rather than from the
+ * output/next_in_input chains.
+ */
+static boolean graph_compile (void)
+{
+    uint generation = obj_graph_generation;
+    obj_t **objs = NULL;
+    obj_t *obj, *input_obj;
+    myrefl_list_element_t *element;
+    obj_graph_t graph;
+    uint count = 0, size = 0, n_edges = 0, n_actions = 0;
+    uint *in_degree = NULL, *out_start = NULL, *out_list = NULL;
+    uint *order = NULL, *rank = NULL;
+    uint i, j, head, tail, operand, action;
+    boolean ok = FALSE;
+
+    memset(&graph, 0, sizeof(graph));
+
+    for (obj = myrefl_comp_get_first_contained(myrefl_obj_system_comp, 
+                                               OBJ_TYPE_RULE);
+         obj != NULL;
+         obj = myrefl_comp_get_next_contained(myrefl_obj_system_comp, obj,
+                                              OBJ_TYPE_RULE)) {
+        if (!graph_add_node(&objs, &count, &size, obj, generation)) {
+            goto done;
+        }
+        for (element = obj->t.rule->inputs->head; 
+             element != NULL; 
+             element = element->next) {
+            if (!graph_add_node(&objs, &count, &size, element->data,
+                                generation)) {
+                goto done;
             }
-            myrefl_obj_comp_link_obj(comp, obj);
-        } else {
-            myrefl_error("Can't change types of existing object %s from %s to %s",
-                obj_name, myrefl_obj_type_str(obj->type), myrefl_obj_type_str(type));
-            return (NULL);
+            n_edges++;
         }
+        n_actions += obj->t.rule->action_list->num_elements;
+    }
 
-        /*
-         * There is no way we should be finding deleted objects still
-         * in the tree, don't return them if we do.
-         */
-        if (obj->i.state == OBJ_STATE_DELETED) {
-            myrefl_error("Failed to create duplicate of deleted object '%s' type '%s'",
-                         myrefl_obj_type_str(obj->type), obj_name);
-            obj = NULL;
-        } 
+    in_degree = calloc(count + 1, sizeof(uint));
+    out_start = calloc(count + 1, sizeof(uint));
+    out_list = malloc((n_edges + 1) * sizeof(uint));
+    order = malloc((count + 1) * sizeof(uint));
+    rank = malloc((count + 1) * sizeof(uint));
+    graph.nodes = calloc(count + 1, sizeof(obj_graph_node_t));
+    graph.operands = malloc((2 * n_edges + 1) * sizeof(uint));
+    graph.actions = malloc((n_actions + 1) * sizeof(obj_t *));
 
-        return (obj);
+    if (!in_degree || !out_start || !out_list || !order || !rank ||
+        !graph.nodes || !graph.operands || !graph.actions) {
+        goto done;
     }
 
     /*
-     * This object is unknown. Lets allocate and zero the base object.
+     * Build the edges from each input to the rules that it feeds.
      */
-    obj = calloc(1, sizeof(obj_t));
-    if (!obj) {
-        myrefl_error("Alloc of %s object '%s'", myrefl_obj_type_str(type), obj_name);
-        return (NULL);
+    for (i = 0; i < count; i++) {
+        if (objs[i]->type != OBJ_TYPE_RULE) {
+            continue;
+        }
+        for (element = objs[i]->t.rule->inputs->head; 
+             element != NULL; 
+             element = element->next) {
+            input_obj = element->data;
+            out_start[input_obj->graph_index + 1]++;
+            in_degree[i]++;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        out_start[i + 1] += out_start[i];
+    }
+    for (i = 0; i < count; i++) {
+        order[i] = out_start[i];
+    }
+    for (i = 0; i < count; i++) {
+        if (objs[i]->type != OBJ_TYPE_RULE) {
+            continue;
+        }
+        for (element = objs[i]->t.rule->inputs->head; 
+             element != NULL; 
+             element = element->next) {
+            input_obj = element->data;
+            out_list[order[input_obj->graph_index]++] = i;
+        }
     }
 
     /*
-     * Now set the base object defaults.
+     * Topological sort, anything left over is part of a loop and is
+     * added on the end in the order found.
      */
-    obj->ident = obj_idents[OBJ_TYPE_NONE];
-    obj->type = OBJ_TYPE_NONE; /* Overridden by allocate_object_type() */
-    obj->description = NULL;
+    head = tail = 0;
+    for (i = 0; i < count; i++) {
+        if (in_degree[i] == 0) {
+            order[tail++] = i;
+        }
+    }
+    while (head < tail) {
+        i = order[head++];
+        for (j = out_start[i]; j < out_start[i + 1]; j++) {
+            if (--in_degree[out_list[j]] == 0) {
+                order[tail++] = out_list[j];
+            }
+        }
+    }
+    if (tail < count) {
+        myrefl_debug(NULL, "Rule graph has %u rules in loops", count - tail);
+        for (i = 0; i < count; i++) {
+            if (in_degree[i] != 0) {
+                order[tail++] = i;
+            }
+        }
+    }
+    for (i = 0; i < count; i++) {
+        rank[order[i]] = i;
+    }
 
     /*
-     * Only the API module can move the state from ALLOCATED to INITIALIZED
-     * as only the API module has knowledge of how to initialize the fields
-     * of the specific type.
+     * Lay out the nodes and their operands in topological order.
      */
-    obj->i.obj = obj;
-    obj->i.state = OBJ_STATE_ALLOCATED;
-    obj->i.name = obj_name;
-    obj->i.context = NULL;
-    obj->i.next = NULL;
-    obj->i.prev = NULL;
-    obj->i.sched_test.queued = TEST_QUEUE_NONE;
-    obj->i.sched_test.instance = &obj->i;
-
-    obj->parent_depend = myrefl_list_create();
-    obj->child_depend = myrefl_list_create();
-    obj->ref_rule = NULL;
-    obj->domain = 0;
+    operand = 0;
+    action = 0;
+    for (i = 0; i < count; i++) {
+        obj_graph_node_t *node = &graph.nodes[i];
+
+        obj = objs[order[i]];
+        node->obj = obj;
+
+        node->inputs = operand;
+        if (obj->type == OBJ_TYPE_RULE) {
+            for (element = obj->t.rule->inputs->head; 
+                 element != NULL; 
+                 element = element->next) {
+                input_obj = element->data;
+                graph.operands[operand++] = rank[input_obj->graph_index];
+            }
+        }
+        node->n_inputs = operand - node->inputs;
 
-    /*
-     * Now allocate the type specific portion of the object.
-     * No specific portion is created for unknown types.
-     */
-    if (!allocate_object_type(obj, type)) {
-        myrefl_error("Could not create  %s object '%s'", myrefl_obj_type_str(type), obj_name);
-        /* object still stored, but has INVALID state */
-        free(obj);
-        return (NULL);
-    }
+        node->outputs = operand;
+        for (j = out_start[order[i]]; j < out_start[order[i] + 1]; j++) {
+            graph.operands[operand++] = rank[out_list[j]];
+        }
+        node->n_outputs = operand - node->outputs;
+        qsort(&graph.operands[node->outputs], node->n_outputs, 
+              sizeof(uint), graph_operand_cmp);
 
-    /*
-     * The object is first linked into the System component to keep track
-     * of it.
-     */
-    if (myrefl_obj_system_comp) { 
-        myrefl_debug(NULL, "%s: Added '%s' to '%s'", 
-                     __FUNCTION__, obj->i.name, 
-                     myrefl_obj_system_comp->obj->i.name);
-        myrefl_obj_comp_link_obj(myrefl_obj_system_comp, obj);
-        if (obj->type == OBJ_TYPE_RULE || obj->type == OBJ_TYPE_COMP) {
-            myrefl_list_add(myrefl_obj_system_comp->top_depend, obj);
-            myrefl_list_add(myrefl_obj_system_comp->bottom_depend, obj);
+        node->actions = action;
+        if (obj->type == OBJ_TYPE_RULE) {
+            for (element = obj->t.rule->action_list->head; 
+                 element != NULL; 
+                 element = element->next) {
+                graph.actions[action++] = element->data;
+            }
         }
+        node->n_actions = action - node->actions;
     }
-    
-    if (!myrefl_obj_system_comp && strcmp(obj_name, MYREFL_SYSTEM_COMP) == 0) {
-        myrefl_obj_system_comp = obj->t.comp;
+
+    for (i = 0; i < count; i++) {
+        objs[i]->graph_index = rank[i];
     }
 
-    myrefl_trace(obj->i.name, "Created obj '%s'", obj->i.name);
+    free(obj_graph.nodes);
+    free(obj_graph.operands);
+    free(obj_graph.actions);
+    graph.generation = generation;
+    graph.n_nodes = count;
+    obj_graph = graph;
+    ok = TRUE;
 
-    return (obj);
+    myrefl_debug(NULL, "Compiled rule graph, %u nodes %u links %u actions",
+                 count, n_edges, n_actions);
+done:
+    if (!ok) {
+        myrefl_error("Failed to compile rule graph, %u nodes", count);
+        /*
+         * Objects have been stamped with this generation, move on so
+         * that the next attempt starts afresh.
+         */
+        myrefl_obj_graph_changed();
+        free(graph.nodes);
+        free(graph.operands);
+        free(graph.actions);
+    }
+    free(objs);
+    free(in_degree);
+    free(out_start);
+    free(out_list);
+    free(order);
+    free(rank);
+    return (ok);
 }
 
 /*
- * Link an object into the System component.
+ * myrefl_obj_graph_changed()
+ *
+ * The linkages between tests, rules and actions have changed, the
+ * compiled graph will be rebuilt when next used.
  */
-void myrefl_obj_link (obj_t *obj)
+void myrefl_obj_graph_changed (void)
 {
-    myrefl_obj_comp_link_obj(myrefl_obj_system_comp, obj);
+    if (++obj_graph_generation == 0) {
+        obj_graph_generation = 1;
+    }
 }
 
-static void unlink_obj_instance (obj_instance_t *delete_instance)
+/*
+ * myrefl_obj_graph()
+ *
+ * Get the compiled rule graph, compiling it first if it is out of date.
+ * Only valid while the DB is locked.
+ */
+obj_graph_t *myrefl_obj_graph (void)
 {
-    obj_t *delete_obj, *obj;
-    myrefl_list_element_t *current, *element;
-    obj_test_t *test;
-    obj_action_t *action;
-    obj_rule_t *rule, *rule2;
-    obj_comp_t *comp;
+    if (obj_graph.generation != obj_graph_generation) {
+        if (!graph_compile()) {
+            return (NULL);
+        }
+    }
+    return (&obj_graph);
+}
 
-    if (delete_instance) {
-        delete_obj = delete_instance->obj;
-        if (delete_instance == &delete_obj->i) {
-            /*
-             * Deleting the primary instance, remove all links
-             * from this object to other ones, and also remove this
-             * object from dependency trees and its parent component.
-             */
+/*
+ * myrefl_obj_graph_node()
+ *
+ * Get the compiled node for a test or rule, NULL if it is not linked to
+ * any rule.
+ */
+obj_graph_node_t *myrefl_obj_graph_node (obj_t *obj)
+{
+    obj_graph_t *graph = myrefl_obj_graph();
 
-            /*
-             * Start off by removing this object from the owning 
-             * component.
-             */
-            myrefl_obj_unlink_from_comp(delete_obj);
-            
-            /*
-             * Remove this object from any dependency tree that it
-             * is part of. This is a matter of looking through the
-             * parent_depend and child_depend and removing any trace
-             * of our object in those objects parent/child depends.
-             */
-            if (delete_obj->parent_depend) {
-                current = delete_obj->parent_depend->head;
-                while(current) {
+    if (!graph || !obj || obj->graph_generation != graph->generation) {
+        return (NULL);
+    }
+    return (&graph->nodes[obj->graph_index]);
+}
+
+/*
+ * myrefl_obj_walk_push()
+ *
+ * Push a new zeroed frame on to the walk's stack and return it, NULL 
+ * if the stack could not be grown. The stack is kept between walks and
+ * only grows, doubling as it does, so a walk costs memory for its 
+ * deepest point and nothing for the depth of the graph above that.
+ *
+ * Frames move when the stack grows, so a frame pointer held over a
+ * push, including pushes by any walk started from within this one, 
+ * must be looked up again.
+ */
+void *myrefl_obj_walk_push (obj_walk_t *walk)
+{
+    char *frames, *frame;
+    uint size;
+
+    if (walk->top == walk->size) {
+        size = walk->size ? walk->size * 2 : OBJ_WALK_INITIAL;
+        frames = realloc(walk->frames, size * walk->frame_size);
+        if (!frames) {
+            return (NULL);
+        }
+        walk->frames = frames;
+        walk->size = size;
+    }
+
+    frame = walk->frames + (walk->top++ * walk->frame_size);
+    memset(frame, 0, walk->frame_size);
+    return (frame);
+}
+
+/*
+ * myrefl_obj_walk_peek()
+ *
+ * The frame on the top of the walk's stack, NULL once the stack is 
+ * back down to "base", i.e. the walk that started there is complete.
+ */
+void *myrefl_obj_walk_peek (obj_walk_t *walk, uint base)
+{
+    if (walk->top <= base) {
+        return (NULL);
+    }
+    return (walk->frames + ((walk->top - 1) * walk->frame_size));
+}
+
+/*
+ * myrefl_obj_walk_pop()
+ *
+ * Done with the frame on the top of the walk's stack.
+ */
+void myrefl_obj_walk_pop (obj_walk_t *walk)
+{
+    if (walk->top) {
+        walk->top--;
+    }
+}
+
+/*
+ * myrefl_obj_walk_end()
+ *
+ * Discard any frames left by the walk that started at "base".
+ */
+void myrefl_obj_walk_end (obj_walk_t *walk, uint base)
+{
+    if (walk->top > base) {
+        walk->top = base;
+    }
+}
+
+/*
+ * myrefl_obj_walk_stamp()
+ *
+ * Start a new walk that marks the objects it visits in walk_visit, 
+ * returning the stamp to mark them with. Any earlier walk using the 
+ * stamps is over, so these walks can't be started from within one 
+ * another.
+ */
+uint myrefl_obj_walk_stamp (void)
+{
+    if (++obj_walk_visit == 0) {
+        obj_walk_visit = 1;
+    }
+    return (obj_walk_visit);
+}
+
+/*
+ * order_successors()
+ *
+ * The objects that "obj" links to in this relation.
+ */
+static myrefl_list_t *order_successors (obj_order_t relation, obj_t *obj)
+{
+    switch (relation) {
+    case OBJ_ORDER_DEPEND:
+        return (obj->child_depend);
+    case OBJ_ORDER_INPUT:
+        if (obj->type == OBJ_TYPE_RULE && obj->t.rule) {
+            return (obj->t.rule->inputs);
+        }
+        break;
+    default:
+        break;
+    }
+    return (NULL);
+}
+
+/*
+ * order_relayout()
+ *
+ * Out of room at one end, squeeze out the holes left by removed objects
+ * and centre the order in a new array, twice the size if it is getting
+ * full.
+ */
+static boolean order_relayout (obj_order_t relation)
+{
+    obj_order_list_t *order = &obj_orders[relation];
+    obj_t **objs, **moved;
+    uint pos, count = 0, size, to;
+
+    for (pos = order->first; pos < order->last; pos++) {
+        if (order->objs[pos]) {
+            count++;
+        }
+    }
+
+    size = order->size;
+    if (size == 0 || count >= size / 2) {
+        size = size ? size * 2 : OBJ_ORDER_INITIAL;
+    }
+
+    objs = calloc(size, sizeof(obj_t *));
+    if (!objs) {
+        return (FALSE);
+    }
+
+    if (size > obj_order_scratch_size) {
+        moved = realloc(obj_order_moved, size * sizeof(obj_t *));
+        if (!moved) {
+            free(objs);
+            return (FALSE);
+        }
+        obj_order_moved = moved;
+        obj_order_scratch_size = size;
+    }
+
+    to = (size - count) / 2;
+    for (pos = order->first; pos < order->last; pos++) {
+        if (order->objs[pos]) {
+            objs[to] = order->objs[pos];
+            objs[to]->order[relation] = to + 1;
+            to++;
+        }
+    }
+    free(order->objs);
+    order->objs = objs;
+    order->first = (size - count) / 2;
+    order->last = to;
+    order->size = size;
+    return (TRUE);
+}
+
+/*
+ * order_append()
+ *
+ * Give the object a position at the front or back of the order if it 
+ * doesn't have one, FALSE on memory allocation failure.
+ */
+static boolean order_append (obj_order_t relation, obj_t *obj, 
+                             boolean front)
+{
+    obj_order_list_t *order = &obj_orders[relation];
+
+    if (obj->order[relation]) {
+        return (TRUE);
+    }
+
+    if ((front ? order->first == 0 : order->last == order->size) &&
+        !order_relayout(relation)) {
+        return (FALSE);
+    }
+
+    if (front) {
+        order->objs[--order->first] = obj;
+        obj->order[relation] = order->first + 1;
+    } else {
+        order->objs[order->last++] = obj;
+        obj->order[relation] = order->last;
+    }
+    return (TRUE);
+}
+
+/*
+ * order_forget()
+ *
+ * The object is being deleted, remove it from all the orders.
+ */
+static void order_forget (obj_t *obj)
+{
+    uint relation;
+
+    for (relation = 0; relation < OBJ_ORDER_MAX; relation++) {
+        if (obj->order[relation]) {
+            obj_orders[relation].objs[obj->order[relation] - 1] = NULL;
+            obj->order[relation] = 0;
+        }
+    }
+}
+
+/*
+ * order_search()
+ *
+ * Search forwards from "start" for "target", only looking at objects
+ * positioned before "upper" since no others can lead back to it. 
+ * Those reached are stamped with the walk stamp, which is left in 
+ * obj_order_visit. Should it run out of memory to search the target 
+ * is assumed reachable, which the callers treat as a loop.
+ */
+static boolean order_search (obj_order_t relation, obj_t *start,
+                             obj_t *target, uint upper)
+{
+    myrefl_list_t *successors;
+    myrefl_list_element_t *element;
+    obj_t *obj, *next, **frame;
+    boolean found = FALSE;
+
+    obj_order_visit = myrefl_obj_walk_stamp();
+
+    start->walk_visit = obj_order_visit;
+    obj = start;
+
+    while (obj && !found) {
+        successors = order_successors(relation, obj);
+        for (element = successors ? successors->head : NULL; 
+             element && !found; 
+             element = element->next) {
+            next = element->data;
+            if (next == target) {
+                found = TRUE;
+            } else if (next->walk_visit != obj_order_visit &&
+                       next->order[relation] && 
+                       next->order[relation] < upper) {
+                next->walk_visit = obj_order_visit;
+                frame = myrefl_obj_walk_push(&obj_order_walk);
+                if (!frame) {
+                    myrefl_error("No memory to search the order of '%s'",
+                                 start->i.name);
+                    found = TRUE;
+                } else {
+                    *frame = next;
+                }
+            }
+        }
+
+        frame = myrefl_obj_walk_peek(&obj_order_walk, 0);
+        obj = frame ? *frame : NULL;
+        myrefl_obj_walk_pop(&obj_order_walk);
+    }
+
+    /*
+     * Discard whatever is left should it have stopped early.
+     */
+    myrefl_obj_walk_end(&obj_order_walk, 0);
+    return (found);
+}
+
+/*
+ * myrefl_obj_order_reaches()
+ *
+ * Is "to" reachable from "from" in this relation? If "to" is already 
+ * ahead of "from" in the order then it can't be, otherwise only the 
+ * objects between the two need to be searched.
+ */
+boolean myrefl_obj_order_reaches (obj_order_t relation, obj_t *from, obj_t *to)
+{
+    if (from == to || !from->order[relation] || !to->order[relation] ||
+        to->order[relation] < from->order[relation]) {
+        return (FALSE);
+    }
+    return (order_search(relation, from, to, to->order[relation]));
+}
+
+/*
+ * myrefl_obj_order_link()
+ *
+ * A link is about to be made from "from" to "to" in this relation, 
+ * return FALSE if that would create a loop, else update the order so 
+ * that "from" comes before "to" and return TRUE. The caller then makes
+ * the link.
+ *
+ * If "from" is already before "to" there is nothing to do. Otherwise 
+ * search forwards from "to" for "from" among the objects between them,
+ * finding it means a loop. Else the objects found are moved, in their 
+ * current order, to just after "from", and those in between that were
+ * not found shuffled up to make room. Only the objects between the two
+ * are ever touched, so growing a graph is cheap whatever its size.
+ */
+boolean myrefl_obj_order_link (obj_order_t relation, obj_t *from, obj_t *to)
+{
+    obj_order_list_t *order = &obj_orders[relation];
+    obj_t *obj;
+    uint lower, upper, pos, nbr_moved = 0, keep;
+
+    if (from == to) {
+        return (FALSE);
+    }
+
+    /*
+     * An object without a position has no links, so one that is only 
+     * being linked from can go in front of everything.
+     */
+    if (!order_append(relation, from, 
+                      !from->order[relation] && to->order[relation]) ||
+        !order_append(relation, to, FALSE)) {
+        myrefl_error("Memory allocation failure ordering '%s' and '%s'",
+                     from->i.name, to->i.name);
+        return (FALSE);
+    }
+
+    lower = to->order[relation];
+    upper = from->order[relation];
+    if (upper < lower) {
+        return (TRUE);
+    }
+
+    if (order_search(relation, to, from, upper)) {
+        return (FALSE);
+    }
+
+    /*
+     * Everything between the two that was reached moves to after "from",
+     * the rest keep their relative order ahead of it.
+     */
+    keep = lower - 1;
+    for (pos = lower - 1; pos < upper; pos++) {
+        obj = order->objs[pos];
+        if (!obj) {
+            continue;
+        }
+        if (obj->walk_visit == obj_order_visit) {
+            obj_order_moved[nbr_moved++] = obj;
+        } else {
+            order->objs[keep] = obj;
+            obj->order[relation] = ++keep;
+        }
+    }
+    for (pos = 0; pos < nbr_moved; pos++) {
+        order->objs[keep] = obj_order_moved[pos];
+        obj_order_moved[pos]->order[relation] = ++keep;
+    }
+    for (; keep < upper; keep++) {
+        order->objs[keep] = NULL;
+    }
+    return (TRUE);
+}
+
+/*
+ * Find the object with the given name and type (or of any type for OBJ_TYPE_ANY).
+ * If not found then the object is created and is set to enabled state.
+ * The type specific portion (if applicable) is also created, but is unitialized.
+ *  OBJ_TYPE_NONE will be grown into an object of type
+ * A pointer to the object is returned.
+ *
+ * When a real type (TEST,RULE,ACTION,COMP) is given and where an object exists
+ * with the same name and is of OBJ_TYPE_NONE, then that object will grow into
+ * the given real object, with the type specific portion is created. In this way
+ * a partially created object can be referenced before it being fully created.
+ *
+ * It is the responsibility of the caller to:
+ * 1. Complete the initialization of the specialized portion of a created object.
+ * 2. Link the object into the diagnostics database using myrefl_obj_link().
+ * 3. Delete the object in case of errors.
+ */
+obj_t *myrefl_obj_get_or_create (char *obj_name, obj_type_t type)
+{
+    obj_t *obj = NULL;
+    obj_comp_t *comp;
+    
+    /*
+     * If there is no myrefl_obj_system_comp yet then create it first before
+     * creating this object.
+     */
+    if (!myrefl_obj_system_comp && strcmp(obj_name, MYREFL_SYSTEM_COMP) != 0) {
+        obj = myrefl_obj_get_or_create(MYREFL_SYSTEM_COMP, OBJ_TYPE_COMP);
+        if (!obj) {
+            myrefl_error("Could not create system component");
+            return (NULL);
+        }
+        obj->t.comp->health = 1000;
+        obj->t.comp->health_published = 1000;
+        obj->t.comp->confidence = 1000;
+        obj->i.state = OBJ_STATE_ENABLED;
+        obj->i.default_state = OBJ_STATE_ENABLED;
+        obj->i.cli_state = OBJ_STATE_INITIALIZED;  // CLI not set.
+        obj = NULL;
+    }
+
+    if (myrefl_obj_system_comp) {
+        /*
+         * It is at this point where we ensure there is only one name space
+         * for all object types. The underlying functions do support separate
+         * name spaces, however we are placing the restriction on behalf
+         * of the greater swdiag component to avoid API issues.
+         * So we look for an existing name of ANY type.
+         */
+        obj = myrefl_obj_get_by_name(obj_name, OBJ_TYPE_ANY);
+    }
+
+    if (obj) {
+        /*
+         * We have an existing entry, make sure that it is of the correct 
+         * type, if not then convert it if possible.
+         */
+        if (type == OBJ_TYPE_ANY) {
+            /* found it and we don't care what type */
+        } else if (type == obj->type) {
+            /* found it with matching type */
+        } else if (type != OBJ_TYPE_NONE && obj->type == OBJ_TYPE_NONE) {
+            /*
+             * Unlink the object from the component's list of NONE types,
+             * migrate to a real type, and then link the object back into
+             * the same component on the correct type list.
+             */
+            comp = obj->parent_comp;
+            myrefl_obj_unlink_from_comp(obj);
+            if (!allocate_object_type(obj, type)) {
+                myrefl_error("Can't create object type from NONE type");
+                /* fall thru and relink the failed NONE type anyway */
+            }
+            myrefl_obj_comp_link_obj(comp, obj);
+        } else {
+            myrefl_error("Can't change types of existing object %s from %s to %s",
+                obj_name, myrefl_obj_type_str(obj->type), myrefl_obj_type_str(type));
+            return (NULL);
+        }
+
+        /*
+         * There is no way we should be finding deleted objects still
+         * in the tree, don't return them if we do.
+         */
+        if (obj->i.state == OBJ_STATE_DELETED) {
+            myrefl_error("Failed to create duplicate of deleted object '%s' type '%s'",
+                         myrefl_obj_type_str(obj->type), obj_name);
+            obj = NULL;
+        } 
+
+        return (obj);
+    }
+
+    /*
+     * This object is unknown. Lets allocate and zero the base object.
+     */
+    obj = calloc(1, sizeof(obj_t));
+    if (!obj) {
+        myrefl_error("Alloc of %s object '%s'", myrefl_obj_type_str(type), obj_name);
+        return (NULL);
+    }
+
+    /*
+     * Now set the base object defaults.
+     */
+    obj->ident = obj_idents[OBJ_TYPE_NONE];
+    obj->type = OBJ_TYPE_NONE; /* Overridden by allocate_object_type() */
+    obj->description = NULL;
+
+    /*
+     * Only the API module can move the state from ALLOCATED to INITIALIZED
+     * as only the API module has knowledge of how to initialize the fields
+     * of the specific type.
+     */
+    obj->i.obj = obj;
+    obj->i.state = OBJ_STATE_ALLOCATED;
+    obj->i.name = obj_name;
+    obj->i.context = NULL;
+    obj->i.next = NULL;
+    obj->i.prev = NULL;
+    obj->i.sched_test.queued = TEST_QUEUE_NONE;
+    obj->i.sched_test.instance = &obj->i;
+
+    obj->parent_depend = myrefl_list_create();
+    obj->child_depend = myrefl_list_create();
+    obj->ref_rule = NULL;
+    memset(obj->order, 0, sizeof(obj->order));
+    obj->walk_visit = 0;
+
+    /*
+     * Now allocate the type specific portion of the object.
+     * No specific portion is created for unknown types.
+     */
+    if (!allocate_object_type(obj, type)) {
+        myrefl_error("Could not create  %s object '%s'", myrefl_obj_type_str(type), obj_name);
+        /* object still stored, but has INVALID state */
+        free(obj);
+        return (NULL);
+    }
+
+    /*
+     * The object is first linked into the System component to keep track
+     * of it.
+     */
+    if (myrefl_obj_system_comp) { 
+        myrefl_debug(NULL, "%s: Added '%s' to '%s'", 
+                     __FUNCTION__, obj->i.name, 
+                     myrefl_obj_system_comp->obj->i.name);
+        myrefl_obj_comp_link_obj(myrefl_obj_system_comp, obj);
+        if (obj->type == OBJ_TYPE_RULE || obj->type == OBJ_TYPE_COMP) {
+            myrefl_list_add(myrefl_obj_system_comp->top_depend, obj);
+            myrefl_list_add(myrefl_obj_system_comp->bottom_depend, obj);
+        }
+    }
+    
+    if (!myrefl_obj_system_comp && strcmp(obj_name, MYREFL_SYSTEM_COMP) == 0) {
+        myrefl_obj_system_comp = obj->t.comp;
+    }
+
+    myrefl_trace(obj->i.name, "Created obj '%s'", obj->i.name);
+
+    return (obj);
+}
+
+/*
+ * Link an object into the System component.
+ */
+void myrefl_obj_link (obj_t *obj)
+{
+    myrefl_obj_comp_link_obj(myrefl_obj_system_comp, obj);
+}
+
+static void unlink_obj_instance (obj_instance_t *delete_instance)
+{
+    obj_t *delete_obj, *obj;
+    myrefl_list_element_t *current, *element, *peer;
+    obj_test_t *test;
+    obj_action_t *action;
+    obj_rule_t *rule, *rule2;
+    obj_comp_t *comp;
+
+    if (delete_instance) {
+        delete_obj = delete_instance->obj;
+        if (delete_instance == &delete_obj->i) {
+            /*
+             * Deleting the primary instance, remove all links
+             * from this object to other ones, and also remove this
+             * object from dependency trees and its parent component.
+             */
+
+            /*
+             * Start off by removing this object from the owning 
+             * component.
+             */
+            myrefl_obj_unlink_from_comp(delete_obj);
+            myrefl_obj_graph_changed();
+            
+            /*
+             * Remove this object from any dependency tree that it
+             * is part of. This is a matter of looking through the
+             * parent_depend and child_depend and removing any trace
+             * of our object in those objects parent/child depends.
+             * Each link was paired with its other half when created.
+             */
+            if (delete_obj->parent_depend) {
+                current = delete_obj->parent_depend->head;
+                while(current) {
                     obj = current->data;
-                    myrefl_list_remove(obj->child_depend, delete_obj);
+                    peer = myrefl_list_element_peer(current);
+                    if (peer) {
+                        myrefl_list_remove_element(obj->child_depend, peer);
+                    } else {
+                        myrefl_list_remove(obj->child_depend, delete_obj);
+                    }
                     current = current->next;
                 }
             }
@@ -1150,17 +1844,22 @@ static void unlink_obj_instance (obj_instance_t *delete_instance)
                 current = delete_obj->child_depend->head;
                 while(current) {
                     obj = current->data;
-                    myrefl_list_remove(obj->parent_depend, delete_obj);
+                    peer = myrefl_list_element_peer(current);
+                    if (peer) {
+                        myrefl_list_remove_element(obj->parent_depend, peer);
+                    } else {
+                        myrefl_list_remove(obj->parent_depend, delete_obj);
+                    }
                     current = current->next;
                 }
             }
             
             /*
-             * Removing the domain is quite hard, so given that this type
-             * of deletion is not likely to occur often the domains are left
-             * in place (recreation of the object could reuse the old domain
-             * anyway) we will leave the domains in place.
+             * And from the topological orders, removing links never
+             * invalidates the order of those remaining.
              */
+            order_forget(delete_obj);
+            myrefl_rci_depend_changed();
 
             /*
              * Type specific deletion
@@ -1383,6 +2082,7 @@ void myrefl_obj_delete (obj_t *obj)
 
     if (obj) {
         obj->i.state = OBJ_STATE_DELETED;
+        myrefl_rci_depend_changed();
 
         /*
          * Remove all instances (apart from the first static one).
@@ -1426,115 +2126,42 @@ void myrefl_obj_delete (obj_t *obj)
  * Otherwise the same as myrefl_obj_delete()
  */
 boolean myrefl_obj_delete_by_name (const char *name, obj_type_t type)
-{
-    obj_t *obj;
-    boolean rc = FALSE;
-    
-    obj = myrefl_obj_get_by_name(name, type);
-    if (obj) {
-        myrefl_obj_delete(obj);
-        rc = TRUE;
-    }
-    return (rc);
-}
-
-boolean myrefl_obj_delete_by_name_unconverted (const char *name, 
-                                               obj_type_t type)
-{
-    obj_t *obj;
-    boolean rc = FALSE;
-    
-    obj = myrefl_obj_get_by_name_unconverted(name, type);
-    if (obj) {
-        myrefl_obj_delete(obj);
-        rc = TRUE;
-    }
-    return (rc);
-}
-
-/*
- * Recursive function to change the state of all the objects 
- * connected in a chain under this object to the desired state
- * 
- * state is the desired state unless default_state or cli_state 
- * in the object says otherwise.
- */
-void myrefl_obj_chain_update_state (obj_t *obj, obj_state_t state)
-{
-    obj_instance_t *instance;
-
-    if (!myrefl_obj_validate(obj, OBJ_TYPE_ANY)) {
-        return;
-    }
-
-    /*
-     * Ignore objects that are deleted.
-     */
-    if (obj->i.state == OBJ_STATE_DELETED) {
-        return;
-    }
-
-    switch(obj->type) {
-    case OBJ_TYPE_TEST:
-    {
-        obj_test_t *test = obj->t.test;
-        /*
-         * Locate the connected rule
-         */
-        if (test->rule) {
-            myrefl_obj_chain_update_state(test->rule->obj, state);
-        }
-        break;
-    }
-    case OBJ_TYPE_RULE:
-    {
-        obj_rule_t *rule = obj->t.rule;
-        obj_t *action_obj = NULL;
-        myrefl_list_element_t *element;
-
-        /*
-         * Recurse along all the peer rules
-         */
-        if (rule->next_in_input) {
-            myrefl_obj_chain_update_state(rule->next_in_input->obj, state);
-        }
-        
-        /*
-         * Now do every action that this rule triggers
-         */
-        for (element = rule->action_list->head;
-             element != NULL;
-             element = element->next) {
-            action_obj = (obj_t*)element->data;
-            myrefl_obj_chain_update_state(action_obj, state);
-        }
-
-        /*
-         * And if there was an output rule - go there.
-         */
-        if (rule->output) {
-            myrefl_obj_chain_update_state(rule->output->obj, state);
-        }
-        break;
-    }
-    case OBJ_TYPE_ACTION:
-        /*
-         * Nothing explicit to do for actions
-         */
-        break;
-    case OBJ_TYPE_COMP:  
-    default:
-        /*
-         * Not a valid object type in a test chain.
-         */
-        myrefl_error("Invalid object type in a test chain");
-        return;
+{
+    obj_t *obj;
+    boolean rc = FALSE;
+    
+    obj = myrefl_obj_get_by_name(name, type);
+    if (obj) {
+        myrefl_obj_delete(obj);
+        rc = TRUE;
     }
+    return (rc);
+}
+
+boolean myrefl_obj_delete_by_name_unconverted (const char *name, 
+                                               obj_type_t type)
+{
+    obj_t *obj;
+    boolean rc = FALSE;
     
-    /*
-     * And finally change the state of this object and all of its 
-     * instances
-     */
+    obj = myrefl_obj_get_by_name_unconverted(name, type);
+    if (obj) {
+        myrefl_obj_delete(obj);
+        rc = TRUE;
+    }
+    return (rc);
+}
+
+/*
+ * chain_update_instances()
+ *
+ * Change the state of this object and all of its instances, see
+ * myrefl_obj_chain_update_state().
+ */
+static void chain_update_instances (obj_t *obj, obj_state_t state)
+{
+    obj_instance_t *instance;
+
     for (instance = &obj->i; instance != NULL; instance = instance->next) {
         if (instance->cli_state != OBJ_STATE_INITIALIZED) {
             /*
@@ -1575,6 +2202,117 @@ void myrefl_obj_chain_update_state (obj_t *obj, obj_state_t state)
     }
 }
 
+/*
+ * chain_push()
+ *
+ * Add an object to the chain still to be updated, unless this update 
+ * has already been there. FALSE on memory allocation failure.
+ */
+static boolean chain_push (obj_t *obj, uint stamp)
+{
+    obj_t **frame;
+
+    if (!obj || obj->walk_visit == stamp) {
+        return (TRUE);
+    }
+
+    frame = myrefl_obj_walk_push(&obj_chain_walk);
+    if (!frame) {
+        return (FALSE);
+    }
+    obj->walk_visit = stamp;
+    *frame = obj;
+    return (TRUE);
+}
+
+/*
+ * Change the state of all the objects connected in a chain under this
+ * object to the desired state. Each object is visited once however 
+ * many ways there are to it through the rule inputs.
+ * 
+ * state is the desired state unless default_state or cli_state 
+ * in the object says otherwise.
+ */
+void myrefl_obj_chain_update_state (obj_t *obj, obj_state_t state)
+{
+    obj_t **frame;
+    myrefl_list_element_t *element;
+    obj_rule_t *rule;
+    boolean pushed;
+    uint stamp;
+
+    stamp = myrefl_obj_walk_stamp();
+    pushed = chain_push(obj, stamp);
+
+    while (pushed && (frame = myrefl_obj_walk_peek(&obj_chain_walk, 0))) {
+        obj = *frame;
+        myrefl_obj_walk_pop(&obj_chain_walk);
+
+        if (!myrefl_obj_validate(obj, OBJ_TYPE_ANY)) {
+            continue;
+        }
+
+        /*
+         * Ignore objects that are deleted.
+         */
+        if (obj->i.state == OBJ_STATE_DELETED) {
+            continue;
+        }
+
+        switch(obj->type) {
+        case OBJ_TYPE_TEST:
+            /*
+             * Locate the connected rule
+             */
+            if (obj->t.test->rule) {
+                pushed = chain_push(obj->t.test->rule->obj, stamp);
+            }
+            break;
+        case OBJ_TYPE_RULE:
+            rule = obj->t.rule;
+
+            /*
+             * Along all the peer rules, every action that this rule 
+             * triggers, and if there was an output rule - go there.
+             */
+            if (rule->next_in_input) {
+                pushed = chain_push(rule->next_in_input->obj, stamp);
+            }
+        
+            for (element = rule->action_list->head;
+                 element != NULL && pushed;
+                 element = element->next) {
+                pushed = chain_push((obj_t*)element->data, stamp);
+            }
+
+            if (rule->output && pushed) {
+                pushed = chain_push(rule->output->obj, stamp);
+            }
+            break;
+        case OBJ_TYPE_ACTION:
+            /*
+             * Nothing explicit to do for actions
+             */
+            break;
+        case OBJ_TYPE_COMP:  
+        default:
+            /*
+             * Not a valid object type in a test chain.
+             */
+            myrefl_error("Invalid object type in a test chain");
+            continue;
+        }
+    
+        chain_update_instances(obj, state);
+    }
+
+    if (!pushed) {
+        myrefl_error("No memory to update the state of the whole chain");
+        myrefl_obj_walk_end(&obj_chain_walk, 0);
+    }
+    myrefl_rci_depend_changed();
+}
+
 /*
  * myrefl_obj_instance_validate()
  *
@@ -1855,6 +2593,7 @@ boolean myrefl_obj_validate (obj_t *obj, obj_type_t type)
                      * Rule has no link back to this action, fix it 
                      */
                     myrefl_list_add(rule->action_list, obj);
+                    myrefl_obj_graph_changed();
                     myrefl_error("Validate:%s: Action refers to rule that has no link back to this action, corrected", 
                                  obj->i.name);
                 }
@@ -2010,9 +2749,430 @@ obj_instance_t *myrefl_obj_instance_create (obj_t *obj,
     }
     obj->i.next = instance;
     instance->prev = &obj->i;
+    myrefl_rci_depend_changed();
     return(instance);
 }
 
+/*
+ * myrefl_obj_rule_data_free()
+ *
+ * Free the evaluation data that a rule instance has been keeping.
+ */
+void myrefl_obj_rule_data_free (obj_rule_data_t *rule_data)
+{
+    if (rule_data) {
+        free(rule_data->history);
+        free(rule_data->buckets);
+        free(rule_data->baseline);
+        free(rule_data);
+    }
+}
+
+/*
+ * Worst case number of bits to encode a result after the first in a
+ * block, a 64 bit delta of delta, a changed result and a value with a 
+ * new XOR window.
+ */
+#define SERIES_MAX_BITS (4 + 64 + 4 + 2 + 6 + 6 + 64)
+
+/*
+ * series_put_bits()
+ *
+ * Append the low "n" bits of "bits" to the block, most significant 
+ * first. The caller has already made sure that there is room.
+ */
+static void series_put_bits (obj_series_block_t *block,
+                             uint64_t bits,
+                             uint n)
+{
+    while (n--) {
+        if ((bits >> n) & 1) {
+            block->data[block->bits / 8] |= (0x80 >> (block->bits % 8));
+        }
+        block->bits++;
+    }
+}
+
+/*
+ * series_get_bits()
+ */
+static uint64_t series_get_bits (const obj_series_block_t *block,
+                                 uint *pos,
+                                 uint n)
+{
+    uint64_t bits = 0;
+
+    while (n--) {
+        bits <<= 1;
+        if (*pos < block->bits && 
+            (block->data[*pos / 8] & (0x80 >> (*pos % 8)))) {
+            bits |= 1;
+        }
+        (*pos)++;
+    }
+    return (bits);
+}
+
+/*
+ * series_sign_extend()
+ */
+static long long series_sign_extend (uint64_t bits, uint n)
+{
+    if (n < 64 && (bits & ((uint64_t)1 << (n - 1)))) {
+        bits |= ~(uint64_t)0 << n;
+    }
+    return ((long long)bits);
+}
+
+static uint series_leading_zeros (uint64_t x)
+{
+    uint n = 0;
+
+    while (n < 63 && !(x & ((uint64_t)1 << (63 - n)))) {
+        n++;
+    }
+    return (n);
+}
+
+static uint series_trailing_zeros (uint64_t x)
+{
+    uint n = 0;
+
+    while (n < 63 && !(x & ((uint64_t)1 << n))) {
+        n++;
+    }
+    return (n);
+}
+
+/*
+ * series_agg_add()
+ *
+ * Add a result to the aggregate for the period starting at "start", 
+ * the slot is reused once the ring has gone all the way round.
+ */
+static void series_agg_add (obj_series_agg_t *agg,
+                            unsigned long start,
+                            myrefl_result_t result,
+                            long value)
+{
+    if (agg->start != start || agg->count == 0) {
+        agg->start = start;
+        agg->count = 0;
+        agg->failures = 0;
+        agg->min = value;
+        agg->max = value;
+        agg->sum = 0;
+    }
+    agg->count++;
+    if (result == MYREFL_RESULT_FAIL) {
+        agg->failures++;
+    }
+    if (value < agg->min) {
+        agg->min = value;
+    }
+    if (value > agg->max) {
+        agg->max = value;
+    }
+    agg->sum += value;
+}
+
+/*
+ * series_block_start()
+ *
+ * Start a new block (overwriting the oldest) with this result stored
+ * in full in the header.
+ */
+static void series_block_start (obj_series_t *series,
+                                unsigned long long now,
+                                myrefl_result_t result,
+                                long value)
+{
+    obj_series_block_t *block;
+
+    if (series->blocks[series->block_head].count) {
+        series->block_head = (series->block_head + 1) % OBJ_SERIES_BLOCKS;
+    }
+    block = &series->blocks[series->block_head];
+    memset(block, 0, sizeof(obj_series_block_t));
+    block->first_time = now;
+    block->first_value = value;
+    block->first_result = result;
+    block->count = 1;
+
+    series->last_time = now;
+    series->last_delta = 0;
+    series->last_value = value;
+    series->last_result = result;
+    series->last_leading = 64;
+    series->last_trailing = 64;
+}
+
+/*
+ * myrefl_obj_series_add()
+ *
+ * Record a result in the instance's time series, creating the series 
+ * the first time if the series has been enabled for the instance or its
+ * object.
+ */
+void myrefl_obj_series_add (obj_instance_t *instance,
+                            myrefl_result_t result,
+                            long value)
+{
+    obj_series_t *series = instance->series;
+    obj_series_block_t *block;
+    xos_time_t time_now;
+    unsigned long long now;
+    long long delta, dod;
+    uint64_t xor;
+    uint leading, trailing, length;
+
+    if (!series) {
+        if (!((instance->flags.any | instance->obj->i.flags.any) & 
+              OBJ_FLAG_SERIES)) {
+            return;
+        }
+        series = instance->series = calloc(1, sizeof(obj_series_t));
+        if (!series) {
+            return;
+        }
+    }
+
+    myrefl_xos_time_set_now(&time_now);
+    now = ((unsigned long long)time_now.sec * 1000) + 
+        (time_now.nsec / 1000000);
+
+    series_agg_add(&series->minutes[(time_now.sec / 60) % OBJ_SERIES_MINUTES],
+                   time_now.sec - (time_now.sec % 60), result, value);
+    series_agg_add(&series->hours[(time_now.sec / 3600) % OBJ_SERIES_HOURS],
+                   time_now.sec - (time_now.sec % 3600), result, value);
+
+    block = &series->blocks[series->block_head];
+
+    if (block->count == 0 || now < series->last_time ||
+        block->bits + SERIES_MAX_BITS > OBJ_SERIES_BLOCK_BYTES * 8) {
+        /*
+         * First result, block full, or the clock went backwards.
+         */
+        series_block_start(series, now, result, value);
+        return;
+    }
+
+    /*
+     * Time as the change in the delta from the previous result.
+     */
+    delta = now - series->last_time;
+    dod = delta - series->last_delta;
+
+    if (dod == 0) {
+        series_put_bits(block, 0x0, 1);
+    } else if (dod >= -64 && dod <= 63) {
+        series_put_bits(block, 0x2, 2);
+        series_put_bits(block, dod, 7);
+    } else if (dod >= -256 && dod <= 255) {
+        series_put_bits(block, 0x6, 3);
+        series_put_bits(block, dod, 9);
+    } else if (dod >= -2048 && dod <= 2047) {
+        series_put_bits(block, 0xE, 4);
+        series_put_bits(block, dod, 12);
+    } else {
+        series_put_bits(block, 0xF, 4);
+        series_put_bits(block, dod, 64);
+    }
+
+    /*
+     * Result, usually the same as the last one.
+     */
+    if (result == series->last_result) {
+        series_put_bits(block, 0x0, 1);
+    } else {
+        series_put_bits(block, 0x1, 1);
+        series_put_bits(block, result, 3);
+    }
+
+    /*
+     * Value XOR'd with the previous one, just the meaningful bits are
+     * stored and if they fit within the previous window then the 
+     * window isn't repeated.
+     */
+    xor = (uint64_t)value ^ (uint64_t)series->last_value;
+
+    if (xor == 0) {
+        series_put_bits(block, 0x0, 1);
+    } else {
+        leading = series_leading_zeros(xor);
+        trailing = series_trailing_zeros(xor);
+
+        if (series->last_leading + series->last_trailing < 64 &&
+            leading >= series->last_leading &&
+            trailing >= series->last_trailing) {
+            length = 64 - series->last_leading - series->last_trailing;
+            series_put_bits(block, 0x2, 2);
+            series_put_bits(block, xor >> series->last_trailing, length);
+        } else {
+            length = 64 - leading - trailing;
+            series_put_bits(block, 0x3, 2);
+            series_put_bits(block, leading, 6);
+            series_put_bits(block, length - 1, 6);
+            series_put_bits(block, xor >> trailing, length);
+            series->last_leading = leading;
+            series->last_trailing = trailing;
+        }
+    }
+
+    block->count++;
+    series->last_time = now;
+    series->last_delta = delta;
+    series->last_value = value;
+    series->last_result = result;
+}
+
+/*
+ * series_block_read()
+ *
+ * Decode the results from a block, returning how many there were and
+ * filling in as many as fit in points.
+ */
+static uint series_block_read (const obj_series_block_t *block,
+                               obj_series_point_t *points,
+                               uint max)
+{
+    unsigned long long time;
+    long long delta = 0, dod;
+    uint64_t value, xor;
+    myrefl_result_t result;
+    uint pos = 0, i, leading = 64, trailing = 64, length;
+
+    if (block->count == 0) {
+        return (0);
+    }
+
+    time = block->first_time;
+    value = (uint64_t)block->first_value;
+    result = block->first_result;
+
+    for (i = 0; i < block->count; i++) {
+        if (i > 0) {
+            if (series_get_bits(block, &pos, 1) == 0) {
+                dod = 0;
+            } else if (series_get_bits(block, &pos, 1) == 0) {
+                dod = series_sign_extend(series_get_bits(block, &pos, 7), 7);
+            } else if (series_get_bits(block, &pos, 1) == 0) {
+                dod = series_sign_extend(series_get_bits(block, &pos, 9), 9);
+            } else if (series_get_bits(block, &pos, 1) == 0) {
+                dod = series_sign_extend(series_get_bits(block, &pos, 12), 12);
+            } else {
+                dod = (long long)series_get_bits(block, &pos, 64);
+            }
+            delta += dod;
+            time += delta;
+
+            if (series_get_bits(block, &pos, 1)) {
+                result = series_get_bits(block, &pos, 3);
+            }
+
+            if (series_get_bits(block, &pos, 1)) {
+                if (series_get_bits(block, &pos, 1)) {
+                    leading = series_get_bits(block, &pos, 6);
+                    length = series_get_bits(block, &pos, 6) + 1;
+                    trailing = 64 - leading - length;
+                } else {
+                    length = 64 - leading - trailing;
+                }
+                xor = series_get_bits(block, &pos, length) << trailing;
+                value ^= xor;
+            }
+        }
+
+        if (points && i < max) {
+            points[i].time = time;
+            points[i].result = result;
+            points[i].count = 1;
+            points[i].failures = (result == MYREFL_RESULT_FAIL) ? 1 : 0;
+            points[i].min = (long)value;
+            points[i].max = (long)value;
+            points[i].sum = (long)value;
+        }
+    }
+    return (block->count);
+}
+
+/*
+ * series_agg_read()
+ *
+ * Copy out the aggregates still within the ring's period, oldest first.
+ */
+static uint series_agg_read (const obj_series_agg_t *aggs,
+                             uint slots,
+                             ulong period,
+                             obj_series_point_t *points,
+                             uint max)
+{
+    xos_time_t time_now;
+    unsigned long oldest;
+    uint i, slot, count = 0;
+
+    myrefl_xos_time_set_now(&time_now);
+    oldest = time_now.sec - (time_now.sec % period) - ((slots - 1) * period);
+
+    for (i = 1; i <= slots; i++) {
+        slot = ((time_now.sec / period) + i) % slots;
+        if (aggs[slot].count == 0 || aggs[slot].start < oldest) {
+            continue;
+        }
+        if (points && count < max) {
+            points[count].time = (unsigned long long)aggs[slot].start * 1000;
+            points[count].result = MYREFL_RESULT_INVALID;
+            points[count].count = aggs[slot].count;
+            points[count].failures = aggs[slot].failures;
+            points[count].min = aggs[slot].min;
+            points[count].max = aggs[slot].max;
+            points[count].sum = aggs[slot].sum;
+        }
+        count++;
+    }
+    return (count);
+}
+
+/*
+ * myrefl_obj_series_read()
+ *
+ * Read the points from one tier of the series, oldest first, into 
+ * "points" (which may be NULL to just count them). Returns the number of
+ * points in the tier, which may be more than max.
+ */
+uint myrefl_obj_series_read (obj_series_t *series,
+                             obj_series_tier_t tier,
+                             obj_series_point_t *points,
+                             uint max)
+{
+    uint i, block, count = 0;
+
+    if (!series) {
+        return (0);
+    }
+
+    switch (tier) {
+    case OBJ_SERIES_RECENT:
+        for (i = 1; i <= OBJ_SERIES_BLOCKS; i++) {
+            block = (series->block_head + i) % OBJ_SERIES_BLOCKS;
+            count += series_block_read(&series->blocks[block],
+                                       (points && count < max) ? 
+                                       points + count : NULL,
+                                       (count < max) ? max - count : 0);
+        }
+        break;
+    case OBJ_SERIES_MINUTE:
+        count = series_agg_read(series->minutes, OBJ_SERIES_MINUTES, 60,
+                                points, max);
+        break;
+    case OBJ_SERIES_HOUR:
+        count = series_agg_read(series->hours, OBJ_SERIES_HOURS, 3600,
+                                points, max);
+        break;
+    }
+    return (count);
+}
+
 /*
  * myrefl_obj_instance_delete()
  *
@@ -2034,6 +3194,7 @@ void myrefl_obj_instance_delete (obj_instance_t *instance)
              * Always mark the state as deleted first!
              */
             instance->state = OBJ_STATE_DELETED;
+            myrefl_rci_depend_changed();
 
             if (instance->obj->type == OBJ_TYPE_RULE) {
                 myrefl_rci_rule_deleted(instance);
@@ -2054,6 +3215,100 @@ void myrefl_obj_instance_delete (obj_instance_t *instance)
     }
 }
 
+/*
+ * myrefl_obj_handle_get()
+ *
+ * Get the handle for this instance, allocating a slot in the handle 
+ * table if it doesn't have one yet. Generation 0 on failure.
+ */
+myrefl_handle_t myrefl_obj_handle_get (obj_instance_t *instance)
+{
+    myrefl_handle_t handle = { 0, 0 };
+    obj_handle_slot_t *slots;
+    uint index, size, i;
+
+    if (!instance || instance->state == OBJ_STATE_DELETED) {
+        return (handle);
+    }
+
+    if (!instance->handle) {
+        if (!obj_handles_free) {
+            size = obj_handles_size ? obj_handles_size * 2 :
+                OBJ_HANDLE_TABLE_INITIAL;
+            slots = realloc(obj_handles, size * sizeof(obj_handle_slot_t));
+            if (!slots) {
+                myrefl_error("Handle table allocation failure");
+                return (handle);
+            }
+            for (i = obj_handles_size; i < size; i++) {
+                slots[i].instance = NULL;
+                slots[i].generation = 1;
+                slots[i].next_free = (i + 1 < size) ? i + 1 : 0;
+            }
+            /*
+             * Slot 0 is reserved.
+             */
+            obj_handles_free = obj_handles_size ? obj_handles_size : 1;
+            obj_handles = slots;
+            obj_handles_size = size;
+        }
+        index = obj_handles_free;
+        obj_handles_free = obj_handles[index].next_free;
+        obj_handles[index].instance = instance;
+        instance->handle = index;
+    }
+
+    handle.index = instance->handle;
+    handle.generation = obj_handles[instance->handle].generation;
+    return (handle);
+}
+
+/*
+ * myrefl_obj_handle_instance()
+ *
+ * Return the instance for this handle, or NULL if the handle is not valid
+ * or the instance has since been deleted.
+ */
+obj_instance_t *myrefl_obj_handle_instance (myrefl_handle_t handle)
+{
+    obj_handle_slot_t *slot;
+
+    if (handle.index == 0 || handle.index >= obj_handles_size) {
+        return (NULL);
+    }
+
+    slot = &obj_handles[handle.index];
+    if (slot->generation != handle.generation || !slot->instance ||
+        slot->instance->state == OBJ_STATE_DELETED) {
+        return (NULL);
+    }
+    return (slot->instance);
+}
+
+/*
+ * myrefl_obj_handle_release()
+ *
+ * The instance is being freed, invalidate any handles for it.
+ */
+void myrefl_obj_handle_release (obj_instance_t *instance)
+{
+    obj_handle_slot_t *slot;
+
+    if (!instance->handle) {
+        return;
+    }
+
+    slot = &obj_handles[instance->handle];
+    slot->instance = NULL;
+    slot->generation++;
+    if (slot->generation == 0) {
+        slot->generation = 1;
+    }
+    slot->next_free = obj_handles_free;
+    obj_handles_free = instance->handle;
+    instance->handle = 0;
+}
+
 /*
  * myrefl_obj_instance()
  *
@@ -2378,6 +3633,14 @@ static boolean process_freeme_queue (void)
                 //myrefl_trace(myrefl_obj_instance_name(instance), "Freeing memory in garbage collector '%s'", myrefl_obj_instance_name(instance));
 
                 free(instance->name);
+                myrefl_list_free(instance->seq_backlog);
+                myrefl_obj_rule_data_free(instance->rule_data);
+                free(instance->series);
+                free(instance->flap);
+                myrefl_seq_notify_forget(instance);
+                myrefl_seq_action_forget(instance);
+                myrefl_obj_handle_release(instance);
+                myrefl_sched_remove_test(instance);
                 if (myrefl_obj_is_member_instance(instance)) {
                 	free(instance);
                 } else {
@@ -2407,6 +3670,7 @@ static boolean process_freeme_queue (void)
                         break;
                     case OBJ_TYPE_COMP:
                         comp = obj->t.comp;
+                        myrefl_seq_comp_health_forget(comp);
                         myrefl_list_free(comp->top_depend);
                         myrefl_list_free(comp->bottom_depend);
                         myrefl_list_free(comp->interested_test_objs);
@@ -2421,6 +3685,7 @@ static boolean process_freeme_queue (void)
                     case OBJ_TYPE_ANY:
                         break;
                     }
+                    myrefl_rci_memo_free(obj);
                     free(obj);
                 }
             }
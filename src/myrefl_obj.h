@@ -50,6 +50,7 @@ typedef enum obj_flags_t_ {
     OBJ_FLAG_SILENT        = 0x00040000,  // No report on fail
     OBJ_FLAG_NOTIFY        = 0x00060000,  // Notify to interested clients.
     OBJ_FLAG_TEST_CREATED  = 0x00080000,  // Objs created via internal test cmd
+    OBJ_FLAG_SERIES        = 0x00100000,  // Keep a time series of results
     OBJ_FLAG_RESERVED      = 0xFFFF0000,
 } obj_flag_t;
 
@@ -62,6 +63,75 @@ typedef struct obj_history_s {
 
 #define OBJ_HISTORY_SIZE 5
 
+/*
+ * Optional time series of an instance's results, bounded in size. The
+ * recent results are compressed into a ring of blocks, with the times 
+ * stored as the difference between successive deltas and the values as
+ * the XOR with the previous value, both of which are usually very short
+ * for a periodic test. Older results are only kept as per minute and 
+ * per hour aggregates.
+ */
+#define OBJ_SERIES_BLOCKS       4
+#define OBJ_SERIES_BLOCK_BYTES  256
+#define OBJ_SERIES_MINUTES      60
+#define OBJ_SERIES_HOURS        48
+
+typedef enum obj_series_tier_e {
+    OBJ_SERIES_RECENT,
+    OBJ_SERIES_MINUTE,
+    OBJ_SERIES_HOUR,
+} obj_series_tier_t;
+
+typedef struct obj_series_block_s {
+    unsigned long long first_time;   // Time of the first result, ms
+    long first_value;
+    myrefl_result_t first_result;
+    unsigned int count;              // Results in this block
+    unsigned int bits;               // Bits of data used
+    unsigned char data[OBJ_SERIES_BLOCK_BYTES];
+} obj_series_block_t;
+
+typedef struct obj_series_agg_s {
+    unsigned long start;             // Start of the period, seconds
+    unsigned int count;
+    unsigned int failures;
+    long min;
+    long max;
+    long long sum;
+} obj_series_agg_t;
+
+typedef struct obj_series_s {
+    obj_series_block_t blocks[OBJ_SERIES_BLOCKS];
+    unsigned int block_head;         // Block being written to
+
+    /*
+     * Encoder state for the block being written to.
+     */
+    unsigned long long last_time;
+    long long last_delta;
+    long last_value;
+    myrefl_result_t last_result;
+    unsigned int last_leading;
+    unsigned int last_trailing;
+
+    obj_series_agg_t minutes[OBJ_SERIES_MINUTES];
+    obj_series_agg_t hours[OBJ_SERIES_HOURS];
+} obj_series_t;
+
+/*
+ * A result or aggregate read back out of a series, for a result the
+ * count is 1 and min, max and sum are its value.
+ */
+typedef struct obj_series_point_s {
+    unsigned long long time;         // ms
+    myrefl_result_t result;
+    unsigned int count;
+    unsigned int failures;
+    long min;
+    long max;
+    long long sum;
+} obj_series_point_t;
+
 typedef struct obj_stats_s {
     unsigned int runs;
     unsigned int passes;
@@ -98,6 +168,16 @@ typedef enum obj_rel_e {
 /*
  * State that the test/action/rule/component may be in.
  */
+/*
+ * Relations between objects that are kept in an incremental topological 
+ * order so that new links can be checked for loops cheaply.
+ */
+typedef enum obj_order_e {
+    OBJ_ORDER_DEPEND,        // parent depends on child
+    OBJ_ORDER_INPUT,         // rule takes input from test or rule
+    OBJ_ORDER_MAX,
+} obj_order_t;
+
 typedef enum obj_state_e {
     OBJ_STATE_ALLOCATED = 1,  /* object allocated but not yet initialized */
     OBJ_STATE_INITIALIZED,    /* object initialized but not yet created */
@@ -118,12 +198,129 @@ typedef enum rule_root_cause_e {
  * Generic header object for Tests, Actions, Rules and Components
  */
 
+/*
+ * Number of buckets that the window of an N in time M rule is split 
+ * into, the window is accurate to within one bucket.
+ */
+#define RULE_TIME_BUCKETS 64
+
+/*
+ * Number of markers in the streaming percentile sketch.
+ */
+#define RULE_SKETCH_MARKERS 5
+
+/*
+ * Baselines are kept per hour of the day for time of day rules, and
+ * once they have this many values each new value is weighted as if
+ * there were only this many so that the baseline can still follow a
+ * slow drift.
+ */
+#define RULE_BASELINE_SLOTS 24
+#define RULE_BASELINE_MAX_COUNT 10000
+
+/*
+ * Streaming mean and (population) variance of the values seen.
+ */
+typedef struct obj_rule_baseline_t_ {
+    long count;
+    double mean;
+    double variance;
+} obj_rule_baseline_t;
+
 typedef struct obj_rule_data_t_ {
-    unsigned char *history;
-    long history_size;
-    long position;
+    /*
+     * Rule type and operands that this data was built for.
+     */
+    myrefl_rule_operator_t operator;
+    long op_n;
+    long op_m;
+
+    /*
+     * N in M, one bit per result in a circular bitmap of M bits.
+     */
+    uint64_t *history;
+    long history_size;               // In 64 bit words
+    long position;                   // Next bit to be written
+    long history_count;              // Fail bits currently set
+
+    /*
+     * N in time M, a ring of failure counts with each bucket covering
+     * bucket_ms of the window.
+     */
+    unsigned int *buckets;
+    long bucket_count;
+    long bucket_ms;
+    unsigned long long bucket_slot;  // Time slot of the newest bucket
+    long bucket_total;               // Failures within the window
+
+    /*
+     * Fail for time N, when the input started failing (0 if passing).
+     */
+    unsigned long long fail_since;
+
+    /*
+     * Moving average, weighted op_m percent to the newest value.
+     */
+    double ewma;
+    long ewma_count;
+
+    /*
+     * Percentile, a P-squared sketch of five markers whose heights
+     * approximate the minimum, p/2, p, (1+p)/2 quantiles and maximum
+     * of the values in the current window. quantile holds the estimate
+     * from the last complete window while the next one fills.
+     */
+    double sketch[RULE_SKETCH_MARKERS];       // Marker heights
+    double sketch_want[RULE_SKETCH_MARKERS];  // Desired marker positions
+    long sketch_pos[RULE_SKETCH_MARKERS];     // Actual marker positions
+    long sketch_count;                        // Values in this window
+    double quantile;
+    boolean quantile_valid;
+
+    /*
+     * Rate of change, the previous value and when it arrived.
+     */
+    long rate_value;
+    unsigned long long rate_time;
+    double rate;
+
+    /*
+     * Baseline, one per hour of the day or a single one.
+     */
+    obj_rule_baseline_t *baseline;
+    int baseline_slots;
 } obj_rule_data_t;
 
+/*
+ * Notifications accumulated for a test instance over its aggregation
+ * window, "due" being when the window closes in ms.
+ */
+typedef struct obj_notify_agg_s {
+    unsigned int count;
+    unsigned int passes;
+    unsigned int failures;
+    unsigned int values;
+    long min;
+    long max;
+    long long sum;
+    unsigned long long due;
+} obj_notify_agg_t;
+
+/*
+ * Flap damping for a rule instance. Each change between pass and fail 
+ * adds to the penalty, which halves every half life, and while it is 
+ * suppressed the instance reports "held" rather than its latest "raw"
+ * result. "decayed" is when the penalty was last brought up to date
+ * in ms.
+ */
+typedef struct obj_rule_flap_s {
+    uint penalty;
+    unsigned long long decayed;
+    myrefl_result_t raw;
+    myrefl_result_t held;
+    boolean suppressed;
+} obj_rule_flap_t;
+
 /*
  * Object instance, where there may be one or more instances per object.
  */
@@ -151,17 +348,44 @@ struct obj_instance_s {
     unsigned int     last_result_count; // How many times in a row
     unsigned int     fail_count;      // How many failures (rule based)
     obj_rule_data_t *rule_data;       // Data that the rule needs to evaluate
+    obj_series_t    *series;          // Time series of results, if enabled
+    obj_notify_agg_t *notify_agg;     // Aggregated notifications, if any
+    ulong            notify_stamp;    // Last queued notification applied
+    obj_rule_flap_t *flap;            // Flap damping, if enabled
 
     sched_test_t    sched_test;
 
     rule_root_cause_t root_cause;
     boolean action_run;              // Action has been run for root cause.
+    boolean action_pending;          // Action requested but not yet started
+    boolean action_admitted;         // Action holds a slot under the limits
     unsigned int in_use;             // Instance is being referenced
 
+    boolean seq_active;              // Sequencer job queued or running
+    myrefl_list_t *seq_backlog;      // Sequencer jobs waiting their turn
+    uint handle;                     // Index in the handle table, 0 if none
+
     obj_instance_t *next;
     obj_instance_t *prev;
 };
 
+/*
+ * Cached summary of the rule instances below an object in the RCI 
+ * dependencies, for one instance name (NULL for all instances), see 
+ * myrefl_rci.c. Counts are of the immediate dependencies that are, or 
+ * have below them, failing rules, root cause candidates and enabled 
+ * rules.
+ */
+typedef struct obj_rci_memo_s {
+    char *instance_name;
+    boolean comp;              // component's own dependencies
+    boolean busy;              // being evaluated
+    uint generation;           // valid when equal to the RCI generation
+    uint failing;
+    uint rcc;
+    uint enabled;
+} obj_rci_memo_t;
+
 struct obj_s {
     unsigned int ident;
     obj_type_t type;
@@ -182,10 +406,38 @@ struct obj_s {
     obj_rule_t *ref_rule;
 
     /*
-     * which domain is this object in for cyclic loop detection
-     * of dependencies. 0 is no domain.
+     * Position of this object in the topological order for each 
+     * obj_order_t relation, one based, 0 if it has no links yet.
+     */
+    uint order[OBJ_ORDER_MAX];
+
+    /*
+     * Stamped by walks that mark where they have been, see 
+     * myrefl_obj_walk_stamp().
+     */
+    uint walk_visit;
+
+    /*
+     * Where this object is in the compiled rule graph, only valid when
+     * graph_generation matches that of the compiled graph.
+     */
+    uint graph_generation;
+    uint graph_index;
+
+    /*
+     * Stamped with the RCI traversal epoch when visited by that
+     * traversal, see rci_map_function().
      */
-    uint domain;
+    uint rci_visit;
+
+    /*
+     * Cached RCI verdicts on the rules below this object, valid ones
+     * are only present when rci_memo_generation is current.
+     */
+    obj_rci_memo_t *rci_memo;
+    uint rci_memo_count;
+    uint rci_memo_size;
+    uint rci_memo_generation;
 
     /*
      * Zero or one of these pointers will point to the
@@ -222,6 +474,8 @@ struct obj_test_s {
     unsigned long period;          /* configured period */
     unsigned long default_period;  /* default period */
     long          autopass;        /* Auto pass delay */
+    unsigned int  aggregate_ms;    /* Notification aggregation window */
+    myrefl_aggregate_t aggregate;  /* Value fed to the rules per window */
 };
 
 /*************************************************************************
@@ -235,6 +489,11 @@ struct obj_action_s {
     obj_t *obj;
     myrefl_action_t *function;
     myrefl_list_t *rule_list;   // List of rule_objs pointing at this action 
+    uint max_running;           // Instances that may run at once, 0 no limit
+    uint running;               // Instances running now
+    uint coalesced;             // Requests merged into one already pending
+    uint deferred;              // Requests that waited for a limit
+    uint suppressed;            // Requests dropped with the queue full
 };
 
 
@@ -274,6 +533,12 @@ struct obj_rule_s {
     obj_rule_t *next_in_input; /* next (parallel) rule from our input */
     
     myrefl_severity_t severity;
+    int health_counted; /* severity currently taken off our component */
+
+    long hysteresis;          /* distance between fail and clear thresholds */
+    uint flap_half_life;      /* ms, 0 for no flap damping */
+    uint flap_suppress;       /* penalty at which results are held */
+    uint flap_reuse;          /* penalty below which they are released */
 };
 
 /*
@@ -325,6 +590,9 @@ struct obj_comp_s {
 
     int health;
     int confidence;  
+    int health_counted; /* deficit currently taken off our parent */
+    int health_published; /* health last notified to tests and clients */
+    boolean health_dirty; /* waiting for the health to be published */
 
     /*
      * Threshold notifications used by SNMP.
@@ -335,6 +603,49 @@ struct obj_comp_s {
 
 extern obj_comp_t *myrefl_obj_system_comp;
 
+/*
+ * Explicit work stack for walking the object graph without recursing,
+ * so that the depth of the graph is limited only by memory, see 
+ * myrefl_obj_walk_push(). The frames are of the type given to 
+ * OBJ_WALK_INIT(), a walk started from within another on the same 
+ * stack works above the top of the stack at the time, its base.
+ */
+typedef struct obj_walk_s {
+    char *frames;
+    uint frame_size;
+    uint top;
+    uint size;
+} obj_walk_t;
+
+#define OBJ_WALK_INIT(frame_type) { NULL, sizeof(frame_type), 0, 0 }
+#define OBJ_WALK_INITIAL 64
+
+/*
+ * Compiled rule graph
+ *
+ * The tests and rules, along with the links between them, lowered into
+ * contiguous arrays in topological order (inputs before the rules that
+ * they feed). Operands are indexes into the nodes array. The graph is
+ * recompiled on first use after a change to the linkages.
+ */
+typedef struct obj_graph_node_s {
+    obj_t *obj;       /* test, rule or forward referenced input */
+    uint inputs;      /* first input operand for a rule */
+    uint n_inputs;
+    uint outputs;     /* first operand for the rules that we feed */
+    uint n_outputs;
+    uint actions;     /* first recovery action for a rule */
+    uint n_actions;
+} obj_graph_node_t;
+
+typedef struct obj_graph_s {
+    uint generation;
+    uint n_nodes;
+    obj_graph_node_t *nodes;
+    uint *operands;
+    obj_t **actions;
+} obj_graph_t;
+
 /*******************************************************************
  * Useful object related functions
  *******************************************************************/
@@ -369,6 +680,17 @@ void myrefl_obj_delete(obj_t *obj);
 void myrefl_obj_comp_link_obj(obj_comp_t *comp, obj_t *obj);
 void myrefl_obj_unlink_from_comp(obj_t *obj);
 
+void myrefl_obj_graph_changed(void);
+boolean myrefl_obj_order_link(obj_order_t relation, obj_t *from, obj_t *to);
+boolean myrefl_obj_order_reaches(obj_order_t relation, obj_t *from, obj_t *to);
+void *myrefl_obj_walk_push(obj_walk_t *walk);
+void *myrefl_obj_walk_peek(obj_walk_t *walk, uint base);
+void myrefl_obj_walk_pop(obj_walk_t *walk);
+void myrefl_obj_walk_end(obj_walk_t *walk, uint base);
+uint myrefl_obj_walk_stamp(void);
+obj_graph_t *myrefl_obj_graph(void);
+obj_graph_node_t *myrefl_obj_graph_node(obj_t *obj);
+
 void myrefl_obj_init(void);
 void myrefl_obj_terminate(void);
 
@@ -383,6 +705,17 @@ boolean myrefl_obj_read_unlock(obj_t *obj);
 void myrefl_obj_chain_update_state(obj_t *obj, obj_state_t state);
 obj_instance_t *myrefl_obj_instance_create(obj_t *obj, const char *instance_name);
 void myrefl_obj_instance_delete(obj_instance_t *instance);
+void myrefl_obj_rule_data_free(obj_rule_data_t *rule_data);
+void myrefl_obj_series_add(obj_instance_t *instance,
+                           myrefl_result_t result,
+                           long value);
+uint myrefl_obj_series_read(obj_series_t *series,
+                            obj_series_tier_t tier,
+                            obj_series_point_t *points,
+                            uint max);
+myrefl_handle_t myrefl_obj_handle_get(obj_instance_t *instance);
+obj_instance_t *myrefl_obj_handle_instance(myrefl_handle_t handle);
+void myrefl_obj_handle_release(obj_instance_t *instance);
 const char *myrefl_obj_instance_name(obj_instance_t *instance);
 obj_instance_t *myrefl_obj_instance(obj_t *obj, obj_instance_t *ref_instance);
 obj_instance_t *myrefl_obj_instance_by_name(obj_t *obj, const char *instance_name);
@@ -66,6 +66,7 @@
 /*
  * The POSIX specific structures for:
  * - critical sections
+ * - thread local keys
  * - threads
  * - timers
  */
@@ -73,6 +74,10 @@ struct xos_critical_section_t_ {
     pthread_mutex_t mutex;
 };
 
+struct xos_thread_key_t_ {
+    pthread_key_t key;
+};
+
 struct xos_thread_t_ {
     pthread_t tid;
     pthread_mutex_t run_test_mutex;
@@ -396,6 +401,48 @@ void myrefl_xos_critical_section_delete (xos_critical_section_t *cs)
     free(cs);
 }
 
+/*************************************************************
+ * POSIX thread local functions
+ *************************************************************/
+
+/*
+ * Create a thread local key, "destructor" is called with the value
+ * of each thread that exits with a non-NULL value set.
+ */
+xos_thread_key_t *myrefl_xos_thread_key_create (xos_thread_key_destructor_fn_t *destructor)
+{
+    xos_thread_key_t *key;
+
+    key = (xos_thread_key_t *)malloc(sizeof(xos_thread_key_t));
+    if (!key) {
+        myrefl_error("POSIX malloc");
+        return (NULL);
+    }
+
+    if (pthread_key_create(&key->key, destructor)) {
+        myrefl_error("POSIX thread key create failed");
+        free(key);
+        return (NULL);
+    }
+    return (key);
+}
+
+/*
+ * Get the calling thread's value for the key.
+ */
+void *myrefl_xos_thread_key_get (xos_thread_key_t *key)
+{
+    return (pthread_getspecific(key->key));
+}
+
+/*
+ * Set the calling thread's value for the key.
+ */
+boolean myrefl_xos_thread_key_set (xos_thread_key_t *key, void *value)
+{
+    return (pthread_setspecific(key->key, value) == 0);
+}
+
 /*************************************************************
  * POSIX thread functions
  *************************************************************/
@@ -42,11 +42,13 @@ static boolean rci_map_function(obj_instance_t *instance,
                                 const char *instance_name,
                                 rci_map_direction_t direction,
                                 rci_map_function_t function,
-                                myrefl_list_t *history, 
                                 boolean default_state, 
                                 void *context);
 static void rci_propagate_rule_change(obj_instance_t *rule_of_interest,
                                       myrefl_result_t action);
+static void rci_memo_invalidate_above(obj_t *obj);
+static void rci_set_root_cause(obj_instance_t *rule_instance, 
+                               rule_root_cause_t root_cause);
 
 /*
  * Contain the rule and state that is being propagated, e.g. when a new
@@ -58,86 +60,93 @@ typedef struct {
 } rci_propagate_context_t;
 
 /*
- * List of loop domains for loop detection
+ * Visited marking for rci_map_function(). Each traversal takes a new
+ * epoch and stamps the objects that it visits with it. Traversals nest
+ * (a function being mapped may start its own), so the stamp that each
+ * visit overwrote is saved on the undo stack and put back when the 
+ * traversal that made it completes. The stack is kept between 
+ * traversals so that it is only ever allocated as it grows.
  */
-static loop_domain_t *domains = NULL;
+typedef struct {
+    obj_t *obj;
+    uint stamp;
+} rci_visit_undo_t;
+
+static uint rci_visit_epoch = 0;
+static rci_visit_undo_t *rci_visit_undo = NULL;
+static uint rci_visit_undo_top = 0;
+static uint rci_visit_undo_size = 0;
+
+#define RCI_VISIT_UNDO_INITIAL 256
 
 /*
- * What is the next_domain to be used for cyclic dependency loop 
- * detection.
+ * Frame per level of the dependencies being mapped across by 
+ * rci_map_function().
  */
-static uint next_domain = 1;
+typedef struct {
+    obj_instance_t *instance;
+    rci_map_direction_t direction;
+    myrefl_list_element_t *current;   // next dependency to look at
+    boolean started;
+} rci_map_frame_t;
+
+static obj_walk_t rci_map_walk = OBJ_WALK_INIT(rci_map_frame_t);
 
 /*
- * UT variables
+ * Generation of the cached verdicts on the rules below each object, 
+ * see rci_memo_children(). Moved on when the dependencies, components
+ * or rule states change, which invalidates every cached verdict at 
+ * once. Result and root cause changes only invalidate the verdicts of 
+ * the objects above them.
  */
-static boolean rci_ut_in_progress = FALSE;
-myrefl_list_t *rci_ut_visited_rules = NULL;
-myrefl_list_t *rci_ut_scheduled_rules = NULL;
+static uint rci_memo_generation = 1;
 
 /*
- * is_obj_in_tree()
- *
- * recursivly search the tree looking for "target", returns TRUE
- * if found and FALSE if not found.
+ * Number of times a cached verdict was found busy, i.e. the component
+ * expansion led back round to an object being evaluated. Verdicts 
+ * completed after that can be partial so are not kept.
  */
-static boolean is_obj_in_tree (const obj_t *target, const obj_t *tree)
-{
-    myrefl_list_element_t *next_child;
+static uint rci_memo_loops = 0;
 
-    if (!tree || !target) {
-        return(FALSE);
-    }
+#define RCI_MEMO_INITIAL 2
 
-    /*
-     * Is the current head of the tree our target?
-     */
-    if (tree == target) {
-        return(TRUE);
-    } else {
-        /*
-         * Maybe one of the children is the target?
-         */
-        next_child = tree->child_depend->head;
+/*
+ * Summary of the rules below a rule, see rci_memo_children().
+ */
+typedef struct {
+    uint failing;
+    uint rcc;
+    uint enabled;
+} rci_children_t;
 
-        while(next_child) {
-            if (is_obj_in_tree(target, (obj_t*)next_child->data)) {
-                return(TRUE);
-            }
-            next_child = next_child->next;
-        }
-    }
-    return(FALSE);
-}
+/*
+ * Frame per object being summarised by rci_memo_children().
+ */
+typedef struct {
+    obj_t *obj;
+    const char *instance_name;
+    boolean comp;
+    boolean started;
+    int index;                        // of the cached verdict, or -1
+    uint loops;                       // rci_memo_loops when started
+    myrefl_list_element_t *current;   // next dependency to look at
+    rci_children_t children;
+} rci_memo_frame_t;
+
+static obj_walk_t rci_memo_walk = OBJ_WALK_INIT(rci_memo_frame_t);
+static obj_walk_t rci_memo_invalidate_walk = OBJ_WALK_INIT(obj_t *);
 
+/*
+ * UT variables
+ */
+static boolean rci_ut_in_progress = FALSE;
+myrefl_list_t *rci_ut_visited_rules = NULL;
+myrefl_list_t *rci_ut_scheduled_rules = NULL;
 
 /*******************************************************************
  * Exported API Functions
  *******************************************************************/
 
-/*
- * myrefl_is_domain_reachable()
- *
- * Function for finding if a domain "target" is reachable from
- * "container". It is exported because the test code needs to use
- * it, but is not in the header files as it shouldn't be used by
- * anyone else.
- */
-boolean myrefl_is_domain_reachable (uint container, uint target)
-{
-    loop_domain_t *domain = domains;
-    boolean retval = FALSE;
-
-    while(domain) {
-        if (domain->number == container) {
-            retval = myrefl_list_find(domain->reachable, (void*)(uintptr_t)target);
-            break;
-        }
-        domain = domain->next;
-    }
-    return(retval);
-}
-
 /*
  * myrefl_depend_found_comp()
  *
@@ -179,8 +188,6 @@ void myrefl_depend_create (const char *parent_name,
 {
     obj_t *parent = NULL, *child = NULL;
     obj_comp_t *comp;
-    loop_domain_t *domain = NULL;
-    loop_domain_t *parent_domain = NULL;
 
     myrefl_obj_db_lock();
 
@@ -222,123 +229,23 @@ void myrefl_depend_create (const char *parent_name,
     }
 
     /*
-     * Check the domains of the parent and child objects, 
+     * Keep the dependencies in topological order, if the child can 
+     * already reach the parent then this would make a loop. So don't
+     * make this connection.
      */
-    if (parent->domain == 0) {
-        if (child->domain == 0) {
-            /*
-             * Neither are in a dependency tree, add them to the
-             * same new tree, no need to check for loops.
-             */
-            domain = malloc(sizeof(loop_domain_t));
-            if (domain) {
-                domain->number = next_domain++;
-                domain->reachable = myrefl_list_create();
-                if (!domain->reachable) {
-                    myrefl_error("Memory allocation failure");
-                    free(domain);
-                    myrefl_obj_db_unlock();
-                    return;
-                }
-                domain->next = domains;
-                domains = domain;
-            } else {
-                myrefl_error("Memory allocation failure"); 
-                myrefl_obj_db_unlock();
-                return;
-            }
-            parent->domain = child->domain = domain->number;
-        } else {
-            /*
-             * Parent is not in a domain, but child is, add the parent
-             * to the childs domain, no need for a loop check since
-             * the parent was not already connected.
-             */
-            parent->domain = child->domain;
-        }
-    } else if (child->domain == 0) {
-        /*
-         * Parent is in a domain but child isn't, add the child to the
-         * parents domain, no need for a loop check since the child
-         * was not already connected.
-         */
-        child->domain = parent->domain;
-    } else if (child->domain == parent->domain) {
-        /*
-         * Same domain, there may be a loop within this domain. So search
-         * down through the children looking for the parent.
-         */
-        if (is_obj_in_tree(parent, child)) {
-            /*
-             * This parent is already referenced by one of the children
-             * that would create a loop. So don't make this connection.
-             */
-            myrefl_error("Loop detected creating a dependency between "
-                         "'%s' and '%s'", parent->i.name, child->i.name);
-            myrefl_obj_db_unlock();
-            return;
-        } 
-    } else {
-        /*
-         * Different domains. Check to see whether the domains intersect
-         * eachother already. If they do then we have a possible loop.
-         */
-        domain = domains;
-
-        while(domain) {
-            if (domain->number == parent->domain) {
-                /*
-                 * Found the parent domain, add the child domain to
-                 * it as it is now reachable.
-                 */
-                myrefl_list_add(domain->reachable,
-                                (void*)(uintptr_t)child->domain);
-                parent_domain = domain;
-
-            } else if (domain->number == child->domain) {
-                /*
-                 * Can the child contact the parent, if so we have a possible
-                 * loop and need to walk the tree to find out.
-                 */
-                if (myrefl_list_find(domain->reachable, 
-                                     (void*)(uintptr_t)parent->domain)) {
-                    if (is_obj_in_tree(parent, child)) {
-                        /*
-                         * Need to go back through the domains and find the
-                         * parent and remove the child from the reachable
-                         * domains since we are not allowing this connection
-                         */
-                        if (parent_domain) {
-                            myrefl_list_remove(parent_domain->reachable,
-                                               (void*)(uintptr_t)child->domain);
-                        }
-
-                        myrefl_error("Loop detected creating a dependency between "
-                                     "'%s' to '%s'", parent->i.name, 
-                                     child->i.name);
-                        myrefl_obj_db_unlock();
-                        return;
-                    }
-                }
-            } else if (myrefl_list_find(domain->reachable, 
-                                        (void*)(uintptr_t)parent->domain)) {
-                /*
-                 * This non child and non parent domain can reach our parent
-                 * which means that it can now also reach the child.
-                 */
-                myrefl_list_add(domain->reachable, (void*)(uintptr_t)child->domain);
-            }
-            
-            domain = domain->next;
-        }
-
+    if (!myrefl_obj_order_link(OBJ_ORDER_DEPEND, parent, child)) {
+        myrefl_error("Loop detected creating a dependency between "
+                     "'%s' and '%s'", parent->i.name, child->i.name);
+        myrefl_obj_db_unlock();
+        return;
     }
 
     /*
      * No loops detected, so connect the parent and child together.
      */
-    myrefl_list_add(parent->child_depend, child);
-    myrefl_list_add(child->parent_depend, parent);
+    myrefl_list_element_pair(myrefl_list_add(parent->child_depend, child),
+                             myrefl_list_add(child->parent_depend, parent));
+    myrefl_rci_depend_changed();
 
     /*
      * Check whether the parent or child are within a component, and
@@ -364,7 +271,8 @@ void myrefl_depend_create (const char *parent_name,
 
     myrefl_trace(parent->i.name, 
                  "Connected '%s(%d)' to '%s(%d)'", parent->i.name,
-                 parent->domain, child->i.name, child->domain);
+                 parent->order[OBJ_ORDER_DEPEND], child->i.name, 
+                 child->order[OBJ_ORDER_DEPEND]);
     myrefl_obj_db_unlock();
 }
 
@@ -452,10 +360,10 @@ static boolean rci_schedule_dependent_rules (
         instance_name,
         RCI_MAP_CHILDREN,
         rci_schedule_dependent_rules_guts,
-        NULL, TRUE, NULL);
+        TRUE, NULL);
     
     if (mark_rule_rc_candidate) {
-        rule_instance->root_cause = RULE_ROOT_CAUSE_CANDIDATE;
+        rci_set_root_cause(rule_instance, RULE_ROOT_CAUSE_CANDIDATE);
     } else {
         /*
          * There must be a rule under this one that is failing, no
@@ -464,7 +372,7 @@ static boolean rci_schedule_dependent_rules (
          * 
          * If it is already in the test queue we could remove it?
          */
-        rule_instance->root_cause = RULE_ROOT_CAUSE_NOT;
+        rci_set_root_cause(rule_instance, RULE_ROOT_CAUSE_NOT);
     }
 
     myrefl_debug(rule_instance->obj->i.name,
@@ -519,7 +427,7 @@ static boolean rci_apply_propagate_rule_change (obj_instance_t *current_rule,
                          "RCI: Rerunning '%s' since an object under it has changed from fail to pass",
                          myrefl_obj_instance_name(current_rule));
 
-            current_rule->root_cause = RULE_ROOT_CAUSE_CANDIDATE;
+            rci_set_root_cause(current_rule, RULE_ROOT_CAUSE_CANDIDATE);
 
             if (rci_ut_in_progress) {
                 myrefl_list_add(rci_ut_scheduled_rules, 
@@ -541,7 +449,7 @@ static boolean rci_apply_propagate_rule_change (obj_instance_t *current_rule,
                              "RCI: Cleared RC on '%s', found lower RC '%s'",
                              myrefl_obj_instance_name(current_rule),
                              myrefl_obj_instance_name(rule_of_interest));
-                current_rule->root_cause = RULE_ROOT_CAUSE_NOT;
+                rci_set_root_cause(current_rule, RULE_ROOT_CAUSE_NOT);
             }
 
             if (current_rule->last_result == MYREFL_RESULT_PASS) {
@@ -608,7 +516,7 @@ static void rci_propagate_rule_change (obj_instance_t *rule_of_interest,
             instance_name,
             RCI_MAP_PARENTS,
             rci_apply_propagate_rule_change, 
-            NULL, TRUE, context);
+            TRUE, context);
         free(context);
     }
 }
@@ -666,17 +574,6 @@ static boolean rci_is_passed (obj_instance_t *rule_instance, void *context)
     }
 }
 
-/*
- * rci_is_enabled()
- *
- * Is this instance is enabled
- */
-static boolean rci_is_enabled (obj_instance_t *rule_instance, 
-                               void *context)
-{
-    return(rule_instance->state == OBJ_STATE_ENABLED);
-}
-
 void myrefl_rci_ut_map_is_passed(obj_instance_t *rule_instance,
                                  const char *instance_name,
                                  myrefl_list_t *visited_rules)
@@ -692,7 +589,7 @@ void myrefl_rci_ut_map_is_passed(obj_instance_t *rule_instance,
                      instance_name, 
                      RCI_MAP_CHILDREN,
                      rci_is_passed, 
-                     NULL, TRUE, NULL);
+                     TRUE, NULL);
 
     rci_ut_in_progress = FALSE;
     rci_ut_visited_rules = NULL;
@@ -718,71 +615,73 @@ static boolean rci_not_rcc (obj_instance_t *rule_instance, void *context)
 }
 
 /*
- * rci_map_function()
- *
- * Map the function "function" across all the rules in "dependencies", 
- * expanding components where necessary. Return the "default_state" if
- * "function" returned "default_state" for all objects, else !default_state
+ * rci_visit()
  *
- *
- * When expanding components use either the top or bottom depend lists
- * as the immediate neighbors. 
- *
- * Recurse through components until all the rules have been 
- * located. I.e. if a rule dependency contains a component, and that
- * component contains another component on its boundary, then we recurse
- * into that second component to find its rules.
- *
- * Where objects have an instance, only apply this function to the
- * matching instance, where no instance, apply to all the instances.
+ * Mark the object as visited by the traversal with this epoch, returns
+ * FALSE if it already had been.
  */
-static boolean rci_map_function (obj_instance_t *instance,
-                                 const char *instance_name,
-                                 rci_map_direction_t direction,
-                                 rci_map_function_t function,
-                                 myrefl_list_t *history,
-                                 boolean default_state,
-                                 void *context)
+static boolean rci_visit (obj_t *obj, uint epoch)
 {
-    myrefl_list_t *dependencies = NULL;
-    myrefl_list_element_t *current;
-    obj_t *element_obj;
-    obj_t *obj;
-    obj_comp_t *parent_comp;
-    obj_instance_t *rule_instance;
-    boolean retval = default_state;
-    boolean free_history = FALSE;
-    
-    if (instance && instance->state != OBJ_STATE_ENABLED) {
-        /*
-         * Only traverse enabled objects
-         */
-        myrefl_debug(instance->obj->i.name, "RCI: %s: '%s' not enabled, skipping",
-                     __FUNCTION__, myrefl_obj_instance_name(instance));
-        return(retval);
+    rci_visit_undo_t *undo;
+    uint size;
+
+    if (obj->rci_visit == epoch) {
+        return (FALSE);
     }
 
-    if (!myrefl_obj_instance_validate(instance, OBJ_TYPE_ANY)) {
-        myrefl_error("Root Cause Identification aborted due to invalid object");
-        return(retval);
+    if (rci_visit_undo_top == rci_visit_undo_size) {
+        size = rci_visit_undo_size ? rci_visit_undo_size * 2 :
+            RCI_VISIT_UNDO_INITIAL;
+        undo = realloc(rci_visit_undo, size * sizeof(rci_visit_undo_t));
+        if (!undo) {
+            /*
+             * Can't save the old stamp, any enclosing traversal may 
+             * visit this object again, which is wasteful but harmless.
+             */
+            myrefl_error("RCI: No memory for visit undo stack");
+            obj->rci_visit = epoch;
+            return (TRUE);
+        }
+        rci_visit_undo = undo;
+        rci_visit_undo_size = size;
     }
 
-    //myrefl_debug("RCI: mapping fn across object instance '%s'", 
-    //             myrefl_obj_instance_name(instance));
+    undo = &rci_visit_undo[rci_visit_undo_top++];
+    undo->obj = obj;
+    undo->stamp = obj->rci_visit;
+    obj->rci_visit = epoch;
+    return (TRUE);
+}
 
-    if (!history) {
-        /*
-         * First call, allocate some history so that we can avoid 
-         * calling function for objects more than once when there 
-         * are multiple paths through the dependencies.
-         */
-        history = myrefl_list_create();
-        free_history = TRUE;
+/*
+ * rci_visit_restore()
+ *
+ * The traversal that started with the undo stack at "top" is complete,
+ * put back the stamps that it overwrote.
+ */
+static void rci_visit_restore (uint top)
+{
+    rci_visit_undo_t *undo;
+
+    while (rci_visit_undo_top > top) {
+        undo = &rci_visit_undo[--rci_visit_undo_top];
+        undo->obj->rci_visit = undo->stamp;
     }
+}
 
-    obj = instance->obj;
+/*
+ * rci_map_dependencies()
+ *
+ * The dependencies of this object in the direction given, when they
+ * are the component's own dependencies the direction is changed to 
+ * the plain one to carry on in. NULL for unexpected object types.
+ */
+static myrefl_list_t *rci_map_dependencies (obj_t *obj,
+                                            rci_map_direction_t *direction)
+{
+    myrefl_list_t *dependencies = NULL;
 
-    switch (direction) {
+    switch (*direction) {
     case RCI_MAP_PARENTS:
         switch(obj->type) {
         case OBJ_TYPE_RULE:
@@ -805,7 +704,7 @@ static boolean rci_map_function (obj_instance_t *instance,
         switch(obj->type) {
         case OBJ_TYPE_COMP:
             dependencies = obj->parent_depend;
-            direction = RCI_MAP_PARENTS;
+            *direction = RCI_MAP_PARENTS;
             break;
         default:
             myrefl_error("Internal error, found unexpected obj type "
@@ -835,7 +734,7 @@ static boolean rci_map_function (obj_instance_t *instance,
         switch(obj->type) {
         case OBJ_TYPE_COMP:
             dependencies = obj->child_depend;
-            direction = RCI_MAP_CHILDREN;
+            *direction = RCI_MAP_CHILDREN;
             break;
         default:
             myrefl_error("Internal error, found unexpected obj type "
@@ -844,156 +743,628 @@ static boolean rci_map_function (obj_instance_t *instance,
         }
         break;
     }
+    return (dependencies);
+}
 
-    /*
-     * No more dependencies, start unwinding the recursion
-     */
-    if (!dependencies) {
-        if (free_history) {
-            myrefl_list_free(history);
-        }
-        return(!retval);
+/*
+ * rci_map_push()
+ *
+ * Add a frame to map the function across the dependencies of this 
+ * object, FALSE on memory allocation failure.
+ */
+static boolean rci_map_push (obj_instance_t *instance, 
+                             rci_map_direction_t direction)
+{
+    rci_map_frame_t *frame;
+
+    frame = myrefl_obj_walk_push(&rci_map_walk);
+    if (!frame) {
+        myrefl_error("RCI: No memory to map across the dependencies");
+        return (FALSE);
     }
+    frame->instance = instance;
+    frame->direction = direction;
+    return (TRUE);
+}
+
+/*
+ * rci_map_function()
+ *
+ * Map the function "function" across all the rules in "dependencies", 
+ * expanding components where necessary. Return the "default_state" if
+ * "function" returned "default_state" for all objects, else !default_state
+ *
+ *
+ * When expanding components use either the top or bottom depend lists
+ * as the immediate neighbors. 
+ *
+ * Carry on through components until all the rules have been 
+ * located. I.e. if a rule dependency contains a component, and that
+ * component contains another component on its boundary, then we go 
+ * into that second component to find its rules.
+ *
+ * Where objects have an instance, only apply this function to the
+ * matching instance, where no instance, apply to all the instances.
+ *
+ * The dependencies are walked depth first in the same order as they 
+ * always have been, but with a frame per level on rci_map_walk rather
+ * than the C stack. "function" may map across the dependencies itself,
+ * that walk runs above this one on the same stack.
+ */
+static boolean rci_map_function (obj_instance_t *instance,
+                                 const char *instance_name,
+                                 rci_map_direction_t direction,
+                                 rci_map_function_t function,
+                                 boolean default_state,
+                                 void *context)
+{
+    myrefl_list_t *dependencies;
+    myrefl_list_element_t *current;
+    rci_map_frame_t *frame;
+    obj_t *element_obj;
+    obj_t *obj;
+    obj_comp_t *parent_comp;
+    obj_instance_t *rule_instance;
+    boolean retval = default_state;
+    uint undo_top, epoch, base;
 
     /*
-     * If this object was in its parent components top dependencies 
-     * then we must also map the function to the parent_depend of 
-     * the component itself as well since that is one level
-     * above all top depends.
-     *
-     * i.e.
-     *
-     * Rule1     Rule2       Rule3
-     *    \______|             |
-     *       ___Comp1__        |  
-     *       |         |       |
-     *       |  Rule4--|-------|
-     *       |         |
-     *       -----------
-     *
-     * Where Rule1 and RUle2 both depend on Comp1, and Comp1 contains
-     * Rule4. Rule3 has a dependency on Rule4 directly.
-     *
-     * So when this this mapping function is applied to Rule4 and we
-     * are being applied to its parents, it should be applied to Rule3
-     * first since it is a direct parent of the Rule4. Then since Rule4
-     * is in the top_depend of Comp1 it should also be applied to Rule1
-     * and Rule2 which are parents of Comp1.
+     * Start a new traversal so that we can avoid calling function for 
+     * objects more than once when there are multiple paths through 
+     * the dependencies.
      */
-    if (direction == RCI_MAP_PARENTS) {
-        parent_comp = obj->parent_comp;
-        if (parent_comp && myrefl_list_find(parent_comp->top_depend, obj)) {
-            /*
-             * This object is in the top depend list of its component,
-             * so apply it to the parent depend of that component.
-             */
-            if (default_state != rci_map_function(&parent_comp->obj->i, 
-                                                  instance_name, 
-                                                  RCI_MAP_COMP_PARENTS, 
-                                                  function, 
-                                                  history,
-                                                  default_state,
-                                                  context)) {
+    if (++rci_visit_epoch == 0) {
+        rci_visit_epoch = 1;
+    }
+    epoch = rci_visit_epoch;
+    undo_top = rci_visit_undo_top;
+
+    base = rci_map_walk.top;
+    if (!rci_map_push(instance, direction)) {
+        return (retval);
+    }
+
+    while ((frame = myrefl_obj_walk_peek(&rci_map_walk, base))) {
+        if (!frame->started) {
+            frame->started = TRUE;
+            instance = frame->instance;
+
+            if (instance && instance->state != OBJ_STATE_ENABLED) {
+                /*
+                 * Only traverse enabled objects
+                 */
+                myrefl_debug(instance->obj->i.name, 
+                             "RCI: %s: '%s' not enabled, skipping",
+                             __FUNCTION__, 
+                             myrefl_obj_instance_name(instance));
+                myrefl_obj_walk_pop(&rci_map_walk);
+                continue;
+            }
+
+            if (!myrefl_obj_instance_validate(instance, OBJ_TYPE_ANY)) {
+                myrefl_error("Root Cause Identification aborted due to invalid object");
+                myrefl_obj_walk_pop(&rci_map_walk);
+                continue;
+            }
+
+            obj = instance->obj;
+            dependencies = rci_map_dependencies(obj, &frame->direction);
+
+            if (!dependencies) {
                 /*
-                 * Rewrite the retval if any of these objects returned
-                 * the opposite of default_state.
+                 * No more dependencies, nothing below here.
                  */
                 retval = !default_state;
+                myrefl_obj_walk_pop(&rci_map_walk);
+                continue;
             }
-        }
-    }
+            frame->current = dependencies->head;
 
-    if (direction == RCI_MAP_CHILDREN) {
-        parent_comp = obj->parent_comp;
-        if (parent_comp && myrefl_list_find(parent_comp->bottom_depend, obj)) {
             /*
-             * This object is in the bootom depend list of its 
-             * component, so apply it to the child depend of
-             * that component.
+             * If this object was in its parent components top 
+             * dependencies then we must also map the function to the 
+             * parent_depend of the component itself as well since 
+             * that is one level above all top depends.
+             *
+             * i.e.
+             *
+             * Rule1     Rule2       Rule3
+             *    \______|             |
+             *       ___Comp1__        |  
+             *       |         |       |
+             *       |  Rule4--|-------|
+             *       |         |
+             *       -----------
+             *
+             * Where Rule1 and RUle2 both depend on Comp1, and Comp1 
+             * contains Rule4. Rule3 has a dependency on Rule4 directly.
+             *
+             * So when this this mapping function is applied to Rule4 
+             * and we are being applied to its parents, it should be 
+             * applied to Rule3 first since it is a direct parent of the
+             * Rule4. Then since Rule4 is in the top_depend of Comp1 it 
+             * should also be applied to Rule1 and Rule2 which are 
+             * parents of Comp1.
+             *
+             * Likewise for the children of an object in the bottom 
+             * depend list of its component. The component is done 
+             * before the dependencies of this object.
              */
-            if (default_state != rci_map_function(&parent_comp->obj->i, 
-                                                  instance_name, 
-                                                  RCI_MAP_COMP_CHILDREN, 
-                                                  function, 
-                                                  history,
-                                                  default_state,
-                                                  context)) {
-                retval = !default_state;
+            parent_comp = obj->parent_comp;
+            if (parent_comp &&
+                ((frame->direction == RCI_MAP_PARENTS &&
+                  myrefl_list_find(parent_comp->top_depend, obj)) ||
+                 (frame->direction == RCI_MAP_CHILDREN &&
+                  myrefl_list_find(parent_comp->bottom_depend, obj)))) {
+                if (!rci_map_push(&parent_comp->obj->i,
+                                  frame->direction == RCI_MAP_PARENTS ?
+                                  RCI_MAP_COMP_PARENTS : 
+                                  RCI_MAP_COMP_CHILDREN)) {
+                    break;
+                }
             }
+            continue;
         }
-    }
 
-    /*
-     * Walk the dependencies applying function to them.
-     */
-    current = dependencies->head;
-    while (current) {
+        /*
+         * Walk the dependencies applying function to them, one per
+         * visit to this frame.
+         */
+        current = frame->current;
+        if (!current) {
+            myrefl_obj_walk_pop(&rci_map_walk);
+            continue;
+        }
+        frame->current = current->next;
+        direction = frame->direction;
         element_obj = current->data;
 
-        if (!myrefl_list_find(history, element_obj)) {
+        if (!rci_visit(element_obj, epoch)) {
             /*
              * Keep track of where we have been to prevent going 
              * the same way more than once in the same traversal, which
              * can be caused by dependencies that diverge and then join 
              * again.
              */
-            myrefl_list_add(history, element_obj);
+            continue;
+        }
 
-            if (element_obj->type == OBJ_TYPE_RULE) {
+        /*
+         * The function may start its own walk which can move the 
+         * frames, so "frame" isn't used again until the next peek.
+         */
+        if (element_obj->type == OBJ_TYPE_RULE) {
+            /*
+             * If an instance was specified AND if the rule
+             * contains instances, then apply to that one else
+             * apply to *all* instances on the object.
+             */
+            if (instance_name && element_obj->i.next) {
+                rule_instance = myrefl_obj_instance_by_name(element_obj, 
+                                                            instance_name);
+                myrefl_debug(element_obj->i.name,
+                             "RCI: Looking for instance '%s', got %p",
+                             instance_name, rule_instance);
+                
+                if (rule_instance && 
+                    rule_instance->state == OBJ_STATE_ENABLED &&
+                    default_state != function(rule_instance, context)) {
+                    retval = !default_state;
+                }
+            } else {
                 /*
-                 * If an instance was specified AND if the rule
-                 * contains instances, then apply to that one else
-                 * apply to *all* instances on the object.
+                 * Apply to all instances
                  */
-                if (instance_name && element_obj->i.next) {
-                    rule_instance = myrefl_obj_instance_by_name(element_obj, 
-                                                                instance_name);
-                    myrefl_debug(rule_instance->obj->i.name,
-                                 "RCI: Looking for instance '%s', got %p",
-                                 instance_name, rule_instance);
-                    
-                    if (rule_instance && 
-                        rule_instance->state == OBJ_STATE_ENABLED &&
+                for (rule_instance = &element_obj->i;
+                     rule_instance;
+                     rule_instance = rule_instance->next) {
+                    if (rule_instance->state == OBJ_STATE_ENABLED &&
                         default_state != function(rule_instance, context)) {
                         retval = !default_state;
                     }
+                }
+            }
+        }
+            
+        /*
+         * Continue walking dependencies, expanding components
+         * as they are found.
+         */
+        if (!rci_map_push(&element_obj->i, direction)) {
+            break;
+        }
+    }
+
+    myrefl_obj_walk_end(&rci_map_walk, base);
+    rci_visit_restore(undo_top);
+
+    return(retval);
+}
+
+/*
+ * rci_memo_find()
+ *
+ * Index of the cached verdict for this instance name on the object,
+ * adding one if there is none, -1 on memory allocation failure.
+ */
+static int rci_memo_find (obj_t *obj, const char *instance_name, 
+                          boolean comp)
+{
+    obj_rci_memo_t *memo;
+    uint i, size;
+
+    for (i = 0; i < obj->rci_memo_count; i++) {
+        memo = &obj->rci_memo[i];
+        if (memo->comp == comp &&
+            (memo->instance_name == instance_name ||
+             (memo->instance_name && instance_name &&
+              !strcmp(memo->instance_name, instance_name)))) {
+            return (i);
+        }
+    }
+
+    if (obj->rci_memo_count == obj->rci_memo_size) {
+        size = obj->rci_memo_size ? obj->rci_memo_size * 2 :
+            RCI_MEMO_INITIAL;
+        memo = realloc(obj->rci_memo, size * sizeof(obj_rci_memo_t));
+        if (!memo) {
+            return (-1);
+        }
+        obj->rci_memo = memo;
+        obj->rci_memo_size = size;
+    }
+
+    memo = &obj->rci_memo[obj->rci_memo_count];
+    memset(memo, 0, sizeof(obj_rci_memo_t));
+    if (instance_name) {
+        memo->instance_name = strdup(instance_name);
+        if (!memo->instance_name) {
+            return (-1);
+        }
+    }
+    memo->comp = comp;
+    return (obj->rci_memo_count++);
+}
+
+/*
+ * rci_memo_status()
+ *
+ * Add the status of a rule instance below to the summary, as 
+ * rci_is_passed() and rci_not_rcc() would determine.
+ */
+static void rci_memo_status (obj_instance_t *rule_instance, 
+                             rci_children_t *children)
+{
+    if (!rule_instance || rule_instance->state != OBJ_STATE_ENABLED) {
+        return;
+    }
+
+    if (!rci_is_passed(rule_instance, NULL)) {
+        children->failing++;
+    }
+    if (!rci_not_rcc(rule_instance, NULL)) {
+        children->rcc++;
+    }
+    children->enabled++;
+}
+
+/*
+ * rci_memo_add()
+ *
+ * Add the summary of everything below an immediate dependency.
+ */
+static void rci_memo_add (rci_children_t *children, rci_children_t *below)
+{
+    if (below->failing) {
+        children->failing++;
+    }
+    if (below->rcc) {
+        children->rcc++;
+    }
+    if (below->enabled) {
+        children->enabled++;
+    }
+}
+
+/*
+ * rci_memo_enter()
+ *
+ * Start summarising the rules below this object in a new frame, unless
+ * the summary is already cached or is being worked out further up 
+ * (which makes it a loop through the components), in which case that
+ * is the summary. FALSE when the frame is already complete.
+ */
+static boolean rci_memo_enter (rci_memo_frame_t *frame)
+{
+    obj_t *obj = frame->obj;
+    obj_rci_memo_t *memo;
+
+    frame->index = rci_memo_find(obj, frame->instance_name, frame->comp);
+    if (frame->index >= 0) {
+        memo = &obj->rci_memo[frame->index];
+        if (memo->busy) {
+            rci_memo_loops++;
+            frame->index = -1;
+            return (FALSE);
+        }
+        if (obj->rci_memo_generation == rci_memo_generation &&
+            memo->generation == rci_memo_generation) {
+            frame->children.failing = memo->failing;
+            frame->children.rcc = memo->rcc;
+            frame->children.enabled = memo->enabled;
+            frame->index = -1;
+            return (FALSE);
+        }
+        memo->busy = TRUE;
+    }
+    frame->loops = rci_memo_loops;
+
+    switch (obj->type) {
+    case OBJ_TYPE_RULE:
+    case OBJ_TYPE_NONE:
+        frame->current = obj->child_depend->head;
+        break;
+    case OBJ_TYPE_COMP:
+        frame->current = frame->comp ? obj->child_depend->head : 
+            obj->t.comp->top_depend->head;
+        break;
+    default:
+        myrefl_error("Internal error, found unexpected obj type "
+                     "in dependencies");
+        return (FALSE);
+    }
+    return (TRUE);
+}
+
+/*
+ * rci_memo_push()
+ *
+ * Add a frame for summarising the rules below this object, FALSE on 
+ * memory allocation failure.
+ */
+static boolean rci_memo_push (obj_t *obj, const char *instance_name,
+                              boolean comp)
+{
+    rci_memo_frame_t *frame;
+
+    frame = myrefl_obj_walk_push(&rci_memo_walk);
+    if (!frame) {
+        myrefl_error("RCI: No memory to summarise the dependencies");
+        return (FALSE);
+    }
+    frame->obj = obj;
+    frame->instance_name = instance_name;
+    frame->comp = comp;
+    frame->index = -1;
+    return (TRUE);
+}
+
+/*
+ * rci_memo_children()
+ *
+ * Summarise the rules below this object, as rci_map_function() would
+ * find them when mapping over the children, using and keeping the 
+ * cached verdicts. "comp" is for a component's own dependencies 
+ * (RCI_MAP_COMP_CHILDREN) rather than those of its contents.
+ *
+ * A cached verdict only needs working out again when something below
+ * has changed, and then only from the verdicts of the immediate 
+ * dependencies, so a change costs no more than the objects above it.
+ *
+ * Each object being worked out has a frame on rci_memo_walk, when it
+ * is complete its summary is added to the frame of the object above.
+ */
+static void rci_memo_children (obj_t *obj,
+                               const char *instance_name,
+                               boolean comp,
+                               rci_children_t *children)
+{
+    myrefl_list_element_t *current;
+    obj_comp_t *parent_comp;
+    obj_t *element_obj;
+    obj_instance_t *rule_instance;
+    obj_rci_memo_t *memo;
+    rci_memo_frame_t *frame, *above;
+    rci_children_t below;
+    uint base;
+
+    memset(children, 0, sizeof(rci_children_t));
+
+    base = rci_memo_walk.top;
+    if (!rci_memo_push(obj, instance_name, comp)) {
+        return;
+    }
+
+    while ((frame = myrefl_obj_walk_peek(&rci_memo_walk, base))) {
+        if (!frame->started) {
+            frame->started = TRUE;
+            if (!rci_memo_enter(frame)) {
+                frame->current = NULL;
+                continue;
+            }
+
+            /*
+             * As in rci_map_function(), an object on the bottom of its
+             * component also has the component's dependencies below it.
+             */
+            obj = frame->obj;
+            parent_comp = obj->parent_comp;
+            if (parent_comp && 
+                parent_comp->obj->i.state == OBJ_STATE_ENABLED &&
+                myrefl_list_find(parent_comp->bottom_depend, obj) &&
+                !rci_memo_push(parent_comp->obj, instance_name, TRUE)) {
+                break;
+            }
+            continue;
+        }
+
+        current = frame->current;
+        if (current) {
+            frame->current = current->next;
+            element_obj = current->data;
+
+            if (element_obj->type == OBJ_TYPE_RULE) {
+                if (instance_name && element_obj->i.next) {
+                    rci_memo_status(
+                        myrefl_obj_instance_by_name(element_obj, 
+                                                    instance_name),
+                        &frame->children);
                 } else {
-                    /*
-                     * Apply to all instances
-                     */
                     for (rule_instance = &element_obj->i;
                          rule_instance;
                          rule_instance = rule_instance->next) {
-                        if (rule_instance->state == OBJ_STATE_ENABLED &&
-                            default_state != function(rule_instance, context)) {
-                            retval = !default_state;
-                        }
+                        rci_memo_status(rule_instance, &frame->children);
                     }
                 }
             }
-            
-            /*
-             * Continue walking dependencies, expanding components
-             * as they are found.
-             */
-            if (default_state != rci_map_function(&element_obj->i, 
-                                                  instance_name, 
-                                                  direction, 
-                                                  function, 
-                                                  history,
-                                                  default_state,
-                                                  context)) {
-                retval = !default_state;
+
+            if (element_obj->i.state == OBJ_STATE_ENABLED &&
+                !rci_memo_push(element_obj, instance_name, FALSE)) {
+                break;
+            }
+            continue;
+        }
+
+        /*
+         * All the dependencies of this object are done.
+         */
+        if (frame->index >= 0) {
+            memo = &frame->obj->rci_memo[frame->index];
+            memo->busy = FALSE;
+            if (frame->loops == rci_memo_loops) {
+                memo->failing = frame->children.failing;
+                memo->rcc = frame->children.rcc;
+                memo->enabled = frame->children.enabled;
+                memo->generation = rci_memo_generation;
+                frame->obj->rci_memo_generation = rci_memo_generation;
             }
         }
-        current = current->next;
+
+        below = frame->children;
+        myrefl_obj_walk_pop(&rci_memo_walk);
+        above = myrefl_obj_walk_peek(&rci_memo_walk, base);
+        if (above) {
+            rci_memo_add(&above->children, &below);
+        } else {
+            *children = below;
+        }
     }
 
-    if (free_history) {
-        myrefl_list_free(history);
+    if (frame) {
+        /*
+         * Ran out of memory part way, don't leave the unfinished 
+         * verdicts marked busy.
+         */
+        while ((frame = myrefl_obj_walk_peek(&rci_memo_walk, base))) {
+            if (frame->index >= 0) {
+                frame->obj->rci_memo[frame->index].busy = FALSE;
+            }
+            myrefl_obj_walk_pop(&rci_memo_walk);
+        }
     }
+}
 
-    return(retval);
+/*
+ * rci_memo_push_above()
+ *
+ * Add the objects above this one, found the reverse of the way that
+ * rci_memo_children() goes down, to those to invalidate. FALSE on 
+ * memory allocation failure.
+ */
+static boolean rci_memo_push_above (obj_t *obj)
+{
+    myrefl_list_element_t *current;
+    obj_comp_t *parent_comp;
+    obj_t **frame;
+
+    for (current = obj->parent_depend ? obj->parent_depend->head : NULL;
+         current;
+         current = current->next) {
+        if (!(frame = myrefl_obj_walk_push(&rci_memo_invalidate_walk))) {
+            return (FALSE);
+        }
+        *frame = current->data;
+    }
+
+    parent_comp = obj->parent_comp;
+    if (parent_comp && myrefl_list_find(parent_comp->top_depend, obj)) {
+        if (!(frame = myrefl_obj_walk_push(&rci_memo_invalidate_walk))) {
+            return (FALSE);
+        }
+        *frame = parent_comp->obj;
+    }
+
+    if (obj->type == OBJ_TYPE_COMP) {
+        for (current = obj->t.comp->bottom_depend->head;
+             current;
+             current = current->next) {
+            if (!(frame = myrefl_obj_walk_push(&rci_memo_invalidate_walk))) {
+                return (FALSE);
+            }
+            *frame = current->data;
+        }
+    }
+    return (TRUE);
+}
+
+/*
+ * rci_memo_invalidate_above()
+ *
+ * Something about the rules of this object has changed, forget the 
+ * cached verdicts of the objects above it. An object without any 
+ * current verdicts can't have any above it that were worked out from
+ * it, so stop there.
+ */
+static void rci_memo_invalidate_above (obj_t *obj)
+{
+    obj_t **frame;
+    uint i;
+
+    if (!rci_memo_push_above(obj)) {
+        goto nomem;
+    }
+
+    while ((frame = myrefl_obj_walk_peek(&rci_memo_invalidate_walk, 0))) {
+        obj = *frame;
+        myrefl_obj_walk_pop(&rci_memo_invalidate_walk);
+
+        if (obj->rci_memo_generation != rci_memo_generation) {
+            continue;
+        }
+
+        obj->rci_memo_generation = 0;
+        for (i = 0; i < obj->rci_memo_count; i++) {
+            obj->rci_memo[i].generation = 0;
+        }
+
+        if (!rci_memo_push_above(obj)) {
+            goto nomem;
+        }
+    }
+    return;
+
+ nomem:
+    /*
+     * Can't tell which verdicts to forget, so forget them all.
+     */
+    myrefl_obj_walk_end(&rci_memo_invalidate_walk, 0);
+    myrefl_rci_depend_changed();
+}
+
+/*
+ * rci_set_root_cause()
+ *
+ * Update the root cause state of a rule instance, whether it is a root
+ * cause candidate is part of the cached verdicts of those above it.
+ */
+static void rci_set_root_cause (obj_instance_t *rule_instance, 
+                                rule_root_cause_t root_cause)
+{
+    if ((rule_instance->root_cause == RULE_ROOT_CAUSE_CANDIDATE) !=
+        (root_cause == RULE_ROOT_CAUSE_CANDIDATE)) {
+        rci_memo_invalidate_above(rule_instance->obj);
+    }
+    rule_instance->root_cause = root_cause;
 }
 
 /*
@@ -1007,6 +1378,7 @@ static boolean rci_determine_if_root_cause (
     void *context)
 {
     const char *instance_name = NULL;
+    rci_children_t children;
 
     myrefl_debug(rule_instance->obj->i.name, 
                  "Determine if root cause for %s",
@@ -1036,11 +1408,10 @@ static boolean rci_determine_if_root_cause (
              */
             instance_name = rule_instance->name;
         }
-        if (rci_map_function(rule_instance, 
-                             instance_name, 
-                             RCI_MAP_CHILDREN,
-                             rci_is_passed, 
-                             NULL, TRUE, NULL)) {
+        rci_memo_children(rule_instance->obj, instance_name, FALSE, 
+                          &children);
+
+        if (!children.failing) {
             
             myrefl_trace(rule_instance->obj->i.name,
                          "RCI: All children of '%s' passing", 
@@ -1048,17 +1419,13 @@ static boolean rci_determine_if_root_cause (
             /*
              * All children pass
              */
-            if (rci_map_function(rule_instance, 
-                                 instance_name,
-                                 RCI_MAP_CHILDREN,
-                                 rci_not_rcc, 
-                                 NULL, TRUE, NULL)) {
+            if (!children.rcc) {
                 /*
                  * No children are root cause candidates.. so this is
                  * the root cause, let the sequencer know so that
                  * recovery actions may be run.
                  */
-                rule_instance->root_cause = RULE_ROOT_CAUSE;
+                rci_set_root_cause(rule_instance, RULE_ROOT_CAUSE);
                 rci_propagate_rule_change(rule_instance, 
                                           MYREFL_RESULT_FAIL); 
                 /*
@@ -1078,7 +1445,7 @@ static boolean rci_determine_if_root_cause (
              * One of the children are failing, so I can't be the 
              * root cause, so am no longer a candidate.
              */
-            rule_instance->root_cause = RULE_ROOT_CAUSE_NOT;
+            rci_set_root_cause(rule_instance, RULE_ROOT_CAUSE_NOT);
             myrefl_trace(rule_instance->obj->i.name,
                          "RCI: Some children of '%s' are failing, clearing RCC", 
                          myrefl_obj_instance_name(rule_instance));
@@ -1112,7 +1479,7 @@ static void rci_handle_passed_rule_status_report (
         /*
          * Can't be a candidate or a root cause if we are passing
          */
-        rule_instance->root_cause = RULE_ROOT_CAUSE_NOT;
+        rci_set_root_cause(rule_instance, RULE_ROOT_CAUSE_NOT);
         myrefl_trace(rule_instance->obj->i.name,
                      "RCI: '%s' is passing, was RC/RCC, clearing RC/RCC", 
                      myrefl_obj_instance_name(rule_instance));
@@ -1125,7 +1492,7 @@ static void rci_handle_passed_rule_status_report (
                            instance_name,
                            RCI_MAP_PARENTS, 
                            rci_determine_if_root_cause, 
-                           NULL, TRUE, NULL);
+                           TRUE, NULL);
 
     if (change_occurred) {
         /*
@@ -1148,6 +1515,8 @@ static void rci_handle_failed_rule_status_report (
     obj_instance_t *rule_instance,
     boolean change_occurred)
 {
+    rci_children_t children;
+
     if (rule_instance->root_cause == RULE_ROOT_CAUSE) {
         /*
          * Got a failure for an existing root cause, nothing to do
@@ -1162,11 +1531,8 @@ static void rci_handle_failed_rule_status_report (
          * whether it is the actual root cause.
          */
         rci_determine_if_root_cause(rule_instance, NULL);
-    } else if (rci_map_function(rule_instance, 
-                                NULL, 
-                                RCI_MAP_CHILDREN,
-                                rci_is_enabled, 
-                                NULL, FALSE, NULL)) {
+    } else if (rci_memo_children(rule_instance->obj, NULL, FALSE, 
+                                 &children), children.enabled) {
         /*
          * There are child dependencies and this rule was not taking
          * part of a prior root cause identification (else it would have
@@ -1186,7 +1552,7 @@ static void rci_handle_failed_rule_status_report (
                      "RCI: Root Cause '%s' due to failing with no children", 
                      myrefl_obj_instance_name(rule_instance)); 
 
-        rule_instance->root_cause = RULE_ROOT_CAUSE;
+        rci_set_root_cause(rule_instance, RULE_ROOT_CAUSE);
         rci_propagate_rule_change(rule_instance, 
                                   MYREFL_RESULT_FAIL); 
         myrefl_seq_from_root_cause(rule_instance); 
@@ -1283,6 +1649,51 @@ void myrefl_rci_run (obj_instance_t *rule_instance, myrefl_result_t result)
     }
 }
 
+/*
+ * myrefl_rci_result_changed()
+ *
+ * The result of one of the rule instances of this object has changed,
+ * forget the cached verdicts above it.
+ */
+void myrefl_rci_result_changed (obj_t *obj)
+{
+    if (obj) {
+        rci_memo_invalidate_above(obj);
+    }
+}
+
+/*
+ * myrefl_rci_depend_changed()
+ *
+ * The dependencies, component contents, instances or the enabled state
+ * of rules or components have changed, forget all the cached verdicts.
+ */
+void myrefl_rci_depend_changed (void)
+{
+    if (++rci_memo_generation == 0) {
+        rci_memo_generation = 1;
+    }
+}
+
+/*
+ * myrefl_rci_memo_free()
+ *
+ * Free the cached verdicts of an object that is being freed.
+ */
+void myrefl_rci_memo_free (obj_t *obj)
+{
+    uint i;
+
+    for (i = 0; i < obj->rci_memo_count; i++) {
+        free(obj->rci_memo[i].instance_name);
+    }
+    free(obj->rci_memo);
+    obj->rci_memo = NULL;
+    obj->rci_memo_count = 0;
+    obj->rci_memo_size = 0;
+    obj->rci_memo_generation = 0;
+}
+
 /*
  * This object is being deleted, removing it may affect which object
  * is a root cause.
@@ -1322,6 +1733,6 @@ void myrefl_rci_rule_deleted (obj_instance_t *rule_instance)
                                instance_name,
                                RCI_MAP_PARENTS, 
                                rci_determine_if_root_cause, 
-                               NULL, TRUE, NULL);
+                               TRUE, NULL);
     }
 }
@@ -45,15 +45,12 @@ typedef enum {
 
 typedef boolean (*rci_map_function_t) (obj_instance_t *rule, void *context);
 
-typedef struct loop_domain_t_ {
-    struct loop_domain_t_ *next;
-    uint number;
-    myrefl_list_t *reachable;
-} loop_domain_t;
-
 extern void myrefl_rci_run(obj_instance_t *rule_instance, 
                            myrefl_result_t result);
 extern boolean myrefl_depend_found_comp(myrefl_list_t *dependencies, 
                                         obj_comp_t *comp);
 extern void myrefl_rci_rule_deleted(obj_instance_t *rule_instance);
+extern void myrefl_rci_result_changed(obj_t *obj);
+extern void myrefl_rci_depend_changed(void);
+extern void myrefl_rci_memo_free(obj_t *obj);
 #endif
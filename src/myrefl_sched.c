@@ -52,7 +52,41 @@ static sched_test_queue_t test_queues[NBR_TEST_QUEUES] =
  {TEST_QUEUE_USER,      "User",      NULL}
 };
 
+/*
+ * Rule instances waiting on a deadline (e.g. fail for time N), ordered
+ * by deadline and driven from the same timer as the test queues, so
+ * that there is one timer however many rules are waiting.
+ */
+static sched_test_queue_t rule_deadline_queue = 
+{TEST_QUEUE_DEADLINE, "Rule Deadline", NULL};
+
+/*
+ * Batched work that the sequencer has asked to be flushed at a given
+ * time, component health publication, aggregated notifications, rate
+ * limited recovery actions and saving the learnt baselines.
+ */
+typedef struct sched_flush_s {
+    boolean pending;
+    xos_time_t time;
+    void (*fn)(void);
+} sched_flush_t;
+
+static sched_flush_t health_flush = { FALSE, { 0, 0 }, myrefl_seq_health_flush };
+static sched_flush_t notify_flush = { FALSE, { 0, 0 }, myrefl_seq_notify_flush };
+static sched_flush_t action_flush = { FALSE, { 0, 0 }, myrefl_seq_action_flush };
+static sched_flush_t baseline_flush = { FALSE, { 0, 0 }, myrefl_seq_baseline_flush };
+static sched_flush_t *sched_flushes[] = { &health_flush, &notify_flush,
+                                          &action_flush, &baseline_flush };
+
+#define NBR_SCHED_FLUSHES ((int)(sizeof(sched_flushes) / sizeof(sched_flushes[0])))
+
 static myrefl_thread_t *sched_thread = NULL;
+
+/*
+ * Held whilst sched_thread is cleared on exit, so that it can be 
+ * safely kicked by clients that don't hold the DB lock.
+ */
+static xos_critical_section_t *sched_thread_lock = NULL;
 static xos_timer_t *test_start_timer = NULL;
 
 static void check_test_start_timer(void);
@@ -72,7 +106,7 @@ static void dequeue_test_for_start (sched_test_queue_t *test_queue)
     obj_test_t *test;
     obj_instance_t *instance;
     
-    sched_test = myrefl_list_pop(test_queue->queue);
+    sched_test = myrefl_queue_pop(test_queue->queue);
 
     if (!sched_test) {
         myrefl_error("SCHED no scheduled test");
@@ -164,7 +198,7 @@ static void check_queue_test_times (void)
         for (q = TEST_QUEUE_FIRST; q < NBR_TEST_QUEUES; q++) {
             test_queue = &test_queues[q];
             
-            sched_test = myrefl_list_peek(test_queue->queue);
+            sched_test = myrefl_queue_peek(test_queue->queue);
             
             if (sched_test && XOS_TIME_LT(sched_test->next_time, time_now)) {
                 //myrefl_debug(NULL, "SCHED check queues (detect) %s starting test %s",
@@ -175,6 +209,25 @@ static void check_queue_test_times (void)
         }
     } while (found);
 
+    /*
+     * And any rules whose deadlines have passed, let the sequencer
+     * re-evaluate them.
+     */
+    while ((sched_test = myrefl_queue_peek(rule_deadline_queue.queue)) != NULL &&
+           XOS_TIME_LT(sched_test->next_time, time_now)) {
+        myrefl_queue_pop(rule_deadline_queue.queue);
+        sched_test->queued = TEST_QUEUE_NONE;
+        myrefl_seq_from_rule_deadline(sched_test->instance);
+    }
+
+    for (q = 0; q < NBR_SCHED_FLUSHES; q++) {
+        if (sched_flushes[q]->pending && 
+            XOS_TIME_LT(sched_flushes[q]->time, time_now)) {
+            sched_flushes[q]->pending = FALSE;
+            sched_flushes[q]->fn();
+        }
+    }
+
     /*
      * Restart the timer for the next test.
      */
@@ -226,7 +279,14 @@ static void sched_thread_main (myrefl_thread_t *thread)
     }
     test_start_timer = myrefl_xos_timer_create(test_start_timer_expired, NULL);
 
+    /*
+     * Anything queued before we were running, the queues and rule
+     * deadlines are protected by the DB lock.
+     */
+    myrefl_obj_db_lock();
     check_queue_test_times();
+    myrefl_api_notify_drain();
+    myrefl_obj_db_unlock();
 
     while (!sched_thread->quit) {
         myrefl_debug(NULL, "SCHED event thread about to wait");
@@ -235,6 +295,7 @@ static void sched_thread_main (myrefl_thread_t *thread)
         switch (event) {
         case XOS_EVENT_TEST_START:
             myrefl_obj_db_lock();
+            myrefl_api_notify_drain();
             check_queue_test_times();
             myrefl_obj_db_unlock();
             break;
@@ -248,9 +309,12 @@ static void sched_thread_main (myrefl_thread_t *thread)
     }
     myrefl_debug(NULL, "Schedular thread exited");
 
-    myrefl_xos_thread_destroy(sched_thread);
-    free(sched_thread);
+    myrefl_xos_critical_section_enter(sched_thread_lock);
     sched_thread = NULL;
+    myrefl_xos_critical_section_exit(sched_thread_lock);
+
+    myrefl_xos_thread_destroy(thread);
+    free(thread);
 }
 
 /*
@@ -258,11 +322,18 @@ static void sched_thread_main (myrefl_thread_t *thread)
  */
 static void create_queues (void)
 {
-    test_queues[TEST_QUEUE_IMMEDIATE].queue = myrefl_list_create();
-    test_queues[TEST_QUEUE_FAST].queue = myrefl_list_create();
-    test_queues[TEST_QUEUE_NORMAL].queue = myrefl_list_create();
-    test_queues[TEST_QUEUE_SLOW].queue = myrefl_list_create();
-    test_queues[TEST_QUEUE_USER].queue = myrefl_list_create();
+    test_queues[TEST_QUEUE_IMMEDIATE].queue =
+        myrefl_queue_create(MYREFL_QUEUE_OFFSET(sched_test_t, link));
+    test_queues[TEST_QUEUE_FAST].queue =
+        myrefl_queue_create(MYREFL_QUEUE_OFFSET(sched_test_t, link));
+    test_queues[TEST_QUEUE_NORMAL].queue =
+        myrefl_queue_create(MYREFL_QUEUE_OFFSET(sched_test_t, link));
+    test_queues[TEST_QUEUE_SLOW].queue =
+        myrefl_queue_create(MYREFL_QUEUE_OFFSET(sched_test_t, link));
+    test_queues[TEST_QUEUE_USER].queue =
+        myrefl_queue_create(MYREFL_QUEUE_OFFSET(sched_test_t, link));
+    rule_deadline_queue.queue =
+        myrefl_queue_create(MYREFL_QUEUE_OFFSET(sched_test_t, link));
 }
 
 static void destroy_queues (void)
@@ -275,11 +346,17 @@ static void destroy_queues (void)
 
 	for (q = TEST_QUEUE_FIRST; q < NBR_TEST_QUEUES; q++) {
 		test_queue = &test_queues[q];
-		while ((sched_test = myrefl_list_pop(test_queue->queue)) != NULL) {
+		while ((sched_test = myrefl_queue_pop(test_queue->queue)) != NULL) {
 			sched_test->queued = TEST_QUEUE_NONE;
 		}
-		myrefl_list_free(test_queue->queue);
+		myrefl_queue_free(test_queue->queue);
 	}
+
+	while ((sched_test = myrefl_queue_pop(rule_deadline_queue.queue)) != NULL) {
+		sched_test->queued = TEST_QUEUE_NONE;
+	}
+	myrefl_queue_free(rule_deadline_queue.queue);
+	rule_deadline_queue.queue = NULL;
 }
 /*
  * Check all the queues and start/restart the test start timer if necessary
@@ -287,7 +364,7 @@ static void destroy_queues (void)
 static void check_test_start_timer (void)
 {
     int q;
-    sched_test_queue_t *soonest_queue = NULL;
+    boolean found = FALSE;
     xos_time_t soonest_time;
     sched_test_t *sched_test;
 
@@ -307,24 +384,38 @@ static void check_test_start_timer (void)
      * (which may be in the past in some conditions)
      */
     for (q = TEST_QUEUE_FIRST; q < NBR_TEST_QUEUES; q++) {
-        sched_test = myrefl_list_peek(test_queues[q].queue);
+        sched_test = myrefl_queue_peek(test_queues[q].queue);
 
         if (!sched_test) {
             continue;
         }
 
-        if (!soonest_queue || 
-            XOS_TIME_LT(sched_test->next_time, soonest_time)) {
-            soonest_queue = &test_queues[q];
+        if (!found || XOS_TIME_LT(sched_test->next_time, soonest_time)) {
+            found = TRUE;
             soonest_time = sched_test->next_time;
         }
     }
 
-    if (soonest_queue) {
+    sched_test = myrefl_queue_peek(rule_deadline_queue.queue);
+
+    if (sched_test &&
+        (!found || XOS_TIME_LT(sched_test->next_time, soonest_time))) {
+        found = TRUE;
+        soonest_time = sched_test->next_time;
+    }
+
+    for (q = 0; q < NBR_SCHED_FLUSHES; q++) {
+        if (sched_flushes[q]->pending &&
+            (!found || XOS_TIME_LT(sched_flushes[q]->time, soonest_time))) {
+            found = TRUE;
+            soonest_time = sched_flushes[q]->time;
+        }
+    }
+
+    if (found) {
         xos_time_t time_now, delay;
 
         myrefl_xos_time_set_now(&time_now);
-        sched_test = myrefl_list_peek(soonest_queue->queue);
 
         if (XOS_TIME_LT(soonest_time, time_now)) {
             /*
@@ -338,14 +429,16 @@ static void check_test_start_timer (void)
             //             "releasing thread to run %s",
             //             sched_test->instance->name);
 
-            myrefl_xos_thread_release(sched_thread->xos);
+            if (sched_thread) {
+                myrefl_xos_thread_release(sched_thread->xos);
+            }
 
         } else {
             //myrefl_debug(NULL, "SCHED check test start - '%s', now=%lu, then=%lu",
             //             sched_test->instance->name, time_now.sec, 
             //             sched_test->next_time.sec);
 
-            myrefl_xos_time_diff(&time_now, &sched_test->next_time, &delay);
+            myrefl_xos_time_diff(&time_now, &soonest_time, &delay);
             /*
              * An extra bit of padding so that we expire just a bit later 
              * (1s) than the test is due to start.
@@ -377,9 +470,8 @@ void myrefl_sched_add_test (obj_instance_t *instance, boolean force)
 {
     test_queue_t queue_e;
     sched_test_queue_t *test_queue = NULL;
-    sched_test_t *sched_test, *list_sched_test;
+    sched_test_t *sched_test, *list_sched_test, *prev_sched_test;
     obj_test_t *test;
-    myrefl_list_element_t *curr_element, *prev_list_element;
     ulong period = 0;
     ulong period_sec = 0;
     ulong period_nsec = 0;
@@ -465,8 +557,8 @@ void myrefl_sched_add_test (obj_instance_t *instance, boolean force)
         /*
          * remove from the current queue
          */
-        if (myrefl_list_remove(test_queues[sched_test->queued].queue, 
-                               sched_test)) {
+        if (myrefl_queue_remove(test_queues[sched_test->queued].queue, 
+                                sched_test)) {
             sched_test->queued = queue_e;
         }
     }  else {
@@ -492,20 +584,20 @@ void myrefl_sched_add_test (obj_instance_t *instance, boolean force)
          * at the appropriate point. Search forwards from the head
          * to improve the performance on tests at high frequencies.
          */
-        curr_element = test_queue->queue->head;
-        prev_list_element = NULL;
-        while(curr_element) {
-            list_sched_test = curr_element->data;
+        list_sched_test = myrefl_queue_peek(test_queue->queue);
+        prev_sched_test = NULL;
+        while(list_sched_test) {
             if (XOS_TIME_LT(sched_test->next_time,
                             list_sched_test->next_time)) {
                 break;
             }
-            prev_list_element = curr_element;
-            curr_element = curr_element->next;
+            prev_sched_test = list_sched_test;
+            list_sched_test = myrefl_queue_next(test_queue->queue,
+                                                list_sched_test);
         }
-        myrefl_list_insert(test_queue->queue, prev_list_element, sched_test);
+        myrefl_queue_insert(test_queue->queue, prev_sched_test, sched_test);
     } else {
-        myrefl_list_push(test_queue->queue, sched_test);
+        myrefl_queue_push(test_queue->queue, sched_test);
     }
     myrefl_debug(instance->obj->i.name,
                  "SCHED %s queue added test '%s' to run in %lus %luns",
@@ -624,7 +716,7 @@ void myrefl_sched_test_immediate (obj_instance_t *test_instance)
 
     sched_test->queued = TEST_QUEUE_IMMEDIATE;
 
-    myrefl_list_push(test_queue->queue, sched_test);
+    myrefl_queue_push(test_queue->queue, sched_test);
 
     myrefl_debug(test_instance->obj->i.name,
                  "SCHED %s queue added test %s to run immediately",
@@ -633,6 +725,174 @@ void myrefl_sched_test_immediate (obj_instance_t *test_instance)
     check_test_start_timer();
 }
 
+/*
+ * myrefl_sched_rule_deadline()
+ *
+ * Ask for this rule instance to be handed back to the sequencer in
+ * delay_ms, replacing any deadline that it already had. Use 
+ * myrefl_sched_remove_test() to cancel the deadline.
+ */
+void myrefl_sched_rule_deadline (obj_instance_t *rule_instance, 
+                                 ulong delay_ms)
+{
+    sched_test_t *sched_test, *list_sched_test, *prev_sched_test;
+
+    if (!myrefl_obj_instance_validate(rule_instance, OBJ_TYPE_RULE)) {
+        myrefl_error("Scheduler passed invalid rule instance");
+        return;
+    }
+
+    if (!rule_deadline_queue.queue || queues_blocked) {
+        myrefl_debug(rule_instance->obj->i.name,
+                     "Ignoring rule '%s' deadline, blocked", 
+                     myrefl_obj_instance_name(rule_instance));
+        return;
+    }
+
+    sched_test = &rule_instance->sched_test;
+
+    if (sched_test->queued == TEST_QUEUE_DEADLINE) {
+        myrefl_queue_remove(rule_deadline_queue.queue, sched_test);
+    }
+
+    myrefl_xos_time_set_now(&sched_test->next_time);
+    sched_test->next_time.sec += delay_ms / 1000;
+    sched_test->next_time.nsec += (delay_ms % 1000) * 1e6;
+    if (sched_test->next_time.nsec >= 1e9) {
+        sched_test->next_time.sec++;
+        sched_test->next_time.nsec -= 1e9;
+    }
+
+    /*
+     * Insert in deadline order. Rules with the same N arrive in deadline
+     * order, so check the tail first and append where we can.
+     */
+    list_sched_test = myrefl_queue_peek(rule_deadline_queue.queue);
+    prev_sched_test = myrefl_queue_peek_tail(rule_deadline_queue.queue);
+    if (prev_sched_test &&
+        !XOS_TIME_LT(sched_test->next_time, prev_sched_test->next_time)) {
+        list_sched_test = NULL;
+    } else {
+        prev_sched_test = NULL;
+    }
+    while(list_sched_test) {
+        if (XOS_TIME_LT(sched_test->next_time,
+                        list_sched_test->next_time)) {
+            break;
+        }
+        prev_sched_test = list_sched_test;
+        list_sched_test = myrefl_queue_next(rule_deadline_queue.queue,
+                                            list_sched_test);
+    }
+    myrefl_queue_insert(rule_deadline_queue.queue, prev_sched_test, 
+                        sched_test);
+    sched_test->queued = TEST_QUEUE_DEADLINE;
+
+    myrefl_debug(rule_instance->obj->i.name,
+                 "SCHED %s queue added rule '%s' in %lums",
+                 rule_deadline_queue.name, 
+                 myrefl_obj_instance_name(rule_instance), delay_ms);
+
+    check_test_start_timer();
+}
+
+/*
+ * sched_flush_request()
+ *
+ * Ask for the flush to be called in delay_ms, or sooner if it is 
+ * already pending for an earlier time. Returns FALSE if the scheduler 
+ * can't do that right now, in which case the caller should flush 
+ * immediately.
+ */
+static boolean sched_flush_request (sched_flush_t *flush, ulong delay_ms)
+{
+    xos_time_t flush_time;
+
+    if (!test_start_timer || queues_blocked) {
+        return (FALSE);
+    }
+
+    myrefl_xos_time_set_now(&flush_time);
+    flush_time.sec += delay_ms / 1000;
+    flush_time.nsec += (delay_ms % 1000) * 1e6;
+    if (flush_time.nsec >= 1e9) {
+        flush_time.sec++;
+        flush_time.nsec -= 1e9;
+    }
+
+    if (flush->pending && !XOS_TIME_LT(flush_time, flush->time)) {
+        return (TRUE);
+    }
+
+    flush->time = flush_time;
+    flush->pending = TRUE;
+
+    check_test_start_timer();
+    return (TRUE);
+}
+
+/*
+ * myrefl_sched_health_flush()
+ *
+ * Ask for the sequencer's batched component health to be published
+ * in delay_ms.
+ */
+boolean myrefl_sched_health_flush (ulong delay_ms)
+{
+    return (sched_flush_request(&health_flush, delay_ms));
+}
+
+/*
+ * myrefl_sched_notify_flush()
+ *
+ * Ask for the sequencer's aggregated notifications that are due to be
+ * fed to the rules in delay_ms.
+ */
+boolean myrefl_sched_notify_flush (ulong delay_ms)
+{
+    return (sched_flush_request(&notify_flush, delay_ms));
+}
+
+/*
+ * myrefl_sched_action_flush()
+ *
+ * Ask for the sequencer's rate limited recovery actions to be looked at
+ * again in delay_ms, when the next one may start.
+ */
+boolean myrefl_sched_action_flush (ulong delay_ms)
+{
+    return (sched_flush_request(&action_flush, delay_ms));
+}
+
+/*
+ * myrefl_sched_baseline_flush()
+ *
+ * Ask for the sequencer's learnt baselines to be saved in delay_ms.
+ */
+boolean myrefl_sched_baseline_flush (ulong delay_ms)
+{
+    return (sched_flush_request(&baseline_flush, delay_ms));
+}
+
+/*
+ * myrefl_sched_kick()
+ *
+ * Wake the scheduler so that it drains the notify queue, may be called
+ * without the DB lock.
+ */
+void myrefl_sched_kick (void)
+{
+    if (!sched_thread_lock) {
+        return;
+    }
+
+    myrefl_xos_critical_section_enter(sched_thread_lock);
+    if (sched_thread && sched_thread->xos) {
+        myrefl_xos_thread_release(sched_thread->xos);
+    }
+    myrefl_xos_critical_section_exit(sched_thread_lock);
+}
+
 /*
  * myrefl_sched_remove_test()
  *
@@ -640,9 +900,14 @@ void myrefl_sched_test_immediate (obj_instance_t *test_instance)
  */
 void myrefl_sched_remove_test (obj_instance_t *instance)
 {
-    if (instance && instance->sched_test.queued != TEST_QUEUE_NONE) {
-        if (myrefl_list_remove(test_queues[instance->sched_test.queued].queue, 
-                               &instance->sched_test)) {
+    if (instance && instance->sched_test.queued == TEST_QUEUE_DEADLINE) {
+        if (myrefl_queue_remove(rule_deadline_queue.queue, 
+                                &instance->sched_test)) {
+            instance->sched_test.queued = TEST_QUEUE_NONE;
+        }
+    } else if (instance && instance->sched_test.queued != TEST_QUEUE_NONE) {
+        if (myrefl_queue_remove(test_queues[instance->sched_test.queued].queue, 
+                                &instance->sched_test)) {
             instance->sched_test.queued = TEST_QUEUE_NONE;
         }
     } 
@@ -672,6 +937,14 @@ static void myrefl_sched_start (void)
         return;
     }
 
+    if (!sched_thread_lock) {
+        sched_thread_lock = myrefl_xos_critical_section_create();
+        if (!sched_thread_lock) {
+            myrefl_error("Failed to create schedular thread lock");
+            return;
+        }
+    }
+
     /*
      * Create the main schedular thread.
      */
@@ -724,7 +997,7 @@ static myrefl_result_t recover_schedular (const char *instance_name,
 
     for (q = TEST_QUEUE_FIRST; q < NBR_TEST_QUEUES; q++) {
         test_queue = &test_queues[q];
-        while ((sched_test = myrefl_list_pop(test_queue->queue)) != NULL) {
+        while ((sched_test = myrefl_queue_pop(test_queue->queue)) != NULL) {
             sched_test->queued = TEST_QUEUE_NONE;
         }
     }
@@ -46,6 +46,7 @@ typedef enum test_queue_e {
     TEST_QUEUE_USER,
     NBR_TEST_QUEUES,
     TEST_QUEUE_NONE,
+    TEST_QUEUE_DEADLINE,  /* rule instance waiting on a deadline */
 } test_queue_t;
 
 struct sched_test_s {
@@ -53,12 +54,13 @@ struct sched_test_s {
     test_queue_t queued; 
     xos_time_t last_time;
     xos_time_t next_time;
+    myrefl_link_t link;        /* on test_queues[queued] */
 };
 
 typedef struct sched_test_queue_s {
     test_queue_t type;
     const char *name;
-    myrefl_list_t *queue;
+    myrefl_queue_t *queue;
 } sched_test_queue_t;
 
 void myrefl_sched_init(void);
@@ -68,5 +70,12 @@ void myrefl_sched_remove_test(obj_instance_t *test_instance);
 void myrefl_sched_kill(void);
 void myrefl_sched_rule_immediate(obj_instance_t *rule_instance);
 void myrefl_sched_test_immediate(obj_instance_t *test_instance);
+void myrefl_sched_rule_deadline(obj_instance_t *rule_instance, 
+                                ulong delay_ms);
+boolean myrefl_sched_health_flush(ulong delay_ms);
+boolean myrefl_sched_notify_flush(ulong delay_ms);
+boolean myrefl_sched_action_flush(ulong delay_ms);
+boolean myrefl_sched_baseline_flush(ulong delay_ms);
+void myrefl_sched_kick(void);
 
 #endif
@@ -53,6 +53,7 @@ typedef enum seq_event_t_ {
     SEQ_RULE_PROCESS_INPUT,
     SEQ_RULE_RUN,
     SEQ_RULE_RUN_RCI,
+    SEQ_RULE_DEADLINE,
     SEQ_RULE_RESULT,
     SEQ_RCI_RUN,
     SEQ_RULE_ROOT_CAUSE,
@@ -73,80 +74,198 @@ typedef struct {
 } seq_thread_context_t;
 
 static myrefl_list_t *free_seq_contexts = NULL;
-
-static unsigned char *bitvalues = NULL;
+static seq_thread_context_t seq_reserve_contexts[SEQUENCE_CONTEXT_RESERVE];
+static boolean seq_reserve_used[SEQUENCE_CONTEXT_RESERVE];
 
 /*
- * bit_count()
+ * seq_batch
  *
- * Fast lookup of how many bits are set in "data". We do this by generating
- * an array of the counts for all values in a byte, that allows us to do
- * an array lookup rather than counting the bits every time.
+ * Test results that run one after another in a single sequencer job, 
+ * each instance having been marked active for the job as it was added.
+ */
+typedef struct {
+    obj_instance_t *instance;
+    myrefl_result_t result;
+    long value;
+} seq_batch_entry_t;
+
+struct seq_batch_s {
+    uint count;
+    uint max;
+    seq_batch_entry_t entries[];
+};
+
+/*
+ * A component waiting for its health to be published, sorted by depth.
+ */
+typedef struct {
+    obj_comp_t *comp;
+    int depth;
+} seq_dirty_comp_t;
+
+/*
+ * Components whose health has changed since it was last published, and
+ * how often they are published (0 to publish every change immediately).
+ */
+static myrefl_list_t *seq_dirty_comps = NULL;
+static uint seq_health_interval = SEQ_HEALTH_INTERVAL;
+
+/*
+ * A baseline loaded from the baseline file that is waiting for its rule
+ * instance to be run.
+ */
+typedef struct {
+    char *rule;
+    char *instance;                  // Empty for the base instance
+    int slot;
+    obj_rule_baseline_t baseline;
+} seq_baseline_record_t;
+
+/*
+ * Where the baselines are persisted, the loaded baselines not yet 
+ * claimed by their instance, and whether any baseline has changed since
+ * they were last written.
+ */
+static char *seq_baseline_file = NULL;
+static myrefl_list_t *seq_baseline_records = NULL;
+static boolean seq_baseline_dirty = FALSE;
+static unsigned long long seq_baseline_saved = 0;
+
+/*
+ * The baselines as they were when last taken, written to the file 
+ * without the DB lock. Snapshots are numbered so that an older one
+ * can't overwrite a newer one if their writes cross.
+ */
+struct seq_baseline_snapshot_s {
+    char *filename;
+    myrefl_list_t *records;          // of seq_baseline_record_t
+    uint generation;
+};
+
+static uint seq_baseline_generation = 0;
+static uint seq_baseline_written = 0;
+static xos_critical_section_t *seq_baseline_write_lock = NULL;
+
+/*
+ * Test instances with an open notification aggregation window, in the
+ * order that their windows close.
+ */
+static myrefl_list_t *seq_notify_pending = NULL;
+
+/*
+ * Limits on recovery actions and the actions waiting on them, in the 
+ * order that they were requested. The token bucket holds 
+ * SEQ_ACTION_TOKEN per action that may start, topped up by seq_action_rate
+ * every ms.
+ */
+#define SEQ_ACTION_TOKEN (60 * 1000)
+
+static uint seq_action_max_running = SEQ_ACTION_MAX_RUNNING;
+static uint seq_action_rate = SEQ_ACTION_RATE;
+static uint seq_action_burst = SEQ_ACTION_BURST;
+static uint seq_action_running = 0;
+static unsigned long long seq_action_tokens = SEQ_ACTION_BURST * SEQ_ACTION_TOKEN;
+static unsigned long long seq_action_refilled = 0;
+static myrefl_list_t *seq_action_queue = NULL;
+
+/*
+ * seq_comp_settled()
  *
- * i.e. tradeoff memory for performance.
+ * Whether the confidence of this component and all its parents has
+ * caught up with their health, in which case recalculating the health
+ * for an unchanged rule result would not change anything.
  */
-static unsigned char bit_count (unsigned char data)
+static boolean seq_comp_settled (obj_comp_t *comp)
 {
-    unsigned char count = 0;
-    int i, j;
-
-    if (!bitvalues) {
-        unsigned char val;
-        bitvalues = (unsigned char*)malloc(256 * sizeof(unsigned char));
-        if (bitvalues) {
-            for(j = 0; j <= 255; j++) {
-                val = j;
-                count = 0;
-                for(i = 0; i < 8; i++) {
-                    if (val & 1) count++;
-                    val = val >> 1;
-                }
-                bitvalues[j] = count;
-            }
+    for (; comp; comp = comp->obj->parent_comp) {
+        if (comp->confidence < comp->health) {
+            return (FALSE);
         }
     }
+    return (TRUE);
+}
 
-    if (bitvalues) {
-        return(bitvalues[data]);
-    } else {
-        return(0);
+/*
+ * seq_obj_health_counted()
+ *
+ * Where the amount of health that a rule or component is currently
+ * taking away from its parent component is kept.
+ */
+static int *seq_obj_health_counted (obj_t *obj)
+{
+    switch (obj->type) {
+    case OBJ_TYPE_RULE:
+        return (obj->t.rule ? &obj->t.rule->health_counted : NULL);
+    case OBJ_TYPE_COMP:
+        return (obj->t.comp ? &obj->t.comp->health_counted : NULL);
+    default:
+        return (NULL);
     }
 }
 
-static void seq_comp_health (obj_comp_t *comp, int health_delta)
+/*
+ * seq_obj_health_desired()
+ *
+ * How much health this rule or component should be taking away from
+ * its parent component given its current state. A failing rule takes
+ * its severity and a component takes its own lack of health.
+ */
+static int seq_obj_health_desired (obj_t *obj)
 {
-    int increment;
-    myrefl_list_element_t *element;
-    obj_t *obj;
-    int health = 1000;
-
-    /*
-     * Calculate the health of the component by taking 1000 and
-     * then taking away the severity of all the failing rules
-     * and components that are a member of it.
-     */
-    obj = myrefl_obj_get_first_rel(comp->obj, OBJ_REL_RULE);
+    if (!obj->parent_comp || obj->i.state != OBJ_STATE_ENABLED) {
+        return (0);
+    }
 
-    while(obj) {
-        if (myrefl_obj_validate(obj, OBJ_TYPE_RULE) &&
-            obj->i.state == OBJ_STATE_ENABLED &&
-            obj->i.last_result == MYREFL_RESULT_FAIL) {
-            health -= obj->t.rule->severity;
+    switch (obj->type) {
+    case OBJ_TYPE_RULE:
+        if (obj->i.last_result == MYREFL_RESULT_FAIL) {
+            return (obj->t.rule->severity);
         }
-        obj = myrefl_obj_get_next_rel(obj, OBJ_REL_NEXT_IN_COMP);
+        break;
+    case OBJ_TYPE_COMP:
+        return (1000 - obj->t.comp->health);
+    default:
+        break;
     }
+    return (0);
+}
 
-    obj = myrefl_obj_get_first_rel(comp->obj, OBJ_REL_COMP);
+/*
+ * seq_obj_health_delta()
+ *
+ * Record that "obj" now takes "desired" off its parent and return the
+ * change in health that the parent has to apply as a result.
+ */
+static int seq_obj_health_delta (obj_t *obj, int desired)
+{
+    int *counted;
+    int health_delta;
 
-    while(obj) {
-        if (myrefl_obj_validate(obj, OBJ_TYPE_COMP) &&
-            obj->i.state == OBJ_STATE_ENABLED) {
-            health -= (1000 - obj->t.comp->health);
-        }
-        obj = myrefl_obj_get_next_rel(obj, OBJ_REL_NEXT_IN_COMP);
+    counted = seq_obj_health_counted(obj);
+    if (!counted) {
+        return (0);
     }
+    health_delta = *counted - desired;
+    *counted = desired;
+    return (health_delta);
+}
+
+/*
+ * seq_comp_health_publish()
+ *
+ * Bring the confidence of a component up to date with its health and,
+ * if the health has changed since it was last published, let any
+ * interested tests and clients know.
+ */
+static void seq_comp_health_publish (obj_comp_t *comp)
+{
+    int increment;
+    myrefl_list_element_t *element;
+    obj_t *obj;
 
-    comp->health = health;
+    if (comp->obj->i.state == OBJ_STATE_DELETED) {
+        return;
+    }
 
     /*
      * Confidence is always as low as the health, and then rises
@@ -191,6 +310,85 @@ static void seq_comp_health (obj_comp_t *comp, int health_delta)
         comp->confidence = 1000;
     }
 
+    if (comp->health == comp->health_published) {
+        return;
+    }
+
+    myrefl_debug(comp->obj->i.name,
+                 "Set Health on %s to %d (change %d)", 
+                 comp->obj->i.name,
+                 comp->health, comp->health - comp->health_published);
+
+    comp->health_published = comp->health;
+
+    /*
+     * Notify interested tests of the health change
+     */
+    for (element = comp->interested_test_objs->head;
+         element != NULL;
+         element = element->next) {
+        obj = element->data;
+        if (myrefl_obj_validate(obj, OBJ_TYPE_TEST)) {
+            myrefl_seq_from_test_notify(&obj->i, MYREFL_RESULT_VALUE, 
+                                        comp->health);
+        }
+    }
+    /* Notify result to interested clients */
+    /* TODO. To be added once component health notification is supported */
+    myrefl_xos_notify_component_health(comp->obj->i.name, comp->health);
+}
+
+/*
+ * seq_comp_health_dirty()
+ *
+ * The health of this component has been touched. Either publish it now,
+ * or when batching, remember it until the next health interval so that
+ * a burst of rule results is published once per component.
+ */
+static void seq_comp_health_dirty (obj_comp_t *comp)
+{
+    if (seq_health_interval == 0 || !seq_dirty_comps) {
+        seq_comp_health_publish(comp);
+        return;
+    }
+
+    if (comp->health_dirty) {
+        return;
+    }
+
+    if (!myrefl_list_push(seq_dirty_comps, comp)) {
+        /*
+         * No memory to batch it, publish now instead.
+         */
+        seq_comp_health_publish(comp);
+        return;
+    }
+    comp->health_dirty = TRUE;
+
+    if (!myrefl_sched_health_flush(seq_health_interval)) {
+        /*
+         * Scheduler isn't running, nothing would publish it later.
+         */
+        myrefl_seq_health_flush();
+    }
+}
+
+/*
+ * seq_comp_health()
+ *
+ * Apply a change in health to a component and then pass the resulting
+ * change in its deficit up to the parent component.
+ *
+ * The health of a component is 1000 less the severity of all the
+ * failing rules and the deficit of all the components that are a member
+ * of it. Each member remembers what it is currently counted for
+ * (health_counted) so the health is maintained as a running total, which
+ * keeps a rule transition O(depth) rather than O(members) at each level.
+ */
+static void seq_comp_health (obj_comp_t *comp, int health_delta)
+{
+    comp->health += health_delta;
+
     switch(-health_delta) {
     case MYREFL_SEVERITY_CATASTROPHIC:
         comp->catastrophic++;
@@ -222,33 +420,13 @@ static void seq_comp_health (obj_comp_t *comp, int health_delta)
         break;
     }
 
-    myrefl_debug(comp->obj->i.name,
-                 "Set Health on %s to %d (change %d)", 
-                 comp->obj->i.name,
-                 comp->health, health_delta);
-
-    /*
-     * Notify interested tests of the health change
-     */
-    if (health_delta != 0) {
-        for (element = comp->interested_test_objs->head;
-             element != NULL;
-             element = element->next) {
-            obj = element->data;
-            if (myrefl_obj_validate(obj, OBJ_TYPE_TEST)) {
-                myrefl_seq_from_test_notify(&obj->i, MYREFL_RESULT_VALUE, 
-                                            comp->health);
-            }
-        }
-        /* Notify result to interested clients */
-        /* TODO. To be added once component health notification is supported */
-        myrefl_xos_notify_component_health(comp->obj->i.name, comp->health);
-    }
+    seq_comp_health_dirty(comp);
                                                                    
     /* apply the change to the parent component in a recursive fashion */
     if (comp->obj->parent_comp) {
-        /* later we should normalize the health_delta */
-        seq_comp_health(comp->obj->parent_comp, health_delta);
+        seq_comp_health(comp->obj->parent_comp,
+                        seq_obj_health_delta(comp->obj,
+                                             seq_obj_health_desired(comp->obj)));
     }
 }
 
@@ -332,6 +510,17 @@ static void seq_stats_update (obj_instance_t *instance,
 
     if (base_stats) base_stats->runs++;
 
+    switch (result) {
+    case MYREFL_RESULT_PASS:
+    case MYREFL_RESULT_FAIL:
+    case MYREFL_RESULT_ABORT:
+    case MYREFL_RESULT_VALUE:
+        myrefl_obj_series_add(instance, result, value);
+        break;
+    default:
+        break;
+    }
+
     switch (result) {
     case MYREFL_RESULT_PASS:
         stats->passes++;
@@ -441,6 +630,10 @@ static void seq_stats_update (obj_instance_t *instance,
         }
     }
 
+    if (result_changed && instance->obj->type == OBJ_TYPE_RULE) {
+        myrefl_rci_result_changed(instance->obj);
+    }
+
     /* Notify results to interested clients if they have registered to receive
      * notification.
      */ 
@@ -521,46 +714,58 @@ static void seq_result_stats_update (obj_instance_t *instance,
  * severity, not multipled by the number of instances that 
  * are failing.
  */
-static void seq_rule_result_on_health (obj_instance_t *instance,
-                                       myrefl_result_t result)
+static void seq_rule_result_on_health (obj_instance_t *instance)
 {
     obj_comp_t *comp;
-    obj_rule_t *rule;
+    int health_delta;
 
     if (!myrefl_obj_instance_validate(instance, OBJ_TYPE_ANY)) {
         return;
     }
 
-    rule = instance->obj->t.rule;
     comp = instance->obj->parent_comp;
+    if (!comp) {
+        return;
+    }
+
+    /*
+     * Work out the change from what this rule was previously counted
+     * for, rather than trusting the transition in "result", so that any
+     * state or severity change since then is picked up here as well.
+     */
+    health_delta = seq_obj_health_delta(instance->obj,
+                                        seq_obj_health_desired(instance->obj));
 
     /*
      * if the test result is the same as the previous test result
      * then there is no change to the health of the component, but
      * there maybe change in the confidence.
      */
-    if (instance->last_result_count > 1) {
-        seq_comp_health(comp, 0);
-        return;
+    if (health_delta == 0 && instance->last_result_count > 1) {
+        if ((instance->obj->i.flags.rule & MYREFL_RULE_PROPAGATE_ON_CHANGE) &&
+            seq_comp_settled(comp)) {
+            return;
+        }
     }
 
-    switch(result) {
-    case  MYREFL_RESULT_PASS:
-        /*
-         * We've changed from met to not met, so increment the health.
-         */
-        seq_comp_health(comp, rule->severity);
-        break;
-    case MYREFL_RESULT_FAIL:
-        /*
-         * We've changed from not met, to met the conditions for this 
-         * rule, so decrement the health.
-         */
-        seq_comp_health(comp, -rule->severity);
-        break;
-    default:
-        break;
-    }
+    seq_comp_health(comp, health_delta);
+}
+
+/*
+ * seq_rule_unchanged()
+ *
+ * Whether this rule only propagates changes and has just repeated its
+ * previous result, in which case there is nothing new to tell the 
+ * output rules or RCI. A root cause candidate is still waiting on 
+ * results so always goes through to RCI.
+ */
+static boolean seq_rule_unchanged (obj_instance_t *instance,
+                                   myrefl_result_t rule_result)
+{
+    return ((instance->obj->i.flags.rule & MYREFL_RULE_PROPAGATE_ON_CHANGE) &&
+            rule_result == instance->last_result &&
+            instance->last_result_count > 1 &&
+            instance->root_cause != RULE_ROOT_CAUSE_CANDIDATE);
 }
 
 /*
@@ -610,323 +815,2057 @@ myrefl_result_t myrefl_seq_test_run (obj_instance_t *instance, long *value)
     return (result);
 }
 
-static myrefl_result_t seq_rule_run (obj_instance_t *instance,
-                                     myrefl_result_t result,
-                                     long value)
+/*
+ * seq_time_now_ms()
+ *
+ * Current time in milliseconds.
+ */
+static unsigned long long seq_time_now_ms (void)
 {
-    myrefl_result_t rule_result = MYREFL_RESULT_PASS;
-    obj_rule_t *rule;
-    obj_t *obj;
-    obj_instance_t *input_instance;
-    myrefl_list_element_t *element;
+    xos_time_t now;
 
-    if (!myrefl_obj_instance_validate(instance, OBJ_TYPE_RULE)) {
-        return(MYREFL_RESULT_ABORT);
+    myrefl_xos_time_set_now(&now);
+
+    return (((unsigned long long)now.sec * 1000) + (now.nsec / 1000000));
+}
+
+/*
+ * seq_baseline_record_free()
+ */
+static void seq_baseline_record_free (seq_baseline_record_t *record)
+{
+    free(record->rule);
+    free(record->instance);
+    free(record);
+}
+
+/*
+ * seq_baseline_instance_name()
+ *
+ * Name to key the baseline for this instance on, the base instance has
+ * no name of its own.
+ */
+static const char *seq_baseline_instance_name (obj_instance_t *instance)
+{
+    if (instance == &instance->obj->i || !instance->name) {
+        return ("");
     }
+    return (instance->name);
+}
 
-    obj = instance->obj;
-    rule = obj->t.rule;
+/*
+ * seq_baseline_restore()
+ *
+ * Claim any baselines loaded from the file for this instance, skipping
+ * the learning for them.
+ */
+static void seq_baseline_restore (obj_instance_t *instance,
+                                  obj_rule_data_t *rule_data)
+{
+    myrefl_list_element_t *element, *next;
+    seq_baseline_record_t *record;
+    const char *instance_name;
 
-    switch (rule->operator) {
-    case MYREFL_RULE_ON_FAIL:
-        /* we only get here if the test returns failure, so trigger rule */
-        if (result == MYREFL_RESULT_FAIL) {
-            rule_result = MYREFL_RESULT_FAIL;
+    if (!seq_baseline_records) {
+        return;
+    }
+
+    instance_name = seq_baseline_instance_name(instance);
+
+    for (element = seq_baseline_records->head; element; element = next) {
+        next = element->next;
+        record = element->data;
+
+        if (record->slot < rule_data->baseline_slots &&
+            strcmp(record->rule, instance->obj->i.name) == 0 &&
+            strcmp(record->instance, instance_name) == 0) {
+            rule_data->baseline[record->slot] = record->baseline;
+            myrefl_list_remove(seq_baseline_records, record);
+            seq_baseline_record_free(record);
         }
-        break;
-        
-    case MYREFL_RULE_EQUAL_TO_N:
-        if (result == MYREFL_RESULT_VALUE) {
-            if (value == rule->op_n) {
-                rule_result = MYREFL_RESULT_FAIL;
-            }
+    }
+}
+
+/*
+ * seq_baseline_load()
+ *
+ * Read the baseline file, one tab separated line per learnt baseline of
+ * rule, instance, slot, count, mean and variance.
+ */
+static void seq_baseline_load (const char *filename)
+{
+    FILE *file;
+    char line[(MYREFL_MAX_NAME_LEN * 2) + 128];
+    char *rule, *instance, *fields;
+    seq_baseline_record_t *record;
+    int loaded = 0;
+
+    file = fopen(filename, "r");
+    if (!file) {
+        myrefl_debug(NULL, "No baselines in '%s'", filename);
+        return;
+    }
+
+    if (!seq_baseline_records) {
+        seq_baseline_records = myrefl_list_create();
+    }
+
+    while (seq_baseline_records && fgets(line, sizeof(line), file)) {
+        rule = line;
+        instance = strchr(rule, '\t');
+        if (!instance) {
+            continue;
         }
-        break;
-        
-    case MYREFL_RULE_NOT_EQUAL_TO_N:
-        if (result == MYREFL_RESULT_VALUE) {
-            if (value != rule->op_n) {
-                rule_result = MYREFL_RESULT_FAIL;
-            }
+        *instance++ = '\0';
+        fields = strchr(instance, '\t');
+        if (!fields) {
+            continue;
         }
-        break;
-        
-    case MYREFL_RULE_LESS_THAN_N: 
-        if (result == MYREFL_RESULT_VALUE) {
-            if (value < rule->op_n) {
-                rule_result = MYREFL_RESULT_FAIL;
-            }
+        *fields++ = '\0';
+
+        record = calloc(1, sizeof(seq_baseline_record_t));
+        if (!record) {
+            break;
         }
-        break;
-        
-    case MYREFL_RULE_GREATER_THAN_N:
-        if (result == MYREFL_RESULT_VALUE) {
-            if (value > rule->op_n) {
-                rule_result = MYREFL_RESULT_FAIL;
+        if (sscanf(fields, "%d %ld %lg %lg", &record->slot, 
+                   &record->baseline.count, &record->baseline.mean,
+                   &record->baseline.variance) != 4 ||
+            record->slot < 0 || record->slot >= RULE_BASELINE_SLOTS ||
+            !(record->rule = strdup(rule)) ||
+            !(record->instance = strdup(instance))) {
+            myrefl_error("Ignoring bad baseline for rule '%s' in '%s'",
+                         rule, filename);
+            seq_baseline_record_free(record);
+            continue;
+        }
+        myrefl_list_push(seq_baseline_records, record);
+        loaded++;
+    }
+    fclose(file);
+
+    myrefl_trace(NULL, "Loaded %d baselines from '%s'", loaded, filename);
+}
+
+/*
+ * seq_baseline_record_copy()
+ */
+static seq_baseline_record_t *seq_baseline_record_copy (
+    const char *rule, 
+    const char *instance,
+    int slot,
+    obj_rule_baseline_t *baseline)
+{
+    seq_baseline_record_t *record;
+
+    record = calloc(1, sizeof(seq_baseline_record_t));
+    if (!record) {
+        return (NULL);
+    }
+    record->rule = strdup(rule);
+    record->instance = strdup(instance);
+    if (!record->rule || !record->instance) {
+        seq_baseline_record_free(record);
+        return (NULL);
+    }
+    record->slot = slot;
+    record->baseline = *baseline;
+    return (record);
+}
+
+/*
+ * seq_baseline_snapshot_add()
+ */
+static boolean seq_baseline_snapshot_add (seq_baseline_snapshot_t *snapshot,
+                                          const char *rule,
+                                          const char *instance,
+                                          int slot,
+                                          obj_rule_baseline_t *baseline)
+{
+    seq_baseline_record_t *record;
+
+    record = seq_baseline_record_copy(rule, instance, slot, baseline);
+    if (!record) {
+        return (FALSE);
+    }
+    if (!myrefl_list_push(snapshot->records, record)) {
+        seq_baseline_record_free(record);
+        return (FALSE);
+    }
+    return (TRUE);
+}
+
+/*
+ * seq_baseline_snapshot_free()
+ */
+static void seq_baseline_snapshot_free (seq_baseline_snapshot_t *snapshot)
+{
+    seq_baseline_record_t *record;
+
+    if (!snapshot) {
+        return;
+    }
+    while ((record = myrefl_list_pop(snapshot->records)) != NULL) {
+        seq_baseline_record_free(record);
+    }
+    myrefl_list_free(snapshot->records);
+    free(snapshot->filename);
+    free(snapshot);
+}
+
+/*
+ * myrefl_seq_baseline_snapshot()
+ *
+ * Copy all the learnt baselines, plus any loaded ones that haven't 
+ * been claimed yet, ready for myrefl_seq_baseline_write(). NULL if 
+ * there is no baseline file or no memory.
+ *
+ * Must be called with the DB locked.
+ */
+seq_baseline_snapshot_t *myrefl_seq_baseline_snapshot (void)
+{
+    seq_baseline_snapshot_t *snapshot;
+    obj_rule_data_t *rule_data;
+    obj_t *obj;
+    obj_instance_t *instance;
+    myrefl_list_element_t *element;
+    seq_baseline_record_t *record;
+    boolean ok = TRUE;
+    int slot;
+
+    if (!seq_baseline_file) {
+        return (NULL);
+    }
+
+    if (!seq_baseline_write_lock) {
+        seq_baseline_write_lock = myrefl_xos_critical_section_create();
+        if (!seq_baseline_write_lock) {
+            return (NULL);
+        }
+    }
+
+    snapshot = calloc(1, sizeof(seq_baseline_snapshot_t));
+    if (!snapshot) {
+        return (NULL);
+    }
+    snapshot->filename = strdup(seq_baseline_file);
+    snapshot->records = myrefl_list_create();
+    if (!snapshot->filename || !snapshot->records) {
+        seq_baseline_snapshot_free(snapshot);
+        return (NULL);
+    }
+
+    for (obj = myrefl_comp_get_first_contained(myrefl_obj_system_comp, 
+                                               OBJ_TYPE_RULE);
+         ok && obj != NULL;
+         obj = myrefl_comp_get_next_contained(myrefl_obj_system_comp, obj,
+                                              OBJ_TYPE_RULE)) {
+        for (instance = &obj->i; ok && instance; instance = instance->next) {
+            rule_data = instance->rule_data;
+            if (!rule_data || !rule_data->baseline) {
+                continue;
+            }
+            for (slot = 0; ok && slot < rule_data->baseline_slots; slot++) {
+                if (rule_data->baseline[slot].count) {
+                    ok = seq_baseline_snapshot_add(
+                        snapshot, obj->i.name,
+                        seq_baseline_instance_name(instance), slot,
+                        &rule_data->baseline[slot]);
+                }
+            }
+        }
+    }
+
+    if (seq_baseline_records) {
+        for (element = seq_baseline_records->head; ok && element; 
+             element = element->next) {
+            record = element->data;
+            ok = seq_baseline_snapshot_add(snapshot, record->rule, 
+                                           record->instance, record->slot,
+                                           &record->baseline);
+        }
+    }
+
+    if (!ok) {
+        myrefl_error("No memory to save the baselines");
+        seq_baseline_snapshot_free(snapshot);
+        return (NULL);
+    }
+
+    snapshot->generation = ++seq_baseline_generation;
+    seq_baseline_dirty = FALSE;
+    seq_baseline_saved = seq_time_now_ms();
+    return (snapshot);
+}
+
+/*
+ * myrefl_seq_baseline_write()
+ *
+ * Write a snapshot to a temporary file and then move it over the 
+ * baseline file so that a crash part way through doesn't lose them.
+ * The snapshot is freed.
+ *
+ * Called without the DB lock, it may take a while.
+ */
+boolean myrefl_seq_baseline_write (seq_baseline_snapshot_t *snapshot)
+{
+    FILE *file;
+    char *tmpname;
+    myrefl_list_element_t *element;
+    seq_baseline_record_t *record;
+    boolean ok = FALSE;
+
+    if (!snapshot) {
+        return (FALSE);
+    }
+
+    myrefl_xos_critical_section_enter(seq_baseline_write_lock);
+
+    if (snapshot->generation <= seq_baseline_written) {
+        /*
+         * A newer snapshot has already been written.
+         */
+        myrefl_xos_critical_section_exit(seq_baseline_write_lock);
+        seq_baseline_snapshot_free(snapshot);
+        return (TRUE);
+    }
+
+    tmpname = malloc(strlen(snapshot->filename) + 5);
+    if (!tmpname) {
+        myrefl_xos_critical_section_exit(seq_baseline_write_lock);
+        seq_baseline_snapshot_free(snapshot);
+        return (FALSE);
+    }
+    sprintf(tmpname, "%s.tmp", snapshot->filename);
+
+    file = fopen(tmpname, "w");
+    if (!file) {
+        myrefl_error("Could not write baselines to '%s'", tmpname);
+    } else {
+        for (element = snapshot->records->head; element; 
+             element = element->next) {
+            record = element->data;
+            fprintf(file, "%s\t%s\t%d %ld %.17g %.17g\n",
+                    record->rule, record->instance, record->slot,
+                    record->baseline.count, record->baseline.mean,
+                    record->baseline.variance);
+        }
+
+        ok = (fclose(file) == 0);
+        if (ok) {
+            ok = (rename(tmpname, snapshot->filename) == 0);
+        }
+        if (!ok) {
+            myrefl_error("Could not write baselines to '%s'", 
+                         snapshot->filename);
+            remove(tmpname);
+        } else {
+            seq_baseline_written = snapshot->generation;
+        }
+    }
+
+    myrefl_xos_critical_section_exit(seq_baseline_write_lock);
+    free(tmpname);
+    seq_baseline_snapshot_free(snapshot);
+    return (ok);
+}
+
+/*
+ * seq_baseline_changed()
+ *
+ * A baseline has been updated, have the scheduler save them once 
+ * SEQ_BASELINE_SAVE_INTERVAL has passed since they were last saved.
+ */
+static void seq_baseline_changed (void)
+{
+    unsigned long long now, due;
+
+    if (seq_baseline_dirty) {
+        return;
+    }
+    seq_baseline_dirty = TRUE;
+
+    if (!seq_baseline_file) {
+        return;
+    }
+
+    now = seq_time_now_ms();
+    due = seq_baseline_saved + SEQ_BASELINE_SAVE_INTERVAL;
+    myrefl_sched_baseline_flush(due > now ? (ulong)(due - now) : 0);
+}
+
+/*
+ * seq_baseline_thread_fn()
+ *
+ * Write the baselines taken by the scheduler's flush.
+ */
+static void seq_baseline_thread_fn (myrefl_thread_t *thread, 
+                                    void *snapshot)
+{
+    if (!myrefl_seq_baseline_write(snapshot)) {
+        /*
+         * Try again next interval.
+         */
+        myrefl_obj_db_lock();
+        seq_baseline_changed();
+        myrefl_obj_db_unlock();
+    }
+}
+
+/*
+ * myrefl_seq_baseline_flush()
+ *
+ * Called by the scheduler when the baselines are due to be saved, take
+ * them now and leave the writing to a worker thread.
+ */
+void myrefl_seq_baseline_flush (void)
+{
+    seq_baseline_snapshot_t *snapshot;
+
+    if (!seq_baseline_dirty) {
+        return;
+    }
+
+    snapshot = myrefl_seq_baseline_snapshot();
+    if (!snapshot) {
+        return;
+    }
+
+    if (!myrefl_thread_request(seq_baseline_thread_fn, NULL, snapshot)) {
+        seq_baseline_snapshot_free(snapshot);
+        seq_baseline_changed();
+    }
+}
+
+/*
+ * seq_baseline_slot()
+ *
+ * Which of the rule's baselines applies now.
+ */
+static obj_rule_baseline_t *seq_baseline_slot (obj_rule_data_t *rule_data)
+{
+    xos_time_t now;
+
+    if (rule_data->baseline_slots == 1) {
+        return (&rule_data->baseline[0]);
+    }
+    myrefl_xos_time_set_now(&now);
+    return (&rule_data->baseline[(now.sec / 3600) % rule_data->baseline_slots]);
+}
+
+/*
+ * seq_baseline_update()
+ *
+ * Add a value to the baseline. This is Welford's running mean and 
+ * variance, except that the count stops at RULE_BASELINE_MAX_COUNT after
+ * which it becomes an exponentially weighted average.
+ */
+static void seq_baseline_update (obj_rule_baseline_t *baseline,
+                                 long value)
+{
+    double weight, delta;
+
+    if (baseline->count < RULE_BASELINE_MAX_COUNT) {
+        baseline->count++;
+    }
+    weight = 1.0 / baseline->count;
+    delta = value - baseline->mean;
+
+    baseline->mean += weight * delta;
+    baseline->variance = (1.0 - weight) * 
+        (baseline->variance + (weight * delta * delta));
+}
+
+/*
+ * seq_rule_baseline_slots()
+ *
+ * How many baselines a baseline rule instance keeps.
+ */
+static int seq_rule_baseline_slots (obj_rule_t *rule)
+{
+    if (rule->obj->i.flags.rule & MYREFL_RULE_BASELINE_TIME_OF_DAY) {
+        return (RULE_BASELINE_SLOTS);
+    }
+    return (1);
+}
+
+/*
+ * seq_rule_data()
+ *
+ * Get the evaluation data for this rule instance, allocating it the
+ * first time through. If the rule type or operands have changed since
+ * it was allocated then the old data is meaningless, so start again.
+ */
+static obj_rule_data_t *seq_rule_data (obj_instance_t *instance,
+                                       obj_rule_t *rule)
+{
+    obj_rule_data_t *rule_data = instance->rule_data;
+
+    if (rule_data && rule->operator == MYREFL_RULE_BASELINE_N_SIGMA &&
+        rule_data->operator == rule->operator &&
+        rule_data->baseline_slots == seq_rule_baseline_slots(rule)) {
+        /*
+         * The baseline is still good whatever the operands, it is only
+         * how it is used that changes.
+         */
+        rule_data->op_n = rule->op_n;
+        rule_data->op_m = rule->op_m;
+    }
+
+    if (rule_data &&
+        (rule_data->operator != rule->operator ||
+         rule_data->op_n != rule->op_n ||
+         rule_data->op_m != rule->op_m ||
+         (rule_data->baseline && 
+          rule_data->baseline_slots != seq_rule_baseline_slots(rule)))) {
+        myrefl_obj_rule_data_free(rule_data);
+        rule_data = instance->rule_data = NULL;
+    }
+
+    if (rule_data) {
+        return (rule_data);
+    }
+
+    rule_data = calloc(1, sizeof(obj_rule_data_t));
+    if (!rule_data) {
+        return (NULL);
+    }
+
+    rule_data->operator = rule->operator;
+    rule_data->op_n = rule->op_n;
+    rule_data->op_m = rule->op_m;
+
+    switch (rule->operator) {
+    case MYREFL_RULE_N_IN_M:
+        /*
+         * Allocate the history bits
+         */
+        rule_data->history_size = (rule->op_m / 64) + 1;
+        rule_data->history = calloc(rule_data->history_size, 
+                                    sizeof(uint64_t));
+        break;
+    case MYREFL_RULE_N_IN_TIME_M:
+        /*
+         * Split the window into buckets of whole milliseconds, rounding
+         * up so that the buckets cover all of the window.
+         */
+        rule_data->bucket_count = RULE_TIME_BUCKETS;
+        if (rule->op_m < rule_data->bucket_count) {
+            rule_data->bucket_count = rule->op_m;
+        }
+        rule_data->bucket_ms = 
+            (rule->op_m + rule_data->bucket_count - 1) / rule_data->bucket_count;
+        rule_data->buckets = calloc(rule_data->bucket_count, 
+                                    sizeof(unsigned int));
+        if (!rule_data->buckets) {
+            myrefl_obj_rule_data_free(rule_data);
+            return (NULL);
+        }
+        break;
+    case MYREFL_RULE_BASELINE_N_SIGMA:
+        rule_data->baseline_slots = seq_rule_baseline_slots(rule);
+        rule_data->baseline = calloc(rule_data->baseline_slots,
+                                     sizeof(obj_rule_baseline_t));
+        if (!rule_data->baseline) {
+            myrefl_obj_rule_data_free(rule_data);
+            return (NULL);
+        }
+        seq_baseline_restore(instance, rule_data);
+        break;
+    default:
+        break;
+    }
+
+    instance->rule_data = rule_data;
+    return (rule_data);
+}
+
+/*
+ * seq_rule_time_expire()
+ *
+ * Move the N in time M window along to the time slot "slot", emptying
+ * the buckets that have fallen out of the window. Each bucket is only 
+ * emptied once per trip around the ring, so this is O(1) amortised no
+ * matter how often the rule is run.
+ */
+static void seq_rule_time_expire (obj_rule_data_t *rule_data,
+                                  unsigned long long slot)
+{
+    unsigned long long stale;
+    long bucket;
+
+    if (slot <= rule_data->bucket_slot) {
+        /*
+         * Still within the newest bucket (or the clock went backwards, 
+         * in which case keep counting into the newest bucket).
+         */
+        return;
+    }
+
+    stale = slot - rule_data->bucket_slot;
+
+    if (stale >= (unsigned long long)rule_data->bucket_count) {
+        memset(rule_data->buckets, 0, 
+               rule_data->bucket_count * sizeof(unsigned int));
+        rule_data->bucket_total = 0;
+    } else {
+        while (stale--) {
+            bucket = (++rule_data->bucket_slot) % rule_data->bucket_count;
+            rule_data->bucket_total -= rule_data->buckets[bucket];
+            rule_data->buckets[bucket] = 0;
+        }
+    }
+    rule_data->bucket_slot = slot;
+}
+
+/*
+ * seq_rule_sketch_add()
+ *
+ * Add a value to the P-squared percentile sketch (Jain & Chlamtac) for
+ * the p'th quantile. The first five values seed the markers, after which
+ * each value moves the markers it lands beyond along one position and any
+ * of the three middle markers that have drifted from where they should
+ * be are nudged back, adjusting their heights with a parabolic fit of the
+ * neighbouring markers.
+ */
+static void seq_rule_sketch_add (obj_rule_data_t *rule_data,
+                                 double p,
+                                 double value)
+{
+    double *q = rule_data->sketch;
+    long *n = rule_data->sketch_pos;
+    double *want = rule_data->sketch_want;
+    double step[RULE_SKETCH_MARKERS];
+    double height;
+    long count = rule_data->sketch_count;
+    int i, k, d;
+
+    if (count < RULE_SKETCH_MARKERS) {
+        /*
+         * Still seeding, keep the heights sorted.
+         */
+        for (i = count; i > 0 && q[i - 1] > value; i--) {
+            q[i] = q[i - 1];
+        }
+        q[i] = value;
+        rule_data->sketch_count++;
+
+        if (rule_data->sketch_count == RULE_SKETCH_MARKERS) {
+            for (i = 0; i < RULE_SKETCH_MARKERS; i++) {
+                n[i] = i + 1;
+            }
+            want[0] = 1;
+            want[1] = 1 + (2 * p);
+            want[2] = 1 + (4 * p);
+            want[3] = 3 + (2 * p);
+            want[4] = 5;
+        }
+        return;
+    }
+
+    step[0] = 0;
+    step[1] = p / 2;
+    step[2] = p;
+    step[3] = (1 + p) / 2;
+    step[4] = 1;
+
+    /*
+     * Find the cell the value falls in, extending the ends if required.
+     */
+    if (value < q[0]) {
+        q[0] = value;
+        k = 0;
+    } else if (value >= q[4]) {
+        q[4] = value;
+        k = 3;
+    } else {
+        for (k = 0; k < 3 && value >= q[k + 1]; k++) {
+            ;
+        }
+    }
+
+    for (i = k + 1; i < RULE_SKETCH_MARKERS; i++) {
+        n[i]++;
+    }
+    for (i = 0; i < RULE_SKETCH_MARKERS; i++) {
+        want[i] += step[i];
+    }
+
+    for (i = 1; i < RULE_SKETCH_MARKERS - 1; i++) {
+        double off = want[i] - n[i];
+
+        if ((off >= 1 && n[i + 1] - n[i] > 1) ||
+            (off <= -1 && n[i - 1] - n[i] < -1)) {
+            d = (off > 0) ? 1 : -1;
+
+            height = q[i] + ((double)d / (n[i + 1] - n[i - 1])) *
+                ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+                 (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+
+            if (height <= q[i - 1] || height >= q[i + 1]) {
+                /*
+                 * Parabola overshot a neighbour, fall back to linear.
+                 */
+                height = q[i] + d * (q[i + d] - q[i]) / (n[i + d] - n[i]);
+            }
+            q[i] = height;
+            n[i] += d;
+        }
+    }
+    rule_data->sketch_count++;
+}
+
+/*
+ * seq_rule_sketch_estimate()
+ *
+ * Current estimate of the p'th quantile from the sketch. Until the
+ * markers are seeded the values seen so far are sorted in the marker
+ * heights, so pick the nearest rank.
+ */
+static double seq_rule_sketch_estimate (obj_rule_data_t *rule_data,
+                                        double p)
+{
+    long count = rule_data->sketch_count;
+    long rank;
+
+    if (count >= RULE_SKETCH_MARKERS) {
+        return (rule_data->sketch[2]);
+    }
+    if (count == 0) {
+        return (0);
+    }
+    rank = (long)(p * count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return (rule_data->sketch[rank - 1]);
+}
+
+/*
+ * seq_rule_quantile()
+ *
+ * Add the value to the percentile rule's sketch and return the estimate
+ * to compare against N. When the window of M values is complete its
+ * estimate is kept and the sketch started again, the kept estimate being
+ * used until the new window has enough values to seed its markers.
+ */
+static double seq_rule_quantile (obj_rule_data_t *rule_data,
+                                 double p,
+                                 long value)
+{
+    double estimate;
+
+    seq_rule_sketch_add(rule_data, p, (double)value);
+
+    if (rule_data->sketch_count < RULE_SKETCH_MARKERS &&
+        rule_data->quantile_valid) {
+        estimate = rule_data->quantile;
+    } else {
+        estimate = seq_rule_sketch_estimate(rule_data, p);
+    }
+
+    if (rule_data->op_m && rule_data->sketch_count >= rule_data->op_m) {
+        rule_data->quantile = estimate;
+        rule_data->quantile_valid = TRUE;
+        rule_data->sketch_count = 0;
+    }
+    return (estimate);
+}
+
+/*
+ * The fraction left of a flap penalty after each sixteenth of a half 
+ * life, out of 65536, so that it can decay without floating point.
+ */
+static const uint seq_flap_decay[16] = {
+    65536, 62757, 60097, 57549, 55109, 52773, 50535, 48393, 
+    46341, 44376, 42495, 40693, 38968, 37316, 35734, 34219
+};
+
+/*
+ * seq_rule_flap_decay()
+ *
+ * Bring the flap penalty up to date for the time that has passed.
+ */
+static void seq_rule_flap_decay (obj_rule_flap_t *flap, uint half_life)
+{
+    unsigned long long now = seq_time_now_ms();
+    unsigned long long elapsed, halves;
+
+    if (flap->decayed && now > flap->decayed) {
+        elapsed = now - flap->decayed;
+        halves = elapsed / half_life;
+        if (halves >= 32) {
+            flap->penalty = 0;
+        } else {
+            flap->penalty >>= halves;
+            flap->penalty = ((unsigned long long)flap->penalty * 
+                             seq_flap_decay[(elapsed % half_life) * 16 / 
+                                            half_life]) >> 16;
+        }
+    }
+    if (!flap->decayed || now > flap->decayed) {
+        flap->decayed = now;
+    }
+}
+
+/*
+ * seq_rule_flap_reuse_ms()
+ *
+ * How long until a suppressed instance's penalty decays below the 
+ * reuse threshold.
+ */
+static ulong seq_rule_flap_reuse_ms (obj_rule_flap_t *flap, obj_rule_t *rule)
+{
+    unsigned long long penalty = flap->penalty;
+    ulong sixteenths = 0;
+
+    while (penalty && penalty >= rule->flap_reuse) {
+        penalty = (penalty * seq_flap_decay[1]) >> 16;
+        sixteenths++;
+    }
+    return ((sixteenths * rule->flap_half_life + 15) / 16);
+}
+
+/*
+ * seq_rule_flap_deadline()
+ *
+ * Make sure that a suppressed instance is looked at again when its 
+ * penalty should have decayed, since its input may never report again.
+ * A deadline that the rule already has (e.g. fail for time N) will get
+ * here first anyway.
+ */
+static void seq_rule_flap_deadline (obj_instance_t *instance)
+{
+    if (instance->sched_test.queued != TEST_QUEUE_DEADLINE) {
+        myrefl_sched_rule_deadline(instance, 
+                                   seq_rule_flap_reuse_ms(instance->flap,
+                                                          instance->obj->t.rule));
+    }
+}
+
+/*
+ * seq_rule_flap()
+ *
+ * Flap damping, given the result that the rule has just come up with,
+ * return the result that it should report. Each change between pass and
+ * fail adds a penalty, and once the penalty reaches the suppress 
+ * threshold the instance holds the result it had before it started 
+ * flapping, until the penalty decays below the reuse threshold.
+ */
+static myrefl_result_t seq_rule_flap (obj_instance_t *instance,
+                                      obj_rule_t *rule,
+                                      myrefl_result_t result)
+{
+    obj_rule_flap_t *flap = instance->flap;
+    unsigned long long ceiling;
+
+    if (!rule->flap_half_life) {
+        if (flap) {
+            free(flap);
+            instance->flap = NULL;
+        }
+        return (result);
+    }
+
+    if (!flap) {
+        flap = instance->flap = calloc(1, sizeof(obj_rule_flap_t));
+        if (!flap) {
+            return (result);
+        }
+        flap->raw = instance->last_result;
+    }
+
+    seq_rule_flap_decay(flap, rule->flap_half_life);
+
+    if (result != MYREFL_RESULT_PASS && result != MYREFL_RESULT_FAIL) {
+        return (flap->suppressed ? flap->held : result);
+    }
+
+    if ((flap->raw == MYREFL_RESULT_PASS || 
+         flap->raw == MYREFL_RESULT_FAIL) && result != flap->raw) {
+        /*
+         * Don't let the penalty grow so far that a rule that has 
+         * flapped hard stays suppressed for a long time after.
+         */
+        ceiling = (unsigned long long)rule->flap_suppress * 4;
+        flap->penalty += SEQ_FLAP_PENALTY;
+        if (flap->penalty > ceiling) {
+            flap->penalty = ceiling;
+        }
+    }
+    flap->raw = result;
+
+    if (!flap->suppressed && flap->penalty >= rule->flap_suppress) {
+        flap->suppressed = TRUE;
+        flap->held = instance->last_result;
+        myrefl_trace(instance->obj->i.name, 
+                     "Rule %s flapping, holding %s (penalty %u)",
+                     myrefl_obj_instance_name(instance),
+                     myrefl_util_myrefl_result_str(flap->held),
+                     flap->penalty);
+    } else if (flap->suppressed && flap->penalty < rule->flap_reuse) {
+        flap->suppressed = FALSE;
+        myrefl_trace(instance->obj->i.name, 
+                     "Rule %s stopped flapping, %s (penalty %u)",
+                     myrefl_obj_instance_name(instance),
+                     myrefl_util_myrefl_result_str(result),
+                     flap->penalty);
+    }
+
+    if (flap->suppressed) {
+        seq_rule_flap_deadline(instance);
+        return (flap->held);
+    }
+    return (result);
+}
+
+/*
+ * seq_rule_flap_release()
+ *
+ * A suppressed instance's deadline has passed without it being run 
+ * again, if its penalty has decayed enough then report its latest 
+ * result and return TRUE.
+ */
+static boolean seq_rule_flap_release (obj_instance_t *instance,
+                                      myrefl_result_t *result)
+{
+    obj_rule_flap_t *flap = instance->flap;
+    obj_rule_t *rule;
+
+    if (!flap || !flap->suppressed || 
+        !myrefl_obj_instance_validate(instance, OBJ_TYPE_RULE)) {
+        return (FALSE);
+    }
+    rule = instance->obj->t.rule;
+
+    if (rule->flap_half_life) {
+        seq_rule_flap_decay(flap, rule->flap_half_life);
+        if (flap->penalty >= rule->flap_reuse) {
+            seq_rule_flap_deadline(instance);
+            return (FALSE);
+        }
+    }
+
+    flap->suppressed = FALSE;
+    myrefl_trace(instance->obj->i.name, 
+                 "Rule %s stopped flapping, %s (penalty %u)",
+                 myrefl_obj_instance_name(instance),
+                 myrefl_util_myrefl_result_str(flap->raw),
+                 flap->penalty);
+
+    *result = flap->raw;
+    seq_result_stats_update(instance, flap->raw, instance->last_value);
+    seq_rule_result_on_health(&instance->obj->i);
+    return (TRUE);
+}
+
+/*
+ * seq_rule_flapping()
+ *
+ * Whether the instance is holding its result while flapping, in which
+ * case there is nothing new to tell the output rules or RCI. As with 
+ * seq_rule_unchanged() a root cause candidate always goes through.
+ */
+static boolean seq_rule_flapping (obj_instance_t *instance)
+{
+    return (instance->flap && instance->flap->suppressed &&
+            instance->root_cause != RULE_ROOT_CAUSE_CANDIDATE);
+}
+
+/*
+ * seq_rule_clearing()
+ *
+ * Hysteresis for the threshold operators, how far the threshold moves 
+ * while the instance is failing so that it has to come back past the 
+ * clear threshold (rather than just the fail threshold) to pass.
+ */
+static long seq_rule_clearing (obj_instance_t *instance, obj_rule_t *rule)
+{
+    myrefl_result_t last;
+
+    last = instance->flap ? instance->flap->raw : instance->last_result;
+    return (last == MYREFL_RESULT_FAIL ? rule->hysteresis : 0);
+}
+
+static myrefl_result_t seq_rule_run (obj_instance_t *instance,
+                                     myrefl_result_t result,
+                                     long value)
+{
+    myrefl_result_t rule_result = MYREFL_RESULT_PASS;
+    obj_rule_t *rule;
+    obj_t *obj;
+    obj_instance_t *input_instance;
+    obj_graph_t *graph;
+    obj_graph_node_t *node;
+    uint i;
+
+    if (!myrefl_obj_instance_validate(instance, OBJ_TYPE_RULE)) {
+        return(MYREFL_RESULT_ABORT);
+    }
+
+    obj = instance->obj;
+    rule = obj->t.rule;
+    graph = myrefl_obj_graph();
+    node = myrefl_obj_graph_node(obj);
+
+    switch (rule->operator) {
+    case MYREFL_RULE_ON_FAIL:
+        /* we only get here if the test returns failure, so trigger rule */
+        if (result == MYREFL_RESULT_FAIL) {
+            rule_result = MYREFL_RESULT_FAIL;
+        }
+        break;
+        
+    case MYREFL_RULE_EQUAL_TO_N:
+        if (result == MYREFL_RESULT_VALUE) {
+            if (value == rule->op_n) {
+                rule_result = MYREFL_RESULT_FAIL;
+            }
+        }
+        break;
+        
+    case MYREFL_RULE_NOT_EQUAL_TO_N:
+        if (result == MYREFL_RESULT_VALUE) {
+            if (value != rule->op_n) {
+                rule_result = MYREFL_RESULT_FAIL;
+            }
+        }
+        break;
+        
+    case MYREFL_RULE_LESS_THAN_N: 
+        if (result == MYREFL_RESULT_VALUE) {
+            if (value < rule->op_n + seq_rule_clearing(instance, rule)) {
+                rule_result = MYREFL_RESULT_FAIL;
+            }
+        }
+        break;
+        
+    case MYREFL_RULE_GREATER_THAN_N:
+        if (result == MYREFL_RESULT_VALUE) {
+            if (value > rule->op_n - seq_rule_clearing(instance, rule)) {
+                rule_result = MYREFL_RESULT_FAIL;
+            }
+        }
+        break;
+    case MYREFL_RULE_RANGE_N_TO_M:
+        /*
+         * Pass if inside the range, else fail.
+         */
+        if (result == MYREFL_RESULT_VALUE) {
+            long clearing = seq_rule_clearing(instance, rule);
+
+            if (value < rule->op_n + clearing ||
+                value > rule->op_m - clearing) {
+                rule_result = MYREFL_RESULT_FAIL;
+            }
+        }
+        break;
+
+    case MYREFL_RULE_DISABLE:
+        rule_result = MYREFL_RESULT_ABORT;
+        break;
+
+    case MYREFL_RULE_N_EVER:
+        if (result == MYREFL_RESULT_FAIL) {
+            instance->fail_count++;
+            if (instance->fail_count >= rule->op_n) {
+                rule_result = MYREFL_RESULT_FAIL;
+                instance->fail_count = 0;
+            }
+        }
+        break;
+    case MYREFL_RULE_N_IN_ROW:
+        if (result == MYREFL_RESULT_FAIL) {
+            instance->fail_count++;
+            if (instance->fail_count >= rule->op_n) {
+                rule_result = MYREFL_RESULT_FAIL;
+            }
+        } else {
+            instance->fail_count = 0;
+        }
+        break;
+    case MYREFL_RULE_N_IN_M:
+        /*
+         * For tracking N in M we use 1 bit per rule invocation in a 
+         * circular bitmap of M bits. For every invocation we move our
+         * insertion bit along one, which overwrites the oldest value.
+         *
+         * A running count of the fail (1) bits is kept by taking off the
+         * bit that is being overwritten and adding on the new one, so N
+         * is compared against the count of failures in the last M results
+         * without ever having to recount the bitmap.
+         */
+        if (result != MYREFL_RESULT_PASS &&
+            result != MYREFL_RESULT_FAIL) {
+            /*
+             * Not a valid input to an N in M rule, we only
+             * want pass or fail;
+             */
+            myrefl_error("Rule '%s' not pass or fail, got %s, ignoring", 
+                         myrefl_obj_instance_name(instance), 
+                         myrefl_util_myrefl_result_str(result));
+            rule_result = MYREFL_RESULT_ABORT;
+            break;
+        }
+
+        if (seq_rule_data(instance, rule)) {
+            obj_rule_data_t *rule_data = instance->rule_data;
+
+            if (rule_data->history) {
+                long word = rule_data->position / 64;
+                uint64_t mask = ((uint64_t)1) << (rule_data->position % 64);
+
+                if (word >= rule_data->history_size) {
+                    /*
+                     * We'd be off the end of the data, how did that 
+                     * happen?
+                     */
+                    break;
+                }
+
+                if (rule_data->history[word] & mask) {
+                    /*
+                     * Overwriting a fail that is leaving the window.
+                     */
+                    rule_data->history_count--;
+                }
+
+                if (result == MYREFL_RESULT_PASS) {
+                    /*
+                     * Clear the bit for a pass
+                     */
+                    rule_data->history[word] &= ~mask;
+                } else {
+                    /*
+                     * Set the bit for a fail
+                     */
+                    rule_data->history[word] |= mask;
+                    rule_data->history_count++;
+                }
+                
+                if (rule_data->history_count >= rule->op_n) {
+                    rule_result = MYREFL_RESULT_FAIL;
+                }
+                     
+                rule_data->position++;
+
+                if (rule_data->position >= rule->op_m) {
+                    rule_data->position = 0;
+                }
+                myrefl_debug(instance->obj->i.name, "%s Fail Count = %ld",
+                             myrefl_obj_instance_name(instance), 
+                             rule_data->history_count);
+            } else {
+                myrefl_error("No rule history data for '%s'",
+                             myrefl_obj_instance_name(instance));
+                rule_result = MYREFL_RESULT_ABORT;
+            }
+        } else {
+            myrefl_error("No rule data for '%s'", 
+                         myrefl_obj_instance_name(instance));
+            rule_result = MYREFL_RESULT_ABORT;
+        }
+        break;
+    case MYREFL_RULE_N_IN_TIME_M:
+        /*
+         * Rather than remembering the time of every failure, which 
+         * could be a lot of them for a busy notification test, the
+         * window of M milliseconds is split into a fixed ring of 
+         * buckets each holding a count of the failures that arrived 
+         * within it. As time moves on the oldest buckets are emptied
+         * and their counts taken off the running total.
+         */
+        if (result != MYREFL_RESULT_PASS &&
+            result != MYREFL_RESULT_FAIL) {
+            myrefl_error("Rule '%s' not pass or fail, got %s, ignoring", 
+                         myrefl_obj_instance_name(instance), 
+                         myrefl_util_myrefl_result_str(result));
+            rule_result = MYREFL_RESULT_ABORT;
+            break;
+        }
+
+        if (seq_rule_data(instance, rule)) {
+            obj_rule_data_t *rule_data = instance->rule_data;
+            unsigned long long slot;
+
+            slot = seq_time_now_ms() / rule_data->bucket_ms;
+
+            seq_rule_time_expire(rule_data, slot);
+
+            if (result == MYREFL_RESULT_FAIL) {
+                rule_data->buckets[rule_data->bucket_slot % 
+                                   rule_data->bucket_count]++;
+                rule_data->bucket_total++;
+            }
+
+            if (rule_data->bucket_total >= rule->op_n) {
+                rule_result = MYREFL_RESULT_FAIL;
+            }
+
+            myrefl_debug(instance->obj->i.name, "%s Fail Count = %ld",
+                         myrefl_obj_instance_name(instance), 
+                         rule_data->bucket_total);
+        } else {
+            myrefl_error("No rule data for '%s'", 
+                         myrefl_obj_instance_name(instance));
+            rule_result = MYREFL_RESULT_ABORT;
+        }
+        break;
+    case MYREFL_RULE_FAIL_FOR_TIME_N:
+        /*
+         * Note when the input started failing and ask the scheduler to 
+         * hand us back to the sequencer N milliseconds later, at which 
+         * point if the input hasn't passed in the meantime we will fail 
+         * even if the input has gone quiet.
+         */
+        if (result != MYREFL_RESULT_PASS &&
+            result != MYREFL_RESULT_FAIL) {
+            myrefl_error("Rule '%s' not pass or fail, got %s, ignoring", 
+                         myrefl_obj_instance_name(instance), 
+                         myrefl_util_myrefl_result_str(result));
+            rule_result = MYREFL_RESULT_ABORT;
+            break;
+        }
+
+        if (seq_rule_data(instance, rule)) {
+            obj_rule_data_t *rule_data = instance->rule_data;
+            unsigned long long now = seq_time_now_ms();
+
+            if (result == MYREFL_RESULT_PASS) {
+                rule_data->fail_since = 0;
+                myrefl_sched_remove_test(instance);
+            } else if (!rule_data->fail_since) {
+                rule_data->fail_since = now;
+                myrefl_sched_rule_deadline(instance, rule->op_n);
+            }
+
+            if (rule_data->fail_since &&
+                now - rule_data->fail_since >= (unsigned long long)rule->op_n) {
+                rule_result = MYREFL_RESULT_FAIL;
+            }
+        } else {
+            myrefl_error("No rule data for '%s'", 
+                         myrefl_obj_instance_name(instance));
+            rule_result = MYREFL_RESULT_ABORT;
+        }
+        break;
+    case MYREFL_RULE_EWMA_ABOVE_N:
+        /*
+         * Exponentially weighted moving average, the first value seeds
+         * the average and each one after that moves it op_m percent of 
+         * the way towards the new value.
+         */
+        if (result != MYREFL_RESULT_VALUE) {
+            break;
+        }
+
+        if (seq_rule_data(instance, rule)) {
+            obj_rule_data_t *rule_data = instance->rule_data;
+
+            if (rule_data->ewma_count++ == 0) {
+                rule_data->ewma = value;
+            } else {
+                rule_data->ewma += 
+                    (value - rule_data->ewma) * rule->op_m / 100.0;
+            }
+
+            if (rule_data->ewma > 
+                rule->op_n - seq_rule_clearing(instance, rule)) {
+                rule_result = MYREFL_RESULT_FAIL;
+            }
+
+            myrefl_debug(instance->obj->i.name, "%s Average = %.2f",
+                         myrefl_obj_instance_name(instance), 
+                         rule_data->ewma);
+        } else {
+            myrefl_error("No rule data for '%s'", 
+                         myrefl_obj_instance_name(instance));
+            rule_result = MYREFL_RESULT_ABORT;
+        }
+        break;
+    case MYREFL_RULE_P95_ABOVE_N:
+    case MYREFL_RULE_P99_ABOVE_N:
+        /*
+         * Percentiles are estimated with a P-squared sketch, five 
+         * markers per instance regardless of the window size.
+         */
+        if (result != MYREFL_RESULT_VALUE) {
+            break;
+        }
+
+        if (seq_rule_data(instance, rule)) {
+            double estimate;
+
+            estimate = seq_rule_quantile(instance->rule_data,
+                                         (rule->operator == 
+                                          MYREFL_RULE_P95_ABOVE_N) ? 
+                                         0.95 : 0.99,
+                                         value);
+            if (estimate > rule->op_n - seq_rule_clearing(instance, rule)) {
+                rule_result = MYREFL_RESULT_FAIL;
+            }
+
+            myrefl_debug(instance->obj->i.name, "%s Percentile = %.2f",
+                         myrefl_obj_instance_name(instance), estimate);
+        } else {
+            myrefl_error("No rule data for '%s'", 
+                         myrefl_obj_instance_name(instance));
+            rule_result = MYREFL_RESULT_ABORT;
+        }
+        break;
+    case MYREFL_RULE_RATE_ABOVE_N:
+        /*
+         * Change in value per second since the previous value. Values
+         * arriving within the same millisecond keep the previous rate
+         * rather than dividing by zero.
+         */
+        if (result != MYREFL_RESULT_VALUE) {
+            break;
+        }
+
+        if (seq_rule_data(instance, rule)) {
+            obj_rule_data_t *rule_data = instance->rule_data;
+            unsigned long long now = seq_time_now_ms();
+
+            if (rule_data->rate_time && now > rule_data->rate_time) {
+                rule_data->rate = 
+                    ((double)value - rule_data->rate_value) * 1000.0 /
+                    (double)(now - rule_data->rate_time);
+            }
+
+            if (!rule_data->rate_time || now > rule_data->rate_time) {
+                rule_data->rate_value = value;
+                rule_data->rate_time = now;
+            }
+
+            if (rule_data->rate > 
+                rule->op_n - seq_rule_clearing(instance, rule)) {
+                rule_result = MYREFL_RESULT_FAIL;
+            }
+
+            myrefl_debug(instance->obj->i.name, "%s Rate = %.2f/s",
+                         myrefl_obj_instance_name(instance), 
+                         rule_data->rate);
+        } else {
+            myrefl_error("No rule data for '%s'", 
+                         myrefl_obj_instance_name(instance));
+            rule_result = MYREFL_RESULT_ABORT;
+        }
+        break;
+    case MYREFL_RULE_BASELINE_N_SIGMA:
+        /*
+         * Learn the mean and variance of the first M values, and after
+         * that fail any value more than N standard deviations from the
+         * mean. Passing values carry on refining the baseline, failing
+         * ones are left out so that an anomaly doesn't become normal.
+         */
+        if (result != MYREFL_RESULT_VALUE) {
+            break;
+        }
+
+        if (seq_rule_data(instance, rule)) {
+            obj_rule_data_t *rule_data = instance->rule_data;
+            obj_rule_baseline_t *baseline = seq_baseline_slot(rule_data);
+            double delta = value - baseline->mean;
+
+            if (baseline->count >= rule->op_m &&
+                delta * delta > 
+                (double)rule->op_n * rule->op_n * baseline->variance) {
+                rule_result = MYREFL_RESULT_FAIL;
+            } else {
+                seq_baseline_update(baseline, value);
+                seq_baseline_changed();
+                if (baseline->count == rule->op_m) {
+                    myrefl_debug(instance->obj->i.name, 
+                                 "%s baseline learnt, enforcing",
+                                 myrefl_obj_instance_name(instance));
+                }
+            }
+
+            myrefl_debug(instance->obj->i.name, 
+                         "%s Baseline mean = %.2f variance = %.2f (%ld)",
+                         myrefl_obj_instance_name(instance),
+                         baseline->mean, baseline->variance,
+                         baseline->count);
+        } else {
+            myrefl_error("No rule data for '%s'", 
+                         myrefl_obj_instance_name(instance));
+            rule_result = MYREFL_RESULT_ABORT;
+        }
+        break;
+    case MYREFL_RULE_OR:
+        /*
+         * Find matching input rule instances and if any are failing
+         * then we are failing.
+         */
+        for (i = 0; node && i < node->n_inputs; i++) {
+            obj = graph->nodes[graph->operands[node->inputs + i]].obj;
+            input_instance = myrefl_obj_instance(obj, instance);
+
+            if (input_instance && 
+                input_instance->last_result == MYREFL_RESULT_FAIL &&
+                input_instance->state == OBJ_STATE_ENABLED) {
+                /*
+                 * Any inputs failing means the whole rule fails
+                 */
+                rule_result = MYREFL_RESULT_FAIL;
+                break;
+            }
+        }
+        break;
+    case MYREFL_RULE_AND:
+        /*
+         * Find matching input rule instances and if all are failing
+         * then we are failing. An abort counts as a failure.
+         */
+        rule_result = MYREFL_RESULT_FAIL;
+
+        for (i = 0; node && i < node->n_inputs; i++) {
+            obj = graph->nodes[graph->operands[node->inputs + i]].obj;
+            input_instance = myrefl_obj_instance(obj, instance);
+
+            if (input_instance && 
+                input_instance->last_result == MYREFL_RESULT_PASS &&
+                input_instance->state == OBJ_STATE_ENABLED) {
+                /*
+                 * Any inputs passing means the whole rule passes
+                 */
+                rule_result = MYREFL_RESULT_PASS;
+                break;
+            }
+        }
+        
+        break;
+    case MYREFL_RULE_INVALID:
+    case MYREFL_RULE_LAST:
+        myrefl_error("Invalid rule type for rule '%s'", 
+                     myrefl_obj_instance_name(instance));
+        rule_result = MYREFL_RESULT_FAIL;
+        break;
+    }
+
+    rule_result = seq_rule_flap(instance, rule, rule_result);
+
+    seq_result_stats_update(instance, rule_result, value);
+
+    /*
+     * Update health now that we've updated the stats, health is only
+     * calculated on the base instance, not the member instances. The
+     * stats update will have updated the base wrt the member instance 
+     * state.
+     */
+    seq_rule_result_on_health(&instance->obj->i);
+
+    myrefl_debug(instance->obj->i.name,
+                 "Ran rule '%s' result '%s' criteria for (%ld in n:%ld m:%ld)",  
+                 myrefl_obj_instance_name(instance),
+                 myrefl_util_myrefl_result_str(rule_result), 
+                 value, rule->op_n, rule->op_m);
+
+    return (rule_result);
+}
+
+/*
+ * Runs an action by calling the action function.
+ * Actions stats are incremented depending on the result of the action.
+ */
+static myrefl_result_t seq_action_run (obj_instance_t *instance)
+{
+    myrefl_result_t result = MYREFL_RESULT_ABORT;
+    obj_action_t *action;
+
+    if (!myrefl_obj_instance_validate(instance, OBJ_TYPE_ACTION)) {
+        return(MYREFL_RESULT_ABORT);
+    }
+
+    action = instance->obj->t.action;
+
+    if (action->function) {
+        instance->in_use++;;
+        myrefl_obj_db_unlock();
+        result = (action->function)(instance->name, instance->context);
+        myrefl_obj_db_lock();
+        instance->in_use--;
+    }
+
+    seq_result_stats_update(instance, result, 0);
+
+    myrefl_trace(instance->obj->i.name, "Action %s %s", 
+                 myrefl_obj_instance_name(instance),
+                 myrefl_util_myrefl_result_str(result));
+
+    return (result);
+}
+
+static void seq_sequencer(obj_instance_t *instance, 
+                          seq_event_t event, 
+                          myrefl_result_t result,
+                          long value);
+static void seq_thread_fn(myrefl_thread_t *thread, void *context_v);
+static void seq_release(obj_instance_t *instance);
+
+/*
+ * seq_context_alloc()
+ *
+ * Take a sequencer context from the free pool, or allocate a new one
+ * if the pool is empty.
+ */
+static seq_thread_context_t *seq_context_alloc (void)
+{
+    seq_thread_context_t *context = NULL;
+
+    if (free_seq_contexts) {
+        context = myrefl_list_pop(free_seq_contexts);
+    }
+
+    if (!context) {
+        context = malloc(sizeof(seq_thread_context_t));
+    }
+    return (context);
+}
+
+/*
+ * seq_context_reserve()
+ *
+ * Take one of the reserved sequencer contexts, used only when no other
+ * context can be allocated.
+ *
+ * Must be called with the DB locked.
+ */
+static seq_thread_context_t *seq_context_reserve (void)
+{
+    int i;
+
+    for (i = 0; i < SEQUENCE_CONTEXT_RESERVE; i++) {
+        if (!seq_reserve_used[i]) {
+            seq_reserve_used[i] = TRUE;
+            return (&seq_reserve_contexts[i]);
+        }
+    }
+    return (NULL);
+}
+
+/*
+ * seq_context_free()
+ *
+ * Return a sequencer context to the reserve or the free pool.
+ */
+static void seq_context_free (seq_thread_context_t *context)
+{
+    if (context >= seq_reserve_contexts && 
+        context < seq_reserve_contexts + SEQUENCE_CONTEXT_RESERVE) {
+        seq_reserve_used[context - seq_reserve_contexts] = FALSE;
+        return;
+    }
+
+    if (!free_seq_contexts) {
+        free_seq_contexts = myrefl_list_create();
+    }
+
+    if (free_seq_contexts && 
+        free_seq_contexts->num_elements < SEQUENCE_CONTEXT_LOW_WATER) {
+        myrefl_list_push(free_seq_contexts, context);
+    } else {
+        free(context);
+    }
+}
+
+/*
+ * seq_dispatch()
+ *
+ * Hand an event for this instance to a worker thread. 
+ *
+ * Only one sequencer job per instance is queued or running at any one 
+ * time, further events for a busy instance wait on that instance's 
+ * backlog so that they are processed in the order that they were raised,
+ * whichever thread ends up running them. 
+ *
+ * Must be called with the DB locked.
+ */
+static void seq_dispatch (obj_instance_t *instance, 
+                          seq_event_t event, 
+                          myrefl_result_t result,
+                          long value)
+{
+    seq_thread_context_t *context;
+
+    context = seq_context_alloc();
+
+    if (!context && instance->seq_active) {
+        /*
+         * The instance is busy, so this event has to wait on its backlog
+         * if at all possible.
+         */
+        context = seq_context_reserve();
+        if (!context) {
+            /*
+             * Nothing left to queue it with, better to run it now out
+             * of order than lose it. The instance stays with whoever
+             * has it.
+             */
+            myrefl_error("SEQ: No memory for '%s', event %d may run out of order",
+                         myrefl_obj_instance_name(instance), event);
+            seq_sequencer(instance, event, result, value);
+            return;
+        }
+    }
+
+    if (!context) {
+        /*
+         * No memory for the context, so run it now in this thread, 
+         * holding the instance just as a job would.
+         */
+        instance->seq_active = TRUE;
+        seq_sequencer(instance, event, result, value);
+        seq_release(instance);
+        return;
+    }
+
+    context->instance = instance;
+    context->event = event;
+    context->result = result;
+    context->value = value;
+
+    /*
+     * Held until the job runs, whether that is now or from the backlog.
+     */
+    instance->in_use++;
+
+    if (instance->seq_active) {
+        if (!instance->seq_backlog) {
+            instance->seq_backlog = myrefl_list_create();
+        }
+
+        if (instance->seq_backlog &&
+            myrefl_list_push(instance->seq_backlog, context)) {
+            return;
+        }
+        /*
+         * No backlog, better to run it out of order than lose it.
+         */
+        myrefl_error("SEQ: No backlog for '%s', event %d may run out of order",
+                     myrefl_obj_instance_name(instance), event);
+    }
+
+    instance->seq_active = TRUE;
+    if (!myrefl_thread_request(seq_thread_fn, NULL, context)) {
+        seq_thread_fn(NULL, context);
+    }
+}
+
+/*
+ * seq_release()
+ *
+ * The sequencer has finished with this instance, start the next event
+ * waiting on its backlog, or mark the instance as idle.
+ *
+ * Must be called with the DB locked.
+ */
+static void seq_release (obj_instance_t *instance)
+{
+    seq_thread_context_t *context = NULL;
+
+    if (instance->seq_backlog) {
+        context = myrefl_list_pop(instance->seq_backlog);
+    }
+
+    if (context) {
+        if (!myrefl_thread_request(seq_thread_fn, NULL, context)) {
+            seq_thread_fn(NULL, context);
+        }
+    } else {
+        instance->seq_active = FALSE;
+    }
+}
+
+/*
+ * Limit on how many instances are processed inline, one within another,
+ * before the rest of a chain is handed off as a new job. Rule chains 
+ * are no longer limited in length, so this is what keeps the stack in 
+ * check. Protected by the DB lock, it is shared between the threads, 
+ * which only ever makes handing off happen sooner.
+ */
+#define SEQ_INLINE_DEPTH_LIMIT 25
+
+static uint seq_inline_depth = 0;
+
+/*
+ * Rules fed by a seq_process_outputs() walk are recorded in a set local
+ * to that walk, held on the stack unless the walk feeds more than this.
+ */
+#define SEQ_OUTPUT_FED_INLINE 16
+
+/*
+ * seq_fanout()
+ *
+ * Apply an event to one of several downstream instances (rule inputs, 
+ * rule outputs or actions). The first idle instance is processed inline 
+ * by the current job, the rest get jobs of their own so that independent
+ * chains, and the client actions at the end of them, proceed in parallel
+ * on the other threads. 
+ *
+ * A busy instance is never run inline since that would overtake the 
+ * events already waiting for it.
+ */
+static void seq_fanout (obj_instance_t *instance, 
+                        seq_event_t event, 
+                        myrefl_result_t result,
+                        long value,
+                        boolean *inline_done)
+{
+    if (!*inline_done && !instance->seq_active &&
+        seq_inline_depth < SEQ_INLINE_DEPTH_LIMIT) {
+        *inline_done = TRUE;
+        instance->seq_active = TRUE;
+        seq_inline_depth++;
+        seq_sequencer(instance, event, result, value);
+        seq_inline_depth--;
+        seq_release(instance);
+    } else {
+        seq_dispatch(instance, event, result, value);
+    }
+}
+
+/*
+ * seq_action_tokens_take()
+ *
+ * Top up the token bucket for the time that has passed and take a token
+ * for an action to start, if there is one. Returns the ms until there
+ * will be a token if there isn't, else 0.
+ */
+static ulong seq_action_tokens_take (void)
+{
+    unsigned long long now, max;
+
+    if (seq_action_rate == 0) {
+        return (0);
+    }
+
+    now = seq_time_now_ms();
+    max = (unsigned long long)seq_action_burst * SEQ_ACTION_TOKEN;
+    if (now > seq_action_refilled) {
+        seq_action_tokens += (now - seq_action_refilled) * seq_action_rate;
+        if (seq_action_tokens > max) {
+            seq_action_tokens = max;
+        }
+    }
+    seq_action_refilled = now;
+
+    if (seq_action_tokens >= SEQ_ACTION_TOKEN) {
+        seq_action_tokens -= SEQ_ACTION_TOKEN;
+        return (0);
+    }
+    return ((SEQ_ACTION_TOKEN - seq_action_tokens + seq_action_rate - 1) / 
+            seq_action_rate);
+}
+
+/*
+ * seq_action_slot_free()
+ *
+ * Whether another instance of this action may run alongside those 
+ * running now.
+ */
+static boolean seq_action_slot_free (obj_action_t *action)
+{
+    if (seq_action_max_running && 
+        seq_action_running >= seq_action_max_running) {
+        return (FALSE);
+    }
+    if (action->max_running && action->running >= action->max_running) {
+        return (FALSE);
+    }
+    return (TRUE);
+}
+
+/*
+ * seq_action_reserve()
+ *
+ * Take a slot and a token for the action instance to start. If the 
+ * only thing stopping it is the rate, and the scheduler can't call us
+ * back when there is a token, then it starts anyway rather than waiting
+ * on an action that may never complete.
+ */
+static boolean seq_action_reserve (obj_instance_t *instance)
+{
+    obj_action_t *action = instance->obj->t.action;
+    ulong delay_ms;
+
+    if (!seq_action_slot_free(action)) {
+        return (FALSE);
+    }
+
+    delay_ms = seq_action_tokens_take();
+    if (delay_ms && myrefl_sched_action_flush(delay_ms)) {
+        return (FALSE);
+    }
+
+    seq_action_running++;
+    action->running++;
+    instance->action_admitted = TRUE;
+    return (TRUE);
+}
+
+/*
+ * seq_action_admit()
+ *
+ * Storm control for recovery actions, called as the action instance is
+ * about to run. Returns TRUE if it may run now, otherwise it waits on 
+ * the action queue for seq_action_kick() to start it (or is dropped if
+ * the queue is full).
+ */
+static boolean seq_action_admit (obj_instance_t *instance)
+{
+    obj_action_t *action;
+
+    if (!myrefl_obj_instance_validate(instance, OBJ_TYPE_ACTION)) {
+        instance->action_pending = FALSE;
+        return (TRUE);
+    }
+    action = instance->obj->t.action;
+
+    if (instance->action_admitted || 
+        ((!seq_action_queue || !seq_action_queue->num_elements) &&
+         seq_action_reserve(instance))) {
+        instance->action_pending = FALSE;
+        return (TRUE);
+    }
+
+    if (!seq_action_queue) {
+        seq_action_queue = myrefl_list_create();
+    }
+
+    if (!seq_action_queue || 
+        seq_action_queue->num_elements >= SEQ_ACTION_QUEUE_MAX) {
+        action->suppressed++;
+        instance->action_pending = FALSE;
+        myrefl_error("SEQ: Action '%s' suppressed, too many actions waiting",
+                     myrefl_obj_instance_name(instance));
+        return (FALSE);
+    }
+
+    /*
+     * Held until the action is started from the queue.
+     */
+    instance->in_use++;
+    myrefl_list_push(seq_action_queue, instance);
+    action->deferred++;
+    myrefl_debug(instance->obj->i.name, 
+                 "SEQ: Action '%s' deferred, %d actions waiting",
+                 myrefl_obj_instance_name(instance), 
+                 seq_action_queue->num_elements);
+    return (FALSE);
+}
+
+/*
+ * seq_action_kick()
+ *
+ * Start as many of the waiting actions as the limits allow, in order,
+ * passing over those held back by their own action's limit.
+ */
+static void seq_action_kick (void)
+{
+    myrefl_list_element_t *element;
+    obj_instance_t *instance;
+    boolean found;
+
+    do {
+        found = FALSE;
+        for (element = seq_action_queue ? seq_action_queue->head : NULL;
+             element != NULL;
+             element = element->next) {
+            instance = element->data;
+            if (instance->state == OBJ_STATE_DELETED ||
+                !myrefl_obj_instance_validate(instance, OBJ_TYPE_ACTION)) {
+                found = TRUE;
+            } else if (seq_action_max_running &&
+                       seq_action_running >= seq_action_max_running) {
+                return;
+            } else if (seq_action_reserve(instance)) {
+                found = TRUE;
+            } else if (seq_action_slot_free(instance->obj->t.action)) {
+                /*
+                 * Out of tokens, wait for the flush.
+                 */
+                return;
             }
-        }
-        break;
-    case MYREFL_RULE_RANGE_N_TO_M:
-        /*
-         * Pass if inside the range, else fail.
-         */
-        if (result == MYREFL_RESULT_VALUE) {
-            if (value < rule->op_n ||
-                value > rule->op_m) {
-                rule_result = MYREFL_RESULT_FAIL;
+
+            if (found) {
+                myrefl_list_remove(seq_action_queue, instance);
+                instance->in_use--;
+                if (instance->action_admitted) {
+                    seq_dispatch(instance, SEQ_ACTION_RUN, 
+                                 MYREFL_RESULT_INVALID, 0);
+                } else {
+                    instance->action_pending = FALSE;
+                }
+                break;
             }
         }
-        break;
+    } while (found);
+}
 
-    case MYREFL_RULE_DISABLE:
-        rule_result = MYREFL_RESULT_ABORT;
-        break;
+/*
+ * seq_action_release()
+ *
+ * The action instance has completed, give up its slot and start 
+ * whatever was waiting for it.
+ */
+static void seq_action_release (obj_instance_t *instance)
+{
+    if (!instance->action_admitted) {
+        return;
+    }
+    instance->action_admitted = FALSE;
+    seq_action_running--;
+    if (myrefl_obj_validate(instance->obj, OBJ_TYPE_ACTION) &&
+        instance->obj->t.action->running) {
+        instance->obj->t.action->running--;
+    }
+    seq_action_kick();
+}
 
-    case MYREFL_RULE_N_EVER:
-        if (result == MYREFL_RESULT_FAIL) {
-            instance->fail_count++;
-            if (instance->fail_count >= rule->op_n) {
-                rule_result = MYREFL_RESULT_FAIL;
-                instance->fail_count = 0;
-            }
-        }
-        break;
-    case MYREFL_RULE_N_IN_ROW:
-        if (result == MYREFL_RESULT_FAIL) {
-            instance->fail_count++;
-            if (instance->fail_count >= rule->op_n) {
-                rule_result = MYREFL_RESULT_FAIL;
-            }
-        } else {
-            instance->fail_count = 0;
-        }
-        break;
-    case MYREFL_RULE_N_IN_M:
-        /*
-         * For tracking N in M we use 1 bit per rule invocation in a 
-         * block of memory sized to 1 bit per invocation. For every 
-         * invocation we move our insertion bit along one, which overwrites
-         * old values.
-         *
-         * To evaluate whether the rule passes or fails we simply have to
-         * count how many bits are fail (1) versus pass (0), so N is a count
-         * of failures (1), and M is the total count.
-         */
-        if (result != MYREFL_RESULT_PASS &&
-            result != MYREFL_RESULT_FAIL) {
-            /*
-             * Not a valid input to an N in M rule, we only
-             * want pass or fail;
-             */
-            myrefl_error("Rule '%s' not pass or fail, got %s, ignoring", 
-                         myrefl_obj_instance_name(instance), 
-                         myrefl_util_myrefl_result_str(result));
-            rule_result = MYREFL_RESULT_ABORT;
-            break;
-        }
+/*
+ * seq_process_outputs()
+ *
+ * Feed the result from a test or rule instance into each of the rules
+ * that it is an input to, as given by the compiled rule graph.
+ *
+ * The same instance on each rule is used as on the input, if the rule
+ * doesn't have that instance then the result is mapped to all of the
+ * rule's instances.
+ */
+static void seq_process_outputs (obj_instance_t *instance,
+                                 seq_event_t event,
+                                 myrefl_result_t result,
+                                 long value,
+                                 boolean *inline_done)
+{
+    obj_graph_t *graph;
+    obj_graph_node_t *node;
+    obj_instance_t *rule_instance;
+    obj_t *rule_obj;
+    obj_t *fed_inline[SEQ_OUTPUT_FED_INLINE];
+    obj_t **fed = fed_inline, **grown;
+    uint i, j, outputs, n_outputs, generation;
+    uint n_fed = 0, fed_size = SEQ_OUTPUT_FED_INLINE;
+    boolean map_instances, restarted = FALSE;
+
+ restart:
+    node = myrefl_obj_graph_node(instance->obj);
+
+    if (!node || node->n_outputs == 0) {
+        myrefl_debug(instance->obj->i.name,
+                     "SEQ: No rule found for instance %s", 
+                     myrefl_obj_instance_name(instance));
+        goto done;
+    }
+
+    graph = myrefl_obj_graph();
+    generation = graph->generation;
+    outputs = node->outputs;
+    n_outputs = node->n_outputs;
 
-        if (!instance->rule_data) {
+    for (i = 0; i < n_outputs; i++) {
+        if (graph->generation != generation) {
             /*
-             * Allocate it - must be the first time through or the
-             * rule type was changed.
+             * A client changed the rules from a notification further
+             * down the walk and the graph was rebuilt, our operands 
+             * have gone. Walk the new graph, skipping the rules that 
+             * have already been fed.
              */
-            instance->rule_data = calloc(1, sizeof(obj_rule_data_t));
-            if (instance->rule_data) {
-                /*
-                 * Allocate the history bits
-                 */
-                int history_size = (rule->op_m / 8) + 1;
-                instance->rule_data->history = calloc(1, history_size);
-                instance->rule_data->history_size = history_size;
-            }
+            myrefl_debug(instance->obj->i.name,
+                         "SEQ: Rule graph changed whilst processing %s, "
+                         "restarting", myrefl_obj_instance_name(instance));
+            restarted = TRUE;
+            goto restart;
         }
 
-        if (instance->rule_data) {
-            if (instance->rule_data->history) {
-                int byte = instance->rule_data->position / 8;
-                int bit = instance->rule_data->position % 8;
-                uchar mask = (1 << bit);
-                long count_n = 0;
-
-                if (byte >= instance->rule_data->history_size) {
-                    /*
-                     * We'd be off the end of the data, how did that 
-                     * happen?
-                     */
-                    break;
-                }
+        rule_obj = graph->nodes[graph->operands[outputs + i]].obj;
 
-                if (result == MYREFL_RESULT_PASS) {
-                    /*
-                     * Clear the bit for a pass
-                     */
-                    instance->rule_data->history[byte] &= ~mask;
-                } else {
-                    /*
-                     * Set the bit for a fail
-                     */
-                    instance->rule_data->history[byte] |= mask;
-                }
-                
-                /*
-                 * Count the bits, by walking through the history
-                 * a byte at a time and looking up how many bits in
-                 * each byte (faster than shifting and counting).
-                 */
-                for(byte = 0; 
-                    byte < instance->rule_data->history_size; 
-                    byte++) {
-                    count_n += bit_count(instance->rule_data->history[byte]);
-                }
-                if (count_n >= rule->op_n) {
-                    rule_result = MYREFL_RESULT_FAIL;
-                }
-                     
-                instance->rule_data->position++;
+        /*
+         * The fed set is only consulted once the walk has restarted,
+         * a single graph never lists the same output twice.
+         */
+        if (restarted) {
+            for (j = 0; j < n_fed && fed[j] != rule_obj; j++) {
+            }
+            if (j < n_fed) {
+                continue;
+            }
+        }
 
-                if (instance->rule_data->position >= rule->op_m) {
-                    instance->rule_data->position = 0;
+        if (n_fed == fed_size) {
+            if (fed == fed_inline) {
+                grown = malloc(2 * fed_size * sizeof(obj_t *));
+                if (grown) {
+                    memcpy(grown, fed_inline, sizeof(fed_inline));
                 }
-                myrefl_debug(instance->obj->i.name, "%s Fail Count = %ld",
-                             myrefl_obj_instance_name(instance), count_n);
-
-                
             } else {
-                myrefl_error("No rule history data for '%s'",
+                grown = realloc(fed, 2 * fed_size * sizeof(obj_t *));
+            }
+            if (!grown) {
+                myrefl_error("SEQ: No memory to process outputs of %s", 
                              myrefl_obj_instance_name(instance));
-                rule_result = MYREFL_RESULT_ABORT;
+                goto done;
             }
-        } else {
-            myrefl_error("No rule data for '%s'", 
-                         myrefl_obj_instance_name(instance));
-            rule_result = MYREFL_RESULT_ABORT;
+            fed = grown;
+            fed_size *= 2;
         }
-        break;
-    case MYREFL_RULE_N_IN_TIME_M:
-        /*
-         * I need to know the time of each entry so that I can expire
-         * them.
-         */
-        myrefl_error("Not supported Rule N in time M yet");
-        rule_result = MYREFL_RESULT_ABORT;
-        break;
-    case MYREFL_RULE_FAIL_FOR_TIME_N:
-        myrefl_error("Not supported Rule Fail for time N yet");
-        rule_result = MYREFL_RESULT_ABORT;
-        break;
-    case MYREFL_RULE_OR:
+        fed[n_fed++] = rule_obj;
+
         /*
-         * Find matching input rule instances and if any are failing
-         * then we are failing.
+         * apply each rule instance to the result/value.
+         *
+         * First locate the same instance on the rule as was used
+         * for this input, if none found then use the rule instance.
          */
-        for(element = rule->inputs->head; 
-            element != NULL; 
-            element = element->next) 
-        {
-            obj = element->data;
-            input_instance = myrefl_obj_instance(obj, instance);
+        rule_instance = myrefl_obj_instance(rule_obj, instance);
 
-            if (input_instance && 
-                input_instance->last_result == MYREFL_RESULT_FAIL &&
-                input_instance->state == OBJ_STATE_ENABLED) {
-                /*
-                 * Any inputs failing means the whole rule fails
-                 */
-                rule_result = MYREFL_RESULT_FAIL;
-                break;
-            }
+        if (!rule_instance) {
+            myrefl_error("SEQ: No rule instance found for instance %s", 
+                         myrefl_obj_instance_name(instance));
+            continue;
         }
-        break;
-    case MYREFL_RULE_AND:
+
         /*
-         * Find matching input rule instances and if all are failing
-         * then we are failing. An abort counts as a failure.
+         * If the rule_instance is the base instance then map the 
+         * result to all instances.
          */
-        rule_result = MYREFL_RESULT_FAIL;
+        map_instances = !myrefl_obj_is_member_instance(rule_instance);
 
-        for(element = rule->inputs->head; 
-            element != NULL; 
-            element = element->next) 
-        {
-            obj = element->data;
-            input_instance = myrefl_obj_instance(obj, instance);
-
-            if (input_instance && 
-                input_instance->last_result == MYREFL_RESULT_PASS &&
-                input_instance->state == OBJ_STATE_ENABLED) {
+        while (rule_instance != NULL) {
+            if (result == MYREFL_RESULT_ABORT) {
                 /*
-                 * Any inputs passing means the whole rule passes
+                 * An aborted test may be of importance to the root
+                 * cause identification, since it could block the
+                 * proper identfication of the root cause. Let RCI
+                 * know about this abort.
                  */
-                rule_result = MYREFL_RESULT_PASS;
-                break;
+                myrefl_rci_run(rule_instance, result);
+            } else {
+                seq_fanout(rule_instance, event, result, value, 
+                           inline_done);
+            }
+                
+            if (map_instances) {
+                rule_instance = rule_instance->next;
+            } else {
+                rule_instance = NULL;
             }
         }
-        
-        break;
-    case MYREFL_RULE_INVALID:
-    case MYREFL_RULE_LAST:
-        myrefl_error("Invalid rule type for rule '%s'", 
-                     myrefl_obj_instance_name(instance));
-        rule_result = MYREFL_RESULT_FAIL;
-        break;
-    }
-
-    seq_result_stats_update(instance, rule_result, value);
-
-    /*
-     * Update health now that we've updated the stats, health is only
-     * calculated on the base instance, not the member instances. The
-     * stats update will have updated the base wrt the member instance 
-     * state.
-     */
-    seq_rule_result_on_health(&instance->obj->i, rule_result);
-
-    myrefl_debug(instance->obj->i.name,
-                 "Ran rule '%s' result '%s' criteria for (%ld in n:%ld m:%ld)",  
-                 myrefl_obj_instance_name(instance),
-                 myrefl_util_myrefl_result_str(rule_result), 
-                 value, rule->op_n, rule->op_m);
-
-    return (rule_result);
-}
-
-/*
- * Runs an action by calling the action function.
- * Actions stats are incremented depending on the result of the action.
- */
-static myrefl_result_t seq_action_run (obj_instance_t *instance)
-{
-    myrefl_result_t result = MYREFL_RESULT_ABORT;
-    obj_action_t *action;
-
-    if (!myrefl_obj_instance_validate(instance, OBJ_TYPE_ACTION)) {
-        return(MYREFL_RESULT_ABORT);
     }
 
-    action = instance->obj->t.action;
-
-    if (action->function) {
-        instance->in_use++;;
-        myrefl_obj_db_unlock();
-        result = (action->function)(instance->name, instance->context);
-        myrefl_obj_db_lock();
-        instance->in_use--;
+ done:
+    if (fed != fed_inline) {
+        free(fed);
     }
-
-    seq_result_stats_update(instance, result, 0);
-
-    myrefl_trace(instance->obj->i.name, "Action %s %s", 
-                 myrefl_obj_instance_name(instance),
-                 myrefl_util_myrefl_result_str(result));
-
-    return (result);
 }
 
 /*
  * seq_sequencer()
  *
  * Given an object instance and event walk through the sequence of
- * test/rule/action
+ * test/rule/action. Where a result feeds more than one downstream
+ * instance they are fanned out via seq_fanout().
  */
 static void seq_sequencer (obj_instance_t *instance, 
                            seq_event_t event, 
@@ -935,16 +2874,27 @@ static void seq_sequencer (obj_instance_t *instance,
 { 
     myrefl_result_t rule_result, test_result, action_result;
     myrefl_list_element_t *element;
+    obj_graph_node_t *node;
+    obj_t **actions;
+    uint i, n_actions;
     obj_t *action_obj, *rule_obj;
-    obj_rule_t *rule = NULL;
     obj_test_t *test = NULL;
     obj_action_t *action = NULL;
     obj_instance_t *rule_instance = NULL;
     obj_instance_t *action_instance = NULL;
+    boolean inline_done = FALSE;
 
     rule_result = test_result = action_result = result;
 
     if (!myrefl_obj_instance_validate(instance, OBJ_TYPE_ANY)) {
+        if (instance && 
+            (event == SEQ_ACTION_RUN || event == SEQ_ACTION_RESULT)) {
+            /*
+             * Deleted after it was started from the action queue, or 
+             * whilst it was in progress.
+             */
+            seq_action_release(instance);
+        }
         return;
     }
     
@@ -1029,94 +2979,59 @@ static void seq_sequencer (obj_instance_t *instance,
             myrefl_sched_add_test(instance, FALSE);
         }
 
-        /*
-         * First rule triggering from this test.
-         */
-        rule = test->rule;
         /* no break */
 
     case SEQ_RULE_PROCESS_INPUT:
         /*
          * Process the input result sending it to all interested
-         * rules. Allows rule->multiple_rule processing.
+         * rules.
          */
-        if (!rule && instance->obj->type == OBJ_TYPE_RULE) {
-            /*
-             * Got a rule as input
-             */
-            rule = instance->obj->t.rule;
-        }
-
-        if (!rule) {
-            myrefl_debug(instance->obj->i.name,
-                         "SEQ: No rule found for instance %s", 
-                         myrefl_obj_instance_name(instance));
-            break;
-        }
-
-        for (; rule; rule = rule->next_in_input) {
-            boolean map_instances = FALSE;
+        if (event != SEQ_TEST_RESULT_RCI) {
             /*
-             * apply each rule instance to the result/value.
-             *
-             * First locate the same instance on the rule as was used
-             * for this test, if none found then use the rule instance.
+             * Normal test process the results in a rule
              */
-            rule_instance = myrefl_obj_instance(rule->obj, instance);
-
-            if (!rule_instance) {
-                myrefl_error("SEQ: No rule instance found for instance %s", 
-                             myrefl_obj_instance_name(instance));
-                continue;
-            }
-
+            seq_process_outputs(instance, SEQ_RULE_RUN, test_result, value,
+                                &inline_done);
+        } else {
             /*
-             * If the rule_instance is the base instance then map the 
-             * result to all instances.
+             * This is an RCI run, don't run the actual rule
+             * again since that can stuff up the history.
              */
-            if (!myrefl_obj_is_member_instance(rule_instance)) {
-                map_instances = TRUE;
-            }
-
-            while (rule_instance != NULL) {
-                if (test_result == MYREFL_RESULT_ABORT) {
-                    /*
-                     * An aborted test may be of importance to the root
-                     * cause identification, since it could block the
-                     * proper identfication of the root cause. Let RCI
-                     * know about this abort.
-                     */
-                    myrefl_rci_run(rule_instance, test_result);
-                } else {
-                    if (event != SEQ_TEST_RESULT_RCI) {
-                        /*
-                         * Normal test process the results in a rule
-                         */
-                        seq_sequencer(rule_instance, SEQ_RULE_RUN, 
-                                      test_result, value);
-                    } else {
-                        /*
-                         * This is an RCI run, don't run the actual rule
-                         * again since that can stuff up the history.
-                         */
-                        seq_sequencer(rule_instance, SEQ_RULE_RUN_RCI, 
-                                      test_result, value);
-                    }
-                }
-                
-                if (map_instances) {
-                    rule_instance = rule_instance->next;
-                } else {
-                    rule_instance = NULL;
-                }
-            }
+            seq_process_outputs(instance, SEQ_RULE_RUN_RCI, test_result, 
+                                value, &inline_done);
         }
         break;
     case SEQ_RULE_RUN_RCI:
         rule_result = instance->last_result;
         /* no break */
+    case SEQ_RULE_DEADLINE:
+        if (event == SEQ_RULE_DEADLINE) {
+            /*
+             * A time based rule's deadline has passed, if its input is 
+             * still failing then run the rule again as if the input had 
+             * just reported that failure. The run applies the flap 
+             * damping to what it comes up with, so a suppressed instance
+             * is released on its new result rather than a stale one.
+             *
+             * Otherwise a flapping rule may have stopped flapping, if so
+             * report the result it was holding back.
+             */
+            if (instance->obj->type == OBJ_TYPE_RULE &&
+                instance->rule_data &&
+                instance->rule_data->operator == 
+                MYREFL_RULE_FAIL_FOR_TIME_N &&
+                instance->rule_data->fail_since) {
+                test_result = MYREFL_RESULT_FAIL;
+                value = instance->last_value;
+            } else if (seq_rule_flap_release(instance, &rule_result)) {
+                event = SEQ_RULE_RESULT;
+            } else {
+                return;
+            }
+        }
+        /* no break */
     case SEQ_RULE_RUN:
-        if (event != SEQ_RULE_RUN_RCI) {
+        if (event == SEQ_RULE_RUN || event == SEQ_RULE_DEADLINE) {
             rule_result = seq_rule_run(instance, test_result, value);
         }
         /* no break */
@@ -1130,8 +3045,6 @@ static void seq_sequencer (obj_instance_t *instance,
             return;
         }
 
-        rule = instance->obj->t.rule;
-
         if (rule_result == MYREFL_RESULT_PASS && instance->action_run) {
             /*
              * We're passing, so clear action_run since we are OK to
@@ -1140,35 +3053,27 @@ static void seq_sequencer (obj_instance_t *instance,
             instance->action_run = FALSE;
         }
 
-        if (rule->output && 
-            myrefl_obj_validate(rule->output->obj, OBJ_TYPE_RULE)) {
-            rule_instance = myrefl_obj_instance(rule->output->obj, instance);
-
-            if (!rule_instance) {
-                myrefl_error("SEQ: No rule instance for instance %s from rule output",
-                             myrefl_obj_instance_name(instance));             
-                break;
-            }
-
+        if (event != SEQ_RULE_RUN_RCI && 
+            seq_rule_unchanged(instance, rule_result)) {
             /*
-             * If the rule_instance is the base instance then map the 
-             * result to all instances.
+             * Same result as last time, the stats have been updated and
+             * that is all that is required.
              */
-            if (!myrefl_obj_is_member_instance(rule_instance)) {
-                while (rule_instance != NULL) {
-                    seq_sequencer(rule_instance, SEQ_RULE_PROCESS_INPUT, 
-                                  rule_result, 0);
-                    rule_instance = rule_instance->next;
-                }
-            } else {
-                /*
-                 * Found a matching instance on the output, apply 
-                 * only to that matching instance.
-                 */
-                seq_sequencer(rule_instance, SEQ_RULE_PROCESS_INPUT, 
-                              rule_result, 0);
-            }
+            myrefl_debug(instance->obj->i.name,
+                         "SEQ: Result unchanged for '%s', not propagating",
+                         myrefl_obj_instance_name(instance));
+            break;
+        }
+
+        if (event != SEQ_RULE_RUN_RCI && seq_rule_flapping(instance)) {
+            myrefl_debug(instance->obj->i.name,
+                         "SEQ: '%s' is flapping, not propagating",
+                         myrefl_obj_instance_name(instance));
+            break;
         }
+
+        seq_process_outputs(instance, SEQ_RULE_RUN, rule_result, 0, 
+                            &inline_done);
         /* no break */
     case SEQ_RCI_RUN:
         /*
@@ -1187,8 +3092,6 @@ static void seq_sequencer (obj_instance_t *instance,
             return;
         }
 
-        rule = instance->obj->t.rule;
-
         if (instance->action_run) {
             /*
              * Don't rerun actions just because a rule has been
@@ -1202,11 +3105,24 @@ static void seq_sequencer (obj_instance_t *instance,
             instance->action_run = TRUE;
         }
 
-        for(element = rule->action_list->head; 
-            element != NULL; 
-            element = element->next) 
-        {
-            action_obj = (obj_t*)element->data;
+        /*
+         * Actions call out to the client with the DB unlocked, so where
+         * there is more than one give each its own job and let them run
+         * alongside each other.
+         */
+        node = myrefl_obj_graph_node(instance->obj);
+        if (!node) {
+            myrefl_error("SEQ: No compiled rule for '%s'",
+                         myrefl_obj_instance_name(instance));
+            break;
+        }
+        actions = &myrefl_obj_graph()->actions[node->actions];
+        n_actions = node->n_actions;
+
+        inline_done = (n_actions > 1);
+
+        for (i = 0; i < n_actions; i++) {
+            action_obj = actions[i];
 
             /*
              * For each action, find the appropriate instance.
@@ -1214,6 +3130,21 @@ static void seq_sequencer (obj_instance_t *instance,
             action_instance = myrefl_obj_instance(action_obj, 
                                                   instance);
 
+            /*
+             * Many rules may find themselves the root cause of the 
+             * same failure, one run of the action that hasn't started
+             * yet covers them all.
+             */
+            if (action_instance->action_pending) {
+                action_obj->t.action->coalesced++;
+                myrefl_debug(action_obj->i.name,
+                             "SEQ: Action '%s' for '%s' coalesced with one pending",
+                             myrefl_obj_instance_name(action_instance),
+                             myrefl_obj_instance_name(instance));
+                continue;
+            }
+            action_instance->action_pending = TRUE;
+
             /*
              * Before we lose the context of which rule is triggering
              * the action we need to notify the user of what is going on.
@@ -1229,11 +3160,14 @@ static void seq_sequencer (obj_instance_t *instance,
                 myrefl_xos_recovery_in_progress(instance, action_instance);
             }
 
-            seq_sequencer(action_instance, SEQ_ACTION_RUN, 
-                          rule_result, 0);
+            seq_fanout(action_instance, SEQ_ACTION_RUN, 
+                       rule_result, 0, &inline_done);
         }
         break;
     case SEQ_ACTION_RUN:
+        if (!seq_action_admit(instance)) {
+            return;
+        }
         action_result = seq_action_run(instance);
 
         if (!myrefl_obj_validate(instance->obj, OBJ_TYPE_ACTION) ||
@@ -1243,13 +3177,15 @@ static void seq_sequencer (obj_instance_t *instance,
              * deleted or corrupted, don't look at this object any
              * further.
              */
+            seq_action_release(instance);
             return;
         }
 
         if (action_result == MYREFL_RESULT_IN_PROGRESS) {
             /*
              * The action will inform us when the result is available, don't
-             * do anything now other than start a watchdog timer.
+             * do anything now other than start a watchdog timer. It keeps
+             * its slot under the limits until then.
              *
              * TODO
              */ 
@@ -1259,6 +3195,12 @@ static void seq_sequencer (obj_instance_t *instance,
         }
         /* no break */
     case SEQ_ACTION_RESULT:  
+        /*
+         * The action has finished, whether it returned the result or 
+         * notified it later, so let the next one waiting have its slot.
+         */
+        seq_action_release(instance);
+
         /*
          * If the action passed then we should retest the rule to check
          * whether it is now working (assuming it is polled). If it is
@@ -1269,266 +3211,749 @@ static void seq_sequencer (obj_instance_t *instance,
             return;
         }
 
-        if (action_result == MYREFL_RESULT_PASS) {
-            action = instance->obj->t.action;
-            
-            /*
-             * Don't run rules for built in's, there could be a lot of 
-             * those, and most don't apply.
-             *
-             * Note that at this time these flags are only set on the 
-             * base object.
-             */
-            if (instance->obj->i.flags.action & OBJ_FLAG_BUILT_IN) {
-                return;
-            }
+        if (action_result == MYREFL_RESULT_PASS) {
+            action = instance->obj->t.action;
+            
+            /*
+             * Don't run rules for built in's, there could be a lot of 
+             * those, and most don't apply.
+             *
+             * Note that at this time these flags are only set on the 
+             * base object.
+             */
+            if (instance->obj->i.flags.action & OBJ_FLAG_BUILT_IN) {
+                return;
+            }
+
+            if (action->rule_list) {
+                for (element = action->rule_list->head;
+                     element != NULL;
+                     element = element->next)
+                {
+                    rule_obj = (obj_t*)element->data;
+                    rule_instance = myrefl_obj_instance(rule_obj, 
+                                                        instance);
+                    myrefl_debug(rule_instance->obj->i.name,
+                                 "SEQ: Scheduling tests for rule '%s' to confirm action", 
+                                 myrefl_obj_instance_name(rule_instance));
+                    myrefl_sched_rule_immediate(rule_instance);
+                }
+            }
+        }
+        break;
+    }
+}
+
+/*
+ * seq_thread_fn()
+ *
+ * Thread function, take the context from the thread and extract the
+ * necessary information for the sequencer, then kick off the sequencer
+ * at the correct point.
+ */
+static void seq_thread_fn (myrefl_thread_t *thread, void *context_v)
+{
+    seq_thread_context_t *context = context_v;
+    obj_instance_t *instance = context->instance;
+
+    myrefl_obj_db_lock();
+    /*
+     * The DB is now locked, so the in_use flag can be cleared.
+     */
+    instance->in_use--;
+
+    seq_sequencer(instance, context->event, context->result, 
+                  context->value);
+
+    seq_context_free(context);
+
+    /*
+     * Let the next event for this instance (if any) run.
+     */
+    seq_release(instance);
+    myrefl_obj_db_unlock();
+}
+
+/*
+ * myrefl_seq_from_test()
+ *
+ * Kick off the sequencer from the start of a test within a new thread.
+ */
+void myrefl_seq_from_test (obj_instance_t *instance)
+{
+    seq_dispatch(instance, SEQ_TEST_RUN, MYREFL_RESULT_INVALID, 0);
+}
+
+/*
+ * myrefl_seq_from_test_notify()
+ *
+ * Kick off of the sequencer from the start of the test results within
+ * a new thread.
+ */
+void myrefl_seq_from_test_notify (obj_instance_t *instance,
+                                  myrefl_result_t result,
+                                  long value)
+{
+    seq_dispatch(instance, SEQ_TEST_RESULT, result, value);
+}
+
+/*
+ * myrefl_seq_from_test_notify_rci()
+ *
+ * Kick off of the sequencer from the start of the test results within
+ * a new thread.
+ */
+void myrefl_seq_from_test_notify_rci (obj_instance_t *instance,
+                                      myrefl_result_t result,
+                                      long value)
+{
+    seq_dispatch(instance, SEQ_TEST_RESULT_RCI, result, value);
+}
+
+/*
+ * myrefl_seq_batch_create()
+ *
+ * Create an empty batch for up to max test results. May return NULL, 
+ * in which case myrefl_seq_batch_add() dispatches each result itself.
+ */
+seq_batch_t *myrefl_seq_batch_create (uint max)
+{
+    seq_batch_t *batch;
+
+    batch = malloc(sizeof(seq_batch_t) + (max * sizeof(seq_batch_entry_t)));
+    if (batch) {
+        batch->count = 0;
+        batch->max = max;
+    }
+    return (batch);
+}
+
+/*
+ * myrefl_seq_batch_add()
+ *
+ * Add a test result to the batch. If the instance already has a job 
+ * queued or running (including an earlier result in this batch) then
+ * the result has to wait its turn on the instance's backlog instead.
+ */
+void myrefl_seq_batch_add (seq_batch_t *batch,
+                           obj_instance_t *instance,
+                           myrefl_result_t result,
+                           long value)
+{
+    seq_batch_entry_t *entry;
+
+    if (!batch || batch->count >= batch->max || instance->seq_active) {
+        seq_dispatch(instance, SEQ_TEST_RESULT, result, value);
+        return;
+    }
+
+    entry = &batch->entries[batch->count++];
+    entry->instance = instance;
+    entry->result = result;
+    entry->value = value;
+
+    instance->in_use++;
+    instance->seq_active = TRUE;
+}
+
+/*
+ * seq_batch_thread_fn()
+ *
+ * Run each of the batch's results through the sequencer in turn.
+ */
+static void seq_batch_thread_fn (myrefl_thread_t *thread, void *batch_v)
+{
+    seq_batch_t *batch = batch_v;
+    seq_batch_entry_t *entry;
+    uint i;
+
+    myrefl_obj_db_lock();
+    for (i = 0; i < batch->count; i++) {
+        entry = &batch->entries[i];
+        entry->instance->in_use--;
+
+        seq_sequencer(entry->instance, SEQ_TEST_RESULT, entry->result, 
+                      entry->value);
+
+        seq_release(entry->instance);
+    }
+    myrefl_obj_db_unlock();
+
+    free(batch);
+}
+
+/*
+ * seq_batch_request()
+ *
+ * Give the batch a job of its own, or run it now in this thread if there
+ * is no job for it rather than leave its instances marked active.
+ */
+static void seq_batch_request (seq_batch_t *batch)
+{
+    if (!myrefl_thread_request(seq_batch_thread_fn, NULL, batch)) {
+        seq_batch_thread_fn(NULL, batch);
+    }
+}
+
+/*
+ * myrefl_seq_batch_dispatch()
+ *
+ * Hand the batch to the worker threads, the batch is freed once it has
+ * run.
+ *
+ * It is split into as many parts as there are threads, so that a result
+ * whose chain ends up dropping the DB lock for a slow test or action 
+ * only holds up the results in its own part. The instances in a batch 
+ * are all different, so the parts can run in any order.
+ */
+void myrefl_seq_batch_dispatch (seq_batch_t *batch)
+{
+    seq_batch_t *part;
+    uint size, first;
+
+    if (!batch) {
+        return;
+    }
+
+    if (batch->count == 0) {
+        free(batch);
+        return;
+    }
+
+    size = (batch->count + NBR_THREADS - 1) / NBR_THREADS;
+    for (first = 0; batch->count - first > size; first += size) {
+        part = myrefl_seq_batch_create(size);
+        if (!part) {
+            /*
+             * The rest stay together in the batch itself.
+             */
+            break;
+        }
+        memcpy(part->entries, &batch->entries[first], 
+               size * sizeof(seq_batch_entry_t));
+        part->count = size;
+        seq_batch_request(part);
+    }
+
+    batch->count -= first;
+    memmove(batch->entries, &batch->entries[first], 
+            batch->count * sizeof(seq_batch_entry_t));
+    seq_batch_request(batch);
+}
+
+/*
+ * seq_notify_feed()
+ *
+ * The aggregation window for this test instance has closed, feed the 
+ * rules a single result for everything that was notified within it.
+ */
+static void seq_notify_feed (obj_instance_t *instance)
+{
+    obj_notify_agg_t *agg = instance->notify_agg;
+    myrefl_result_t result;
+    long value = 0;
+
+    if (!agg || agg->count == 0) {
+        return;
+    }
+
+    if (agg->failures) {
+        result = MYREFL_RESULT_FAIL;
+    } else if (agg->values) {
+        result = MYREFL_RESULT_VALUE;
+    } else if (agg->passes) {
+        result = MYREFL_RESULT_PASS;
+    } else {
+        result = MYREFL_RESULT_ABORT;
+    }
+
+    switch (instance->obj->t.test->aggregate) {
+    case MYREFL_AGGREGATE_FAILURES:
+        value = agg->failures;
+        break;
+    case MYREFL_AGGREGATE_COUNT:
+        value = agg->count;
+        break;
+    case MYREFL_AGGREGATE_MIN:
+        value = agg->min;
+        break;
+    case MYREFL_AGGREGATE_MAX:
+        value = agg->max;
+        break;
+    case MYREFL_AGGREGATE_AVERAGE:
+        if (agg->values) {
+            value = (long)(agg->sum / agg->values);
+        }
+        break;
+    case MYREFL_AGGREGATE_SUM:
+        value = (long)agg->sum;
+        break;
+    case MYREFL_AGGREGATE_LAST:
+        break;
+    }
+
+    myrefl_debug(instance->obj->i.name, 
+                 "SEQ: %u notifications for '%s' aggregated to %s %ld",
+                 agg->count, myrefl_obj_instance_name(instance),
+                 myrefl_util_myrefl_result_str(result), value);
+
+    memset(agg, 0, sizeof(obj_notify_agg_t));
+
+    if (instance->state == OBJ_STATE_ENABLED) {
+        seq_dispatch(instance, SEQ_TEST_RESULT, result, value);
+    }
+}
+
+/*
+ * myrefl_seq_from_test_notify_aggregate()
+ *
+ * Accumulate a notification into the test instance's aggregation window,
+ * opening a new window if there isn't one. The window is fed to the 
+ * rules by myrefl_seq_notify_flush() when it closes.
+ */
+void myrefl_seq_from_test_notify_aggregate (obj_instance_t *instance,
+                                            myrefl_result_t result,
+                                            long value)
+{
+    obj_notify_agg_t *agg = instance->notify_agg;
+    obj_notify_agg_t *other;
+    myrefl_list_element_t *element, *prev;
+    unsigned int window_ms = instance->obj->t.test->aggregate_ms;
+
+    if (!agg) {
+        agg = instance->notify_agg = calloc(1, sizeof(obj_notify_agg_t));
+        if (!agg) {
+            seq_dispatch(instance, SEQ_TEST_RESULT, result, value);
+            return;
+        }
+    }
+
+    agg->count++;
+    switch (result) {
+    case MYREFL_RESULT_PASS:
+        agg->passes++;
+        break;
+    case MYREFL_RESULT_FAIL:
+        agg->failures++;
+        break;
+    case MYREFL_RESULT_VALUE:
+        /*
+         * Only values count towards the value statistics, the value 
+         * passed with a pass or fail means nothing.
+         */
+        if (agg->values == 0 || value < agg->min) {
+            agg->min = value;
+        }
+        if (agg->values == 0 || value > agg->max) {
+            agg->max = value;
+        }
+        agg->sum += value;
+        agg->values++;
+        break;
+    default:
+        break;
+    }
+
+    if (agg->count > 1) {
+        /*
+         * Window already open.
+         */
+        return;
+    }
+
+    if (!seq_notify_pending) {
+        seq_notify_pending = myrefl_list_create();
+    }
+    agg->due = seq_time_now_ms() + window_ms;
+
+    if (!seq_notify_pending || !myrefl_sched_notify_flush(window_ms)) {
+        /*
+         * Can't hold on to it, so feed it straight through.
+         */
+        seq_notify_feed(instance);
+        return;
+    }
+
+    /*
+     * Keep the list in due order. Most tests share a window size so
+     * usually this just goes on the end.
+     */
+    element = seq_notify_pending->tail;
+    if (!element ||
+        ((obj_instance_t *)element->data)->notify_agg->due <= agg->due) {
+        myrefl_list_push(seq_notify_pending, instance);
+        return;
+    }
+    prev = NULL;
+    for (element = seq_notify_pending->head; element; element = element->next) {
+        other = ((obj_instance_t *)element->data)->notify_agg;
+        if (other->due > agg->due) {
+            break;
+        }
+        prev = element;
+    }
+    myrefl_list_insert(seq_notify_pending, prev, instance);
+}
+
+/*
+ * myrefl_seq_notify_flush()
+ *
+ * Feed the rules from every aggregation window that has closed, and ask
+ * to be called again when the next one closes.
+ */
+void myrefl_seq_notify_flush (void)
+{
+    obj_instance_t *instance;
+    unsigned long long now = seq_time_now_ms();
 
-            if (action->rule_list) {
-                for (element = action->rule_list->head;
-                     element != NULL;
-                     element = element->next)
-                {
-                    rule_obj = (obj_t*)element->data;
-                    rule_instance = myrefl_obj_instance(rule_obj, 
-                                                        instance);
-                    myrefl_debug(rule_instance->obj->i.name,
-                                 "SEQ: Scheduling tests for rule '%s' to confirm action", 
-                                 myrefl_obj_instance_name(rule_instance));
-                    myrefl_sched_rule_immediate(rule_instance);
-                }
-            }
+    while ((instance = myrefl_list_peek(seq_notify_pending)) != NULL &&
+           instance->notify_agg->due <= now) {
+        myrefl_list_pop(seq_notify_pending);
+        seq_notify_feed(instance);
+    }
+
+    if (instance && 
+        !myrefl_sched_notify_flush(instance->notify_agg->due - now)) {
+        while ((instance = myrefl_list_pop(seq_notify_pending)) != NULL) {
+            seq_notify_feed(instance);
         }
-        break;
     }
 }
 
 /*
- * seq_thread_fn()
+ * myrefl_seq_notify_forget()
  *
- * Thread function, take the context from the thread and extract the
- * necessary information for the sequencer, then kick off the sequencer
- * at the correct point.
+ * The test instance is being freed, forget its aggregation window.
  */
-static void seq_thread_fn (myrefl_thread_t *thread, void *context_v)
+void myrefl_seq_notify_forget (obj_instance_t *instance)
 {
-    seq_thread_context_t *context = context_v;
+    if (instance->notify_agg) {
+        if (instance->notify_agg->count && seq_notify_pending) {
+            myrefl_list_remove(seq_notify_pending, instance);
+        }
+        free(instance->notify_agg);
+        instance->notify_agg = NULL;
+    }
+}
 
-    myrefl_obj_db_lock();
-    /*
-     * The DB is now locked, so the in_use flag can be cleared.
-     */
-    context->instance->in_use--;
+/*
+ * myrefl_seq_action_forget()
+ *
+ * The action instance is being freed, give up any slot it still holds.
+ */
+void myrefl_seq_action_forget (obj_instance_t *instance)
+{
+    seq_action_release(instance);
+}
 
-    seq_sequencer(context->instance, context->event, context->result, 
-                  context->value);
+/*
+ * myrefl_seq_root_cause()
+ *
+ * This rule has been identified as the root cause, re-enter the sequencer
+ * to process the actions. Do this in a new thread so as to not block
+ * the caller (which may be EEM or the RCI code).
+ */
+void myrefl_seq_from_root_cause (obj_instance_t *instance)
+{
+    seq_dispatch(instance, SEQ_RULE_ROOT_CAUSE, MYREFL_RESULT_INVALID, 0);
+}
 
-    if (!free_seq_contexts) {
-        free_seq_contexts = myrefl_list_create();
-    }
-    
-    if (free_seq_contexts && 
-        free_seq_contexts->num_elements < SEQUENCE_CONTEXT_LOW_WATER) {
-        myrefl_list_push(free_seq_contexts, context);
-    } else {
-        free(context);
+
+/*
+ * myrefl_seq_from_rule_deadline()
+ *
+ * A deadline requested by this rule instance has expired, re-enter the
+ * sequencer to re-evaluate the rule.
+ */
+void myrefl_seq_from_rule_deadline (obj_instance_t *instance)
+{
+    seq_dispatch(instance, SEQ_RULE_DEADLINE, MYREFL_RESULT_FAIL, 0);
+}
+
+/*
+ * myrefl_seq_from_action_complete()
+ *
+ * Kick off of the sequencer from the action results
+ */
+void myrefl_seq_from_action_complete (obj_instance_t *instance,
+                                      myrefl_result_t result)
+{
+    seq_dispatch(instance, SEQ_ACTION_RESULT, result, 0);
+}
+
+/*
+ * myrefl_seq_action_set_limits()
+ *
+ * Set how many recovery actions may run at once and how many may be
+ * started per minute, with bursts of up to "burst" (0 for no limit).
+ */
+void myrefl_seq_action_set_limits (uint max_running, uint rate, uint burst)
+{
+    seq_action_max_running = max_running;
+    seq_action_rate = rate;
+    seq_action_burst = burst ? burst : 1;
+    if (seq_action_tokens > 
+        (unsigned long long)seq_action_burst * SEQ_ACTION_TOKEN) {
+        seq_action_tokens = 
+            (unsigned long long)seq_action_burst * SEQ_ACTION_TOKEN;
     }
-    myrefl_obj_db_unlock();
+    seq_action_kick();
 }
 
 /*
- * myrefl_seq_from_test()
+ * myrefl_seq_action_flush()
  *
- * Kick off the sequencer from the start of a test within a new thread.
+ * There should be a token for the next rate limited action by now.
  */
-void myrefl_seq_from_test (obj_instance_t *instance)
+void myrefl_seq_action_flush (void)
 {
-    seq_thread_context_t *context = NULL;
-    seq_thread_context_t no_memory;
+    seq_action_kick();
+}
 
-    if (free_seq_contexts) {
-        context = myrefl_list_pop(free_seq_contexts);
+/*
+ * myrefl_seq_obj_health_sync()
+ *
+ * The state or severity of a rule or component has changed outside of
+ * the sequencer, bring its parent component's health up to date.
+ */
+void myrefl_seq_obj_health_sync (obj_t *obj)
+{
+    int health_delta;
+
+    if (!obj || !obj->parent_comp) {
+        return;
     }
 
-    if (!context) {
-        context = malloc(sizeof(seq_thread_context_t));
+    health_delta = seq_obj_health_delta(obj, seq_obj_health_desired(obj));
+    if (health_delta != 0) {
+        seq_comp_health(obj->parent_comp, health_delta);
     }
+}
 
-    if (!context) {
-        context = &no_memory;
+/*
+ * myrefl_seq_obj_health_withdraw()
+ *
+ * The object is about to be removed from its parent component, give
+ * back any health that it is currently taking away from it.
+ */
+void myrefl_seq_obj_health_withdraw (obj_t *obj)
+{
+    int health_delta;
+
+    if (!obj || !obj->parent_comp) {
+        return;
     }
 
-    context->instance = instance;
-    context->event = SEQ_TEST_RUN;
-    context->result = MYREFL_RESULT_INVALID;
-    context->value = 0;
-    
-    if (context != &no_memory) {
-        instance->in_use++;
-        myrefl_thread_request(seq_thread_fn, 
-                              NULL, 
-                              context);
-    } else {
-        seq_sequencer(context->instance, context->event, context->result, 
-                      context->value);
+    health_delta = seq_obj_health_delta(obj, 0);
+    if (health_delta != 0) {
+        seq_comp_health(obj->parent_comp, health_delta);
     }
 }
 
 /*
- * myrefl_seq_from_test_notify()
+ * myrefl_seq_comp_health_resync()
  *
- * Kick off of the sequencer from the start of the test results within
- * a new thread.
+ * Recalculate the health of a component and all the components within
+ * it from scratch. Used when the state of many members has been changed
+ * at once, e.g. enabling or disabling a whole component.
  */
-void myrefl_seq_from_test_notify (obj_instance_t *instance,
-                                  myrefl_result_t result,
-                                  long value)
+void myrefl_seq_comp_health_resync (obj_comp_t *comp)
 {
-    seq_thread_context_t *context = NULL;
-    seq_thread_context_t no_memory;
+    obj_t *obj;
+    int health = 1000;
 
-    if (free_seq_contexts) {
-        context = myrefl_list_pop(free_seq_contexts);
+    if (!comp) {
+        return;
     }
 
-    if (!context) {
-        context = malloc(sizeof(seq_thread_context_t));
+    obj = myrefl_obj_get_first_rel(comp->obj, OBJ_REL_COMP);
+    while (obj) {
+        if (myrefl_obj_validate(obj, OBJ_TYPE_COMP)) {
+            myrefl_seq_comp_health_resync(obj->t.comp);
+        }
+        obj = myrefl_obj_get_next_rel(obj, OBJ_REL_NEXT_IN_COMP);
     }
-    
-    if (!context) {
-        context = &no_memory;
+
+    obj = myrefl_obj_get_first_rel(comp->obj, OBJ_REL_RULE);
+    while (obj) {
+        if (myrefl_obj_validate(obj, OBJ_TYPE_RULE)) {
+            obj->t.rule->health_counted = seq_obj_health_desired(obj);
+            health -= obj->t.rule->health_counted;
+        }
+        obj = myrefl_obj_get_next_rel(obj, OBJ_REL_NEXT_IN_COMP);
     }
 
-    context->instance = instance;
-    context->event = SEQ_TEST_RESULT;
-    context->result = result;
-    context->value = value;
-    
-    if (context != &no_memory) {
-        instance->in_use++;
-        myrefl_thread_request(seq_thread_fn, 
-                              NULL, 
-                              context);
-    } else {
-        seq_sequencer(context->instance, context->event, context->result, 
-                      context->value);
+    obj = myrefl_obj_get_first_rel(comp->obj, OBJ_REL_COMP);
+    while (obj) {
+        if (myrefl_obj_validate(obj, OBJ_TYPE_COMP)) {
+            obj->t.comp->health_counted = seq_obj_health_desired(obj);
+            health -= obj->t.comp->health_counted;
+        }
+        obj = myrefl_obj_get_next_rel(obj, OBJ_REL_NEXT_IN_COMP);
     }
+
+    seq_comp_health(comp, health - comp->health);
 }
 
 /*
- * myrefl_seq_from_test_notify_rci()
+ * seq_comp_depth()
  *
- * Kick off of the sequencer from the start of the test results within
- * a new thread.
+ * How deep in the component tree this component is, the system
+ * component being at depth 0.
  */
-void myrefl_seq_from_test_notify_rci (obj_instance_t *instance,
-                                      myrefl_result_t result,
-                                      long value)
+static int seq_comp_depth (obj_comp_t *comp)
 {
-    seq_thread_context_t *context = NULL;
-    seq_thread_context_t no_memory;
+    int depth = 0;
 
-    if (free_seq_contexts) {
-        context = myrefl_list_pop(free_seq_contexts);
-    }
-
-    if (!context) {
-        context = malloc(sizeof(seq_thread_context_t));
+    while ((comp = comp->obj->parent_comp) != NULL) {
+        depth++;
     }
+    return (depth);
+}
 
-    if (!context) {
-        context = &no_memory;
-    }
+static int seq_comp_depth_cmp (const void *a, const void *b)
+{
+    const seq_dirty_comp_t *comp_a = a;
+    const seq_dirty_comp_t *comp_b = b;
 
-    context->instance = instance;
-    context->event = SEQ_TEST_RESULT_RCI;
-    context->result = result;
-    context->value = value;
-    
-    if (context != &no_memory) {
-        instance->in_use++;
-        myrefl_thread_request(seq_thread_fn, 
-                              NULL, 
-                              context);
-    } else {
-        seq_sequencer(context->instance, context->event, context->result, 
-                      context->value);
-    }
+    return (comp_b->depth - comp_a->depth);
 }
 
 /*
- * myrefl_seq_root_cause()
+ * myrefl_seq_health_flush()
  *
- * This rule has been identified as the root cause, re-enter the sequencer
- * to process the actions. Do this in a new thread so as to not block
- * the caller (which may be EEM or the RCI code).
+ * Publish the health of all the components that have changed since the
+ * last flush. The deepest components go first so that a parent has
+ * caught up with all its children before its own confidence is worked
+ * out and its health published. Called with the DB locked.
  */
-void myrefl_seq_from_root_cause (obj_instance_t *instance)
+void myrefl_seq_health_flush (void)
 {
-    seq_thread_context_t *context = NULL;
-    seq_thread_context_t no_memory;
+    seq_dirty_comp_t *dirty;
+    obj_comp_t *comp;
+    uint count, i;
 
-    if (free_seq_contexts) {
-        context = myrefl_list_pop(free_seq_contexts);
+    if (!seq_dirty_comps || seq_dirty_comps->num_elements == 0) {
+        return;
     }
 
-    if (!context) {
-        context = malloc(sizeof(seq_thread_context_t));
+    count = seq_dirty_comps->num_elements;
+    dirty = malloc(count * sizeof(seq_dirty_comp_t));
+
+    if (!dirty) {
+        /*
+         * No memory to sort them, publish in the order that they
+         * were dirtied, which has children before parents anyway.
+         */
+        while ((comp = myrefl_list_pop(seq_dirty_comps)) != NULL) {
+            comp->health_dirty = FALSE;
+            seq_comp_health_publish(comp);
+        }
+        return;
     }
 
-    if (!context) {
-        context = &no_memory;
+    for (i = 0; i < count; i++) {
+        comp = myrefl_list_pop(seq_dirty_comps);
+        comp->health_dirty = FALSE;
+        dirty[i].comp = comp;
+        dirty[i].depth = seq_comp_depth(comp);
     }
 
-    context->instance = instance;
-    context->event = SEQ_RULE_ROOT_CAUSE;
-        
-    if (context != &no_memory) {
-        instance->in_use++;
-        myrefl_thread_request(seq_thread_fn, 
-                              NULL, 
-                              context);
-    } else {
-        seq_sequencer(context->instance, context->event, context->result, 
-                      context->value);
+    qsort(dirty, count, sizeof(seq_dirty_comp_t), seq_comp_depth_cmp);
+
+    for (i = 0; i < count; i++) {
+        seq_comp_health_publish(dirty[i].comp);
     }
+    free(dirty);
 }
 
+/*
+ * myrefl_seq_comp_health_forget()
+ *
+ * The component is being freed, make sure that we don't try and
+ * publish its health later.
+ */
+void myrefl_seq_comp_health_forget (obj_comp_t *comp)
+{
+    if (comp->health_dirty && seq_dirty_comps) {
+        myrefl_list_remove(seq_dirty_comps, comp);
+        comp->health_dirty = FALSE;
+    }
+}
 
 /*
- * myrefl_seq_from_action_complete()
+ * myrefl_seq_set_health_interval()
  *
- * Kick off of the sequencer from the action results
+ * Set how long health changes are batched for before being published,
+ * 0 publishes every change as it happens.
  */
-void myrefl_seq_from_action_complete (obj_instance_t *instance,
-                                      myrefl_result_t result)
+void myrefl_seq_set_health_interval (uint interval_ms)
 {
-    seq_thread_context_t *context = NULL;
-    seq_thread_context_t no_memory;
+    seq_health_interval = interval_ms;
 
-    if (free_seq_contexts) {
-        context = myrefl_list_pop(free_seq_contexts);
+    if (interval_ms == 0) {
+        myrefl_seq_health_flush();
     }
+}
 
-    if (!context) {
-        context = malloc(sizeof(seq_thread_context_t));
+/*
+ * myrefl_seq_baseline_mode()
+ *
+ * Whether this rule instance is learning or enforcing its baseline for
+ * the current time of day.
+ */
+seq_baseline_mode_t myrefl_seq_baseline_mode (obj_instance_t *instance)
+{
+    obj_rule_t *rule;
+    obj_rule_data_t *rule_data;
+
+    if (instance->obj->type != OBJ_TYPE_RULE) {
+        return (SEQ_BASELINE_NONE);
+    }
+    rule = instance->obj->t.rule;
+    if (rule->operator != MYREFL_RULE_BASELINE_N_SIGMA) {
+        return (SEQ_BASELINE_NONE);
     }
 
-    if (!context) {
-        context = &no_memory;
+    rule_data = instance->rule_data;
+    if (!rule_data || !rule_data->baseline ||
+        rule_data->operator != rule->operator ||
+        seq_baseline_slot(rule_data)->count < rule->op_m) {
+        return (SEQ_BASELINE_LEARNING);
     }
+    return (SEQ_BASELINE_ENFORCING);
+}
 
-    context->instance = instance;
-    context->event = SEQ_ACTION_RESULT;
-    context->result = result;
-    
-    if (context != &no_memory) {
-        instance->in_use++;
-        myrefl_thread_request(seq_thread_fn, 
-                              NULL, 
-                              context);
-    } else {
-        seq_sequencer(context->instance, context->event, context->result, 
-                      context->value);
+/*
+ * myrefl_seq_baseline_set_file()
+ *
+ * Persist the baselines in filename, loading any that are already
+ * there.
+ */
+void myrefl_seq_baseline_set_file (const char *filename)
+{
+    seq_baseline_record_t *record;
+
+    free(seq_baseline_file);
+    seq_baseline_file = NULL;
+
+    while ((record = myrefl_list_pop(seq_baseline_records)) != NULL) {
+        seq_baseline_record_free(record);
+    }
+
+    if (filename) {
+        seq_baseline_file = strdup(filename);
+        if (seq_baseline_file) {
+            seq_baseline_load(seq_baseline_file);
+            seq_baseline_saved = seq_time_now_ms();
+            if (seq_baseline_dirty) {
+                /*
+                 * Learnt before there was a file to save them in.
+                 */
+                seq_baseline_dirty = FALSE;
+                seq_baseline_changed();
+            }
+        }
     }
 }
 
@@ -1554,6 +3979,10 @@ void myrefl_seq_init (void)
         free_seq_contexts = myrefl_list_create();
     }
 
+    if (!seq_dirty_comps) {
+        seq_dirty_comps = myrefl_list_create();
+    }
+
     if (free_seq_contexts) {
         for (i=0; i < SEQUENCE_CONTEXT_LOW_WATER; i++) {
             context = malloc(sizeof(seq_thread_context_t));
@@ -1568,10 +3997,40 @@ void myrefl_seq_terminate (void)
 {
 	// Free up the contexts
 	seq_thread_context_t *context;
+	obj_comp_t *comp;
+	obj_instance_t *instance;
+	seq_baseline_snapshot_t *snapshot;
 
 	while ((context = myrefl_list_pop(free_seq_contexts)) != NULL) {
 		free(context);
 	}
 	myrefl_list_free(free_seq_contexts);
 	free_seq_contexts = NULL;
+
+	while ((comp = myrefl_list_pop(seq_dirty_comps)) != NULL) {
+		comp->health_dirty = FALSE;
+	}
+	myrefl_list_free(seq_dirty_comps);
+	seq_dirty_comps = NULL;
+
+	myrefl_obj_db_lock();
+	while ((instance = myrefl_list_pop(seq_notify_pending)) != NULL) {
+		instance->notify_agg->count = 0;
+	}
+	myrefl_list_free(seq_notify_pending);
+	seq_notify_pending = NULL;
+
+	while ((instance = myrefl_list_pop(seq_action_queue)) != NULL) {
+		instance->action_pending = FALSE;
+		instance->in_use--;
+	}
+	myrefl_list_free(seq_action_queue);
+	seq_action_queue = NULL;
+
+	snapshot = seq_baseline_dirty ? myrefl_seq_baseline_snapshot() : NULL;
+	myrefl_seq_baseline_set_file(NULL);
+	myrefl_obj_db_unlock();
+	myrefl_seq_baseline_write(snapshot);
+	myrefl_list_free(seq_baseline_records);
+	seq_baseline_records = NULL;
 }
@@ -45,6 +45,41 @@
  */
 #define SEQUENCE_CONTEXT_LOW_WATER   50
 
+/*
+ * Contexts held back for events on a busy instance when no more can be
+ * allocated, so that they can still wait on its backlog.
+ */
+#define SEQUENCE_CONTEXT_RESERVE     4
+
+/*
+ * Default interval in ms over which component health changes are
+ * batched before being published.
+ */
+#define SEQ_HEALTH_INTERVAL          100
+
+/*
+ * Interval in ms at which learnt baselines are written to the baseline
+ * file, if they have changed.
+ */
+#define SEQ_BASELINE_SAVE_INTERVAL   (10 * 60 * 1000)
+
+/*
+ * Default limits on recovery actions, how many may run at once (0 for no
+ * limit) and how many actions per minute may be started (0 for no limit)
+ * with bursts of up to SEQ_ACTION_BURST. Actions over the limits wait, 
+ * up to SEQ_ACTION_QUEUE_MAX of them, beyond that they are suppressed.
+ */
+#define SEQ_ACTION_MAX_RUNNING       0
+#define SEQ_ACTION_RATE              0
+#define SEQ_ACTION_BURST             10
+#define SEQ_ACTION_QUEUE_MAX         1000
+
+/*
+ * Flap damping penalty added to a rule instance each time it changes 
+ * between pass and fail.
+ */
+#define SEQ_FLAP_PENALTY             1000
+
 void myrefl_seq_from_test(obj_instance_t *test_instance);
 
 void myrefl_seq_from_test_notify(obj_instance_t *test_instance,
@@ -54,15 +89,58 @@ void myrefl_seq_from_test_notify(obj_instance_t *test_instance,
 void myrefl_seq_from_test_notify_rci(obj_instance_t *test_instance,
                                      myrefl_result_t result,
                                      long value);
+void myrefl_seq_from_test_notify_aggregate(obj_instance_t *test_instance,
+                                           myrefl_result_t result,
+                                           long value);
+
+/*
+ * A batch of test results that are run through the sequencer by a 
+ * few jobs, at most one per worker thread, rather than one job each.
+ */
+typedef struct seq_batch_s seq_batch_t;
+
+seq_batch_t *myrefl_seq_batch_create(uint max);
+void myrefl_seq_batch_add(seq_batch_t *batch,
+                          obj_instance_t *test_instance,
+                          myrefl_result_t result,
+                          long value);
+void myrefl_seq_batch_dispatch(seq_batch_t *batch);
+void myrefl_seq_notify_flush(void);
+void myrefl_seq_notify_forget(obj_instance_t *test_instance);
+void myrefl_seq_action_forget(obj_instance_t *action_instance);
 
 void myrefl_seq_from_root_cause(obj_instance_t *rule_instance);
+void myrefl_seq_from_rule_deadline(obj_instance_t *rule_instance);
 
 void myrefl_seq_comp_set_health(obj_comp_t *comp, uint health);
+void myrefl_seq_obj_health_sync(obj_t *obj);
+void myrefl_seq_obj_health_withdraw(obj_t *obj);
+void myrefl_seq_comp_health_resync(obj_comp_t *comp);
+void myrefl_seq_comp_health_forget(obj_comp_t *comp);
+void myrefl_seq_health_flush(void);
+void myrefl_seq_set_health_interval(uint interval_ms);
+
+typedef enum seq_baseline_mode_e {
+    SEQ_BASELINE_NONE,          // Not a baseline rule
+    SEQ_BASELINE_LEARNING,      // Still learning, will not fail
+    SEQ_BASELINE_ENFORCING,     // Failing values that deviate
+} seq_baseline_mode_t;
+
+seq_baseline_mode_t myrefl_seq_baseline_mode(obj_instance_t *instance);
+void myrefl_seq_baseline_set_file(const char *filename);
+
+typedef struct seq_baseline_snapshot_s seq_baseline_snapshot_t;
+
+seq_baseline_snapshot_t *myrefl_seq_baseline_snapshot(void);
+boolean myrefl_seq_baseline_write(seq_baseline_snapshot_t *snapshot);
+void myrefl_seq_baseline_flush(void);
 
 myrefl_result_t myrefl_seq_test_run(obj_instance_t *test_instance, 
                                     long *value);
 void myrefl_seq_from_action_complete(obj_instance_t *action_instance,
                                      myrefl_result_t result);
+void myrefl_seq_action_set_limits(uint max_running, uint rate, uint burst);
+void myrefl_seq_action_flush(void);
 void myrefl_seq_init(void);
 void myrefl_seq_terminate(void);
 
@@ -42,11 +42,11 @@
 /*
  * Keep track of the threads and jobs
  */
-static myrefl_list_t *thread_free_queue = NULL;
-static myrefl_list_t *thread_executing_queue = NULL;
-static myrefl_list_t *job_pending_queue = NULL;
+static myrefl_queue_t *thread_free_queue = NULL;
+static myrefl_queue_t *thread_executing_queue = NULL;
+static myrefl_queue_t *job_pending_queue = NULL;
 
-static myrefl_list_t *free_job_requests = NULL;
+static myrefl_queue_t *free_job_requests = NULL;
 
 /*
  * How many ms to delay the scheduling of tasks due to the
@@ -77,7 +77,6 @@ long myrefl_thread_ut_get_delay (void)
  */
 long myrefl_thread_cpu (void)
 {
-    myrefl_list_element_t *element;
     myrefl_thread_t *thread;
     long cpu = 0;
 
@@ -87,13 +86,13 @@ long myrefl_thread_cpu (void)
     /*
      * Check running processes first
      */
-    for(element = thread_free_queue->head; element; element = element->next) {
-        thread = element->data;
+    for(thread = myrefl_queue_peek(thread_free_queue); thread;
+        thread = myrefl_queue_next(thread_free_queue, thread)) {
         cpu += myrefl_xos_thread_cpu_last_min(thread->xos);
     }
 
-    for(element = thread_executing_queue->head; element; element = element->next) {
-        thread = element->data;
+    for(thread = myrefl_queue_peek(thread_executing_queue); thread;
+        thread = myrefl_queue_next(thread_executing_queue, thread)) {
         cpu += myrefl_xos_thread_cpu_last_min(thread->xos);
     }
     return(cpu);
@@ -190,7 +189,7 @@ static void thread_main (myrefl_thread_t *thread)
                 if (free_job_requests && 
                     free_job_requests->num_elements < THREAD_REQUEST_LOW_WATER) {
                 	// Recyle the job.
-                    myrefl_list_push(free_job_requests, thread->job);
+                    myrefl_queue_push(free_job_requests, thread->job);
                 } else {
                 	// Free it, we have enough job in the free queue.
                     free(thread->job);
@@ -200,14 +199,14 @@ static void thread_main (myrefl_thread_t *thread)
                 /*
                  * Any other jobs pending? Lets do them now.
                  */
-                thread->job = myrefl_list_pop(job_pending_queue);
+                thread->job = myrefl_queue_pop(job_pending_queue);
             }
 
             /*
              * No more work to do, Remove the thread from the executing queue
              */
-            myrefl_list_remove(thread_executing_queue, thread);
-            myrefl_list_push(thread_free_queue, thread);
+            myrefl_queue_remove(thread_executing_queue, thread);
+            myrefl_queue_push(thread_free_queue, thread);
         } else {
             myrefl_thread_kill(thread);
         }
@@ -217,6 +216,9 @@ static void thread_main (myrefl_thread_t *thread)
      * Thread is quitting, free memory for the thread.
      */    
     myrefl_debug(NULL, "Thread %s(%d) killed", thread->name, thread->id);
+    if (thread->link.queue) {
+        myrefl_queue_remove(thread->link.queue, thread);
+    }
     myrefl_xos_thread_destroy(thread);
     free(thread);
 }
@@ -232,10 +234,14 @@ void myrefl_thread_init (void)
     myrefl_thread_t *thread;
     obj_t *obj;
 
-    thread_free_queue = myrefl_list_create();
-    thread_executing_queue = myrefl_list_create();
-    job_pending_queue = myrefl_list_create();
-    free_job_requests = myrefl_list_create();
+    thread_free_queue =
+        myrefl_queue_create(MYREFL_QUEUE_OFFSET(myrefl_thread_t, link));
+    thread_executing_queue =
+        myrefl_queue_create(MYREFL_QUEUE_OFFSET(myrefl_thread_t, link));
+    job_pending_queue =
+        myrefl_queue_create(MYREFL_QUEUE_OFFSET(thread_job_t, link));
+    free_job_requests =
+        myrefl_queue_create(MYREFL_QUEUE_OFFSET(thread_job_t, link));
 
     if (!thread_free_queue || !thread_executing_queue || !job_pending_queue ||
         !free_job_requests) {
@@ -246,14 +252,14 @@ void myrefl_thread_init (void)
 
     for (i=0; i<THREAD_REQUEST_LOW_WATER; i++) {
         thread_job_t *job;
-        job = malloc(sizeof(thread_job_t));
+        job = calloc(1, sizeof(thread_job_t));
         if (job) {
-            myrefl_list_push(free_job_requests, job);
+            myrefl_queue_push(free_job_requests, job);
         }
     }
 
     for (i=0; i<NBR_THREADS; i++) {
-        thread = (myrefl_thread_t *)malloc(sizeof(myrefl_thread_t));
+        thread = (myrefl_thread_t *)calloc(1, sizeof(myrefl_thread_t));
         if (!thread) {
             myrefl_error("Failed to alloc thread");
             continue;
@@ -265,7 +271,7 @@ void myrefl_thread_init (void)
         thread->job = NULL;
 
         if (thread->xos) {
-            myrefl_list_add(thread_free_queue, thread);
+            myrefl_queue_add(thread_free_queue, thread);
         } else {
             myrefl_error("Failed to create xos thread");
             if (thread->name) {
@@ -374,11 +380,11 @@ static thread_job_t *thread_alloc_job (thread_function_exe_t execute,
     thread_job_t *job = NULL;
 
     if (free_job_requests) {
-        job = myrefl_list_pop(free_job_requests);
+        job = myrefl_queue_pop(free_job_requests);
     }
     
     if (!job) {
-        job = malloc(sizeof(thread_job_t));
+        job = calloc(1, sizeof(thread_job_t));
     }
 
     if (job) {
@@ -394,18 +400,18 @@ static void thread_free_jobs (void)
 	thread_job_t *job = NULL;
 
 	if (free_job_requests) {
-		while ((job = myrefl_list_pop(free_job_requests)) != NULL) {
+		while ((job = myrefl_queue_pop(free_job_requests)) != NULL) {
 			free(job);
 		}
-		myrefl_list_free(free_job_requests);
+		myrefl_queue_free(free_job_requests);
 		free_job_requests = NULL;
 	}
 
 	if (job_pending_queue) {
-		while ((job = myrefl_list_pop(job_pending_queue)) != NULL) {
+		while ((job = myrefl_queue_pop(job_pending_queue)) != NULL) {
 			free(job);
 		}
-		myrefl_list_free(job_pending_queue);
+		myrefl_queue_free(job_pending_queue);
 		job_pending_queue = NULL;
 	}
 }
@@ -422,10 +428,13 @@ void myrefl_thread_terminate (void)
  * Accept a request to run a thread calling this function with the
  * supplied context. If there are no threads available then defer the
  * request to the pending queue until one becomes available.
+ *
+ * Returns FALSE if the request could not be accepted, in which case the
+ * caller still owns the context.
  */
-void myrefl_thread_request (thread_function_exe_t execute, 
-                            thread_function_dsp_t display,
-                            void *context)
+boolean myrefl_thread_request (thread_function_exe_t execute, 
+                               thread_function_dsp_t display,
+                               void *context)
 {
     myrefl_thread_t *thread;
     thread_job_t *job;
@@ -438,11 +447,11 @@ void myrefl_thread_request (thread_function_exe_t execute,
          * Could not allocate the job, we'll have to discard it
          */
         myrefl_error("Could not execute job, discarded");
-        return;
+        return (FALSE);
     }
 
     //myrefl_trace(NULL, "thread free queue %d, executing %d", thread_free_queue->num_elements, thread_executing_queue->num_elements);
-    thread = myrefl_list_pop(thread_free_queue);
+    thread = myrefl_queue_pop(thread_free_queue);
 
     if (thread && !thread->quit) {
         /*
@@ -454,15 +463,17 @@ void myrefl_thread_request (thread_function_exe_t execute,
         if (!myrefl_xos_thread_release(thread->xos)) {
             myrefl_error("Failed to release thread");
             myrefl_thread_kill(thread);
-            return;
+            free(job);
+            return (FALSE);
         }
-        myrefl_list_push(thread_executing_queue, thread);
+        myrefl_queue_push(thread_executing_queue, thread);
     } else {
         /*
          * No threads free, add to the pending queue.
          */
-        myrefl_list_push(job_pending_queue, job);
+        myrefl_queue_push(job_pending_queue, job);
     }
+    return (TRUE);
 }
 
 void myrefl_thread_kill (myrefl_thread_t *thread)
@@ -489,18 +500,13 @@ void myrefl_thread_kill (myrefl_thread_t *thread)
  */
 void myrefl_thread_ut_clear_pending (thread_function_exe_t function)
 {
-    myrefl_list_element_t *element;
-    thread_job_t *job;
+    thread_job_t *job, *next;
     
-    for(element = job_pending_queue->head; element; element = element->next) {
-        job = element->data;
+    for(job = myrefl_queue_peek(job_pending_queue); job; job = next) {
+        next = myrefl_queue_next(job_pending_queue, job);
 
         if (job->execute == function) {
-            myrefl_list_remove(job_pending_queue, job);
-            /*
-             * Back to the head.
-             */
-            element = job_pending_queue->head;
+            myrefl_queue_remove(job_pending_queue, job);
         }
     }
 
@@ -523,10 +529,10 @@ void myrefl_thread_kill_threads ()
 		// kill off the free threads and pop them from
 		// the queue.
 		myrefl_thread_t *thread;
-		while ((thread = (myrefl_thread_t*)myrefl_list_pop(thread_free_queue)) != NULL) {
+		while ((thread = (myrefl_thread_t*)myrefl_queue_pop(thread_free_queue)) != NULL) {
 			myrefl_thread_kill(thread);
 		}
-		myrefl_list_free(thread_free_queue);
+		myrefl_queue_free(thread_free_queue);
 		thread_free_queue = NULL;
 	}
 
@@ -536,10 +542,10 @@ void myrefl_thread_kill_threads ()
 		// kill off the executing threads and pop them from
 		// the queue.
 		myrefl_thread_t *thread;
-		while ((thread = (myrefl_thread_t*)myrefl_list_pop(thread_executing_queue)) != NULL) {
+		while ((thread = (myrefl_thread_t*)myrefl_queue_pop(thread_executing_queue)) != NULL) {
 			myrefl_thread_kill(thread);
 		}
-		myrefl_list_free(thread_executing_queue);
+		myrefl_queue_free(thread_executing_queue);
 		thread_executing_queue = NULL;
 	}
 }
@@ -66,6 +66,7 @@ typedef struct {
     thread_function_exe_t execute;
     thread_function_dsp_t display;
     void *context;
+    myrefl_link_t link;        /* pending or free job queue */
 } thread_job_t;
 
 /*
@@ -82,13 +83,14 @@ struct myrefl_thread_s {
     xos_timer_t *guard_timer; /* timer guards against slow tests/actions */
     xos_thread_t *xos;
     thread_job_t *job;
+    myrefl_link_t link;       /* free or executing thread queue */
 };
 
 extern void myrefl_thread_init(void);
 extern void myrefl_thread_terminate(void);
-extern void myrefl_thread_request(thread_function_exe_t execute, 
-                                  thread_function_dsp_t display,
-                                  void *context);
+extern boolean myrefl_thread_request(thread_function_exe_t execute, 
+                                     thread_function_dsp_t display,
+                                     void *context);
 extern void myrefl_thread_kill(myrefl_thread_t *thread);
 extern void myrefl_thread_kill_threads(void);
 
@@ -40,6 +40,7 @@
 
 typedef struct trace_event_s trace_event_t;
 typedef struct myrefl_list_s myrefl_list_t;
+typedef struct myrefl_queue_s myrefl_queue_t;
 typedef struct sched_test_s sched_test_t;
 typedef struct myrefl_thread_s myrefl_thread_t;
 
@@ -51,6 +52,16 @@ typedef struct obj_action_s obj_action_t;
 typedef struct obj_rule_s obj_rule_t;
 typedef struct obj_comp_s obj_comp_t;
 
+/*
+ * Link for the intrusive queue (see myrefl_util.h), it is embedded in
+ * the owning structure so it has to be complete here.
+ */
+typedef struct myrefl_link_s {
+    struct myrefl_link_s *next;
+    struct myrefl_link_s *prev;
+    myrefl_queue_t *queue;
+} myrefl_link_t;
+
 /*
  * Get the standard types like uint after we have declared our own types
  */
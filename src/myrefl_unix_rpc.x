@@ -29,7 +29,9 @@
  * Define the RPC data types for communication between HA Diags
  * instances.
  *
- * TODO: Extend messages to cover the full set of messages required.
+ * TODO: Extend messages to cover the full set of messages required,
+ *       the time series for one are only served by the web server, as
+ *       /series/<tier>/<object>.
  */
 
 typedef string swdiag_name_t<>;
@@ -64,6 +66,9 @@ struct swdiag_cli_info_element_rpc_t {
     int default_state;
     int health;
     int confidence;
+    int coalesced;
+    int deferred;
+    int suppressed;
 };
 
 typedef struct swdiag_cli_info_element_rpc_t swdiag_cli_info_rsp_t<20>;
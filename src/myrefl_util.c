@@ -43,50 +43,209 @@
 #define HEADER_MALLOC_MULTIPLIER 50
 
 /*
- * List of free list elements
+ * Each thread keeps a cache of free list elements so that it only takes
+ * the global lock to move a batch of them to or from the global pool.
+ */
+#define ELEMENT_CACHE_BATCH HEADER_MALLOC_MULTIPLIER
+#define ELEMENT_CACHE_MAX   (2 * ELEMENT_CACHE_BATCH)
+
+typedef struct util_element_cache_s {
+    myrefl_list_element_t *free;
+    uint count;
+    myrefl_link_t link;         /* on element_caches */
+} util_element_cache_t;
+
+/*
+ * List of free list elements and the statistics, protected by
+ * free_elements_lock. The thread caches are kept on element_caches
+ * for the statistics.
  */
 static myrefl_list_element_t *free_elements = NULL;
 static xos_critical_section_t *free_elements_lock = NULL;
+static xos_thread_key_t *element_cache_key = NULL;
+static myrefl_queue_t *element_caches = NULL;
+static myrefl_list_stats_t element_stats;
+
 /*******************************************************************
  * Local Functions
  *******************************************************************/
 
-static myrefl_list_element_t *new_list_element (void)
+/*
+ * element_block_alloc()
+ *
+ * Allocate a new block of elements, returned as a chain. Called with
+ * free_elements_lock held.
+ */
+static myrefl_list_element_t *element_block_alloc (void)
 {
-    myrefl_list_element_t *element = NULL;
+    myrefl_list_element_t *element, *chain = NULL;
     char *memory_block;
     int i;
 
+    myrefl_trace(NULL, "Allocated new block of elements");
+    memory_block = calloc(HEADER_MALLOC_MULTIPLIER, 
+                          sizeof(myrefl_list_element_t));
+    
+    if (memory_block) {
+        for(i = 0; i < HEADER_MALLOC_MULTIPLIER; i++) {
+            element = (myrefl_list_element_t*)(memory_block + 
+                                   (i * sizeof(myrefl_list_element_t)));
+            element->next = chain;
+            chain = element;
+        }
+        element_stats.blocks++;
+        element_stats.elements += HEADER_MALLOC_MULTIPLIER;
+    }
+    return(chain);
+}
+
+/*
+ * element_cache_drain()
+ *
+ * Give "count" elements from the thread cache back to the global pool.
+ */
+static void element_cache_drain (util_element_cache_t *cache, uint count)
+{
+    myrefl_list_element_t *element;
+    uint moved = 0;
 
-    if (!free_elements_lock) {
-    	free_elements_lock = myrefl_xos_critical_section_create();
+    if (!count) {
+        return;
     }
 
     myrefl_xos_critical_section_enter(free_elements_lock);
+    while (moved < count && cache->free) {
+        element = cache->free;
+        cache->free = element->next;
+        element->next = free_elements;
+        free_elements = element;
+        moved++;
+    }
+    cache->count -= moved;
+    element_stats.global_free += moved;
+    element_stats.drains++;
+    myrefl_xos_critical_section_exit(free_elements_lock);
+}
+
+/*
+ * element_cache_refill()
+ *
+ * Move a batch of elements from the global pool into the empty thread
+ * cache, or a whole new block if the global pool is empty.
+ */
+static void element_cache_refill (util_element_cache_t *cache)
+{
+    myrefl_list_element_t *element;
 
+    myrefl_xos_critical_section_enter(free_elements_lock);
     if (free_elements == NULL) {
-    	myrefl_trace(NULL, "Allocated new block of elements");
-        memory_block = calloc(HEADER_MALLOC_MULTIPLIER, 
-                              sizeof(myrefl_list_element_t));
-        
-        if (memory_block) {
-            for(i = 0; i < HEADER_MALLOC_MULTIPLIER; i++) {
-                element = (myrefl_list_element_t*)(memory_block + 
-                                       (i * sizeof(myrefl_list_element_t)));
-                element->next = free_elements;
-                free_elements = element;
-            }
+        cache->free = element_block_alloc();
+        if (cache->free) {
+            cache->count = HEADER_MALLOC_MULTIPLIER;
+        }
+    } else {
+        while (cache->count < ELEMENT_CACHE_BATCH && free_elements) {
+            element = free_elements;
+            free_elements = element->next;
+            element->next = cache->free;
+            cache->free = element;
+            cache->count++;
+        }
+        element_stats.global_free -= cache->count;
+    }
+    element_stats.refills++;
+    myrefl_xos_critical_section_exit(free_elements_lock);
+}
+
+/*
+ * element_cache_destroy()
+ *
+ * The thread is exiting, return its cached elements to the global pool.
+ */
+static void element_cache_destroy (void *value)
+{
+    util_element_cache_t *cache = value;
+
+    if (cache) {
+        element_cache_drain(cache, cache->count);
+        myrefl_queue_remove(element_caches, cache);
+        free(cache);
+    }
+}
+
+/*
+ * element_cache()
+ *
+ * Return the calling thread's element cache, creating it on first use.
+ * NULL if there isn't one, in which case use the global pool directly.
+ */
+static util_element_cache_t *element_cache (void)
+{
+    util_element_cache_t *cache;
+
+    if (!element_cache_key || !element_caches) {
+        return(NULL);
+    }
+
+    cache = myrefl_xos_thread_key_get(element_cache_key);
+    if (!cache) {
+        cache = calloc(1, sizeof(util_element_cache_t));
+        if (cache && !myrefl_xos_thread_key_set(element_cache_key, cache)) {
+            free(cache);
+            cache = NULL;
+        }
+        if (cache) {
+            myrefl_queue_push(element_caches, cache);
         }
     }
+    return(cache);
+}
+
+static myrefl_list_element_t *new_list_element (void)
+{
+    myrefl_list_element_t *element = NULL;
+    util_element_cache_t *cache;
+
+    if (!free_elements_lock) {
+    	free_elements_lock = myrefl_xos_critical_section_create();
+    	element_cache_key = myrefl_xos_thread_key_create(element_cache_destroy);
+    	element_caches =
+    	    myrefl_queue_create(MYREFL_QUEUE_OFFSET(util_element_cache_t, link));
+    }
+
+    cache = element_cache();
 
-    if (free_elements) {
+    if (cache) {
+        if (!cache->free) {
+            element_cache_refill(cache);
+        }
+        element = cache->free;
+        if (element) {
+            cache->free = element->next;
+            cache->count--;
+        }
+    } else {
+        myrefl_xos_critical_section_enter(free_elements_lock);
+        if (free_elements == NULL) {
+            free_elements = element_block_alloc();
+            if (free_elements) {
+                element_stats.global_free += HEADER_MALLOC_MULTIPLIER;
+            }
+        }
         element = free_elements;
-        free_elements = element->next;
+        if (element) {
+            free_elements = element->next;
+            element_stats.global_free--;
+        }
+        myrefl_xos_critical_section_exit(free_elements_lock);
+    }
+
+    if (element) {
         element->next = NULL;
+        element->prev = NULL;
+        element->peer = NULL;
         element->data = NULL;
     } 
-
-    myrefl_xos_critical_section_exit(free_elements_lock);
     
     return(element);
 }
@@ -94,15 +253,28 @@ static myrefl_list_element_t *new_list_element (void)
 /*
  * free_list_element()
  *
- * Put the element back on the free list.
+ * Put the element back on the thread's cache, or the global free list.
  */
 static void free_list_element (myrefl_list_element_t *element)
 {
+    util_element_cache_t *cache;
+
     if (element) {
-    	myrefl_xos_critical_section_enter(free_elements_lock);
-        element->next = free_elements;
-        free_elements = element;
-        myrefl_xos_critical_section_exit(free_elements_lock);
+        cache = element_cache();
+        if (cache) {
+            element->next = cache->free;
+            cache->free = element;
+            cache->count++;
+            if (cache->count > ELEMENT_CACHE_MAX) {
+                element_cache_drain(cache, ELEMENT_CACHE_BATCH);
+            }
+        } else {
+            myrefl_xos_critical_section_enter(free_elements_lock);
+            element->next = free_elements;
+            free_elements = element;
+            element_stats.global_free++;
+            myrefl_xos_critical_section_exit(free_elements_lock);
+        }
     }
 }
 
@@ -114,12 +286,54 @@ static void free_list_element (myrefl_list_element_t *element)
  * myrefl_test_expose_free_list()
  *
  * Function to be used by the unit test code to access the free list.
+ * The calling thread's cache is flushed first so that all its free
+ * elements are on the list.
  */
 myrefl_list_element_t *myrefl_ut_expose_free_list (void)
 {
+    util_element_cache_t *cache = element_cache();
+
+    if (cache && cache->count) {
+        element_cache_drain(cache, cache->count);
+    }
     return(free_elements);
 }
 
+/*
+ * myrefl_list_get_stats()
+ *
+ * Snapshot of the list element allocator.
+ */
+void myrefl_list_get_stats (myrefl_list_stats_t *stats)
+{
+    util_element_cache_t *cache;
+
+    if (!stats) {
+        return;
+    }
+    if (!free_elements_lock) {
+        memset(stats, 0, sizeof(myrefl_list_stats_t));
+        return;
+    }
+    myrefl_xos_critical_section_enter(free_elements_lock);
+    *stats = element_stats;
+    if (element_caches) {
+        /*
+         * The cache counts change without the lock, so this is only
+         * approximate while other threads are busy.
+         */
+        myrefl_xos_critical_section_enter(element_caches->lock);
+        for (cache = myrefl_queue_peek(element_caches); cache;
+             cache = myrefl_queue_next(element_caches, cache)) {
+            stats->cached += cache->count;
+        }
+        stats->caches = element_caches->num_elements;
+        myrefl_xos_critical_section_exit(element_caches->lock);
+    }
+    stats->in_use = stats->elements - stats->global_free - stats->cached;
+    myrefl_xos_critical_section_exit(free_elements_lock);
+}
+
 /*
  * Check that the list is valid.
  */
@@ -141,8 +355,8 @@ static boolean validate_list (myrefl_list_t *list)
 			myrefl_error("List with one element head != tail %p", list);
 			return FALSE;
 		}
-		if (list->head->next != NULL) {
-			myrefl_error("List with one element head->next != NULL %p", list);
+		if (list->head->next != NULL || list->head->prev != NULL) {
+			myrefl_error("List with one element head->next/prev != NULL %p", list);
 			return FALSE;
 		}
 		break;
@@ -159,6 +373,10 @@ static boolean validate_list (myrefl_list_t *list)
 			myrefl_error("Populated list tail->next != NULL %p", list);
 			return FALSE;
 		}
+		if (list->head->prev != NULL || list->tail->prev == NULL) {
+			myrefl_error("Populated list bad head->prev or tail->prev %p", list);
+			return FALSE;
+		}
 		break;
 	}
 	return TRUE;
@@ -201,6 +419,9 @@ void myrefl_list_free (myrefl_list_t *list)
         while(list->head) {
             current = list->head;
             list->head = current->next;
+            if (current->peer) {
+                current->peer->peer = NULL;
+            }
             free_list_element(current);
         }
         myrefl_xos_critical_section_exit(list->lock);
@@ -209,37 +430,65 @@ void myrefl_list_free (myrefl_list_t *list)
     }
 }
 
+/*
+ * list_unlink()
+ *
+ * Take the element out of the list and free it, called with the list
+ * lock held.
+ */
+static void list_unlink (myrefl_list_t *list, myrefl_list_element_t *element)
+{
+    if (element->prev) {
+        element->prev->next = element->next;
+    } else {
+        list->head = element->next;
+    }
+    if (element->next) {
+        element->next->prev = element->prev;
+    } else {
+        list->tail = element->prev;
+    }
+    if (element->peer) {
+        element->peer->peer = NULL;
+    }
+    list->num_elements--;
+
+    // put the free element back in the free pool.
+    free_list_element(element);
+}
+
 /*
  * myrefl_list_add()
  *
  * Add the new_element to the head of the list.
  */
-void myrefl_list_add (myrefl_list_t *list, void *data)
+myrefl_list_element_t *myrefl_list_add (myrefl_list_t *list, void *data)
 {
-    myrefl_list_insert(list, NULL, data);
+    return(myrefl_list_insert(list, NULL, data));
 }
                       
 /*
  * myrefl_list_insert()
  *
  * Insert an element after the "prev" if "prev" is NULL then insert
- * at the head.
+ * at the head. Returns the new element, which may be used as a handle
+ * for myrefl_list_remove_element() while it is on the list.
  */
-void myrefl_list_insert (myrefl_list_t *list, 
-                         myrefl_list_element_t *prev,
-                         void *data)
+myrefl_list_element_t *myrefl_list_insert (myrefl_list_t *list, 
+                                           myrefl_list_element_t *prev,
+                                           void *data)
 {
     myrefl_list_element_t *element, *head, *next;
 
     if (!list) {
         myrefl_error("%s: bad parameters", __FUNCTION__);
-        return;
+        return(NULL);
     }
 
     myrefl_xos_critical_section_enter(list->lock);
 
     if (!validate_list(list)) {
-		return;
+		return(NULL);
 	}
 
     /*
@@ -249,7 +498,7 @@ void myrefl_list_insert (myrefl_list_t *list,
     if (myrefl_list_find(list, data)) {
         myrefl_error("%s: duplicate element", __FUNCTION__);
         myrefl_xos_critical_section_exit(list->lock);
-        return;
+        return(NULL);
     }
 
     element = new_list_element();
@@ -268,11 +517,15 @@ void myrefl_list_insert (myrefl_list_t *list,
             head = element;
         }
         element->next = next;
+        element->prev = prev;
+        if (next) {
+            next->prev = element;
+        }
     } else {
     	// No element.
     	myrefl_error("Could not get a list element");
         myrefl_xos_critical_section_exit(list->lock);
-        return;
+        return(NULL);
     }
     
     list->head = head;
@@ -293,10 +546,11 @@ void myrefl_list_insert (myrefl_list_t *list,
     list->num_elements++;
 
     if (!validate_list(list)) {
-		return;
+		return(NULL);
 	}
 
     myrefl_xos_critical_section_exit(list->lock);
+    return(element);
 }
 
 /*
@@ -306,7 +560,7 @@ void myrefl_list_insert (myrefl_list_t *list,
  */
 boolean myrefl_list_remove (myrefl_list_t *list, void *data)
 {
-    myrefl_list_element_t *current, *previous;
+    myrefl_list_element_t *current;
     boolean retval = FALSE;
 
     if (!list) {
@@ -320,51 +574,18 @@ boolean myrefl_list_remove (myrefl_list_t *list, void *data)
 		return FALSE;
 	}
 
-    previous = NULL;
     current = list->head;
 
     while (current != NULL) {
         if (current->data == data) {
             /*
-             * Got a match, remove this element from the list
-             */
-            if (current == list->head) {
-                /*
-                 * At the head of the list., Move the head to the
-                 * next element.
-                 */
-                list->head = current->next;
-            } else {
-                /*
-                 * Have a previous element, make it's next
-                 * point our next.
-                 */
-                previous->next = current->next;
-            }
-
-            if (current == list->tail) {
-                /*
-                 * At tail of the list, so new tail is our previous
-                 * element.
-                 */
-                list->tail = previous;
-            }
-
-            // put the free element back in the free pool.
-            free_list_element(current);
-
-            list->num_elements--;
-
-            if (!validate_list(list)) {
-        		return FALSE;
-        	}
-            /*
+             * Got a match, remove this element from the list.
              * Assume that there is only one match in the list and bail.
              */
+            list_unlink(list, current);
             retval = TRUE;
             break;
         }
-        previous = current;
         current = current->next;
     }
 
@@ -376,18 +597,81 @@ boolean myrefl_list_remove (myrefl_list_t *list, void *data)
     return(retval);
 }
 
+/*
+ * myrefl_list_remove_element()
+ *
+ * Remove the element returned when the data was put on the list,
+ * without having to search for it.
+ */
+boolean myrefl_list_remove_element (myrefl_list_t *list, 
+                                    myrefl_list_element_t *element)
+{
+    if (!list || !element) {
+        myrefl_error("%s: bad parameters", __FUNCTION__);
+        return(FALSE);
+    }
+
+    myrefl_xos_critical_section_enter(list->lock);
+
+    /*
+     * Check the element's neighbours agree that it is on this list.
+     */
+    if ((element->prev ? element->prev->next : list->head) != element ||
+        (element->next ? element->next->prev : list->tail) != element) {
+        myrefl_error("%s: element %p not on list %p", __FUNCTION__, 
+                     element, list);
+        myrefl_xos_critical_section_exit(list->lock);
+        return(FALSE);
+    }
+
+    list_unlink(list, element);
+
+    if (!validate_list(list)) {
+		return FALSE;
+	}
+
+    myrefl_xos_critical_section_exit(list->lock);
+    return(TRUE);
+}
+
+/*
+ * myrefl_list_element_pair()
+ *
+ * Pair two elements, typically the two halves of a two way link, so
+ * that removing one of them can find the other with
+ * myrefl_list_element_peer(). Removing either unpairs them.
+ */
+void myrefl_list_element_pair (myrefl_list_element_t *a, 
+                               myrefl_list_element_t *b)
+{
+    if (a && b) {
+        a->peer = b;
+        b->peer = a;
+    }
+}
+
+/*
+ * myrefl_list_element_peer()
+ *
+ * Return the element paired with this one, if any.
+ */
+myrefl_list_element_t *myrefl_list_element_peer (myrefl_list_element_t *element)
+{
+    return(element ? element->peer : NULL);
+}
+
 /*
  * myrefl_list_push()
  *
  * Push the element to the tail of the list
  */
-void myrefl_list_push (myrefl_list_t *list, void *data)
+myrefl_list_element_t *myrefl_list_push (myrefl_list_t *list, void *data)
 {
     myrefl_list_element_t *element;
 
     if (!list) {
         myrefl_error("%s: bad parameters", __FUNCTION__);
-        return;
+        return(NULL);
     }
 
     element = new_list_element();
@@ -399,7 +683,7 @@ void myrefl_list_push (myrefl_list_t *list, void *data)
         myrefl_xos_critical_section_enter(list->lock);
 
         if (!validate_list(list)) {
-    		return;
+    		return(NULL);
     	}
 
         if (!list->head) {
@@ -410,29 +694,30 @@ void myrefl_list_push (myrefl_list_t *list, void *data)
             list->tail->next = element;
         }
 
+        element->prev = list->tail;
         list->tail = element;
         
         list->num_elements++;
 
         if (!validate_list(list)) {
-    		return;
+    		return(NULL);
     	}
 
         myrefl_xos_critical_section_exit(list->lock);
     } else {
         myrefl_error("%s: could not allocate element", __FUNCTION__);
     }
+    return(element);
 }
 
-
 /*
- * myrefl_list_pop()
+ * list_pop()
  *
- * Pop off and return the head of the list.
+ * Pop off and return the head or tail of the list.
  */
-void *myrefl_list_pop (myrefl_list_t *list)
+static void *list_pop (myrefl_list_t *list, boolean tail)
 {
-    myrefl_list_element_t *head;
+    myrefl_list_element_t *element;
     void *data;
 
     if (!list || !list->lock) {
@@ -445,28 +730,16 @@ void *myrefl_list_pop (myrefl_list_t *list)
     	return NULL;
     }
 
-    head = list->head;
+    element = tail ? list->tail : list->head;
 
-    if (!head) {
+    if (!element) {
     	// Empty list.
         myrefl_xos_critical_section_exit(list->lock);
     	return(NULL);
     }
 
-    list->head = head->next;
-
-    if (list->tail == head) {
-        /*
-         * Popped the last element
-         */
-        list->tail = NULL;
-    }
-
-    data = head->data;
-    // Put the list element back in the free pool
-    free_list_element(head);
-
-    list->num_elements--;
+    data = element->data;
+    list_unlink(list, element);
 
     if (!validate_list(list)) {
 		return NULL;
@@ -476,6 +749,26 @@ void *myrefl_list_pop (myrefl_list_t *list)
     return(data);
 }
 
+/*
+ * myrefl_list_pop()
+ *
+ * Pop off and return the head of the list.
+ */
+void *myrefl_list_pop (myrefl_list_t *list)
+{
+    return(list_pop(list, FALSE));
+}
+
+/*
+ * myrefl_list_pop_tail()
+ *
+ * Pop off and return the tail of the list.
+ */
+void *myrefl_list_pop_tail (myrefl_list_t *list)
+{
+    return(list_pop(list, TRUE));
+}
+
 /*
  * myrefl_list_peek()
  *
@@ -491,6 +784,21 @@ void *myrefl_list_peek (myrefl_list_t *list)
     return(data);
 }
 
+/*
+ * myrefl_list_peek_tail()
+ *
+ * Return the tail of the queue, but leave it on the queue.
+ */
+void *myrefl_list_peek_tail (myrefl_list_t *list)
+{
+    void *data = NULL;
+
+    if (list && list->tail) {
+        data = list->tail->data;
+    }
+    return(data);
+}
+
 /*
  * myrefl_list_find()
  *
@@ -516,6 +824,262 @@ boolean myrefl_list_find (myrefl_list_t *list, const void *data)
     return(retval);
 }
 
+/*
+ * Intrusive queue helpers, convert between the owning structure and
+ * the link embedded within it.
+ */
+#define QUEUE_LINK(queue, data) \
+    ((myrefl_link_t *)((char *)(data) + (queue)->offset))
+#define QUEUE_DATA(queue, link) \
+    ((void *)((char *)(link) - (queue)->offset))
+
+/*
+ * myrefl_queue_create()
+ *
+ * Allocate a new empty queue for structures that have their
+ * myrefl_link_t at "offset".
+ */
+myrefl_queue_t *myrefl_queue_create (size_t offset)
+{
+    myrefl_queue_t *queue;
+
+    queue = calloc(1, sizeof(myrefl_queue_t));
+    if (queue) {
+        queue->offset = offset;
+        queue->lock = myrefl_xos_critical_section_create();
+        if (!queue->lock) {
+            free(queue);
+            queue = NULL;
+        }
+    }
+    return(queue);
+}
+
+/*
+ * myrefl_queue_free()
+ *
+ * Unlink anything left on the queue and free it, the queued structures
+ * themselves belong to the caller.
+ */
+void myrefl_queue_free (myrefl_queue_t *queue)
+{
+    if (queue) {
+        while (myrefl_queue_pop(queue)) {
+            ;
+        }
+        myrefl_xos_critical_section_delete(queue->lock);
+        free(queue);
+    }
+}
+
+/*
+ * myrefl_queue_insert()
+ *
+ * Insert "data" after "prev", if "prev" is NULL then insert at the
+ * head. "prev" must already be on this queue.
+ */
+void myrefl_queue_insert (myrefl_queue_t *queue, void *prev, void *data)
+{
+    myrefl_link_t *link, *prev_link = NULL;
+
+    if (!queue || !data) {
+        myrefl_error("%s: bad parameters", __FUNCTION__);
+        return;
+    }
+
+    myrefl_xos_critical_section_enter(queue->lock);
+
+    link = QUEUE_LINK(queue, data);
+    if (link->queue) {
+        myrefl_error("%s: already queued", __FUNCTION__);
+        myrefl_xos_critical_section_exit(queue->lock);
+        return;
+    }
+
+    if (prev) {
+        prev_link = QUEUE_LINK(queue, prev);
+        if (prev_link->queue != queue) {
+            myrefl_error("%s: previous not on the queue", __FUNCTION__);
+            myrefl_xos_critical_section_exit(queue->lock);
+            return;
+        }
+        link->next = prev_link->next;
+        prev_link->next = link;
+    } else {
+        link->next = queue->head;
+        queue->head = link;
+    }
+    link->prev = prev_link;
+
+    if (link->next) {
+        link->next->prev = link;
+    } else {
+        queue->tail = link;
+    }
+    link->queue = queue;
+    queue->num_elements++;
+
+    myrefl_xos_critical_section_exit(queue->lock);
+}
+
+/*
+ * myrefl_queue_add()
+ *
+ * Add "data" to the head of the queue.
+ */
+void myrefl_queue_add (myrefl_queue_t *queue, void *data)
+{
+    myrefl_queue_insert(queue, NULL, data);
+}
+
+/*
+ * myrefl_queue_push()
+ *
+ * Push "data" to the tail of the queue.
+ */
+void myrefl_queue_push (myrefl_queue_t *queue, void *data)
+{
+    if (!queue || !data) {
+        myrefl_error("%s: bad parameters", __FUNCTION__);
+        return;
+    }
+
+    myrefl_xos_critical_section_enter(queue->lock);
+    myrefl_queue_insert(queue, 
+                        queue->tail ? QUEUE_DATA(queue, queue->tail) : NULL,
+                        data);
+    myrefl_xos_critical_section_exit(queue->lock);
+}
+
+/*
+ * myrefl_queue_remove()
+ *
+ * Unlink "data" from the queue, returns FALSE if it wasn't on this
+ * queue.
+ */
+boolean myrefl_queue_remove (myrefl_queue_t *queue, void *data)
+{
+    myrefl_link_t *link;
+
+    if (!queue || !data) {
+        myrefl_error("%s: bad parameters", __FUNCTION__);
+        return(FALSE);
+    }
+
+    myrefl_xos_critical_section_enter(queue->lock);
+
+    link = QUEUE_LINK(queue, data);
+    if (link->queue != queue) {
+        myrefl_xos_critical_section_exit(queue->lock);
+        return(FALSE);
+    }
+
+    if (link->prev) {
+        link->prev->next = link->next;
+    } else {
+        queue->head = link->next;
+    }
+    if (link->next) {
+        link->next->prev = link->prev;
+    } else {
+        queue->tail = link->prev;
+    }
+    link->next = NULL;
+    link->prev = NULL;
+    link->queue = NULL;
+    queue->num_elements--;
+
+    myrefl_xos_critical_section_exit(queue->lock);
+    return(TRUE);
+}
+
+/*
+ * myrefl_queue_pop()
+ *
+ * Unlink and return the head of the queue.
+ */
+void *myrefl_queue_pop (myrefl_queue_t *queue)
+{
+    void *data = NULL;
+
+    if (!queue || !queue->lock) {
+        return(NULL);
+    }
+
+    myrefl_xos_critical_section_enter(queue->lock);
+    if (queue->head) {
+        data = QUEUE_DATA(queue, queue->head);
+        myrefl_queue_remove(queue, data);
+    }
+    myrefl_xos_critical_section_exit(queue->lock);
+
+    return(data);
+}
+
+/*
+ * myrefl_queue_peek()
+ *
+ * Return the head of the queue, but leave it on the queue.
+ */
+void *myrefl_queue_peek (myrefl_queue_t *queue)
+{
+    void *data = NULL;
+
+    if (queue && queue->head) {
+        data = QUEUE_DATA(queue, queue->head);
+    }
+    return(data);
+}
+
+/*
+ * myrefl_queue_peek_tail()
+ *
+ * Return the tail of the queue, but leave it on the queue.
+ */
+void *myrefl_queue_peek_tail (myrefl_queue_t *queue)
+{
+    void *data = NULL;
+
+    if (queue && queue->tail) {
+        data = QUEUE_DATA(queue, queue->tail);
+    }
+    return(data);
+}
+
+/*
+ * myrefl_queue_next()
+ *
+ * Return what follows "data" on the queue. The caller must stop the
+ * queue from changing while walking it.
+ */
+void *myrefl_queue_next (myrefl_queue_t *queue, void *data)
+{
+    myrefl_link_t *link;
+
+    if (!queue || !data) {
+        return(NULL);
+    }
+
+    link = QUEUE_LINK(queue, data);
+    if (link->queue != queue || !link->next) {
+        return(NULL);
+    }
+    return(QUEUE_DATA(queue, link->next));
+}
+
+/*
+ * myrefl_queue_linked()
+ *
+ * Is "data" on this queue.
+ */
+boolean myrefl_queue_linked (myrefl_queue_t *queue, void *data)
+{
+    if (!queue || !data) {
+        return(FALSE);
+    }
+    return(QUEUE_LINK(queue, data)->queue == queue);
+}
+
 /*
  * myrefl_obj_list_find_by_name()
  *
@@ -31,12 +31,15 @@
 #ifndef __MYREFL_UTIL_H__
 #define __MYREFL_UTIL_H__
 
+#include <stddef.h>
 #include "myrefl_client.h"
 #include "myrefl_types.h"
 #include "myrefl_obj.h"
 
 typedef struct myrefl_list_element_t_ {
     struct myrefl_list_element_t_ *next;
+    struct myrefl_list_element_t_ *prev;
+    struct myrefl_list_element_t_ *peer;  /* see myrefl_list_element_pair() */
     void *data;
 } myrefl_list_element_t;
 
@@ -50,16 +53,69 @@ struct myrefl_list_s {
     xos_critical_section_t *lock;
 };
 
+/*
+ * List element allocator statistics. Free elements are either in the
+ * global pool or cached by a thread.
+ */
+typedef struct myrefl_list_stats_s {
+    uint blocks;        /* blocks of elements allocated */
+    uint elements;      /* elements in those blocks */
+    uint in_use;        /* elements on a list */
+    uint global_free;   /* free elements in the global pool */
+    uint cached;        /* free elements in thread caches */
+    uint caches;        /* threads with a cache */
+    ulong refills;      /* batches moved from the global pool to a cache */
+    ulong drains;       /* batches moved from a cache to the global pool */
+} myrefl_list_stats_t;
+
 myrefl_list_t *myrefl_list_create(void);
 void myrefl_list_free(myrefl_list_t *list);
-void myrefl_list_add(myrefl_list_t *list, void *element);  // add to head
+myrefl_list_element_t *myrefl_list_add(myrefl_list_t *list, void *element);  // add to head
 boolean myrefl_list_remove(myrefl_list_t *list, void *element);
+boolean myrefl_list_remove_element(myrefl_list_t *list, 
+                                   myrefl_list_element_t *element);
 void *myrefl_list_pop(myrefl_list_t *list);                // pop head
-void myrefl_list_push(myrefl_list_t *list, void *element); // push to tail
+void *myrefl_list_pop_tail(myrefl_list_t *list);
+myrefl_list_element_t *myrefl_list_push(myrefl_list_t *list, void *element); // push to tail
 void *myrefl_list_peek(myrefl_list_t *list);
-void myrefl_list_insert(myrefl_list_t *list, myrefl_list_element_t *prev, 
-                        void *element);
+void *myrefl_list_peek_tail(myrefl_list_t *list);
+myrefl_list_element_t *myrefl_list_insert(myrefl_list_t *list, 
+                                          myrefl_list_element_t *prev, 
+                                          void *element);
+void myrefl_list_element_pair(myrefl_list_element_t *a, 
+                              myrefl_list_element_t *b);
+myrefl_list_element_t *myrefl_list_element_peer(myrefl_list_element_t *element);
 boolean myrefl_list_find(myrefl_list_t *list, const void *element);
+void myrefl_list_get_stats(myrefl_list_stats_t *stats);
+
+/*
+ * Intrusive queue
+ *
+ * The myrefl_link_t lives inside the queued structure, "offset" is
+ * where, so adding and removing never allocates and removal is O(1).
+ * A structure may be on at most one queue per embedded link.
+ */
+struct myrefl_queue_s {
+    myrefl_link_t *head;
+    myrefl_link_t *tail;
+    uint num_elements;
+    size_t offset;
+    xos_critical_section_t *lock;
+};
+
+#define MYREFL_QUEUE_OFFSET(type, member) offsetof(type, member)
+
+myrefl_queue_t *myrefl_queue_create(size_t offset);
+void myrefl_queue_free(myrefl_queue_t *queue);
+void myrefl_queue_add(myrefl_queue_t *queue, void *data);   // add to head
+void myrefl_queue_push(myrefl_queue_t *queue, void *data);  // push to tail
+void myrefl_queue_insert(myrefl_queue_t *queue, void *prev, void *data);
+boolean myrefl_queue_remove(myrefl_queue_t *queue, void *data);
+void *myrefl_queue_pop(myrefl_queue_t *queue);              // pop head
+void *myrefl_queue_peek(myrefl_queue_t *queue);
+void *myrefl_queue_peek_tail(myrefl_queue_t *queue);
+void *myrefl_queue_next(myrefl_queue_t *queue, void *data);
+boolean myrefl_queue_linked(myrefl_queue_t *queue, void *data);
 
 /*
  * obj_t specific specialisation of the general list
@@ -57,6 +57,7 @@ typedef struct xos_thread_t_ xos_thread_t;
 typedef struct xos_time_t_ xos_time_t;
 typedef struct xos_timer_t_ xos_timer_t;
 typedef struct xos_critical_section_t_ xos_critical_section_t;
+typedef struct xos_thread_key_t_ xos_thread_key_t;
 
 /*******************************************************************
  * Thread functions
@@ -139,6 +140,14 @@ void myrefl_xos_critical_section_delete(xos_critical_section_t *cs);
 void myrefl_xos_critical_section_enter(xos_critical_section_t *cs);
 void myrefl_xos_critical_section_exit(xos_critical_section_t *cs);
 
+/*******************************************************************
+ * Thread local storage
+ *******************************************************************/
+typedef void (xos_thread_key_destructor_fn_t)(void *value);
+xos_thread_key_t *myrefl_xos_thread_key_create(xos_thread_key_destructor_fn_t *destructor);
+void *myrefl_xos_thread_key_get(xos_thread_key_t *key);
+boolean myrefl_xos_thread_key_set(xos_thread_key_t *key, void *value);
+
 
 /*******************************************************************
  * Miscellaneous functions
@@ -29,6 +29,12 @@ void myrefl_xos_notify_test_result (const char *test_name,
     //    "instance name (%s)", test_name, instance_name);
 }
 
+/*
+ * Set by a test to act on rule notifications as a client would, it is
+ * called from within the sequencer with the DB locked.
+ */
+void (*check_xos_rule_result_hook)(const char *rule_name) = NULL;
+
 /*
  * myrefl_xos_notify_rule_result()
  * Notify the results of a rule.
@@ -40,6 +46,9 @@ void myrefl_xos_notify_rule_result (const char *rule_name,
                                     long value)
 
 {
+    if (check_xos_rule_result_hook) {
+        check_xos_rule_result_hook(rule_name);
+    }
     //printf("\n** Software Diagnostics notify rule result for rule (%s) "
     //    "instance name (%s)", rule_name, instance_name);
 }
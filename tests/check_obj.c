@@ -35,6 +35,7 @@
  * April 2014, Edward Groenendaal
  */
 #include <unistd.h>
+#include <limits.h>
 #include <check.h>
 #include "../src/myrefl_obj.h"
 #include "../src/myrefl_util.h"
@@ -205,6 +206,128 @@ START_TEST (test_myrefl_garbage_collector_auto)
 END_TEST
 
 
+/*
+ * Create an object with a time series of its results.
+ */
+static obj_t *series_test_obj (void)
+{
+	obj_t *obj = myrefl_obj_get_or_create(strdup("series object"), 
+										  OBJ_TYPE_NONE);
+	ck_assert(obj != NULL);
+	obj->i.flags.any |= OBJ_FLAG_SERIES;
+	return (obj);
+}
+
+static unsigned long long series_test_now (void)
+{
+	xos_time_t now;
+
+	myrefl_xos_time_set_now(&now);
+	return (((unsigned long long)now.sec * 1000) + (now.nsec / 1000000));
+}
+
+/*
+ * Values and results go through the XOR encoding and come back out
+ * the same, including negative values, the extremes, and a value whose
+ * meaningful bits fit in the previous one's window.
+ */
+START_TEST (test_myrefl_obj_series_values)
+{
+	long values[] = { 0, -1, 1, LONG_MIN, LONG_MAX, -12345, 
+					  0xF0, 0x80, 0xA0, 0xA0, 42 };
+	myrefl_result_t results[] = { MYREFL_RESULT_PASS, MYREFL_RESULT_FAIL,
+								  MYREFL_RESULT_VALUE };
+	obj_series_point_t points[20];
+	uint count, i, n = sizeof(values) / sizeof(values[0]);
+
+	myrefl_obj_init();
+	obj_t *obj = series_test_obj();
+
+	for (i = 0; i < n; i++) {
+		myrefl_obj_series_add(&obj->i, results[i % 3], values[i]);
+	}
+
+	count = myrefl_obj_series_read(obj->i.series, OBJ_SERIES_RECENT, 
+								   points, 20);
+	ck_assert_msg(count == n, "%u results read back", count);
+	for (i = 0; i < n; i++) {
+		ck_assert_msg(points[i].min == values[i], "Value %u is %ld not %ld",
+					  i, points[i].min, values[i]);
+		ck_assert_msg(points[i].result == results[i % 3], 
+					  "Result %u is %d", i, points[i].result);
+	}
+}
+END_TEST
+
+/*
+ * Times go through the delta-of-delta encoding, with gaps that make the
+ * delta-of-delta negative and that need the full 64 bit escape both ways.
+ */
+START_TEST (test_myrefl_obj_series_times)
+{
+	int gaps[] = { 0, 10, 30, 5, 5, 2100, 10 };
+	unsigned long long before[7], after[7];
+	obj_series_point_t points[7];
+	uint count, i;
+
+	myrefl_obj_init();
+	obj_t *obj = series_test_obj();
+
+	for (i = 0; i < 7; i++) {
+		usleep(gaps[i] * 1000);
+		before[i] = series_test_now();
+		myrefl_obj_series_add(&obj->i, MYREFL_RESULT_PASS, i);
+		after[i] = series_test_now();
+	}
+
+	count = myrefl_obj_series_read(obj->i.series, OBJ_SERIES_RECENT, 
+								   points, 7);
+	ck_assert_msg(count == 7, "%u results read back", count);
+	for (i = 0; i < 7; i++) {
+		ck_assert_msg(points[i].time >= before[i] && 
+					  points[i].time <= after[i],
+					  "Result %u at %llu, added between %llu and %llu", i, 
+					  points[i].time, before[i], after[i]);
+		ck_assert(points[i].min == i);
+	}
+}
+END_TEST
+
+/*
+ * Once the blocks are full the oldest is reused, what is left reads back
+ * in order up to the latest result.
+ */
+START_TEST (test_myrefl_obj_series_wrap)
+{
+	obj_series_point_t *points;
+	uint count, i, total = 5000;
+
+	myrefl_obj_init();
+	obj_t *obj = series_test_obj();
+
+	for (i = 0; i < total; i++) {
+		myrefl_obj_series_add(&obj->i, MYREFL_RESULT_VALUE, i * 7);
+	}
+
+	count = myrefl_obj_series_read(obj->i.series, OBJ_SERIES_RECENT, 
+								   NULL, 0);
+	ck_assert_msg(count > 0 && count < total, "%u results kept", count);
+	points = malloc(count * sizeof(obj_series_point_t));
+	ck_assert(points != NULL);
+	ck_assert(myrefl_obj_series_read(obj->i.series, OBJ_SERIES_RECENT, 
+									 points, count) == count);
+	for (i = 0; i < count; i++) {
+		ck_assert_msg(points[i].min == (long)(total - count + i) * 7, 
+					  "Result %u is %ld", i, points[i].min);
+	}
+	free(points);
+
+	count = myrefl_obj_series_read(obj->i.series, OBJ_SERIES_MINUTE, 
+								   NULL, 0);
+	ck_assert_msg(count >= 1 && count <= 2, "%u minutes", count);
+}
+END_TEST
+
 /*
  * Register the above unit tests.
  */
@@ -226,6 +349,13 @@ swdaig_obj_test_suite (void)
   tcase_set_timeout(tc_gc, 25);
   suite_add_tcase (s, tc_gc);
 
+  TCase *tc_series = tcase_create ("Series");
+  tcase_add_test(tc_series, test_myrefl_obj_series_values);
+  tcase_add_test(tc_series, test_myrefl_obj_series_times);
+  tcase_add_test(tc_series, test_myrefl_obj_series_wrap);
+  tcase_set_timeout(tc_series, 10);
+  suite_add_tcase (s, tc_series);
+
   return s;
 }
 
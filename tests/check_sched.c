@@ -26,17 +26,2150 @@
  * Test the contents of myrefl_sched.c using the "check" UT framework.
  * Use "make check" to run these tests.
  *
+ * The scheduler and the sequencer that it drives are tested together,
+ * through the client API, with the results checked against the private
+ * structures.
+ *
  * Use ck_assert_msg() for things being tested in that test, and ck_assert()
  * where it is not core  to the test at hand.
  *
  * April 2014, Edward Groenendaal
  */
 #include <check.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "myrefl_client.h"
 #include "../src/myrefl_obj.h"
+#include "../src/myrefl_api.h"
+#include "../src/myrefl_sched.h"
+#include "../src/myrefl_sequence.h"
+#include "../src/myrefl_thread.h"
+#include "../src/myrefl_util.h"
+#include "../src/myrefl_xos.h"
+
+extern void myrefl_obj_test_run_garbage_collector();
+
+/*
+ * Sleep for ms milliseconds, carrying on after the timer signals.
+ */
+static void sched_test_sleep (int ms)
+{
+    struct timespec nap = { ms / 1000, (ms % 1000) * 1000 * 1000 };
+
+    while (nanosleep(&nap, &nap) == -1 && errno == EINTR) {
+        ;
+    }
+}
+
+/*
+ * Bring up the same subsystems as myrefl_start() without its main loop,
+ * each test runs in its own process so there is no need to stop them.
+ */
+static void sched_test_start (void)
+{
+    myrefl_sched_init();
+    myrefl_thread_init();
+    myrefl_obj_init();
+    myrefl_api_init();
+    myrefl_seq_init();
+
+    /*
+     * Give the scheduler thread time to start its timer.
+     */
+    sched_test_sleep(200);
+}
+
+typedef boolean (*sched_test_condition_t)(const void *arg, long target);
+
+/*
+ * Wait up to ms milliseconds for the condition to reach the target, the
+ * sleeps may be cut short by the timer signals so go by the clock.
+ */
+static boolean sched_test_wait_for (sched_test_condition_t condition,
+                                    const void *arg, long target, int ms)
+{
+    struct timespec now, end, nap = { 0, 10 * 1000 * 1000 };
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += ms / 1000;
+    end.tv_nsec += (ms % 1000) * 1000 * 1000;
+    if (end.tv_nsec >= 1000 * 1000 * 1000) {
+        end.tv_sec++;
+        end.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    for (;;) {
+        if (condition(arg, target)) {
+            return (TRUE);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > end.tv_sec ||
+            (now.tv_sec == end.tv_sec && now.tv_nsec >= end.tv_nsec)) {
+            return (condition(arg, target));
+        }
+        nanosleep(&nap, NULL);
+    }
+}
+
+/*
+ * Conditions for sched_test_wait_for(), a counter bumped by the test's
+ * own functions, the number of results an object has recorded, the
+ * last of those results and the health of a component, as worked out
+ * and as last published.
+ */
+static boolean sched_test_counted (const void *counter, long target)
+{
+    return (*(volatile const int *)counter >= target);
+}
+
+static boolean sched_test_ran (const void *name, long target)
+{
+    obj_t *obj;
+    boolean ran;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_ANY);
+    ran = (obj && obj->i.stats.runs >= target);
+    myrefl_obj_db_unlock();
+    return (ran);
+}
+
+static boolean sched_test_result_is (const void *name, long result)
+{
+    obj_t *obj;
+    boolean is;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_ANY);
+    is = (obj && obj->i.last_result == result);
+    myrefl_obj_db_unlock();
+    return (is);
+}
+
+static boolean sched_test_health_is (const void *name, long health)
+{
+    obj_t *obj;
+    boolean is;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_COMP);
+    is = (obj && obj->t.comp->health == health);
+    myrefl_obj_db_unlock();
+    return (is);
+}
+
+static boolean sched_test_published_is (const void *name, long health)
+{
+    obj_t *obj;
+    boolean is;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_COMP);
+    is = (obj && obj->t.comp->health_published == health);
+    myrefl_obj_db_unlock();
+    return (is);
+}
+
+/*
+ * The last result recorded by a rule.
+ */
+static myrefl_result_t sched_test_result (const char *name)
+{
+    obj_t *obj;
+    myrefl_result_t result;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_RULE);
+    ck_assert(obj != NULL);
+    result = obj->i.last_result;
+    myrefl_obj_db_unlock();
+    return (result);
+}
+
+static myrefl_result_t sched_test_action_pass (const char *instance,
+                                               void *context)
+{
+    return (MYREFL_RESULT_PASS);
+}
+
+/*
+ * Fan out, the recovery actions of the rules fed by one test result each
+ * get a job of their own and so run alongside each other.
+ */
+static volatile int fan_gate;
+static volatile int fan_running;
+
+static myrefl_result_t fan_action_blocking (const char *instance,
+                                            void *context)
+{
+    struct timespec nap = { 0, 10 * 1000 * 1000 };
+
+    __sync_fetch_and_add(&fan_running, 1);
+    while (!fan_gate) {
+        nanosleep(&nap, NULL);
+    }
+    return (MYREFL_RESULT_PASS);
+}
+
+START_TEST (test_myrefl_seq_fan_out_actions)
+{
+    sched_test_start();
+    myrefl_action_create("AFAN1", fan_action_blocking, NULL);
+    myrefl_action_create("AFAN2", fan_action_blocking, NULL);
+    myrefl_action_create("AFAN3", fan_action_blocking, NULL);
+    myrefl_test_create_notification("TFAN");
+    myrefl_rule_create("RFAN1", "TFAN", "AFAN1");
+    myrefl_rule_create("RFAN2", "TFAN", "AFAN2");
+    myrefl_rule_create("RFAN3", "TFAN", "AFAN3");
+    myrefl_test_chain_ready("TFAN");
+
+    myrefl_test_notify("TFAN", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_counted,
+                                      (const void *)&fan_running, 3, 2000),
+                  "%d of 3 actions running together", fan_running);
+    fan_gate = TRUE;
+}
+END_TEST
+
+/*
+ * The results for one instance are processed in the order they were
+ * notified, even though each may be picked up by a different thread.
+ * Only the last value is over the threshold so both rules end up failed.
+ */
+START_TEST (test_myrefl_seq_fan_out_order)
+{
+    obj_t *obj;
+    int i;
+
+    sched_test_start();
+    myrefl_action_create("AORD", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TORD");
+    myrefl_rule_create("RORD1", "TORD", "AORD");
+    myrefl_rule_create("RORD2", "TORD", "AORD");
+    myrefl_rule_set_type("RORD1", MYREFL_RULE_GREATER_THAN_N, 50, 0);
+    myrefl_rule_set_type("RORD2", MYREFL_RULE_GREATER_THAN_N, 50, 0);
+    myrefl_test_chain_ready("TORD");
+
+    for (i = 1; i <= 51; i++) {
+        myrefl_test_notify("TORD", NULL, MYREFL_RESULT_VALUE, i);
+    }
+    ck_assert(sched_test_wait_for(sched_test_ran, "RORD1", 51, 2000));
+    ck_assert(sched_test_wait_for(sched_test_ran, "RORD2", 51, 2000));
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted("TORD", OBJ_TYPE_TEST);
+    ck_assert_msg(obj->i.last_value == 51, "Last value %ld",
+                  obj->i.last_value);
+    obj = myrefl_obj_get_by_name_unconverted("RORD1", OBJ_TYPE_RULE);
+    ck_assert_msg(obj->i.last_result == MYREFL_RESULT_FAIL,
+                  "RORD1 last result %d", obj->i.last_result);
+    obj = myrefl_obj_get_by_name_unconverted("RORD2", OBJ_TYPE_RULE);
+    ck_assert_msg(obj->i.last_result == MYREFL_RESULT_FAIL,
+                  "RORD2 last result %d", obj->i.last_result);
+    myrefl_obj_db_unlock();
+}
+END_TEST
+
+/*
+ * N in time M, the rule fails on N failures in the last M milliseconds
+ * rather than over a number of results.
+ */
+START_TEST (test_myrefl_seq_rule_n_in_time_m)
+{
+    sched_test_start();
+    myrefl_action_create("ATYP", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TTYP");
+    myrefl_rule_create("RTYP", "TTYP", "ATYP");
+    myrefl_rule_set_type("RTYP", MYREFL_RULE_N_IN_TIME_M, 3, 400);
+    myrefl_test_chain_ready("TTYP");
+
+    /*
+     * Let the first two failures age out of the window.
+     */
+    myrefl_test_notify("TTYP", NULL, MYREFL_RESULT_FAIL, 0);
+    myrefl_test_notify("TTYP", NULL, MYREFL_RESULT_FAIL, 0);
+    sched_test_sleep(600);
+    myrefl_test_notify("TTYP", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RTYP", 3, 2000));
+    ck_assert_msg(sched_test_result("RTYP") == MYREFL_RESULT_PASS,
+                  "Failures outside the window counted");
+
+    myrefl_test_notify("TTYP", NULL, MYREFL_RESULT_PASS, 0);
+    myrefl_test_notify("TTYP", NULL, MYREFL_RESULT_FAIL, 0);
+    myrefl_test_notify("TTYP", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RTYP", 6, 2000));
+    ck_assert_msg(sched_test_result("RTYP") == MYREFL_RESULT_FAIL,
+                  "Not failing on 3 failures in the window");
+
+    /*
+     * Changing the operands starts the count again.
+     */
+    myrefl_rule_set_type("RTYP", MYREFL_RULE_N_IN_TIME_M, 3, 500);
+    myrefl_test_notify("TTYP", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RTYP", 7, 2000));
+    ck_assert_msg(sched_test_result("RTYP") == MYREFL_RESULT_PASS,
+                  "Count carried over the type change");
+}
+END_TEST
+
+/*
+ * Fail for time N, the rule fails once its input has been failing for N
+ * milliseconds, even if the input has stopped reporting by then.
+ */
+START_TEST (test_myrefl_seq_rule_fail_for_time_n)
+{
+    obj_t *obj;
+
+    sched_test_start();
+    myrefl_action_create("ATYP", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TTYP");
+    myrefl_rule_create("RTYP", "TTYP", "ATYP");
+    myrefl_rule_set_type("RTYP", MYREFL_RULE_FAIL_FOR_TIME_N, 300, 0);
+    myrefl_test_chain_ready("TTYP");
+
+    myrefl_rule_set_type("RTYP", MYREFL_RULE_FAIL_FOR_TIME_N, 0, 0);
+    obj = myrefl_obj_get_by_name_unconverted("RTYP", OBJ_TYPE_RULE);
+    ck_assert_msg(obj->t.rule->op_n == 300, "N of 0 accepted");
+
+    myrefl_test_notify("TTYP", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RTYP", 1, 2000));
+    ck_assert_msg(sched_test_result("RTYP") == MYREFL_RESULT_PASS,
+                  "Failing before N");
+    ck_assert_msg(sched_test_wait_for(sched_test_result_is, "RTYP", 
+                                      MYREFL_RESULT_FAIL, 2000),
+                  "Not failing at the deadline");
+
+    /*
+     * A pass cancels the deadline, wait past where it would have been.
+     */
+    myrefl_test_notify("TTYP", NULL, MYREFL_RESULT_PASS, 0);
+    myrefl_test_notify("TTYP", NULL, MYREFL_RESULT_FAIL, 0);
+    myrefl_test_notify("TTYP", NULL, MYREFL_RESULT_PASS, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RTYP", 5, 2000));
+    sched_test_sleep(500);
+    ck_assert_msg(sched_test_result("RTYP") == MYREFL_RESULT_PASS,
+                  "Failed after the input passed");
+}
+END_TEST
+
+static void sched_test_notify_n (const char *test, myrefl_result_t result,
+                                 int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        myrefl_test_notify(test, NULL, result, 0);
+    }
+}
+
+/*
+ * N in M keeps a running count of the failures in the last M results,
+ * check it against the results as they leave the window, over more than
+ * one word of the history.
+ */
+START_TEST (test_myrefl_seq_rule_n_in_m_count)
+{
+    obj_t *obj;
+
+    sched_test_start();
+    myrefl_action_create("ATYP", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TTYP");
+    myrefl_rule_create("RTYP", "TTYP", "ATYP");
+    myrefl_rule_set_type("RTYP", MYREFL_RULE_N_IN_M, 70, 100);
+    myrefl_test_chain_ready("TTYP");
+
+    sched_test_notify_n("TTYP", MYREFL_RESULT_FAIL, 70);
+    sched_test_notify_n("TTYP", MYREFL_RESULT_PASS, 30);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RTYP", 100, 2000));
+    ck_assert_msg(sched_test_result("RTYP") == MYREFL_RESULT_FAIL,
+                  "Not failing on 70 in 100");
+
+    sched_test_notify_n("TTYP", MYREFL_RESULT_PASS, 1);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RTYP", 101, 2000));
+    ck_assert_msg(sched_test_result("RTYP") == MYREFL_RESULT_PASS,
+                  "Failure leaving the window still counted");
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted("RTYP", OBJ_TYPE_RULE);
+    ck_assert(obj != NULL && obj->i.rule_data != NULL);
+    ck_assert_msg(obj->i.rule_data->history_count == 69, "Count %ld",
+                  (long)obj->i.rule_data->history_count);
+    myrefl_obj_db_unlock();
+
+    /*
+     * Round the ring again, the fails overwrite fails until they reach
+     * the passes.
+     */
+    sched_test_notify_n("TTYP", MYREFL_RESULT_FAIL, 69);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RTYP", 170, 2000));
+    ck_assert_msg(sched_test_result("RTYP") == MYREFL_RESULT_PASS,
+                  "Failing on 69 in 100 after wrapping");
+
+    sched_test_notify_n("TTYP", MYREFL_RESULT_FAIL, 1);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RTYP", 171, 2000));
+    ck_assert_msg(sched_test_result("RTYP") == MYREFL_RESULT_FAIL,
+                  "Not failing on 70 in 100 after wrapping");
+}
+END_TEST
+
+static unsigned int sched_test_runs (const char *name)
+{
+    obj_t *obj;
+    unsigned int runs;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_ANY);
+    ck_assert(obj != NULL);
+    runs = obj->i.stats.runs;
+    myrefl_obj_db_unlock();
+    return (runs);
+}
+
+static int sched_test_comp_health (const char *name)
+{
+    obj_t *obj;
+    int health;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_COMP);
+    ck_assert(obj != NULL);
+    health = obj->t.comp->health;
+    myrefl_obj_db_unlock();
+    return (health);
+}
+
+/*
+ * A propagate on change rule only passes changes on to its output rules,
+ * a rule without the flag passes on every result. Either way the health
+ * of the component follows the result. The repeats are passes so that
+ * root cause identification stays out of it.
+ */
+START_TEST (test_myrefl_seq_propagate_on_change)
+{
+    unsigned int poc_runs, all_runs;
+
+    sched_test_start();
+    myrefl_action_create("APOC", sched_test_action_pass, NULL);
+    myrefl_comp_create("CPOC");
+
+    myrefl_test_create_notification("TPOC");
+    myrefl_rule_create("RPOC", "TPOC", "APOC");
+    myrefl_rule_set_flags("RPOC", myrefl_rule_get_flags("RPOC") | 
+                          MYREFL_RULE_PROPAGATE_ON_CHANGE);
+    myrefl_rule_set_severity("RPOC", MYREFL_SEVERITY_MEDIUM);
+    myrefl_rule_create("RPOCOUT", "RPOC", "APOC");
+    myrefl_comp_contains_many("CPOC", "TPOC", "RPOC", NULL);
+    myrefl_test_chain_ready("TPOC");
+
+    myrefl_test_create_notification("TALL");
+    myrefl_rule_create("RALL", "TALL", "APOC");
+    myrefl_rule_create("RALLOUT", "RALL", "APOC");
+    myrefl_test_chain_ready("TALL");
+
+    myrefl_test_notify("TPOC", NULL, MYREFL_RESULT_PASS, 0);
+    myrefl_test_notify("TALL", NULL, MYREFL_RESULT_PASS, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RPOC", 1, 2000));
+    ck_assert(sched_test_wait_for(sched_test_ran, "RALLOUT", 1, 2000));
+    poc_runs = sched_test_runs("RPOCOUT");
+    all_runs = sched_test_runs("RALLOUT");
+
+    sched_test_notify_n("TPOC", MYREFL_RESULT_PASS, 4);
+    sched_test_notify_n("TALL", MYREFL_RESULT_PASS, 4);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RPOC", 5, 2000));
+    ck_assert_msg(sched_test_wait_for(sched_test_ran, "RALLOUT", 
+                                      all_runs + 4, 2000),
+                  "Output runs %u without the flag", 
+                  sched_test_runs("RALLOUT"));
+    ck_assert_msg(sched_test_runs("RPOCOUT") == poc_runs, 
+                  "Repeated result propagated, output runs %u",
+                  sched_test_runs("RPOCOUT"));
+    ck_assert_msg(sched_test_comp_health("CPOC") == MYREFL_HEALTH_FULL,
+                  "Health %d while passing", sched_test_comp_health("CPOC"));
+
+    myrefl_test_notify("TPOC", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_ran, "RPOCOUT", 
+                                      poc_runs + 1, 2000),
+                  "Change not propagated, output runs %u",
+                  sched_test_runs("RPOCOUT"));
+    ck_assert_msg(sched_test_comp_health("CPOC") == 
+                  MYREFL_HEALTH_FULL - MYREFL_SEVERITY_MEDIUM,
+                  "Health %d after failing", sched_test_comp_health("CPOC"));
+}
+END_TEST
+
+/*
+ * Component health is kept as a running total as rules change, check it
+ * against the expected figures and against a recalculation from scratch.
+ * The rules share a test, and the values pick which of them fail.
+ */
+START_TEST (test_myrefl_seq_health_incremental)
+{
+    obj_t *obj;
+    int parent, child;
+
+    sched_test_start();
+    myrefl_action_create("AHLT", sched_test_action_pass, NULL);
+    myrefl_comp_create("CHLTP");
+    myrefl_comp_create("CHLTC");
+    myrefl_comp_contains("CHLTP", "CHLTC");
+    myrefl_test_create_notification("THLT");
+    myrefl_rule_create("RHLT1", "THLT", "AHLT");
+    myrefl_rule_create("RHLT2", "THLT", "AHLT");
+    myrefl_rule_create("RHLT3", "THLT", "AHLT");
+    myrefl_rule_set_type("RHLT1", MYREFL_RULE_GREATER_THAN_N, 10, 0);
+    myrefl_rule_set_type("RHLT2", MYREFL_RULE_GREATER_THAN_N, 20, 0);
+    myrefl_rule_set_type("RHLT3", MYREFL_RULE_GREATER_THAN_N, 10, 0);
+    myrefl_rule_set_severity("RHLT1", MYREFL_SEVERITY_MEDIUM);
+    myrefl_rule_set_severity("RHLT2", MYREFL_SEVERITY_HIGH);
+    myrefl_rule_set_severity("RHLT3", MYREFL_SEVERITY_LOW);
+    myrefl_comp_contains_many("CHLTC", "THLT", "RHLT1", "RHLT2", NULL);
+    myrefl_comp_contains("CHLTP", "RHLT3");
+    myrefl_test_chain_ready("THLT");
+
+    myrefl_test_notify("THLT", NULL, MYREFL_RESULT_VALUE, 30);
+    ck_assert_msg(sched_test_wait_for(sched_test_health_is, "CHLTC", 700, 
+                                      2000),
+                  "Child %d", sched_test_comp_health("CHLTC"));
+    ck_assert_msg(sched_test_wait_for(sched_test_health_is, "CHLTP", 650, 
+                                      2000),
+                  "Parent %d", sched_test_comp_health("CHLTP"));
+
+    myrefl_test_notify("THLT", NULL, MYREFL_RESULT_VALUE, 15);
+    ck_assert_msg(sched_test_wait_for(sched_test_health_is, "CHLTC", 900, 
+                                      2000),
+                  "Child %d after a pass", sched_test_comp_health("CHLTC"));
+    ck_assert_msg(sched_test_wait_for(sched_test_health_is, "CHLTP", 850, 
+                                      2000),
+                  "Parent %d after a pass", sched_test_comp_health("CHLTP"));
+
+    /*
+     * Severity and state changes apply straight away.
+     */
+    myrefl_rule_set_severity("RHLT1", MYREFL_SEVERITY_CRITICAL);
+    ck_assert_msg(sched_test_comp_health("CHLTC") == 500,
+                  "Child %d after a severity change",
+                  sched_test_comp_health("CHLTC"));
+    ck_assert_msg(sched_test_comp_health("CHLTP") == 450,
+                  "Parent %d after a severity change",
+                  sched_test_comp_health("CHLTP"));
+
+    myrefl_rule_disable("RHLT3", NULL);
+    ck_assert_msg(sched_test_comp_health("CHLTP") == 500,
+                  "Parent %d after a disable",
+                  sched_test_comp_health("CHLTP"));
+
+    parent = sched_test_comp_health("CHLTP");
+    child = sched_test_comp_health("CHLTC");
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted("CHLTP", OBJ_TYPE_COMP);
+    ck_assert(obj != NULL);
+    myrefl_seq_comp_health_resync(obj->t.comp);
+    myrefl_obj_db_unlock();
+    ck_assert_msg(sched_test_comp_health("CHLTP") == parent &&
+                  sched_test_comp_health("CHLTC") == child,
+                  "Running health %d/%d, recalculated %d/%d", parent, child,
+                  sched_test_comp_health("CHLTP"),
+                  sched_test_comp_health("CHLTC"));
+}
+END_TEST
+
+/*
+ * Health is worked out as the results arrive but only published once per
+ * interval, so a flap inside the interval never reaches the component's
+ * health test.
+ */
+START_TEST (test_myrefl_seq_health_publish_interval)
+{
+    sched_test_start();
+    myrefl_health_set_interval(1000);
+    myrefl_action_create("APUB", sched_test_action_pass, NULL);
+    myrefl_comp_create("CPUB");
+    myrefl_test_create_notification("TPUB");
+    myrefl_rule_create("RPUB", "TPUB", "APUB");
+    myrefl_rule_set_severity("RPUB", MYREFL_SEVERITY_MEDIUM);
+    myrefl_comp_contains_many("CPUB", "TPUB", "RPUB", NULL);
+    myrefl_test_chain_ready("TPUB");
+    myrefl_test_create_comp_health("THPUB", "CPUB");
+
+    /*
+     * The very first result is batched too, before the sequencer has
+     * finished any job.
+     */
+    myrefl_test_notify("TPUB", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RPUB", 1, 2000));
+    ck_assert_msg(sched_test_comp_health("CPUB") == 900, 
+                  "Health %d not updated straight away",
+                  sched_test_comp_health("CPUB"));
+    ck_assert_msg(sched_test_published_is("CPUB", 1000),
+                  "Published before the interval");
+
+    myrefl_test_notify("TPUB", NULL, MYREFL_RESULT_PASS, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RPUB", 2, 2000));
+    myrefl_test_notify("TPUB", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_published_is, "CPUB", 900, 
+                                      3000),
+                  "Not published after the interval");
+    ck_assert(sched_test_wait_for(sched_test_ran, "THPUB", 1, 2000));
+    ck_assert_msg(sched_test_runs("THPUB") == 1, 
+                  "Health test notified %u times",
+                  sched_test_runs("THPUB"));
+
+    /*
+     * Without an interval every change is published as it happens.
+     */
+    myrefl_health_set_interval(0);
+    myrefl_test_notify("TPUB", NULL, MYREFL_RESULT_PASS, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RPUB", 4, 2000));
+    ck_assert_msg(sched_test_published_is("CPUB", 1000),
+                  "Not published immediately");
+}
+END_TEST
+
+/*
+ * The compiled graph has each input ahead of the rules that it feeds,
+ * whatever order the rules were created in.
+ */
+START_TEST (test_myrefl_obj_graph_order)
+{
+    obj_graph_node_t *node[4];
+    obj_graph_t *graph;
+    const char *names[] = { "TGRO", "RGRO1", "RGRO2", "RGRO3" };
+    int i;
+
+    sched_test_start();
+    myrefl_action_create("AGRO", sched_test_action_pass, NULL);
+    myrefl_rule_create("RGRO3", "RGRO2", "AGRO");
+    myrefl_rule_create("RGRO2", "RGRO1", "AGRO");
+    myrefl_rule_create("RGRO1", "TGRO", "AGRO");
+    myrefl_test_create_notification("TGRO");
+    myrefl_test_chain_ready("TGRO");
+
+    myrefl_obj_db_lock();
+    graph = myrefl_obj_graph();
+    ck_assert(graph != NULL);
+    for (i = 0; i < 4; i++) {
+        node[i] = myrefl_obj_graph_node(
+            myrefl_obj_get_by_name_unconverted(names[i], OBJ_TYPE_ANY));
+        ck_assert_msg(node[i] != NULL, "%s not in the graph", names[i]);
+    }
+    for (i = 1; i < 4; i++) {
+        ck_assert_msg(node[i - 1] < node[i], "%s ahead of its input %s",
+                      names[i], names[i - 1]);
+        ck_assert_msg(node[i]->n_inputs == 1 && 
+                      &graph->nodes[graph->operands[node[i]->inputs]] ==
+                      node[i - 1],
+                      "%s input is not %s", names[i], names[i - 1]);
+        ck_assert_msg(node[i - 1]->n_outputs == 1 &&
+                      &graph->nodes[graph->operands[node[i - 1]->outputs]] ==
+                      node[i],
+                      "%s does not feed %s", names[i - 1], names[i]);
+        ck_assert_msg(node[i]->n_actions == 1, "%s has %u actions", 
+                      names[i], node[i]->n_actions);
+    }
+    myrefl_obj_db_unlock();
+}
+END_TEST
+
+/*
+ * A rule with two inputs is fed by both of them.
+ */
+START_TEST (test_myrefl_seq_graph_two_inputs)
+{
+    sched_test_start();
+    myrefl_action_create("AGTI", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TGTI1");
+    myrefl_test_create_notification("TGTI2");
+    myrefl_rule_create("RGTI", "TGTI1", "AGTI");
+    myrefl_rule_add_input("RGTI", "TGTI2");
+    myrefl_test_chain_ready("TGTI1");
+    myrefl_test_chain_ready("TGTI2");
+
+    myrefl_test_notify("TGTI2", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_ran, "RGTI", 1, 2000),
+                  "Not fed by the second input");
+    myrefl_test_notify("TGTI1", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_ran, "RGTI", 2, 2000),
+                  "Not fed by the first input");
+}
+END_TEST
+
+/*
+ * Adding a rule to a chain that is already running recompiles the graph
+ * on its next use, so the new rule gets the next result.
+ */
+START_TEST (test_myrefl_seq_graph_late_rule)
+{
+    sched_test_start();
+    myrefl_action_create("AGLR", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TGLR");
+    myrefl_rule_create("RGLR1", "TGLR", "AGLR");
+    myrefl_test_chain_ready("TGLR");
+
+    myrefl_test_notify("TGLR", NULL, MYREFL_RESULT_PASS, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RGLR1", 1, 2000));
+
+    myrefl_rule_create("RGLR2", "TGLR", "AGLR");
+    myrefl_test_notify("TGLR", NULL, MYREFL_RESULT_PASS, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RGLR1", 2, 2000));
+    ck_assert_msg(sched_test_wait_for(sched_test_ran, "RGLR2", 1, 2000),
+                  "Rule added after the chain was ready not fed");
+}
+END_TEST
+
+/*
+ * A client that adds a rule to the test when it is first told of a rule
+ * result, from within the walk over the test's outputs, so the graph 
+ * is rebuilt part way through that walk.
+ */
+extern void (*check_xos_rule_result_hook)(const char *rule_name);
+extern boolean myrefl_notify_rule_result(const char *rule_name, 
+                                         const char *instance_name,
+                                         boolean enable_notification);
+
+static volatile int graph_restart_notified;
+
+static void graph_restart_hook (const char *rule_name)
+{
+    if (graph_restart_notified++ == 0) {
+        myrefl_rule_create("RGRSX", "TGRS", "AGRS");
+    }
+}
+
+/*
+ * A graph rebuild whilst the test's outputs are being walked restarts 
+ * the walk on the new graph, every rule is fed once, including the 
+ * rule that was added, and more of them than the walk keeps on the 
+ * stack.
+ */
+START_TEST (test_myrefl_seq_graph_restart)
+{
+    char name[16];
+    int i, rules = 20;
+
+    sched_test_start();
+    myrefl_action_create("AGRS", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TGRS");
+    for (i = 0; i < rules; i++) {
+        snprintf(name, sizeof(name), "RGRS%d", i);
+        myrefl_rule_create(name, "TGRS", "AGRS");
+        myrefl_notify_rule_result(name, NULL, TRUE);
+    }
+    myrefl_test_chain_ready("TGRS");
+    check_xos_rule_result_hook = graph_restart_hook;
+
+    myrefl_test_notify("TGRS", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_ran, "RGRSX", 1, 2000),
+                  "Rule added during the walk not fed");
+
+    for (i = 0; i < rules; i++) {
+        snprintf(name, sizeof(name), "RGRS%d", i);
+        ck_assert_msg(sched_test_wait_for(sched_test_ran, name, 1, 2000),
+                      "%s not fed", name);
+        ck_assert_msg(!sched_test_ran(name, 2), "%s fed twice", name);
+    }
+}
+END_TEST
+
+/*
+ * The EWMA moves M percent of the way towards each new value.
+ */
+START_TEST (test_myrefl_seq_rule_ewma)
+{
+    obj_t *obj;
+
+    sched_test_start();
+    myrefl_action_create("AEWMA", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TEWMA");
+    myrefl_rule_create("REWMA", "TEWMA", "AEWMA");
+    myrefl_rule_set_type("REWMA", MYREFL_RULE_EWMA_ABOVE_N, 50, 50);
+    myrefl_test_chain_ready("TEWMA");
+
+    myrefl_rule_set_type("REWMA", MYREFL_RULE_EWMA_ABOVE_N, 50, 0);
+    obj = myrefl_obj_get_by_name_unconverted("REWMA", OBJ_TYPE_RULE);
+    ck_assert_msg(obj->t.rule->op_m == 50, "Weight of 0 accepted");
+
+    myrefl_test_notify("TEWMA", NULL, MYREFL_RESULT_VALUE, 40);
+    ck_assert(sched_test_wait_for(sched_test_ran, "REWMA", 1, 2000));
+    ck_assert_msg(sched_test_result("REWMA") == MYREFL_RESULT_PASS,
+                  "Failing on the first value");
+
+    myrefl_test_notify("TEWMA", NULL, MYREFL_RESULT_VALUE, 80);
+    ck_assert(sched_test_wait_for(sched_test_ran, "REWMA", 2, 2000));
+    ck_assert_msg(sched_test_result("REWMA") == MYREFL_RESULT_FAIL,
+                  "Not failing with the average above N");
+
+    myrefl_obj_db_lock();
+    ck_assert(obj->i.rule_data != NULL);
+    ck_assert_msg(obj->i.rule_data->ewma == 60.0, "Average %.2f",
+                  obj->i.rule_data->ewma);
+    myrefl_obj_db_unlock();
+
+    myrefl_test_notify("TEWMA", NULL, MYREFL_RESULT_VALUE, 20);
+    ck_assert(sched_test_wait_for(sched_test_ran, "REWMA", 3, 2000));
+    ck_assert_msg(sched_test_result("REWMA") == MYREFL_RESULT_PASS,
+                  "Failing with the average back at N");
+}
+END_TEST
+
+/*
+ * The percentile estimates, over the values 1 to 100 the 95th percentile
+ * is about 95 and the 99th about 99.
+ */
+START_TEST (test_myrefl_seq_rule_percentile)
+{
+    obj_t *obj;
+    int i;
+
+    sched_test_start();
+    myrefl_action_create("APCT", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TPCT");
+    myrefl_rule_create("RP95LOW", "TPCT", "APCT");
+    myrefl_rule_create("RP95HIGH", "TPCT", "APCT");
+    myrefl_rule_create("RP99", "TPCT", "APCT");
+    myrefl_rule_set_type("RP95LOW", MYREFL_RULE_P95_ABOVE_N, 90, 0);
+    myrefl_rule_set_type("RP95HIGH", MYREFL_RULE_P95_ABOVE_N, 98, 0);
+    myrefl_rule_set_type("RP99", MYREFL_RULE_P99_ABOVE_N, 97, 0);
+    myrefl_test_chain_ready("TPCT");
+
+    myrefl_rule_set_type("RP99", MYREFL_RULE_P99_ABOVE_N, 97,
+                         RULE_SKETCH_MARKERS - 1);
+    obj = myrefl_obj_get_by_name_unconverted("RP99", OBJ_TYPE_RULE);
+    ck_assert_msg(obj->t.rule->op_m == 0,
+                  "Window smaller than the sketch accepted");
+
+    /*
+     * Spread the values out so the order doesn't favour either end.
+     */
+    for (i = 0; i < 100; i++) {
+        myrefl_test_notify("TPCT", NULL, MYREFL_RESULT_VALUE,
+                           (i * 37) % 100 + 1);
+    }
+    ck_assert(sched_test_wait_for(sched_test_ran, "RP95LOW", 100, 2000));
+    ck_assert(sched_test_wait_for(sched_test_ran, "RP95HIGH", 100, 2000));
+    ck_assert(sched_test_wait_for(sched_test_ran, "RP99", 100, 2000));
+
+    ck_assert_msg(sched_test_result("RP95LOW") == MYREFL_RESULT_FAIL,
+                  "95th percentile not above 90");
+    ck_assert_msg(sched_test_result("RP95HIGH") == MYREFL_RESULT_PASS,
+                  "95th percentile above 98");
+    ck_assert_msg(sched_test_result("RP99") == MYREFL_RESULT_FAIL,
+                  "99th percentile not above 97");
+}
+END_TEST
+
+static seq_baseline_mode_t sched_test_baseline_mode (const char *name)
+{
+    obj_t *obj;
+    seq_baseline_mode_t mode;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_RULE);
+    ck_assert(obj != NULL);
+    mode = myrefl_seq_baseline_mode(&obj->i);
+    myrefl_obj_db_unlock();
+    return (mode);
+}
+
+/*
+ * A baseline rule learns the values for the first M results without
+ * failing, after which it fails the values more than N standard 
+ * deviations out. Alternating 95 and 105 is a mean of 100 and a 
+ * standard deviation of 5.
+ */
+START_TEST (test_myrefl_seq_rule_baseline_learn)
+{
+    int i;
+
+    sched_test_start();
+    myrefl_action_create("ABLN", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TBLN");
+    myrefl_rule_create("RBLN", "TBLN", "ABLN");
+    myrefl_rule_set_type("RBLN", MYREFL_RULE_BASELINE_N_SIGMA, 3, 20);
+    myrefl_test_chain_ready("TBLN");
+
+    for (i = 0; i < 19; i++) {
+        myrefl_test_notify("TBLN", NULL, MYREFL_RESULT_VALUE, 
+                           i & 1 ? 95 : 105);
+    }
+    ck_assert(sched_test_wait_for(sched_test_ran, "RBLN", 19, 2000));
+    ck_assert_msg(sched_test_baseline_mode("RBLN") == SEQ_BASELINE_LEARNING,
+                  "Enforcing before M values");
+
+    myrefl_test_notify("TBLN", NULL, MYREFL_RESULT_VALUE, 95);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RBLN", 20, 2000));
+    ck_assert_msg(sched_test_result("RBLN") == MYREFL_RESULT_PASS,
+                  "Failing whilst learning");
+    ck_assert_msg(sched_test_baseline_mode("RBLN") == SEQ_BASELINE_ENFORCING,
+                  "Still learning after M values");
+
+    myrefl_test_notify("TBLN", NULL, MYREFL_RESULT_VALUE, 112);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RBLN", 21, 2000));
+    ck_assert_msg(sched_test_result("RBLN") == MYREFL_RESULT_PASS,
+                  "Failing within 3 standard deviations");
+
+    myrefl_test_notify("TBLN", NULL, MYREFL_RESULT_VALUE, 130);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RBLN", 22, 2000));
+    ck_assert_msg(sched_test_result("RBLN") == MYREFL_RESULT_FAIL,
+                  "Not failing 6 standard deviations out");
+}
+END_TEST
+
+/*
+ * A baseline loaded from the file is enforced straight away, and the
+ * refined baseline is written back to it.
+ */
+START_TEST (test_myrefl_seq_rule_baseline_file)
+{
+    char filename[] = "/tmp/check_sched_baseline.XXXXXX";
+    char line[128];
+    long count;
+    double mean, variance;
+    FILE *file;
+    int fd;
+
+    fd = mkstemp(filename);
+    ck_assert(fd >= 0);
+    file = fdopen(fd, "w");
+    ck_assert(file != NULL);
+    fprintf(file, "RBLF\t\t0 50 100 25\n");
+    fclose(file);
+
+    sched_test_start();
+    myrefl_baseline_set_file(filename);
+    myrefl_action_create("ABLF", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TBLF");
+    myrefl_rule_create("RBLF", "TBLF", "ABLF");
+    myrefl_rule_set_type("RBLF", MYREFL_RULE_BASELINE_N_SIGMA, 3, 20);
+    myrefl_test_chain_ready("TBLF");
+
+    myrefl_test_notify("TBLF", NULL, MYREFL_RESULT_VALUE, 130);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RBLF", 1, 2000));
+    ck_assert_msg(sched_test_result("RBLF") == MYREFL_RESULT_FAIL,
+                  "Loaded baseline not enforced");
+
+    myrefl_test_notify("TBLF", NULL, MYREFL_RESULT_VALUE, 105);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RBLF", 2, 2000));
+    ck_assert_msg(myrefl_baseline_save(), "Baselines not saved");
+
+    file = fopen(filename, "r");
+    ck_assert(file != NULL);
+    ck_assert(fgets(line, sizeof(line), file) != NULL);
+    fclose(file);
+    remove(filename);
+    ck_assert_msg(strncmp(line, "RBLF\t\t", 6) == 0 &&
+                  sscanf(line + 6, "0 %ld %lg %lg", &count, &mean, 
+                         &variance) == 3,
+                  "Saved baseline '%s'", line);
+    ck_assert_msg(count == 51 && mean > 100.0 && mean < 100.2, 
+                  "Saved count %ld mean %g", count, mean);
+}
+END_TEST
+
+/*
+ * The value statistics of an aggregation window are over the value 
+ * notifications, the values passed with passes and fails are ignored.
+ */
+START_TEST (test_myrefl_seq_aggregate_values)
+{
+    static const char *tests[] = { "TSUM", "TMIN", "TMAX", "TAVG" };
+    static const myrefl_aggregate_t aggregates[] = { 
+        MYREFL_AGGREGATE_SUM, MYREFL_AGGREGATE_MIN, 
+        MYREFL_AGGREGATE_MAX, MYREFL_AGGREGATE_AVERAGE };
+    static const long expected[] = { 36, 6, 20, 12 };
+    char rule[16];
+    obj_t *obj;
+    int i;
+
+    sched_test_start();
+    myrefl_action_create("AAGG", sched_test_action_pass, NULL);
+    for (i = 0; i < 4; i++) {
+        snprintf(rule, sizeof(rule), "R%s", tests[i]);
+        myrefl_test_create_notification(tests[i]);
+        myrefl_test_set_aggregate(tests[i], 500, aggregates[i]);
+        myrefl_rule_create(rule, tests[i], "AAGG");
+        myrefl_test_chain_ready(tests[i]);
+    }
+
+    for (i = 0; i < 4; i++) {
+        myrefl_test_notify(tests[i], NULL, MYREFL_RESULT_PASS, 1000);
+        myrefl_test_notify(tests[i], NULL, MYREFL_RESULT_VALUE, 10);
+        myrefl_test_notify(tests[i], NULL, MYREFL_RESULT_VALUE, 20);
+        myrefl_test_notify(tests[i], NULL, MYREFL_RESULT_PASS, -1000);
+        myrefl_test_notify(tests[i], NULL, MYREFL_RESULT_VALUE, 6);
+    }
+
+    for (i = 0; i < 4; i++) {
+        ck_assert_msg(sched_test_wait_for(sched_test_ran, tests[i], 1, 2000),
+                      "%s window not fed", tests[i]);
+        myrefl_obj_db_lock();
+        obj = myrefl_obj_get_by_name_unconverted(tests[i], OBJ_TYPE_TEST);
+        ck_assert_msg(obj->i.stats.runs == 1 && 
+                      obj->i.last_value == expected[i],
+                      "%s fed %u times, value %ld", tests[i], 
+                      obj->i.stats.runs, obj->i.last_value);
+        myrefl_obj_db_unlock();
+    }
+}
+END_TEST
+
+static boolean notify_delivered (const void *unused, long target)
+{
+    myrefl_notify_stats_t stats;
+
+    myrefl_notify_get_stats(&stats);
+    return (stats.delivered >= target);
+}
+
+/*
+ * Fill the nowait ring while holding the DB lock, so that the scheduler
+ * can't drain it, until a notification is dropped. Returns how many
+ * made it into the ring.
+ */
+static int notify_fill (const char *test)
+{
+    myrefl_notify_stats_t stats;
+    ulong dropped;
+    int queued = 0;
+
+    myrefl_notify_get_stats(&stats);
+    dropped = stats.dropped;
+    myrefl_notify_set_overflow(MYREFL_NOTIFY_OVERFLOW_DROP);
+    for (;;) {
+        myrefl_test_notify_nowait(test, NULL, MYREFL_RESULT_VALUE, 
+                                  queued + 1);
+        myrefl_notify_get_stats(&stats);
+        if (stats.dropped != dropped) {
+            return (queued);
+        }
+        queued++;
+    }
+}
+
+/*
+ * Notifications go through the ring in order.
+ */
+START_TEST (test_myrefl_api_notify_nowait)
+{
+    myrefl_notify_stats_t stats;
+    obj_t *obj;
+    int i;
+
+    sched_test_start();
+    myrefl_action_create("ANFY", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TNFY");
+    myrefl_rule_create("RNFY", "TNFY", "ANFY");
+    myrefl_rule_set_type("RNFY", MYREFL_RULE_GREATER_THAN_N, 99, 0);
+    myrefl_test_chain_ready("TNFY");
+
+    for (i = 1; i <= 100; i++) {
+        myrefl_test_notify_nowait("TNFY", NULL, MYREFL_RESULT_VALUE, i);
+    }
+    ck_assert(sched_test_wait_for(notify_delivered, NULL, 100, 2000));
+    ck_assert(sched_test_wait_for(sched_test_ran, "RNFY", 100, 2000));
+
+    myrefl_notify_get_stats(&stats);
+    ck_assert_msg(stats.queued == 100 && stats.dropped == 0,
+                  "Queued %lu dropped %lu", stats.queued, stats.dropped);
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted("TNFY", OBJ_TYPE_TEST);
+    ck_assert_msg(obj->i.last_value == 100, "Last value %ld", 
+                  obj->i.last_value);
+    myrefl_obj_db_unlock();
+    ck_assert_msg(sched_test_result("RNFY") == MYREFL_RESULT_FAIL,
+                  "Values out of order");
+}
+END_TEST
+
+/*
+ * On overflow a notification is dropped, or parked for coalescing with
+ * later ones for the same instance, according to the policy.
+ */
+START_TEST (test_myrefl_api_notify_overflow)
+{
+    myrefl_notify_stats_t stats;
+    obj_t *obj;
+    int ring, i;
+
+    sched_test_start();
+    myrefl_action_create("AOVF", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TOVF");
+    myrefl_rule_create("ROVF", "TOVF", "AOVF");
+    myrefl_test_chain_ready("TOVF");
+    myrefl_test_create_notification("TCLS");
+    myrefl_rule_create("RCLS", "TCLS", "AOVF");
+    myrefl_test_chain_ready("TCLS");
+
+    myrefl_obj_db_lock();
+    ring = notify_fill("TOVF");
+    ck_assert(ring > 0);
+
+    myrefl_notify_set_overflow(MYREFL_NOTIFY_OVERFLOW_COALESCE);
+    for (i = 1; i <= 5; i++) {
+        myrefl_test_notify_nowait("TCLS", NULL, MYREFL_RESULT_VALUE, i);
+    }
+
+    myrefl_notify_get_stats(&stats);
+    ck_assert_msg(stats.queued == ring + 1 && stats.dropped == 1 &&
+                  stats.coalesced == 4,
+                  "Queued %lu dropped %lu coalesced %lu",
+                  stats.queued, stats.dropped, stats.coalesced);
+    myrefl_obj_db_unlock();
+
+    ck_assert(sched_test_wait_for(notify_delivered, NULL, ring + 1, 5000));
+    ck_assert(sched_test_wait_for(sched_test_ran, "ROVF", ring, 5000));
+    ck_assert(sched_test_wait_for(sched_test_ran, "RCLS", 1, 2000));
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted("TOVF", OBJ_TYPE_TEST);
+    ck_assert_msg(obj->i.last_value == ring, "Last value %ld of %d", 
+                  obj->i.last_value, ring);
+    obj = myrefl_obj_get_by_name_unconverted("TCLS", OBJ_TYPE_TEST);
+    ck_assert_msg(obj->i.stats.runs == 1 && obj->i.last_value == 5, 
+                  "Coalesced runs %u value %ld", obj->i.stats.runs,
+                  obj->i.last_value);
+    myrefl_obj_db_unlock();
+}
+END_TEST
+
+static obj_instance_t *sched_test_instance (const char *name,
+                                           const char *instance)
+{
+    obj_t *obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_ANY);
+    obj_instance_t *found;
+
+    ck_assert(obj != NULL);
+    found = myrefl_obj_instance_by_name(obj, instance);
+    ck_assert(found != NULL);
+    return (found);
+}
+
+/*
+ * Notify, enable and disable by handle, and check that a handle is
+ * rejected once its instance has gone, even after the slot is reused.
+ */
+START_TEST (test_myrefl_api_handles)
+{
+    myrefl_test_handle_t test;
+    myrefl_instance_handle_t first, second;
+    myrefl_handle_t bad = { 0, 0 };
+    obj_instance_t *instance;
+
+    sched_test_start();
+    myrefl_action_create("AHDL", sched_test_action_pass, NULL);
+    test = myrefl_test_create_notification_handle("THDL");
+    ck_assert_msg(test.generation != 0, "No handle for the test");
+    myrefl_rule_create("RHDL", "THDL", "AHDL");
+    myrefl_test_chain_ready("THDL");
+
+    myrefl_test_notify_handle(test, MYREFL_RESULT_FAIL, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_result_is, "RHDL",
+                                      MYREFL_RESULT_FAIL, 2000),
+                  "Notify by handle not run");
+
+    myrefl_test_disable_handle(test);
+    ck_assert_msg(myrefl_obj_get_by_name_unconverted("THDL",
+                                                     OBJ_TYPE_TEST)->i.state
+                  == OBJ_STATE_DISABLED, "Not disabled by handle");
+    myrefl_test_enable_handle(test);
+    ck_assert_msg(myrefl_obj_get_by_name_unconverted("THDL",
+                                                     OBJ_TYPE_TEST)->i.state
+                  == OBJ_STATE_ENABLED, "Not enabled by handle");
+
+    myrefl_test_notify_handle(bad, MYREFL_RESULT_PASS, 0);
+
+    first = myrefl_instance_create_handle("THDL", "IHDL1", NULL);
+    ck_assert_msg(first.generation != 0, "No handle for the instance");
+    myrefl_test_notify_handle(first, MYREFL_RESULT_FAIL, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_ran, "THDL", 2, 2000),
+                  "Notify by instance handle not run");
+    myrefl_obj_db_lock();
+    instance = sched_test_instance("THDL", "IHDL1");
+    ck_assert_msg(instance->stats.runs == 1 &&
+                  instance->last_result == MYREFL_RESULT_FAIL,
+                  "Notify by instance handle went elsewhere");
+    myrefl_obj_db_unlock();
+
+    myrefl_instance_delete("THDL", "IHDL1");
+    myrefl_obj_db_lock();
+    ck_assert_msg(myrefl_obj_handle_instance(first) == NULL,
+                  "Handle valid after the instance was deleted");
+    myrefl_obj_db_unlock();
+
+    myrefl_obj_test_run_garbage_collector();
+    second = myrefl_instance_create_handle("THDL", "IHDL2", NULL);
+    ck_assert_msg(second.index == first.index, "Slot not reused");
+    ck_assert_msg(second.generation != first.generation,
+                  "Generation not moved on");
+
+    /*
+     * The instance's results are handled in order, so once the pass 
+     * has been seen the stale handle's fail would have been as well.
+     */
+    myrefl_test_notify_handle(first, MYREFL_RESULT_FAIL, 0);
+    myrefl_test_notify_handle(second, MYREFL_RESULT_PASS, 0);
+    ck_assert(sched_test_wait_for(sched_test_ran, "THDL", 3, 2000));
+    myrefl_obj_db_lock();
+    instance = sched_test_instance("THDL", "IHDL2");
+    ck_assert_msg(instance->stats.runs == 1 &&
+                  instance->last_result == MYREFL_RESULT_PASS,
+                  "Stale handle reached the new instance");
+    myrefl_obj_db_unlock();
+}
+END_TEST
+
+/*
+ * Results for many instances in one call, each of which is processed as
+ * if notified on its own and in the order given, including an instance
+ * that appears twice.
+ */
+/*
+ * Overflowing notifications are not applied over later ones: a coalesced
+ * one loses to a later one in the ring for the same instance, and one
+ * that blocks goes in behind those already queued.
+ */
+START_TEST (test_myrefl_api_notify_order)
+{
+    myrefl_notify_stats_t stats;
+    obj_t *obj;
+    int ring;
+
+    sched_test_start();
+    myrefl_action_create("AORD", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TFIL");
+    myrefl_rule_create("RFIL", "TFIL", "AORD");
+    myrefl_test_chain_ready("TFIL");
+    myrefl_test_create_notification("TORD");
+    myrefl_rule_create("RORD", "TORD", "AORD");
+    myrefl_test_chain_ready("TORD");
+    myrefl_test_create_notification("TBLK");
+    myrefl_rule_create("RBLK", "TBLK", "AORD");
+    myrefl_test_chain_ready("TBLK");
+
+    /*
+     * A drain that empties a full ring leaves the coalesced one parked, 
+     * behind the later one then queued in the ring.
+     */
+    myrefl_obj_db_lock();
+    ring = notify_fill("TFIL");
+    myrefl_notify_set_overflow(MYREFL_NOTIFY_OVERFLOW_COALESCE);
+    myrefl_test_notify_nowait("TORD", NULL, MYREFL_RESULT_VALUE, 1);
+    myrefl_api_notify_drain();
+    myrefl_test_notify_nowait("TORD", NULL, MYREFL_RESULT_VALUE, 2);
+    myrefl_obj_db_unlock();
+
+    ck_assert(sched_test_wait_for(notify_delivered, NULL, ring + 1, 5000));
+    ck_assert(sched_test_wait_for(sched_test_ran, "RORD", 1, 2000));
+    myrefl_notify_get_stats(&stats);
+    ck_assert_msg(stats.coalesced == 1, "Coalesced %lu", stats.coalesced);
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted("TORD", OBJ_TYPE_TEST);
+    ck_assert_msg(obj->i.stats.runs == 1 && obj->i.last_value == 2, 
+                  "Coalesced runs %u value %ld", obj->i.stats.runs,
+                  obj->i.last_value);
+    myrefl_obj_db_unlock();
+
+    /*
+     * Blocking drains the ring in the caller before queueing.
+     */
+    myrefl_obj_db_lock();
+    ring = notify_fill("TBLK");
+    myrefl_notify_set_overflow(MYREFL_NOTIFY_OVERFLOW_BLOCK);
+    myrefl_test_notify_nowait("TBLK", NULL, MYREFL_RESULT_VALUE, -1);
+    myrefl_notify_get_stats(&stats);
+    ck_assert_msg(stats.blocked == 1, "Blocked %lu", stats.blocked);
+    myrefl_obj_db_unlock();
+
+    ck_assert(sched_test_wait_for(sched_test_ran, "TBLK", ring + 1, 5000));
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted("TBLK", OBJ_TYPE_TEST);
+    ck_assert_msg(obj->i.last_value == -1, "Blocked value %ld", 
+                  obj->i.last_value);
+    myrefl_obj_db_unlock();
+}
+END_TEST
+
+START_TEST (test_myrefl_api_notify_many)
+{
+    myrefl_notify_entry_t entries[] = {
+        { "IMNY1", MYREFL_RESULT_VALUE, 10 },
+        { "IMNY2", MYREFL_RESULT_VALUE, 60 },
+        { "IMNY3", MYREFL_RESULT_VALUE, 20 },
+        { "IMNY2", MYREFL_RESULT_VALUE, 30 },
+        { "IMNY4", MYREFL_RESULT_VALUE, 70 },
+    };
+    obj_instance_t *instance;
+
+    sched_test_start();
+    myrefl_action_create("AMNY", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TMNY");
+    myrefl_rule_create("RMNY", "TMNY", "AMNY");
+    myrefl_rule_set_type("RMNY", MYREFL_RULE_GREATER_THAN_N, 50, 0);
+    myrefl_instance_create("TMNY", "IMNY1", NULL);
+    myrefl_instance_create("TMNY", "IMNY2", NULL);
+    myrefl_instance_create("TMNY", "IMNY3", NULL);
+    myrefl_instance_create("TMNY", "IMNY4", NULL);
+    myrefl_instance_create("RMNY", "IMNY1", NULL);
+    myrefl_instance_create("RMNY", "IMNY2", NULL);
+    myrefl_instance_create("RMNY", "IMNY3", NULL);
+    myrefl_instance_create("RMNY", "IMNY4", NULL);
+    myrefl_test_chain_ready("TMNY");
+
+    myrefl_test_notify_many("TMNY", entries, 5);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RMNY", 5, 2000));
+
+    myrefl_obj_db_lock();
+    instance = sched_test_instance("TMNY", "IMNY2");
+    ck_assert_msg(instance->stats.runs == 2 && instance->last_value == 30,
+                  "Duplicate instance runs %u last value %ld",
+                  instance->stats.runs, instance->last_value);
+    instance = sched_test_instance("RMNY", "IMNY2");
+    ck_assert_msg(instance->stats.runs == 2 &&
+                  instance->last_result == MYREFL_RESULT_PASS,
+                  "Duplicate instance rule runs %u result %d",
+                  instance->stats.runs, instance->last_result);
+    instance = sched_test_instance("RMNY", "IMNY1");
+    ck_assert_msg(instance->last_result == MYREFL_RESULT_PASS,
+                  "IMNY1 result %d", instance->last_result);
+    instance = sched_test_instance("RMNY", "IMNY4");
+    ck_assert_msg(instance->last_result == MYREFL_RESULT_FAIL,
+                  "IMNY4 result %d", instance->last_result);
+    myrefl_obj_db_unlock();
+}
+END_TEST
+
+extern void myrefl_rci_ut_map_is_passed(obj_instance_t *rule_instance,
+                                        const char *instance_name,
+                                        myrefl_list_t *visited_rules);
+extern void myrefl_rci_ut_propagate_rule_change(
+    obj_instance_t *rule_of_interest,
+    myrefl_result_t action,
+    myrefl_list_t *visited_rules,
+    myrefl_list_t *scheduled_rules);
+
+static obj_instance_t *sched_test_rule (const char *name)
+{
+    obj_t *obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_RULE);
+
+    ck_assert(obj != NULL);
+    return (&obj->i);
+}
+
+/*
+ * Build the diamond RVP -> RVA, RVP -> RVB, RVA -> RVC, RVB -> RVC.
+ */
+static void sched_test_diamond (void)
+{
+    myrefl_action_create("AVIS", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TVIS");
+    myrefl_rule_create("RVP", "TVIS", "AVIS");
+    myrefl_rule_create("RVA", "TVIS", "AVIS");
+    myrefl_rule_create("RVB", "TVIS", "AVIS");
+    myrefl_rule_create("RVC", "TVIS", "AVIS");
+    myrefl_depend_create("RVP", "RVA");
+    myrefl_depend_create("RVP", "RVB");
+    myrefl_depend_create("RVA", "RVC");
+    myrefl_depend_create("RVB", "RVC");
+    myrefl_test_chain_ready("TVIS");
+}
+
+/*
+ * A traversal reaching a rule by two paths applies the function to it
+ * once, and the stamps it leaves behind don't hide the rule from the
+ * next traversal.
+ */
+START_TEST (test_myrefl_rci_visit_children)
+{
+    myrefl_list_t *visited;
+    int pass;
+
+    sched_test_start();
+    sched_test_diamond();
+
+    myrefl_obj_db_lock();
+    for (pass = 0; pass < 2; pass++) {
+        visited = myrefl_list_create();
+        myrefl_rci_ut_map_is_passed(sched_test_rule("RVP"), NULL, visited);
+        ck_assert_msg(visited->num_elements == 3,
+                      "Walk %d visited %u rules", pass, visited->num_elements);
+        ck_assert(myrefl_list_find(visited, sched_test_rule("RVA")));
+        ck_assert(myrefl_list_find(visited, sched_test_rule("RVB")));
+        ck_assert(myrefl_list_find(visited, sched_test_rule("RVC")));
+        myrefl_list_free(visited);
+    }
+    myrefl_obj_db_unlock();
+}
+END_TEST
+
+/*
+ * The same going up: a failure at the bottom of the diamond reaches
+ * each rule above it once and schedules the passing ones once.
+ */
+START_TEST (test_myrefl_rci_visit_parents)
+{
+    myrefl_list_t *visited, *scheduled;
+
+    sched_test_start();
+    sched_test_diamond();
+
+    myrefl_obj_db_lock();
+    visited = myrefl_list_create();
+    scheduled = myrefl_list_create();
+    myrefl_rci_ut_propagate_rule_change(sched_test_rule("RVC"),
+                                        MYREFL_RESULT_FAIL,
+                                        visited, scheduled);
+    ck_assert_msg(visited->num_elements == 3,
+                  "Visited %u rules", visited->num_elements);
+    ck_assert_msg(scheduled->num_elements == 3,
+                  "Scheduled %u rules", scheduled->num_elements);
+    ck_assert(myrefl_list_find(visited, sched_test_rule("RVP")));
+    ck_assert(!myrefl_list_find(visited, sched_test_rule("RVC")));
+    myrefl_list_free(visited);
+    myrefl_list_free(scheduled);
+    myrefl_obj_db_unlock();
+}
+END_TEST
+
+
+static boolean sched_test_reaches (obj_order_t relation, const char *from,
+                                   const char *to)
+{
+    obj_t *from_obj, *to_obj;
+    boolean reaches;
+
+    myrefl_obj_db_lock();
+    from_obj = myrefl_obj_get_by_name_unconverted(from, OBJ_TYPE_ANY);
+    to_obj = myrefl_obj_get_by_name_unconverted(to, OBJ_TYPE_ANY);
+    ck_assert(from_obj != NULL && to_obj != NULL);
+    reaches = myrefl_obj_order_reaches(relation, from_obj, to_obj);
+    myrefl_obj_db_unlock();
+    return (reaches);
+}
+
+/*
+ * Rule inputs that would loop are rejected, ones that only go against 
+ * the order the rules were created in are not.
+ */
+START_TEST (test_myrefl_obj_order_input_loops)
+{
+    sched_test_start();
+    myrefl_action_create("ALOOP", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TLOOP");
+    myrefl_rule_create("RLOOP1", "TLOOP", "ALOOP");
+    myrefl_rule_create("RLOOP2", "RLOOP1", "ALOOP");
+    myrefl_rule_create("RLOOP3", "RLOOP2", "ALOOP");
+
+    ck_assert_msg(sched_test_reaches(OBJ_ORDER_INPUT, "RLOOP3", "RLOOP1"),
+                  "Input chain not followed");
+
+    myrefl_rule_add_input("RLOOP1", "RLOOP3");
+    ck_assert_msg(!sched_test_reaches(OBJ_ORDER_INPUT, "RLOOP1", "RLOOP3"),
+                  "Input loop accepted");
+
+    myrefl_rule_create("RLOOP4", "TLOOP", "ALOOP");
+    myrefl_rule_create("RLOOP5", "TLOOP", "ALOOP");
+    myrefl_rule_add_input("RLOOP4", "RLOOP5");
+    myrefl_rule_add_input("RLOOP5", "RLOOP3");
+    ck_assert_msg(sched_test_reaches(OBJ_ORDER_INPUT, "RLOOP4", "RLOOP1"),
+                  "Inputs against the creation order rejected");
+
+    myrefl_rule_add_input("RLOOP1", "RLOOP4");
+    ck_assert_msg(!sched_test_reaches(OBJ_ORDER_INPUT, "RLOOP1", "RLOOP4"),
+                  "Input loop through a reordering accepted");
+}
+END_TEST
+
+/*
+ * A long dependency chain built in either direction, closing it into a
+ * loop is rejected.
+ */
+START_TEST (test_myrefl_obj_order_depend_loops)
+{
+    char parent[32], child[32];
+    int i;
+
+    sched_test_start();
+    for (i = 0; i < 1000; i++) {
+        snprintf(parent, sizeof(parent), "CUP%d", i + 1);
+        snprintf(child, sizeof(child), "CUP%d", i);
+        myrefl_comp_create(child);
+        myrefl_comp_create(parent);
+        myrefl_depend_create(parent, child);
+
+        snprintf(parent, sizeof(parent), "CDOWN%d", 1000 - i);
+        snprintf(child, sizeof(child), "CDOWN%d", 999 - i);
+        myrefl_comp_create(child);
+        myrefl_comp_create(parent);
+        myrefl_depend_create(parent, child);
+    }
+
+    ck_assert_msg(sched_test_reaches(OBJ_ORDER_DEPEND, "CUP1000", "CUP0"),
+                  "Chain built bottom up not followed");
+    ck_assert_msg(sched_test_reaches(OBJ_ORDER_DEPEND, "CDOWN1000", 
+                                     "CDOWN0"),
+                  "Chain built top down not followed");
+
+    myrefl_depend_create("CUP0", "CUP1000");
+    myrefl_depend_create("CDOWN0", "CDOWN1000");
+    ck_assert_msg(!sched_test_reaches(OBJ_ORDER_DEPEND, "CUP0", "CUP1000"),
+                  "Dependency loop accepted bottom up");
+    ck_assert_msg(!sched_test_reaches(OBJ_ORDER_DEPEND, "CDOWN0", 
+                                      "CDOWN1000"),
+                  "Dependency loop accepted top down");
+}
+END_TEST
+
+/*
+ * A rule chain deeper than the sequencer runs inline is accepted and
+ * fed all the way to the end.
+ */
+START_TEST (test_myrefl_seq_deep_chain)
+{
+    char rule[32], input[32];
+    int i;
+
+    sched_test_start();
+    myrefl_action_create("ADEEP", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TDEEP");
+    strcpy(input, "TDEEP");
+    for (i = 0; i < 100; i++) {
+        snprintf(rule, sizeof(rule), "RDEEP%d", i);
+        myrefl_rule_create(rule, input, "ADEEP");
+        strcpy(input, rule);
+    }
+    myrefl_test_chain_ready("TDEEP");
+
+    myrefl_test_notify("TDEEP", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_ran, "RDEEP99", 1, 5000),
+                  "End of the chain not reached");
+}
+END_TEST
+
+static volatile int memo_parent_runs;
+static volatile int memo_child_runs;
+
+static myrefl_result_t memo_action_count (const char *instance, 
+                                          void *context)
+{
+    __sync_fetch_and_add((volatile int *)context, 1);
+    return (MYREFL_RESULT_PASS);
+}
+
+/*
+ * Condition for sched_test_wait_for(), the parent rule has recorded at 
+ * least target results, the last a failure, and the root cause 
+ * identification that followed has finished: no test or rule in the
+ * test is queued for a rerun or has sequencer work outstanding.
+ */
+static boolean memo_settled (const void *name, long target)
+{
+    static const char *names[] = { "TMEMOP", "TMEMOC", "TMEMOG", "TMEMOC2",
+                                   "RMEMOP", "RMEMOC", "RMEMOG", "RMEMOC2",
+                                   NULL };
+    const char **quiet;
+    obj_t *obj;
+    boolean settled;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_RULE);
+    settled = (obj && obj->i.stats.runs >= target &&
+               obj->i.last_result == MYREFL_RESULT_FAIL);
+    for (quiet = names; settled && *quiet; quiet++) {
+        obj = myrefl_obj_get_by_name_unconverted(*quiet, OBJ_TYPE_ANY);
+        settled = (obj && !obj->i.seq_active &&
+                   obj->i.sched_test.queued == TEST_QUEUE_NONE);
+    }
+    myrefl_obj_db_unlock();
+    return (settled);
+}
+
+static rule_root_cause_t memo_root_cause (const char *name)
+{
+    obj_t *obj;
+    rule_root_cause_t root_cause;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_RULE);
+    ck_assert(obj != NULL);
+    root_cause = obj->i.root_cause;
+    myrefl_obj_db_unlock();
+    return (root_cause);
+}
+
+/*
+ * The cached verdicts on the rules below a parent rule are forgotten 
+ * when a result below it changes or a dependency is added, so the 
+ * parent is the root cause only when no rule below it is failing. The
+ * failing rule is a grandchild, since the parent looks at its own 
+ * children directly.
+ */
+START_TEST (test_myrefl_rci_memo_invalidate)
+{
+    sched_test_start();
+    myrefl_action_create("AMEMOP", memo_action_count, 
+                         (void *)&memo_parent_runs);
+    myrefl_action_create("AMEMOC", memo_action_count, 
+                         (void *)&memo_child_runs);
+    myrefl_test_create_notification("TMEMOP");
+    myrefl_test_create_notification("TMEMOC");
+    myrefl_test_create_notification("TMEMOG");
+    myrefl_test_create_notification("TMEMOC2");
+    myrefl_rule_create("RMEMOP", "TMEMOP", "AMEMOP");
+    myrefl_rule_create("RMEMOC", "TMEMOC", "AMEMOC");
+    myrefl_rule_create("RMEMOG", "TMEMOG", "AMEMOC");
+    myrefl_rule_create("RMEMOC2", "TMEMOC2", "AMEMOC");
+    myrefl_depend_create("RMEMOP", "RMEMOC");
+    myrefl_depend_create("RMEMOC", "RMEMOG");
+    myrefl_test_chain_ready("TMEMOP");
+    myrefl_test_chain_ready("TMEMOC");
+    myrefl_test_chain_ready("TMEMOG");
+    myrefl_test_chain_ready("TMEMOC2");
+
+    myrefl_test_notify("TMEMOG", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_counted, 
+                                      (const void *)&memo_child_runs, 
+                                      1, 1000),
+                  "Grandchild not the root cause");
+    myrefl_test_notify("TMEMOP", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert(sched_test_wait_for(memo_settled, "RMEMOP", 1, 1000));
+    ck_assert_msg(memo_root_cause("RMEMOP") == RULE_ROOT_CAUSE_NOT,
+                  "Parent the root cause with its grandchild failing");
+
+    /*
+     * The grandchild passing forgets the parent's verdict, so the 
+     * parent still failing is now the root cause.
+     */
+    myrefl_test_notify("TMEMOG", NULL, MYREFL_RESULT_PASS, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_counted, 
+                                      (const void *)&memo_parent_runs, 
+                                      1, 1000),
+                  "Parent not the root cause with its grandchild passing");
+    ck_assert(memo_root_cause("RMEMOP") == RULE_ROOT_CAUSE);
+
+    /*
+     * A new failing child under the parent.
+     */
+    myrefl_test_notify("TMEMOP", NULL, MYREFL_RESULT_PASS, 0);
+    myrefl_test_notify("TMEMOC2", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert_msg(sched_test_wait_for(sched_test_counted, 
+                                      (const void *)&memo_child_runs, 
+                                      2, 1000),
+                  "New child not the root cause");
+    myrefl_depend_create("RMEMOP", "RMEMOC2");
+    myrefl_test_notify("TMEMOP", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert(sched_test_wait_for(memo_settled, "RMEMOP", 3, 1000));
+    ck_assert_msg(memo_root_cause("RMEMOP") == RULE_ROOT_CAUSE_NOT,
+                  "Parent the root cause over a new failing child");
+}
+END_TEST
+
+/*
+ * Chain walks, these run on an explicit stack rather than the C stack, so
+ * a deep rule input chain does not need a deep thread stack.
+ */
+#define WALK_TEST_STACK (256 * 1024)
+
+typedef struct walk_test_s {
+    const char *test;
+    obj_state_t state;
+    long ns;
+} walk_test_t;
+
+/*
+ * Create a test with a chain of depth rules on it, each feeding the next.
+ */
+static void walk_test_chain (const char *test, int depth)
+{
+    char rule[32], input[32];
+    int i;
+
+    myrefl_test_create_notification(test);
+    snprintf(input, sizeof(input), "%s", test);
+    for (i = 0; i < depth; i++) {
+        snprintf(rule, sizeof(rule), "R%s%d", test, i);
+        myrefl_rule_create(rule, input, "AWLK");
+        snprintf(input, sizeof(input), "%s", rule);
+    }
+}
+
+static void *walk_test_update_state (void *context)
+{
+    walk_test_t *walk = context;
+    xos_time_t start, end, diff;
+    obj_t *obj;
+
+    myrefl_obj_db_lock();
+    obj = myrefl_obj_get_by_name_unconverted(walk->test, OBJ_TYPE_TEST);
+    ck_assert(obj != NULL);
+
+    myrefl_xos_time_set_now(&start);
+    myrefl_obj_chain_update_state(obj, walk->state);
+    myrefl_xos_time_set_now(&end);
+    myrefl_obj_db_unlock();
+
+    myrefl_xos_time_diff(&start, &end, &diff);
+    walk->ns = diff.sec * 1000000000L + diff.nsec;
+    return (NULL);
+}
 
+/*
+ * Walk the test's chain on a thread with a small stack, returning the 
+ * time taken per rule.
+ */
+static long walk_test_cost_ns (const char *test, int depth, 
+                               obj_state_t state)
+{
+    walk_test_t walk = { test, state, 0 };
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    ck_assert(pthread_attr_init(&attr) == 0);
+    ck_assert(pthread_attr_setstacksize(&attr, WALK_TEST_STACK) == 0);
+    ck_assert(pthread_create(&tid, &attr, walk_test_update_state, 
+                             &walk) == 0);
+    ck_assert(pthread_join(tid, NULL) == 0);
+    pthread_attr_destroy(&attr);
+
+    return (walk.ns / depth);
+}
+
+static obj_state_t walk_test_state (const char *name)
+{
+    obj_state_t state;
+
+    myrefl_obj_db_lock();
+    state = sched_test_rule(name)->state;
+    myrefl_obj_db_unlock();
+    return (state);
+}
+
+/*
+ * A 10000 deep chain is walked to the bottom on a thread with a stack
+ * that the recursive walks overflowed.
+ */
+START_TEST (test_myrefl_obj_walk_deep)
+{
+    sched_test_start();
+    myrefl_action_create("AWLK", sched_test_action_pass, NULL);
+    walk_test_chain("TWLKD", 10000);
+    ck_assert(walk_test_state("RTWLKD9999") != OBJ_STATE_ENABLED);
+
+    walk_test_cost_ns("TWLKD", 10000, OBJ_STATE_ENABLED);
+    ck_assert_msg(walk_test_state("RTWLKD0") == OBJ_STATE_ENABLED,
+                  "Top of the chain not enabled");
+    ck_assert_msg(walk_test_state("RTWLKD9999") == OBJ_STATE_ENABLED,
+                  "Bottom of the chain not enabled");
+}
+END_TEST
+
+/*
+ * Benchmark, the walk cost per rule at 1000 and 10000 deep. It only
+ * reports the figures, run with MYREFL_BENCHMARK set in the environment.
+ */
+START_TEST (test_myrefl_obj_walk_cost)
+{
+    long small, large;
+
+    sched_test_start();
+    myrefl_action_create("AWLK", sched_test_action_pass, NULL);
+    walk_test_chain("TWLKS", 1000);
+    walk_test_chain("TWLKL", 10000);
+
+    /* warm up the walk stack */
+    walk_test_cost_ns("TWLKL", 10000, OBJ_STATE_DISABLED);
+
+    small = walk_test_cost_ns("TWLKS", 1000, OBJ_STATE_ENABLED);
+    large = walk_test_cost_ns("TWLKL", 10000, OBJ_STATE_ENABLED);
+
+    printf("Chain walk %ldns per rule at 1000 deep, "
+           "%ldns per rule at 10000 deep\n", small, large);
+}
+END_TEST
+
+/*
+ * Storm control, actions that block until the gate opens so that they
+ * hold on to their slots.
+ */
+static volatile int storm_gate;
+static volatile int storm_running;
+static volatile int storm_max_running;
+static volatile int storm_runs;
+
+static myrefl_result_t storm_action_blocking (const char *instance, 
+                                              void *context)
+{
+    struct timespec nap = { 0, 10 * 1000 * 1000 };
+    int running = __sync_add_and_fetch(&storm_running, 1);
+
+    if (running > storm_max_running) {
+        storm_max_running = running;
+    }
+    while (!storm_gate) {
+        nanosleep(&nap, NULL);
+    }
+    __sync_fetch_and_sub(&storm_running, 1);
+    __sync_fetch_and_add(&storm_runs, 1);
+    return (MYREFL_RESULT_PASS);
+}
+
+/*
+ * An action that completes later, remembering which one it was.
+ */
+static const char * volatile storm_last;
+
+static myrefl_result_t storm_action_in_progress (const char *instance, 
+                                                 void *context)
+{
+    storm_last = context;
+    __sync_fetch_and_add(&storm_runs, 1);
+    return (MYREFL_RESULT_IN_PROGRESS);
+}
+
+static obj_action_t *storm_action (const char *name)
+{
+    obj_t *obj = myrefl_obj_get_by_name_unconverted(name, OBJ_TYPE_ACTION);
+
+    ck_assert(obj != NULL);
+    return (obj->t.action);
+}
+
+/*
+ * Condition for sched_test_wait_for(), the requests deferred and 
+ * coalesced between the NULL terminated list of actions.
+ */
+static boolean storm_held_back (const void *names, long target)
+{
+    const char * const *name;
+    long held = 0;
+
+    myrefl_obj_db_lock();
+    for (name = names; *name; name++) {
+        held += storm_action(*name)->deferred + 
+            storm_action(*name)->coalesced;
+    }
+    myrefl_obj_db_unlock();
+    return (held >= target);
+}
+
+/*
+ * With one action allowed to run at a time the second waits on the 
+ * action queue, and is started once the first returns.
+ */
+START_TEST (test_myrefl_seq_storm_admit_defer)
+{
+    static const char *actions[] = { "SA", "SB", NULL };
+
+    sched_test_start();
+    myrefl_action_set_storm_control(1, 0, 0);
+    myrefl_action_create("SA", storm_action_blocking, NULL);
+    myrefl_action_create("SB", storm_action_blocking, NULL);
+    myrefl_test_create_notification("STA");
+    myrefl_test_create_notification("STB");
+    myrefl_rule_create("SRA", "STA", "SA");
+    myrefl_rule_create("SRB", "STB", "SB");
+    myrefl_test_chain_ready("STA");
+    myrefl_test_chain_ready("STB");
+
+    myrefl_test_notify("STA", NULL, MYREFL_RESULT_FAIL, 0);
+    myrefl_test_notify("STB", NULL, MYREFL_RESULT_FAIL, 0);
+
+    ck_assert_msg(sched_test_wait_for(storm_held_back, actions, 1, 2000),
+                  "Second action not deferred");
+    ck_assert_msg(storm_max_running == 1, 
+                  "%d actions running with a limit of 1", storm_max_running);
+
+    storm_gate = TRUE;
+    ck_assert_msg(sched_test_wait_for(sched_test_counted, 
+                                      (const void *)&storm_runs, 2, 2000),
+                  "Deferred action not started, %d runs", storm_runs);
+    ck_assert_int_eq(storm_max_running, 1);
+}
+END_TEST
+
+/*
+ * Further requests for an action that is waiting to run are merged 
+ * into it rather than queued again.
+ */
+START_TEST (test_myrefl_seq_storm_coalesce)
+{
+    static const char *actions[] = { "SS", NULL };
+    obj_action_t *shared;
+
+    sched_test_start();
+    myrefl_action_set_storm_control(1, 0, 0);
+    myrefl_action_create("SX", storm_action_blocking, NULL);
+    myrefl_action_create("SS", storm_action_blocking, NULL);
+    myrefl_test_create_notification("STX");
+    myrefl_test_create_notification("STA");
+    myrefl_test_create_notification("STB");
+    myrefl_rule_create("SRX", "STX", "SX");
+    myrefl_rule_create("SRA", "STA", "SS");
+    myrefl_rule_create("SRB", "STB", "SS");
+    myrefl_test_chain_ready("STX");
+    myrefl_test_chain_ready("STA");
+    myrefl_test_chain_ready("STB");
+
+    myrefl_test_notify("STX", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert(sched_test_wait_for(sched_test_counted, 
+                                  (const void *)&storm_running, 1, 2000));
+
+    myrefl_test_notify("STA", NULL, MYREFL_RESULT_FAIL, 0);
+    myrefl_test_notify("STB", NULL, MYREFL_RESULT_FAIL, 0);
+    ck_assert(sched_test_wait_for(storm_held_back, actions, 2, 2000));
+
+    myrefl_obj_db_lock();
+    shared = storm_action("SS");
+    ck_assert_msg(shared->deferred == 1, "Deferred %u", shared->deferred);
+    ck_assert_msg(shared->coalesced == 1, "Coalesced %u", shared->coalesced);
+    ck_assert_int_eq(shared->suppressed, 0);
+    myrefl_obj_db_unlock();
+
+    storm_gate = TRUE;
+    ck_assert(sched_test_wait_for(sched_test_counted, 
+                                  (const void *)&storm_runs, 2, 2000));
+    myrefl_obj_db_lock();
+    ck_assert_msg(!storm_action("SS")->obj->i.action_pending,
+                  "Coalesced action still pending");
+    myrefl_obj_db_unlock();
+}
+END_TEST
+
+/*
+ * A range rule's clear thresholds are pulled in from both ends, so the 
+ * hysteresis has to leave some of the range between them.
+ */
+START_TEST (test_myrefl_seq_hysteresis_range)
+{
+    obj_rule_t *rule;
+
+    sched_test_start();
+    myrefl_action_create("AHYS", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("THYS");
+    myrefl_rule_create("RHYS", "THYS", "AHYS");
+    myrefl_rule_set_type("RHYS", MYREFL_RULE_RANGE_N_TO_M, 10, 20);
+    rule = sched_test_rule("RHYS")->obj->t.rule;
+
+    myrefl_rule_set_hysteresis("RHYS", 5);
+    ck_assert_msg(rule->hysteresis == 0, 
+                  "Hysteresis of half the range accepted");
+
+    myrefl_rule_set_hysteresis("RHYS", 4);
+    ck_assert_msg(rule->hysteresis == 4, "Hysteresis %ld", rule->hysteresis);
+
+    myrefl_rule_set_type("RHYS", MYREFL_RULE_RANGE_N_TO_M, 10, 16);
+    ck_assert_msg(rule->op_m == 20, "Range narrowed past the hysteresis");
+}
+END_TEST
+
+/*
+ * Once failing a threshold rule has to come back past the clear 
+ * threshold to pass.
+ */
+START_TEST (test_myrefl_seq_hysteresis_clear)
+{
+    sched_test_start();
+    myrefl_action_create("AHYS", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("THYS");
+    myrefl_rule_create("RHYS", "THYS", "AHYS");
+    myrefl_rule_set_type("RHYS", MYREFL_RULE_GREATER_THAN_N, 90, 0);
+    myrefl_rule_set_hysteresis("RHYS", 5);
+    myrefl_test_chain_ready("THYS");
+
+    myrefl_test_notify("THYS", NULL, MYREFL_RESULT_VALUE, 91);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RHYS", 1, 2000));
+    ck_assert_msg(sched_test_result("RHYS") == MYREFL_RESULT_FAIL,
+                  "Not failing above the threshold");
+
+    myrefl_test_notify("THYS", NULL, MYREFL_RESULT_VALUE, 88);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RHYS", 2, 2000));
+    ck_assert_msg(sched_test_result("RHYS") == MYREFL_RESULT_FAIL,
+                  "Cleared inside the hysteresis");
+
+    myrefl_test_notify("THYS", NULL, MYREFL_RESULT_VALUE, 84);
+    ck_assert(sched_test_wait_for(sched_test_ran, "RHYS", 3, 2000));
+    ck_assert_msg(sched_test_result("RHYS") == MYREFL_RESULT_PASS,
+                  "Not cleared below the clear threshold");
+}
+END_TEST
+
+/*
+ * A rule changing on every value is held at its result from before it
+ * started flapping once the penalty reaches the suppress threshold.
+ */
+START_TEST (test_myrefl_seq_flap_damping)
+{
+    long values[] = { 60, 40, 60, 40, 60, 40 };
+    myrefl_result_t results[] = { MYREFL_RESULT_FAIL, MYREFL_RESULT_PASS,
+                                  MYREFL_RESULT_PASS, MYREFL_RESULT_PASS,
+                                  MYREFL_RESULT_PASS, MYREFL_RESULT_PASS };
+    int i;
+
+    sched_test_start();
+    myrefl_action_create("AFLP", sched_test_action_pass, NULL);
+    myrefl_test_create_notification("TFLP");
+    myrefl_rule_create("RFLP", "TFLP", "AFLP");
+    myrefl_rule_set_type("RFLP", MYREFL_RULE_GREATER_THAN_N, 50, 0);
+    myrefl_rule_set_flap_damping("RFLP", 60000, 3000, 750);
+    myrefl_test_chain_ready("TFLP");
+
+    for (i = 0; i < 6; i++) {
+        myrefl_test_notify("TFLP", NULL, MYREFL_RESULT_VALUE, values[i]);
+        ck_assert(sched_test_wait_for(sched_test_ran, "RFLP", i + 1, 2000));
+        ck_assert_msg(sched_test_result("RFLP") == results[i],
+                      "Value %d result %d", i, sched_test_result("RFLP"));
+    }
+}
+END_TEST
+
+/*
+ * An action that completes later keeps its slot until it does, then the
+ * action waiting for the slot is kicked off.
+ */
+START_TEST (test_myrefl_seq_storm_in_progress)
+{
+    static const char *actions[] = { "SA", "SB", NULL };
+
+    sched_test_start();
+    myrefl_action_set_storm_control(1, 0, 0);
+    myrefl_action_create("SA", storm_action_in_progress, "SA");
+    myrefl_action_create("SB", storm_action_in_progress, "SB");
+    myrefl_test_create_notification("STA");
+    myrefl_test_create_notification("STB");
+    myrefl_rule_create("SRA", "STA", "SA");
+    myrefl_rule_create("SRB", "STB", "SB");
+    myrefl_test_chain_ready("STA");
+    myrefl_test_chain_ready("STB");
+
+    myrefl_test_notify("STA", NULL, MYREFL_RESULT_FAIL, 0);
+    myrefl_test_notify("STB", NULL, MYREFL_RESULT_FAIL, 0);
+
+    ck_assert_msg(sched_test_wait_for(storm_held_back, actions, 1, 2000),
+                  "Second action not deferred");
+    ck_assert_msg(storm_runs == 1, 
+                  "Action started whilst another was still in progress");
+
+    myrefl_action_complete(storm_last, NULL, MYREFL_RESULT_PASS);
+    ck_assert_msg(sched_test_wait_for(sched_test_counted, 
+                                      (const void *)&storm_runs, 2, 2000),
+                  "Deferred action not started on completion");
+}
+END_TEST
+
+/*
+ * Register the above unit tests.
+ */
+Suite *
+myrefl_sched_test_suite (void)
+{
+  Suite *s = suite_create ("myrefl_sched");
+
+  TCase *tc_fan_out = tcase_create ("Fan Out");
+  tcase_add_test(tc_fan_out, test_myrefl_seq_fan_out_actions);
+  tcase_add_test(tc_fan_out, test_myrefl_seq_fan_out_order);
+  suite_add_tcase (s, tc_fan_out);
+
+  TCase *tc_rule_type = tcase_create ("Rule Types");
+  tcase_add_test(tc_rule_type, test_myrefl_seq_rule_n_in_time_m);
+  tcase_add_test(tc_rule_type, test_myrefl_seq_rule_fail_for_time_n);
+  tcase_add_test(tc_rule_type, test_myrefl_seq_rule_n_in_m_count);
+  tcase_add_test(tc_rule_type, test_myrefl_seq_rule_ewma);
+  tcase_add_test(tc_rule_type, test_myrefl_seq_rule_percentile);
+  suite_add_tcase (s, tc_rule_type);
+
+  TCase *tc_propagate = tcase_create ("Propagation");
+  tcase_add_test(tc_propagate, test_myrefl_seq_propagate_on_change);
+  suite_add_tcase (s, tc_propagate);
+
+  TCase *tc_health = tcase_create ("Health");
+  tcase_add_test(tc_health, test_myrefl_seq_health_incremental);
+  tcase_add_test(tc_health, test_myrefl_seq_health_publish_interval);
+  suite_add_tcase (s, tc_health);
+
+  TCase *tc_graph = tcase_create ("Rule Graph");
+  tcase_add_test(tc_graph, test_myrefl_obj_graph_order);
+  tcase_add_test(tc_graph, test_myrefl_seq_graph_two_inputs);
+  tcase_add_test(tc_graph, test_myrefl_seq_graph_late_rule);
+  tcase_add_test(tc_graph, test_myrefl_seq_graph_restart);
+  suite_add_tcase (s, tc_graph);
+
+  TCase *tc_baseline = tcase_create ("Baselines");
+  tcase_add_test(tc_baseline, test_myrefl_seq_rule_baseline_learn);
+  tcase_add_test(tc_baseline, test_myrefl_seq_rule_baseline_file);
+  suite_add_tcase (s, tc_baseline);
+
+  TCase *tc_aggregate = tcase_create ("Aggregation");
+  tcase_add_test(tc_aggregate, test_myrefl_seq_aggregate_values);
+  suite_add_tcase (s, tc_aggregate);
+
+  TCase *tc_notify = tcase_create ("Notify Queue");
+  tcase_add_test(tc_notify, test_myrefl_api_notify_nowait);
+  tcase_add_test(tc_notify, test_myrefl_api_notify_overflow);
+  tcase_add_test(tc_notify, test_myrefl_api_notify_order);
+  tcase_add_test(tc_notify, test_myrefl_api_notify_many);
+  suite_add_tcase (s, tc_notify);
+
+  TCase *tc_handle = tcase_create ("Handles");
+  tcase_add_test(tc_handle, test_myrefl_api_handles);
+  suite_add_tcase (s, tc_handle);
+
+  TCase *tc_visit = tcase_create ("Visit Epochs");
+  tcase_add_test(tc_visit, test_myrefl_rci_visit_children);
+  tcase_add_test(tc_visit, test_myrefl_rci_visit_parents);
+  suite_add_tcase (s, tc_visit);
+
+  TCase *tc_order = tcase_create ("Loop Detection");
+  tcase_add_test(tc_order, test_myrefl_obj_order_input_loops);
+  tcase_add_test(tc_order, test_myrefl_obj_order_depend_loops);
+  tcase_add_test(tc_order, test_myrefl_seq_deep_chain);
+  suite_add_tcase (s, tc_order);
+
+  TCase *tc_memo = tcase_create ("Verdict Cache");
+  tcase_add_test(tc_memo, test_myrefl_rci_memo_invalidate);
+  suite_add_tcase (s, tc_memo);
+
+  TCase *tc_walk = tcase_create ("Chain Walk");
+  tcase_add_test(tc_walk, test_myrefl_obj_walk_deep);
+  tcase_set_timeout(tc_walk, 20);
+  suite_add_tcase (s, tc_walk);
+
+  if (getenv("MYREFL_BENCHMARK")) {
+      TCase *tc_bench = tcase_create ("Benchmarks");
+      tcase_add_test(tc_bench, test_myrefl_obj_walk_cost);
+      tcase_set_timeout(tc_bench, 60);
+      suite_add_tcase (s, tc_bench);
+  }
+
+  TCase *tc_storm = tcase_create ("Storm Control");
+  tcase_add_test(tc_storm, test_myrefl_seq_storm_admit_defer);
+  tcase_add_test(tc_storm, test_myrefl_seq_storm_coalesce);
+  tcase_add_test(tc_storm, test_myrefl_seq_storm_in_progress);
+  suite_add_tcase (s, tc_storm);
+
+  TCase *tc_hysteresis = tcase_create ("Hysteresis");
+  tcase_add_test(tc_hysteresis, test_myrefl_seq_hysteresis_range);
+  tcase_add_test(tc_hysteresis, test_myrefl_seq_hysteresis_clear);
+  tcase_add_test(tc_hysteresis, test_myrefl_seq_flap_damping);
+  suite_add_tcase (s, tc_hysteresis);
+
+  return s;
+}
+
+/*
+ * Run the above unit tests
+ */
 int
 main (void)
 {
-    return EXIT_SUCCESS;
-}
+	int number_failed;
 
+	// We want to see debugging messages on the console, not in syslog.
+	myrefl_xos_running_in_terminal();
+
+	Suite *s = myrefl_sched_test_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all (sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free (sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -35,6 +35,7 @@
  * April 2014, Edward Groenendaal
  */
 #include <check.h>
+#include <stdlib.h>
 #include "../src/myrefl_thread.h"
 #include "../src/myrefl_xos.h"
 #include "../src/myrefl_util.h"
@@ -343,6 +344,200 @@ static void test_myrefl_list_locking_n(int num_elements)
 	pthread_join(thread1->xos->tid, &status1);
 	pthread_join(thread2->xos->tid, &status2);
 }
+/*
+ * Test the intrusive queue, no list elements should be used.
+ */
+START_TEST (test_myrefl_util_queue)
+{
+	thread_job_t jobs[3];
+	myrefl_queue_t *queue = NULL;
+	myrefl_list_element_t *elements = myrefl_ut_expose_free_list();
+	int free_before = count_free_elements(elements);
+
+	memset(jobs, 0, sizeof(jobs));
+	queue = myrefl_queue_create(MYREFL_QUEUE_OFFSET(thread_job_t, link));
+
+	ck_assert(queue != NULL);
+	ck_assert(myrefl_queue_peek(queue) == NULL);
+	ck_assert(myrefl_queue_pop(queue) == NULL);
+
+	myrefl_queue_push(queue, &jobs[0]);
+	myrefl_queue_push(queue, &jobs[2]);
+	myrefl_queue_insert(queue, &jobs[0], &jobs[1]);
+	ck_assert(queue->num_elements == 3);
+	ck_assert(myrefl_queue_peek(queue) == &jobs[0]);
+	ck_assert(myrefl_queue_peek_tail(queue) == &jobs[2]);
+	ck_assert(myrefl_queue_next(queue, &jobs[0]) == &jobs[1]);
+	ck_assert(myrefl_queue_next(queue, &jobs[1]) == &jobs[2]);
+	ck_assert(myrefl_queue_next(queue, &jobs[2]) == NULL);
+
+	/* Already queued, must be ignored */
+	myrefl_queue_add(queue, &jobs[1]);
+	ck_assert(queue->num_elements == 3);
+
+	/* Remove from the middle, then the ends */
+	ck_assert(myrefl_queue_remove(queue, &jobs[1]));
+	ck_assert(!myrefl_queue_remove(queue, &jobs[1]));
+	ck_assert(!myrefl_queue_linked(queue, &jobs[1]));
+	ck_assert(myrefl_queue_next(queue, &jobs[0]) == &jobs[2]);
+	ck_assert(myrefl_queue_remove(queue, &jobs[2]));
+	ck_assert(myrefl_queue_peek_tail(queue) == &jobs[0]);
+
+	myrefl_queue_add(queue, &jobs[1]);
+	ck_assert(myrefl_queue_pop(queue) == &jobs[1]);
+	ck_assert(myrefl_queue_pop(queue) == &jobs[0]);
+	ck_assert(myrefl_queue_pop(queue) == NULL);
+	ck_assert(queue->head == NULL && queue->tail == NULL);
+	ck_assert(queue->num_elements == 0);
+
+	myrefl_queue_push(queue, &jobs[2]);
+	myrefl_queue_free(queue);
+	ck_assert(jobs[2].link.queue == NULL);
+
+	ck_assert(count_free_elements(myrefl_ut_expose_free_list()) == free_before);
+}
+END_TEST
+
+/*
+ * Test the list element statistics, every element is either on a list
+ * or free in the global pool or a thread cache.
+ */
+START_TEST (test_myrefl_util_list_stats)
+{
+	myrefl_list_stats_t stats;
+	myrefl_list_t *list = myrefl_list_create();
+	int data[120];
+	int i;
+
+	for (i = 0; i < 120; i++) {
+		myrefl_list_push(list, &data[i]);
+	}
+	myrefl_list_get_stats(&stats);
+	ck_assert(stats.in_use >= 120);
+	ck_assert(stats.caches >= 1);
+	ck_assert(stats.elements == stats.blocks * 50);
+	ck_assert(stats.elements ==
+	          stats.in_use + stats.global_free + stats.cached);
+
+	for (i = 0; i < 120; i++) {
+		ck_assert(myrefl_list_pop(list) == &data[i]);
+	}
+	myrefl_list_get_stats(&stats);
+	ck_assert(stats.cached <= 100);
+	ck_assert(stats.drains >= 1);
+	ck_assert(stats.elements ==
+	          stats.in_use + stats.global_free + stats.cached);
+
+	myrefl_list_free(list);
+}
+END_TEST
+
+/*
+ * Test removal by handle, the neighbours are relinked and a handle is
+ * only accepted by the list that it is on.
+ */
+START_TEST (test_myrefl_util_list_remove_element)
+{
+	myrefl_list_t *list = myrefl_list_create();
+	myrefl_list_t *other = myrefl_list_create();
+	myrefl_list_element_t *handles[5], *peer;
+	int data[5], x, y;
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		handles[i] = myrefl_list_push(list, &data[i]);
+		ck_assert(handles[i] != NULL);
+	}
+
+	/* From the middle, then the head and the tail */
+	ck_assert(myrefl_list_remove_element(list, handles[2]));
+	ck_assert(handles[1]->next == handles[3]);
+	ck_assert(handles[3]->prev == handles[1]);
+	ck_assert(myrefl_list_remove_element(list, handles[0]));
+	ck_assert(list->head == handles[1] && handles[1]->prev == NULL);
+	ck_assert(myrefl_list_remove_element(list, handles[4]));
+	ck_assert(list->tail == handles[3] && handles[3]->next == NULL);
+	ck_assert(list->num_elements == 2);
+
+	/* Not on the other list */
+	ck_assert(!myrefl_list_remove_element(other, handles[1]));
+	ck_assert(list->num_elements == 2);
+
+	ck_assert(myrefl_list_peek_tail(list) == &data[3]);
+	ck_assert(myrefl_list_pop_tail(list) == &data[3]);
+	ck_assert(myrefl_list_pop_tail(list) == &data[1]);
+	ck_assert(myrefl_list_pop_tail(list) == NULL);
+	ck_assert(list->head == NULL && list->tail == NULL);
+
+	/* Removing one of a pair unpairs the other */
+	handles[0] = myrefl_list_push(list, &x);
+	peer = myrefl_list_push(other, &y);
+	myrefl_list_element_pair(handles[0], peer);
+	ck_assert(myrefl_list_element_peer(handles[0]) == peer);
+	ck_assert(myrefl_list_element_peer(peer) == handles[0]);
+	ck_assert(myrefl_list_remove_element(list, handles[0]));
+	ck_assert(myrefl_list_element_peer(peer) == NULL);
+
+	myrefl_list_free(list);
+	myrefl_list_free(other);
+}
+END_TEST
+
+/*
+ * Benchmark handle based removal, the cost per removal should stay
+ * flat as the list grows.
+ */
+static long list_remove_cost_ns (int length, int removes)
+{
+	myrefl_list_t *list = myrefl_list_create();
+	myrefl_list_element_t **handles;
+	xos_time_t start, end, diff;
+	static int data;
+	int i;
+
+	handles = malloc(length * sizeof(myrefl_list_element_t *));
+	ck_assert(list != NULL && handles != NULL);
+
+	for (i = 0; i < length; i++) {
+		handles[i] = myrefl_list_push(list, &data);
+		ck_assert(handles[i] != NULL);
+	}
+
+	myrefl_xos_time_set_now(&start);
+	for (i = 0; i < removes; i++) {
+		/* from the middle, the worst place for a search */
+		ck_assert(myrefl_list_remove_element(list,
+		                                     handles[length / 2 + i]));
+	}
+	myrefl_xos_time_set_now(&end);
+	ck_assert(list->num_elements == (uint)(length - removes));
+
+	myrefl_list_free(list);
+	free(handles);
+
+	myrefl_xos_time_diff(&start, &end, &diff);
+	return((diff.sec * 1000000000L + diff.nsec) / removes);
+}
+
+/*
+ * Only reports the figures, run with MYREFL_BENCHMARK set in the 
+ * environment.
+ */
+START_TEST (test_myrefl_util_list_remove_cost)
+{
+	long small, large;
+
+	/* warm up the element pool */
+	list_remove_cost_ns(100000, 1000);
+
+	small = list_remove_cost_ns(2000, 1000);
+	large = list_remove_cost_ns(100000, 1000);
+
+	printf("List remove %ldns at 2000 elements, "
+	       "%ldns at 100000 elements\n", small, large);
+}
+END_TEST
+
 /*
  * Test that the reentrancy of the list is OK, and that we
  * lock it at the right times.
@@ -375,10 +570,20 @@ swdaig_xos_test_suite (void)
   /* Core test case */
   TCase *tc_core = tcase_create ("Util lists");
   tcase_add_test(tc_core, test_myrefl_util_list);
+  tcase_add_test(tc_core, test_myrefl_util_queue);
+  tcase_add_test(tc_core, test_myrefl_util_list_stats);
+  tcase_add_test(tc_core, test_myrefl_util_list_remove_element);
   //tcase_add_test(tc_core, test_myrefl_util_list_locking);
   tcase_set_timeout(tc_core, 10);
   suite_add_tcase (s, tc_core);
 
+  if (getenv("MYREFL_BENCHMARK")) {
+      TCase *tc_bench = tcase_create ("Benchmarks");
+      tcase_add_test(tc_bench, test_myrefl_util_list_remove_cost);
+      tcase_set_timeout(tc_bench, 60);
+      suite_add_tcase (s, tc_bench);
+  }
+
   return s;
 }
 int
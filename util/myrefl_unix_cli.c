@@ -192,6 +192,9 @@ int main (int argc, char *argv[])
     if (type == CLI_COMPONENT) {
         printf("Health   Conf   Fail Abort     Pass  State"
                             " Component Name\n"); 
+    } else if (type == CLI_ACTION) {
+        printf("   Last\n");
+        printf(" Result   Fail Abort     Pass  State  Coalsc Defer Supprs Name\n");
     } else {
         printf("   Last\n");
         printf(" Result   Fail Abort     Pass  State Sevrty Name\n");
@@ -215,6 +218,17 @@ int main (int argc, char *argv[])
                            myrefl_unix_cli_state_str_compressed(rpc_element[i].state),
                            
                         rpc_element[i].name);
+                } else if (type == CLI_ACTION) {
+                    printf("%7s %6d %5d %8d %6s %7d %5d %6d %s\n",
+                           myrefl_util_myrefl_result_str(rpc_element[i].last_result),
+                           rpc_element[i].failures,
+                           rpc_element[i].aborts,
+                           rpc_element[i].passes,
+                           myrefl_unix_cli_state_str_compressed(rpc_element[i].state),
+                           rpc_element[i].coalesced,
+                           rpc_element[i].deferred,
+                           rpc_element[i].suppressed,
+                           rpc_element[i].name);
                 } else {
                     printf("%7s %6d %5d %8d %6s %-6s %s\n",
                            myrefl_util_myrefl_result_str(rpc_element[i].last_result),